@@ -0,0 +1,392 @@
+﻿// gltf_instancing_bench: generates a synthetic GLB scene and times every pipeline stage on it
+// separately (loading, exact and tolerance detection, each GlbWriter write path, tileset
+// writing), reporting throughput and the process peak memory after each stage.
+
+#include "synthetic_scene.h"
+#include "utilities.h"
+#include "glb_reader.h"
+#include "instancing_detector.h"
+#include "glb_writer.h"
+#include "tileset_writer.h"
+#include "metrics.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+    struct BenchConfiguration {
+        std::filesystem::path outputDirectory = "bench_output";
+        GltfInstancing::SyntheticSceneOptions scene;
+        double tolerance = 1e-3;
+        int threadCount = 1;
+        int repeatCount = 1;
+        std::filesystem::path reportPath; // Empty: no JSON report
+    };
+
+    // Amount of work a stage processed, for the throughput columns.
+    struct StageVolume {
+        size_t byteCount = 0;
+        size_t itemCount = 0;
+        std::string itemName;
+    };
+
+    struct StageResult {
+        std::string name;
+        double seconds = 0.0; // Best of the repeats
+        StageVolume volume;
+        size_t peakResidentBytes = 0;
+    };
+
+    size_t fileSizeOrZero(const std::filesystem::path& path) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(path, ec);
+        return ec ? 0 : static_cast<size_t>(size);
+    }
+
+    size_t directorySize(const std::filesystem::path& directory) {
+        size_t total = 0;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, ec)) {
+            if (entry.is_regular_file(ec)) {
+                total += fileSizeOrZero(entry.path());
+            }
+        }
+        return total;
+    }
+
+    // Runs stage repeatCount times and keeps the fastest run. stage returns the processed
+    // volume, or std::nullopt if it failed (the benchmark stops then).
+    std::optional<StageResult> runStage(
+        const std::string& name,
+        int repeatCount,
+        const std::function<std::optional<StageVolume>()>& stage) {
+        StageResult result;
+        result.name = name;
+        result.seconds = std::numeric_limits<double>::max();
+        for (int run = 0; run < std::max(repeatCount, 1); ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            std::optional<StageVolume> volume = stage();
+            const auto end = std::chrono::steady_clock::now();
+            if (!volume) {
+                GltfInstancing::logError("Benchmark stage '" + name + "' failed.");
+                return std::nullopt;
+            }
+            result.seconds = std::min(result.seconds, std::chrono::duration<double>(end - start).count());
+            result.volume = *volume;
+        }
+        result.peakResidentBytes = GltfInstancing::peakResidentBytes();
+        return result;
+    }
+
+    std::string formatStageRow(const StageResult& result) {
+        const double seconds = std::max(result.seconds, 1e-9);
+        char row[256];
+        std::snprintf(row, sizeof(row), "  %-26s %10.3f s %10.1f MB/s %12.0f %s/s %10.1f MB peak",
+            result.name.c_str(),
+            result.seconds,
+            static_cast<double>(result.volume.byteCount) / (1024.0 * 1024.0) / seconds,
+            static_cast<double>(result.volume.itemCount) / seconds,
+            result.volume.itemName.c_str(),
+            static_cast<double>(result.peakResidentBytes) / (1024.0 * 1024.0));
+        return row;
+    }
+
+    bool writeReport(const BenchConfiguration& config, const GltfInstancing::SyntheticSceneStatistics& sceneStatistics, const std::vector<StageResult>& results) {
+        nlohmann::json report;
+        report["scene"] = {
+            { "files", sceneStatistics.fileCount },
+            { "meshes", sceneStatistics.meshCount },
+            { "uniqueGeometries", sceneStatistics.uniqueGeometryCount },
+            { "nodes", sceneStatistics.nodeCount },
+            { "vertices", sceneStatistics.vertexCount },
+            { "bytes", sceneStatistics.byteCount },
+            { "duplicateRatio", config.scene.duplicateRatio },
+            { "instancesPerMesh", config.scene.instancesPerMesh },
+            { "hierarchyDepth", config.scene.hierarchyDepth },
+            { "interleaved", config.scene.interleaved },
+            { "positionJitter", config.scene.positionJitter },
+            { "seed", config.scene.seed }
+        };
+        report["threads"] = config.threadCount;
+        report["tolerance"] = config.tolerance;
+        nlohmann::json stages = nlohmann::json::array();
+        for (const StageResult& result : results) {
+            stages.push_back({
+                { "name", result.name },
+                { "seconds", result.seconds },
+                { "bytes", result.volume.byteCount },
+                { "items", result.volume.itemCount },
+                { "itemName", result.volume.itemName },
+                { "peakResidentBytes", result.peakResidentBytes }
+            });
+        }
+        report["stages"] = std::move(stages);
+
+        std::ofstream reportFile(config.reportPath);
+        if (!reportFile) {
+            GltfInstancing::logError("Failed to open benchmark report file: " + config.reportPath.string());
+            return false;
+        }
+        reportFile << report.dump(2) << std::endl;
+        return true;
+    }
+
+    void printUsage(const char* progName) {
+        GltfInstancing::logInfo("Usage: " + std::string(progName) + " [options]");
+        GltfInstancing::logInfo("");
+        GltfInstancing::logInfo("Scene Options:");
+        GltfInstancing::logInfo("  --files <n>:                         Number of generated GLB files. Default: 4.");
+        GltfInstancing::logInfo("  --meshes <n>:                        Meshes per file. Default: 256.");
+        GltfInstancing::logInfo("  --duplicate-ratio <r>:               Fraction of meshes repeating another mesh's geometry (0..1). Default: 0.5.");
+        GltfInstancing::logInfo("  --instances <n>:                     Nodes referencing each mesh. Default: 4.");
+        GltfInstancing::logInfo("  --depth <n>:                         Transform-only parent nodes above each mesh node. Default: 1.");
+        GltfInstancing::logInfo("  --vertices <n>:                      Vertices per mesh. Default: 1024.");
+        GltfInstancing::logInfo("  --interleaved:                       Interleave POSITION and NORMAL in one buffer view.");
+        GltfInstancing::logInfo("  --jitter <value>:                    Vertex offset applied to duplicates (only tolerance mode matches them). Default: 0.");
+        GltfInstancing::logInfo("  --seed <n>:                          Generator seed. Default: 1.");
+        GltfInstancing::logInfo("");
+        GltfInstancing::logInfo("Run Options:");
+        GltfInstancing::logInfo("  --output_directory <path>:           Working directory; its scene/ and output/ subdirectories are replaced. Default: bench_output.");
+        GltfInstancing::logInfo("  --tolerance <value>:                 Geometry tolerance of the tolerance-mode detection. Default: 0.001.");
+        GltfInstancing::logInfo("  --threads <n>:                       Worker threads (0 = all hardware threads). Default: 1.");
+        GltfInstancing::logInfo("  --repeat <n>:                        Runs per stage; the fastest is reported. Default: 1.");
+        GltfInstancing::logInfo("  --report <file_path>:                Also write the results as JSON.");
+        GltfInstancing::logInfo("  --log-level <level>:                 NONE, ERROR, WARNING, INFO, DEBUG, VERBOSE. Default: WARNING during stages.");
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchConfiguration config;
+    GltfInstancing::LogLevel stageLogLevel = GltfInstancing::LogLevel::LEVEL_WARNING;
+
+    for (int argIndex = 1; argIndex < argc; ++argIndex) {
+        const std::string arg = argv[argIndex];
+        // Parses the value following arg; false (logged) if it is missing or malformed.
+        auto parseValue = [&](auto& target) -> bool {
+            if (argIndex + 1 >= argc) {
+                GltfInstancing::logError(arg + " option requires a value.");
+                return false;
+            }
+            const std::string value = argv[++argIndex];
+            try {
+                using Target = std::decay_t<decltype(target)>;
+                if constexpr (std::is_same_v<Target, double>) {
+                    target = std::stod(value);
+                } else if constexpr (std::is_same_v<Target, uint32_t>) {
+                    target = static_cast<uint32_t>(std::stoul(value));
+                } else {
+                    target = std::stoi(value);
+                }
+            } catch (const std::exception& e) {
+                GltfInstancing::logError("Invalid value for " + arg + ": " + value + ". Error: " + e.what());
+                return false;
+            }
+            return true;
+        };
+
+        bool valid = true;
+        if (arg == "--files") valid = parseValue(config.scene.fileCount);
+        else if (arg == "--meshes") valid = parseValue(config.scene.meshesPerFile);
+        else if (arg == "--duplicate-ratio") valid = parseValue(config.scene.duplicateRatio);
+        else if (arg == "--instances") valid = parseValue(config.scene.instancesPerMesh);
+        else if (arg == "--depth") valid = parseValue(config.scene.hierarchyDepth);
+        else if (arg == "--vertices") valid = parseValue(config.scene.verticesPerMesh);
+        else if (arg == "--interleaved") config.scene.interleaved = true;
+        else if (arg == "--jitter") valid = parseValue(config.scene.positionJitter);
+        else if (arg == "--seed") valid = parseValue(config.scene.seed);
+        else if (arg == "--tolerance") valid = parseValue(config.tolerance);
+        else if (arg == "--threads") valid = parseValue(config.threadCount);
+        else if (arg == "--repeat") valid = parseValue(config.repeatCount);
+        else if (arg == "--output_directory" || arg == "--report") {
+            if (argIndex + 1 >= argc) {
+                GltfInstancing::logError(arg + " option requires a path.");
+                valid = false;
+            } else if (arg == "--report") {
+                config.reportPath = argv[++argIndex];
+            } else {
+                config.outputDirectory = argv[++argIndex];
+            }
+        } else if (arg == "--log-level") {
+            if (argIndex + 1 >= argc) {
+                GltfInstancing::logError("--log-level option requires a value.");
+                valid = false;
+            } else {
+                std::string levelStr = argv[++argIndex];
+                std::transform(levelStr.begin(), levelStr.end(), levelStr.begin(), ::toupper);
+                if (levelStr == "NONE") stageLogLevel = GltfInstancing::LogLevel::NONE;
+                else if (levelStr == "ERROR") stageLogLevel = GltfInstancing::LogLevel::LEVEL_ERROR;
+                else if (levelStr == "WARNING") stageLogLevel = GltfInstancing::LogLevel::LEVEL_WARNING;
+                else if (levelStr == "INFO") stageLogLevel = GltfInstancing::LogLevel::LEVEL_INFO;
+                else if (levelStr == "DEBUG") stageLogLevel = GltfInstancing::LogLevel::LEVEL_DEBUG;
+                else if (levelStr == "VERBOSE") stageLogLevel = GltfInstancing::LogLevel::LEVEL_VERBOSE;
+                else {
+                    GltfInstancing::logError("Invalid log level: " + levelStr);
+                    valid = false;
+                }
+            }
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            GltfInstancing::logError("Unknown option: " + arg);
+            valid = false;
+        }
+        if (!valid) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    const std::filesystem::path sceneDirectory = config.outputDirectory / "scene";
+    const std::filesystem::path writerDirectory = config.outputDirectory / "output";
+    // Only the subdirectories this benchmark owns are cleared; the output directory itself may
+    // be a directory the user chose that holds other files.
+    std::error_code ec;
+    for (const std::filesystem::path& ownedDirectory : { sceneDirectory, writerDirectory }) {
+        std::filesystem::remove_all(ownedDirectory, ec);
+        if (ec) {
+            GltfInstancing::logError("Failed to clear benchmark directory " + ownedDirectory.string() + ": " + ec.message());
+            return 1;
+        }
+    }
+    std::filesystem::create_directories(writerDirectory, ec);
+    if (ec) {
+        GltfInstancing::logError("Failed to create benchmark directory " + writerDirectory.string() + ": " + ec.message());
+        return 1;
+    }
+
+    // Stage logging is kept quiet by default so that console output does not dominate the timings.
+    GltfInstancing::setLogLevel(stageLogLevel);
+    std::vector<StageResult> results;
+    auto record = [&](std::optional<StageResult> result) {
+        if (result) {
+            results.push_back(std::move(*result));
+        }
+        return result.has_value();
+    };
+
+    GltfInstancing::SyntheticSceneStatistics sceneStatistics;
+    if (!record(runStage("generate", 1, [&]() -> std::optional<StageVolume> {
+            std::optional<GltfInstancing::SyntheticSceneStatistics> statistics = GltfInstancing::generateSyntheticScene(config.scene, sceneDirectory);
+            if (!statistics) return std::nullopt;
+            sceneStatistics = *statistics;
+            return StageVolume{ statistics->byteCount, statistics->meshCount, "meshes" };
+        }))) {
+        return 1;
+    }
+
+    std::vector<GltfInstancing::LoadedGltfModel> loadedModels;
+    if (!record(runStage("load", config.repeatCount, [&]() -> std::optional<StageVolume> {
+            GltfInstancing::GlbReader reader;
+            loadedModels = reader.loadGltfModels(reader.discoverGlbFiles(sceneDirectory), config.threadCount);
+            if (loadedModels.size() != sceneStatistics.fileCount) return std::nullopt;
+            return StageVolume{ sceneStatistics.byteCount, sceneStatistics.meshCount, "meshes" };
+        }))) {
+        return 1;
+    }
+
+    GltfInstancing::InstancingDetectionResult exactResult;
+    GltfInstancing::InstancingDetectionResult toleranceResult;
+    auto detectStage = [&](double tolerance, GltfInstancing::InstancingDetectionResult& target) {
+        return [&, tolerance, resultSlot = &target]() -> std::optional<StageVolume> {
+            GltfInstancing::InstancingDetector detector(tolerance, {}, tolerance, 2, config.threadCount);
+            *resultSlot = detector.detect(loadedModels);
+            return StageVolume{ sceneStatistics.byteCount, sceneStatistics.nodeCount, "nodes" };
+        };
+    };
+    if (!record(runStage("detect_exact", config.repeatCount, detectStage(0.0, exactResult))) ||
+        !record(runStage("detect_tolerance", config.repeatCount, detectStage(config.tolerance, toleranceResult)))) {
+        return 1;
+    }
+
+    using WriteResult = std::optional<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>>;
+    std::vector<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>> tilesetContents;
+    auto writeStage = [&](const std::string& fileName, const std::function<WriteResult(GltfInstancing::GlbWriter&, const std::filesystem::path&)>& write) {
+        return [&, fileName, write]() -> std::optional<StageVolume> {
+            GltfInstancing::GlbWriter writer;
+            const std::filesystem::path outputPath = writerDirectory / fileName;
+            WriteResult written = write(writer, outputPath);
+            if (!written) return std::nullopt;
+            if (written->second.isValid() &&
+                std::none_of(tilesetContents.begin(), tilesetContents.end(), [&](const auto& content) { return content.first == written->first; })) {
+                tilesetContents.push_back(*written);
+            }
+            return StageVolume{ fileSizeOrZero(written->first), sceneStatistics.meshCount, "meshes" };
+        };
+    };
+    const bool writesSucceeded =
+        record(runStage("write_instanced_glb", config.repeatCount, writeStage("combined.glb",
+            [&](GltfInstancing::GlbWriter& writer, const std::filesystem::path& path) { return writer.writeInstancedGlb(loadedModels, exactResult, path); }))) &&
+        record(runStage("write_instanced_only", config.repeatCount, writeStage("instanced.glb",
+            [&](GltfInstancing::GlbWriter& writer, const std::filesystem::path& path) { return writer.writeInstancedMeshesOnly(loadedModels, exactResult, path); }))) &&
+        record(runStage("write_non_instanced_only", config.repeatCount, writeStage("non_instanced.glb",
+            [&](GltfInstancing::GlbWriter& writer, const std::filesystem::path& path) { return writer.writeNonInstancedMeshesOnly(loadedModels, exactResult, path); }))) &&
+        record(runStage("write_segmented", config.repeatCount, [&]() -> std::optional<StageVolume> {
+            const std::filesystem::path segmentedDirectory = writerDirectory / "segmented";
+            std::filesystem::remove_all(segmentedDirectory, ec);
+            GltfInstancing::GlbWriter writer;
+            GltfInstancing::SegmentationOptions segmentationOptions;
+            segmentationOptions.threadCount = config.threadCount;
+            if (!writer.writeMeshesAsSeparateGlbs(loadedModels, segmentedDirectory, segmentationOptions)) return std::nullopt;
+            return StageVolume{ directorySize(segmentedDirectory), sceneStatistics.meshCount, "meshes" };
+        }));
+    if (!writesSucceeded || tilesetContents.empty()) {
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> tilesetUris;
+    size_t tilesetContentBytes = 0;
+    for (const auto& content : tilesetContents) {
+        tilesetUris.push_back(content.first);
+        tilesetContentBytes += fileSizeOrZero(content.first);
+    }
+    const bool tilesetsSucceeded =
+        record(runStage("tileset_read_back", config.repeatCount, [&]() -> std::optional<StageVolume> {
+            GltfInstancing::TilesetWriter tilesetWriter;
+            if (!tilesetWriter.writeTileset(tilesetUris, writerDirectory / "tileset_read_back.json")) return std::nullopt;
+            return StageVolume{ tilesetContentBytes, tilesetUris.size(), "tiles" };
+        })) &&
+        record(runStage("tileset_known_bounds", config.repeatCount, [&]() -> std::optional<StageVolume> {
+            GltfInstancing::TilesetWriter tilesetWriter;
+            if (!tilesetWriter.writeTileset(tilesetContents, writerDirectory / "tileset_known_bounds.json")) return std::nullopt;
+            return StageVolume{ tilesetContentBytes, tilesetContents.size(), "tiles" };
+        }));
+    if (!tilesetsSucceeded) {
+        return 1;
+    }
+
+    GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_INFO);
+    GltfInstancing::logInfo("Synthetic scene: " + std::to_string(sceneStatistics.fileCount) + " files, " +
+        std::to_string(sceneStatistics.meshCount) + " meshes (" + std::to_string(sceneStatistics.uniqueGeometryCount) + " unique geometries), " +
+        std::to_string(sceneStatistics.nodeCount) + " nodes, " + std::to_string(sceneStatistics.vertexCount) + " vertices, " +
+        std::to_string(sceneStatistics.byteCount) + " bytes.");
+    GltfInstancing::logInfo("Detection: exact " + std::to_string(exactResult.instancedGroups.size()) + " groups / " +
+        std::to_string(exactResult.nonInstancedMeshes.size()) + " non-instanced, tolerance " +
+        std::to_string(toleranceResult.instancedGroups.size()) + " groups / " + std::to_string(toleranceResult.nonInstancedMeshes.size()) + " non-instanced.");
+    GltfInstancing::logInfo("Stage timings (threads: " + std::to_string(GltfInstancing::resolveThreadCount(config.threadCount)) +
+        ", best of " + std::to_string(std::max(config.repeatCount, 1)) + "):");
+    for (const StageResult& result : results) {
+        GltfInstancing::logInfo(formatStageRow(result));
+    }
+
+    if (!config.reportPath.empty()) {
+        if (!writeReport(config, sceneStatistics, results)) {
+            return 1;
+        }
+        GltfInstancing::logInfo("Benchmark report written to: " + config.reportPath.string());
+    }
+    return 0;
+}
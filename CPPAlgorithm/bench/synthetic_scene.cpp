@@ -0,0 +1,314 @@
+﻿#include "synthetic_scene.h"
+#include "utilities.h"
+
+#include <CesiumGltf/Model.h>
+#include <CesiumGltf/Accessor.h>
+#include <CesiumGltf/Buffer.h>
+#include <CesiumGltf/BufferView.h>
+#include <CesiumGltf/Material.h>
+#include <CesiumGltf/Mesh.h>
+#include <CesiumGltf/MeshPrimitive.h>
+#include <CesiumGltf/Node.h>
+#include <CesiumGltf/Scene.h>
+#include <CesiumGltfWriter/GltfWriter.h>
+#include <gsl/span>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace GltfInstancing {
+
+    namespace {
+
+        constexpr int kMaterialsPerFile = 4;
+
+        // splitmix64: a portable, stateless source of reproducible values (std distributions
+        // differ between standard libraries).
+        uint64_t mix64(uint64_t value) {
+            value += 0x9E3779B97F4A7C15ull;
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        // Uniform in [0, 1).
+        double unitRandom(uint64_t seed, uint64_t stream) {
+            return static_cast<double>(mix64(seed ^ mix64(stream)) >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        struct GridGeometry {
+            std::vector<float> positions; // xyz per vertex
+            std::vector<float> normals;   // xyz per vertex
+            std::vector<uint32_t> indices;
+            size_t vertexCount = 0;
+            glm::vec3 min{ 0.0f };
+            glm::vec3 max{ 0.0f };
+        };
+
+        // A height field over a square grid; the shape parameters come from geometryId, so equal
+        // IDs give byte-identical geometry. jitterSeed != 0 perturbs the heights by up to jitter.
+        GridGeometry buildGridGeometry(uint64_t seed, size_t geometryId, int requestedVertices, double jitter, uint64_t jitterSeed) {
+            const size_t columns = std::max<size_t>(2, static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(std::max(requestedVertices, 4))))));
+            const size_t rows = std::max<size_t>(2, (static_cast<size_t>(std::max(requestedVertices, 4)) + columns - 1) / columns);
+
+            const uint64_t geometrySeed = mix64(seed ^ (static_cast<uint64_t>(geometryId) << 1));
+            const double size = 1.0 + 4.0 * unitRandom(geometrySeed, 1);
+            const double amplitude = 0.1 + 0.5 * unitRandom(geometrySeed, 2);
+            const double frequencyU = 1.0 + 5.0 * unitRandom(geometrySeed, 3);
+            const double frequencyV = 1.0 + 5.0 * unitRandom(geometrySeed, 4);
+            const double phaseU = 6.283185307179586 * unitRandom(geometrySeed, 5);
+            const double phaseV = 6.283185307179586 * unitRandom(geometrySeed, 6);
+
+            GridGeometry geometry;
+            geometry.vertexCount = rows * columns;
+            geometry.positions.reserve(geometry.vertexCount * 3);
+            geometry.normals.reserve(geometry.vertexCount * 3);
+            geometry.min = glm::vec3(std::numeric_limits<float>::max());
+            geometry.max = glm::vec3(std::numeric_limits<float>::lowest());
+            for (size_t row = 0; row < rows; ++row) {
+                for (size_t column = 0; column < columns; ++column) {
+                    const double x = (static_cast<double>(column) / static_cast<double>(columns - 1) - 0.5) * size;
+                    const double z = (static_cast<double>(row) / static_cast<double>(rows - 1) - 0.5) * size;
+                    const double su = std::sin(frequencyU * x + phaseU);
+                    const double cv = std::cos(frequencyV * z + phaseV);
+                    double y = amplitude * su * cv;
+                    if (jitterSeed != 0) {
+                        y += jitter * (2.0 * unitRandom(jitterSeed, row * columns + column) - 1.0);
+                    }
+                    const double slopeX = amplitude * frequencyU * std::cos(frequencyU * x + phaseU) * cv;
+                    const double slopeZ = -amplitude * frequencyV * su * std::sin(frequencyV * z + phaseV);
+                    const glm::dvec3 normal = glm::normalize(glm::dvec3(-slopeX, 1.0, -slopeZ));
+
+                    const glm::vec3 position(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+                    geometry.positions.insert(geometry.positions.end(), { position.x, position.y, position.z });
+                    geometry.normals.insert(geometry.normals.end(), { static_cast<float>(normal.x), static_cast<float>(normal.y), static_cast<float>(normal.z) });
+                    geometry.min = glm::min(geometry.min, position);
+                    geometry.max = glm::max(geometry.max, position);
+                }
+            }
+
+            geometry.indices.reserve((rows - 1) * (columns - 1) * 6);
+            for (size_t row = 0; row + 1 < rows; ++row) {
+                for (size_t column = 0; column + 1 < columns; ++column) {
+                    const uint32_t a = static_cast<uint32_t>(row * columns + column);
+                    const uint32_t b = a + 1;
+                    const uint32_t c = a + static_cast<uint32_t>(columns);
+                    const uint32_t d = c + 1;
+                    geometry.indices.insert(geometry.indices.end(), { a, c, b, b, c, d });
+                }
+            }
+            return geometry;
+        }
+
+        void alignBuffer(std::vector<std::byte>& buffer) {
+            buffer.resize((buffer.size() + 3) & ~size_t(3), std::byte(0));
+        }
+
+        int32_t addBufferView(CesiumGltf::Model& model, std::vector<std::byte>& buffer, const void* data, size_t byteLength, int64_t byteStride, int32_t target) {
+            alignBuffer(buffer);
+            CesiumGltf::BufferView& bufferView = model.bufferViews.emplace_back();
+            bufferView.buffer = 0;
+            bufferView.byteOffset = static_cast<int64_t>(buffer.size());
+            bufferView.byteLength = static_cast<int64_t>(byteLength);
+            if (byteStride > 0) {
+                bufferView.byteStride = byteStride;
+            }
+            bufferView.target = target;
+            const std::byte* bytes = static_cast<const std::byte*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + byteLength);
+            return static_cast<int32_t>(model.bufferViews.size() - 1);
+        }
+
+        int32_t addAccessor(CesiumGltf::Model& model, int32_t bufferView, int64_t byteOffset, int32_t componentType, const std::string& type, size_t count) {
+            CesiumGltf::Accessor& accessor = model.accessors.emplace_back();
+            accessor.bufferView = bufferView;
+            accessor.byteOffset = byteOffset;
+            accessor.componentType = componentType;
+            accessor.type = type;
+            accessor.count = static_cast<int64_t>(count);
+            return static_cast<int32_t>(model.accessors.size() - 1);
+        }
+
+        // Appends one mesh with its own buffer views and accessors for geometry.
+        int32_t addMesh(CesiumGltf::Model& model, std::vector<std::byte>& buffer, const GridGeometry& geometry, bool interleaved, int32_t material, const std::string& name) {
+            CesiumGltf::MeshPrimitive primitive;
+            primitive.mode = CesiumGltf::MeshPrimitive::Mode::TRIANGLES;
+            primitive.material = material;
+
+            int32_t positionAccessor = -1;
+            int32_t normalAccessor = -1;
+            if (interleaved) {
+                std::vector<float> vertices;
+                vertices.reserve(geometry.vertexCount * 6);
+                for (size_t v = 0; v < geometry.vertexCount; ++v) {
+                    vertices.insert(vertices.end(), geometry.positions.begin() + v * 3, geometry.positions.begin() + v * 3 + 3);
+                    vertices.insert(vertices.end(), geometry.normals.begin() + v * 3, geometry.normals.begin() + v * 3 + 3);
+                }
+                const int32_t view = addBufferView(model, buffer, vertices.data(), vertices.size() * sizeof(float), 6 * sizeof(float), CesiumGltf::BufferView::Target::ARRAY_BUFFER);
+                positionAccessor = addAccessor(model, view, 0, CesiumGltf::Accessor::ComponentType::FLOAT, CesiumGltf::Accessor::Type::VEC3, geometry.vertexCount);
+                normalAccessor = addAccessor(model, view, 3 * sizeof(float), CesiumGltf::Accessor::ComponentType::FLOAT, CesiumGltf::Accessor::Type::VEC3, geometry.vertexCount);
+            } else {
+                const int32_t positionView = addBufferView(model, buffer, geometry.positions.data(), geometry.positions.size() * sizeof(float), 0, CesiumGltf::BufferView::Target::ARRAY_BUFFER);
+                const int32_t normalView = addBufferView(model, buffer, geometry.normals.data(), geometry.normals.size() * sizeof(float), 0, CesiumGltf::BufferView::Target::ARRAY_BUFFER);
+                positionAccessor = addAccessor(model, positionView, 0, CesiumGltf::Accessor::ComponentType::FLOAT, CesiumGltf::Accessor::Type::VEC3, geometry.vertexCount);
+                normalAccessor = addAccessor(model, normalView, 0, CesiumGltf::Accessor::ComponentType::FLOAT, CesiumGltf::Accessor::Type::VEC3, geometry.vertexCount);
+            }
+            model.accessors[positionAccessor].min = { geometry.min.x, geometry.min.y, geometry.min.z };
+            model.accessors[positionAccessor].max = { geometry.max.x, geometry.max.y, geometry.max.z };
+            primitive.attributes["POSITION"] = positionAccessor;
+            primitive.attributes["NORMAL"] = normalAccessor;
+
+            if (geometry.vertexCount <= 65535) {
+                std::vector<uint16_t> indices(geometry.indices.begin(), geometry.indices.end());
+                const int32_t view = addBufferView(model, buffer, indices.data(), indices.size() * sizeof(uint16_t), 0, CesiumGltf::BufferView::Target::ELEMENT_ARRAY_BUFFER);
+                primitive.indices = addAccessor(model, view, 0, CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT, CesiumGltf::Accessor::Type::SCALAR, indices.size());
+            } else {
+                const int32_t view = addBufferView(model, buffer, geometry.indices.data(), geometry.indices.size() * sizeof(uint32_t), 0, CesiumGltf::BufferView::Target::ELEMENT_ARRAY_BUFFER);
+                primitive.indices = addAccessor(model, view, 0, CesiumGltf::Accessor::ComponentType::UNSIGNED_INT, CesiumGltf::Accessor::Type::SCALAR, geometry.indices.size());
+            }
+
+            CesiumGltf::Mesh& mesh = model.meshes.emplace_back();
+            mesh.name = name;
+            mesh.primitives.push_back(std::move(primitive));
+            return static_cast<int32_t>(model.meshes.size() - 1);
+        }
+
+        bool writeModelAsGlb(const CesiumGltf::Model& model, const std::vector<std::byte>& buffer, const std::filesystem::path& path, size_t& bytesWritten) {
+            CesiumGltfWriter::GltfWriter writer;
+            CesiumGltfWriter::GltfWriterOptions writerOptions;
+            CesiumGltfWriter::GltfWriterResult result = writer.writeGlb(model, gsl::span<const std::byte>(buffer), writerOptions);
+            for (const auto& error : result.errors) {
+                logError("GLB Writer Error (" + path.string() + "): " + error);
+            }
+            if (result.gltfBytes.empty()) {
+                logError("Failed to serialize synthetic GLB: " + path.string());
+                return false;
+            }
+            std::ofstream outFile(path, std::ios::binary | std::ios::trunc);
+            if (!outFile.write(reinterpret_cast<const char*>(result.gltfBytes.data()), static_cast<std::streamsize>(result.gltfBytes.size()))) {
+                logError("Failed to write synthetic GLB: " + path.string());
+                return false;
+            }
+            bytesWritten = result.gltfBytes.size();
+            return true;
+        }
+
+    } // namespace
+
+    std::optional<SyntheticSceneStatistics> generateSyntheticScene(
+        const SyntheticSceneOptions& options,
+        const std::filesystem::path& outputDirectory) {
+        std::error_code ec;
+        std::filesystem::create_directories(outputDirectory, ec);
+        if (ec) {
+            logError("Failed to create synthetic scene directory " + outputDirectory.string() + ": " + ec.message());
+            return std::nullopt;
+        }
+
+        const size_t fileCount = static_cast<size_t>(std::max(options.fileCount, 1));
+        const size_t meshesPerFile = static_cast<size_t>(std::max(options.meshesPerFile, 1));
+        const size_t instancesPerMesh = static_cast<size_t>(std::max(options.instancesPerMesh, 1));
+        const size_t hierarchyDepth = static_cast<size_t>(std::max(options.hierarchyDepth, 0));
+        const uint64_t seed = mix64(options.seed);
+
+        // Mesh slots are numbered across all files; the first uniqueCount slots define the
+        // geometries and every later slot repeats one of them.
+        const size_t totalSlots = fileCount * meshesPerFile;
+        const double duplicateRatio = std::clamp(options.duplicateRatio, 0.0, 1.0);
+        const size_t uniqueCount = std::clamp<size_t>(
+            static_cast<size_t>(std::llround(static_cast<double>(totalSlots) * (1.0 - duplicateRatio))), 1, totalSlots);
+
+        SyntheticSceneStatistics statistics;
+        statistics.uniqueGeometryCount = uniqueCount;
+
+        const size_t gridColumns = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(meshesPerFile * instancesPerMesh))));
+        const double spacing = 8.0;
+
+        for (size_t fileIndex = 0; fileIndex < fileCount; ++fileIndex) {
+            CesiumGltf::Model model;
+            model.asset.version = "2.0";
+            model.asset.generator = "gltf_instancing_bench";
+            std::vector<std::byte> buffer;
+
+            for (int m = 0; m < kMaterialsPerFile; ++m) {
+                CesiumGltf::Material& material = model.materials.emplace_back();
+                material.name = "material_" + std::to_string(m);
+                CesiumGltf::MaterialPBRMetallicRoughness pbr;
+                pbr.baseColorFactor = { 0.25 + 0.25 * m, 0.5, 1.0 - 0.2 * m, 1.0 };
+                material.pbrMetallicRoughness = pbr;
+            }
+
+            CesiumGltf::Scene scene;
+            for (size_t slot = 0; slot < meshesPerFile; ++slot) {
+                const size_t globalSlot = fileIndex * meshesPerFile + slot;
+                const bool isDuplicate = globalSlot >= uniqueCount;
+                const size_t geometryId = isDuplicate ? static_cast<size_t>(mix64(seed ^ globalSlot) % uniqueCount) : globalSlot;
+                const uint64_t jitterSeed = (isDuplicate && options.positionJitter > 0.0) ? mix64(seed + globalSlot) | 1 : 0;
+
+                const GridGeometry geometry = buildGridGeometry(seed, geometryId, options.verticesPerMesh, options.positionJitter, jitterSeed);
+                const int32_t meshIndex = addMesh(model, buffer, geometry, options.interleaved,
+                    static_cast<int32_t>(geometryId % kMaterialsPerFile), "mesh_" + std::to_string(globalSlot));
+                statistics.vertexCount += geometry.vertexCount;
+                ++statistics.meshCount;
+
+                for (size_t instance = 0; instance < instancesPerMesh; ++instance) {
+                    const size_t placement = slot * instancesPerMesh + instance;
+                    const uint64_t placementSeed = mix64(seed ^ (globalSlot << 20) ^ instance);
+                    const double angle = 6.283185307179586 * unitRandom(placementSeed, 1);
+                    const glm::dquat rotation = glm::angleAxis(angle, glm::dvec3(0.0, 1.0, 0.0));
+                    const double scale = 0.5 + 1.5 * unitRandom(placementSeed, 2);
+
+                    CesiumGltf::Node meshNode;
+                    meshNode.mesh = meshIndex;
+                    meshNode.name = "node_" + std::to_string(globalSlot) + "_" + std::to_string(instance);
+                    meshNode.rotation = { rotation.x, rotation.y, rotation.z, rotation.w };
+                    meshNode.scale = { scale, scale, scale };
+                    model.nodes.push_back(std::move(meshNode));
+                    int32_t childIndex = static_cast<int32_t>(model.nodes.size() - 1);
+
+                    // The grid position sits on the outermost parent; inner parents add small offsets,
+                    // so the flattened world matrices depend on the whole chain.
+                    for (size_t level = 0; level < hierarchyDepth; ++level) {
+                        CesiumGltf::Node parent;
+                        parent.children.push_back(childIndex);
+                        parent.translation = { 0.01 * static_cast<double>(level + 1), 0.0, 0.0 };
+                        model.nodes.push_back(std::move(parent));
+                        childIndex = static_cast<int32_t>(model.nodes.size() - 1);
+                    }
+                    CesiumGltf::Node& root = model.nodes[childIndex];
+                    root.translation = {
+                        spacing * static_cast<double>(placement % gridColumns) + root.translation[0],
+                        0.0,
+                        spacing * static_cast<double>(placement / gridColumns) + spacing * static_cast<double>(gridColumns) * static_cast<double>(fileIndex) };
+                    scene.nodes.push_back(childIndex);
+                }
+            }
+            model.scenes.push_back(std::move(scene));
+            model.scene = 0;
+            statistics.nodeCount += model.nodes.size();
+
+            alignBuffer(buffer);
+            CesiumGltf::Buffer& gltfBuffer = model.buffers.emplace_back();
+            gltfBuffer.byteLength = static_cast<int64_t>(buffer.size());
+
+            const std::filesystem::path path = outputDirectory / ("scene_" + std::to_string(fileIndex) + ".glb");
+            size_t bytesWritten = 0;
+            if (!writeModelAsGlb(model, buffer, path, bytesWritten)) {
+                return std::nullopt;
+            }
+            statistics.byteCount += bytesWritten;
+            ++statistics.fileCount;
+            logDebug("Generated " + path.string() + " (" + std::to_string(model.meshes.size()) + " meshes, " + std::to_string(model.nodes.size()) + " nodes).");
+        }
+        return statistics;
+    }
+
+} // namespace GltfInstancing
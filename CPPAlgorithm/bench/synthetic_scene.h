@@ -0,0 +1,43 @@
+﻿#ifndef SYNTHETIC_SCENE_H
+#define SYNTHETIC_SCENE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+namespace GltfInstancing {
+
+    // Parameters of a generated benchmark scene. Every file holds meshesPerFile meshes, each
+    // with its own accessors and buffer data; a duplicateRatio fraction of them repeats the
+    // geometry of another mesh byte for byte (across files too), which is what the detector
+    // has to find. The results are deterministic for a given set of options.
+    struct SyntheticSceneOptions {
+        int fileCount = 4;
+        int meshesPerFile = 256;
+        double duplicateRatio = 0.5;   // 0 = every mesh unique, 1 = one geometry for all meshes
+        int instancesPerMesh = 4;      // Nodes referencing each mesh
+        int hierarchyDepth = 1;        // Transform-only parent nodes above every mesh node
+        int verticesPerMesh = 1024;    // Rounded up to a full grid
+        bool interleaved = false;      // POSITION and NORMAL in one buffer view with byteStride 24
+        double positionJitter = 0.0;   // Max offset added to the vertices of duplicates (> 0: only tolerance mode matches them)
+        uint32_t seed = 1;
+    };
+
+    struct SyntheticSceneStatistics {
+        size_t fileCount = 0;
+        size_t meshCount = 0;
+        size_t uniqueGeometryCount = 0;
+        size_t nodeCount = 0;
+        size_t vertexCount = 0;
+        size_t byteCount = 0; // Total size of the written GLB files
+    };
+
+    // Writes the scene as scene_<n>.glb files into outputDirectory (created if missing).
+    // Returns std::nullopt (logged) if a file cannot be serialized or written.
+    std::optional<SyntheticSceneStatistics> generateSyntheticScene(
+        const SyntheticSceneOptions& options,
+        const std::filesystem::path& outputDirectory);
+
+} // namespace GltfInstancing
+
+#endif // SYNTHETIC_SCENE_H
@@ -0,0 +1,129 @@
+﻿#include "content_hash.h"
+
+#include <cstring> // For std::memcpy
+
+namespace GltfInstancing {
+
+    namespace {
+        constexpr uint64_t C1 = 0x87c37b91114253d5ULL;
+        constexpr uint64_t C2 = 0x4cf5ad432745937fULL;
+
+        inline uint64_t rotl64(uint64_t x, int r) {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        inline uint64_t read64(const uint8_t* p) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v)); // Unaligned-safe; glTF data is little-endian like all supported targets
+            return v;
+        }
+
+        inline uint64_t fmix64(uint64_t k) {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+    }
+
+    std::string ContentHash128::toHexString() const {
+        static const char* digits = "0123456789abcdef";
+        std::string out(32, '0');
+        for (int i = 0; i < 16; ++i) {
+            out[15 - i] = digits[(high >> (i * 4)) & 0xF];
+            out[31 - i] = digits[(low >> (i * 4)) & 0xF];
+        }
+        return out;
+    }
+
+    ContentHasher128::ContentHasher128(uint64_t seed) : _h1(seed), _h2(seed) {}
+
+    void ContentHasher128::processBlock(const uint8_t* block) {
+        uint64_t k1 = read64(block);
+        uint64_t k2 = read64(block + 8);
+
+        k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; _h1 ^= k1;
+        _h1 = rotl64(_h1, 27); _h1 += _h2; _h1 = _h1 * 5 + 0x52dce729;
+
+        k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; _h2 ^= k2;
+        _h2 = rotl64(_h2, 31); _h2 += _h1; _h2 = _h2 * 5 + 0x38495ab5;
+    }
+
+    void ContentHasher128::update(const void* data, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        _totalLength += size;
+
+        // Complete a pending partial block first.
+        if (_tailSize > 0) {
+            size_t needed = sizeof(_tail) - _tailSize;
+            size_t take = size < needed ? size : needed;
+            std::memcpy(_tail + _tailSize, bytes, take);
+            _tailSize += take;
+            bytes += take;
+            size -= take;
+            if (_tailSize < sizeof(_tail)) {
+                return;
+            }
+            processBlock(_tail);
+            _tailSize = 0;
+        }
+
+        // Hot loop: whole blocks straight from the caller's memory.
+        while (size >= 16) {
+            processBlock(bytes);
+            bytes += 16;
+            size -= 16;
+        }
+
+        if (size > 0) {
+            std::memcpy(_tail, bytes, size);
+            _tailSize = size;
+        }
+    }
+
+    ContentHash128 ContentHasher128::finalize() const {
+        uint64_t h1 = _h1;
+        uint64_t h2 = _h2;
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+
+        for (size_t i = _tailSize; i > 8; --i) {
+            k2 ^= static_cast<uint64_t>(_tail[i - 1]) << ((i - 9) * 8);
+        }
+        if (_tailSize > 8) {
+            k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+        }
+        for (size_t i = (_tailSize < 8 ? _tailSize : 8); i > 0; --i) {
+            k1 ^= static_cast<uint64_t>(_tail[i - 1]) << ((i - 1) * 8);
+        }
+        if (_tailSize > 0) {
+            k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+        }
+
+        h1 ^= _totalLength;
+        h2 ^= _totalLength;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix64(h1);
+        h2 = fmix64(h2);
+        h1 += h2;
+        h2 += h1;
+
+        ContentHash128 result;
+        result.low = h1;
+        result.high = h2;
+        return result;
+    }
+
+    ContentHash128 hashBytes128(const void* data, size_t size, uint64_t seed) {
+        ContentHasher128 hasher(seed);
+        hasher.update(data, size);
+        return hasher.finalize();
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,72 @@
+﻿#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace GltfInstancing {
+
+    // 128-bit content hash value. Used as the identity key for file bytes and accessor data.
+    struct ContentHash128 {
+        uint64_t low = 0;
+        uint64_t high = 0;
+
+        bool operator==(const ContentHash128& other) const { return low == other.low && high == other.high; }
+        bool operator!=(const ContentHash128& other) const { return !(*this == other); }
+        bool operator<(const ContentHash128& other) const {
+            return high < other.high || (high == other.high && low < other.low);
+        }
+
+        // Folds the 128-bit value into a size_t (for std::unordered_map and the existing size_t signatures).
+        size_t toSizeT() const { return static_cast<size_t>(low ^ (high * 0x9E3779B97F4A7C15ULL)); }
+
+        // 32 lowercase hex characters, high word first.
+        std::string toHexString() const;
+    };
+
+    struct ContentHash128Hasher {
+        size_t operator()(const ContentHash128& hash) const { return hash.toSizeT(); }
+    };
+
+    // Incremental 128-bit hasher (MurmurHash3 x64/128 construction) that accepts data in
+    // arbitrary chunks. Feeding the same byte sequence in different chunk sizes yields the
+    // same result, which lets callers stream strided data without first copying it.
+    class ContentHasher128 {
+    public:
+        explicit ContentHasher128(uint64_t seed = 0);
+
+        void update(const void* data, size_t size);
+
+        // Convenience for trivially copyable scalars (counts, enum values, component types...).
+        template <typename T>
+        void updateValue(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "updateValue requires a trivially copyable type");
+            update(&value, sizeof(T));
+        }
+
+        void updateString(const std::string& value) {
+            updateValue(static_cast<uint64_t>(value.size()));
+            update(value.data(), value.size());
+        }
+
+        // Returns the hash of everything fed so far; the hasher can keep receiving data afterwards.
+        ContentHash128 finalize() const;
+
+    private:
+        void processBlock(const uint8_t* block);
+
+        uint64_t _h1;
+        uint64_t _h2;
+        uint8_t _tail[16];
+        size_t _tailSize = 0;
+        uint64_t _totalLength = 0;
+    };
+
+    // One-shot helper over a contiguous byte range.
+    ContentHash128 hashBytes128(const void* data, size_t size, uint64_t seed = 0);
+
+} // namespace GltfInstancing
+
+#endif // CONTENT_HASH_H
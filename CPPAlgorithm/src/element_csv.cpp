@@ -0,0 +1,171 @@
+﻿#include "element_csv.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "utilities.h" // For logging, parallelFor
+
+#include <algorithm>
+#include <string_view>
+#include <system_error>
+
+namespace GltfInstancing {
+
+    namespace {
+
+        constexpr std::string_view kElementCsvSuffix = "_IDExport.csv";
+
+        std::string_view trimView(std::string_view text) {
+            const size_t first = text.find_first_not_of(" \t\r");
+            if (first == std::string_view::npos) {
+                return {};
+            }
+            const size_t last = text.find_last_not_of(" \t\r");
+            return text.substr(first, last - first + 1);
+        }
+
+        // Unquotes a complete double-quoted field ("" -> "); other text is returned as it is.
+        // Sets closed to false for an opening quote without a closing one.
+        std::string unquoteField(std::string_view field, bool& closed) {
+            closed = true;
+            if (field.empty() || field.front() != '"') {
+                return std::string(field);
+            }
+            std::string unquoted;
+            unquoted.reserve(field.size());
+            for (size_t i = 1; i < field.size(); ++i) {
+                if (field[i] != '"') {
+                    unquoted.push_back(field[i]);
+                } else if (i + 1 < field.size() && field[i + 1] == '"') {
+                    unquoted.push_back('"');
+                    ++i;
+                } else if (i + 1 == field.size()) {
+                    return unquoted;
+                } else {
+                    return std::string(field); // Text after the closing quote: keep the field verbatim
+                }
+            }
+            closed = false;
+            return unquoted;
+        }
+
+        // Position of the first comma outside double quotes, or npos.
+        size_t findFieldSeparator(std::string_view row) {
+            bool quoted = false;
+            for (size_t i = 0; i < row.size(); ++i) {
+                if (row[i] == '"') {
+                    quoted = !quoted;
+                } else if (row[i] == ',' && !quoted) {
+                    return i;
+                }
+            }
+            return std::string_view::npos;
+        }
+
+    } // namespace
+
+    std::optional<std::vector<ElementCsvRow>> parseElementCsv(const std::filesystem::path& csvPath) {
+        std::optional<MappedFile> mappedFile = MappedFile::open(csvPath);
+        if (!mappedFile) {
+            logError("Could not open CSV file: " + csvPath.string());
+            return std::nullopt;
+        }
+        addBytesRead(mappedFile->size());
+        std::string_view text(reinterpret_cast<const char*>(mappedFile->data()), mappedFile->size());
+        if (text.size() >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            text.remove_prefix(3); // UTF-8 BOM
+        }
+
+        std::vector<ElementCsvRow> rows;
+        bool headerSkipped = false;
+        size_t lineNumber = 0;
+        size_t lineStart = 0;
+        while (lineStart < text.size()) {
+            size_t lineEnd = text.find('\n', lineStart);
+            if (lineEnd == std::string_view::npos) {
+                lineEnd = text.size();
+            }
+            const std::string_view row = trimView(text.substr(lineStart, lineEnd - lineStart));
+            lineStart = lineEnd + 1;
+            ++lineNumber;
+            if (!headerSkipped) {
+                headerSkipped = true;
+                continue;
+            }
+            if (row.empty()) {
+                continue; // Skip empty lines
+            }
+
+            const size_t separator = findFieldSeparator(row);
+            if (separator == std::string_view::npos) {
+                logWarning("Skipping malformed row " + std::to_string(lineNumber) + " in " + csvPath.filename().string());
+                continue;
+            }
+            bool hashClosed = true;
+            bool idClosed = true;
+            ElementCsvRow entry;
+            entry.meshHash = unquoteField(trimView(row.substr(0, separator)), hashClosed);
+            entry.elementId = unquoteField(trimView(row.substr(separator + 1)), idClosed);
+            if (!hashClosed || !idClosed) {
+                logWarning("Skipping row " + std::to_string(lineNumber) + " in " + csvPath.filename().string() + " with an unterminated quote.");
+                continue;
+            }
+            if (entry.meshHash.empty()) {
+                logWarning("Skipping row " + std::to_string(lineNumber) + " in " + csvPath.filename().string() + " due to empty mesh hash.");
+                continue;
+            }
+            rows.push_back(std::move(entry));
+        }
+        if (!headerSkipped) {
+            logWarning("CSV file is empty or could not read header: " + csvPath.string());
+        }
+        return rows;
+    }
+
+    std::vector<ElementCsvFile> loadElementCsvFiles(const std::filesystem::path& directory, int threadCount) {
+        std::vector<std::filesystem::path> csvPaths;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            const std::string filename = entry.path().filename().string();
+            if (entry.is_regular_file() &&
+                filename.size() >= kElementCsvSuffix.size() &&
+                filename.compare(filename.size() - kElementCsvSuffix.size(), kElementCsvSuffix.size(), kElementCsvSuffix) == 0) {
+                csvPaths.push_back(entry.path());
+            }
+        }
+        if (ec) {
+            logError("Failed to list CSV directory " + directory.string() + ". Error: " + ec.message());
+        }
+        std::sort(csvPaths.begin(), csvPaths.end());
+
+        std::vector<std::optional<std::vector<ElementCsvRow>>> parsed(csvPaths.size());
+        parallelFor(csvPaths.size(), threadCount, [&](size_t fileIndex, int /*workerIndex*/) {
+            parsed[fileIndex] = parseElementCsv(csvPaths[fileIndex]);
+        });
+
+        std::vector<ElementCsvFile> files;
+        files.reserve(csvPaths.size());
+        for (size_t i = 0; i < csvPaths.size(); ++i) {
+            if (!parsed[i]) {
+                logError("Failed to load CSV file, skipping: " + csvPaths[i].string());
+                continue;
+            }
+            files.push_back({ csvPaths[i], std::move(*parsed[i]) });
+        }
+        return files;
+    }
+
+    std::unordered_map<std::string, std::string> buildElementIdMap(const std::vector<ElementCsvFile>& files) {
+        size_t rowCount = 0;
+        for (const ElementCsvFile& file : files) {
+            rowCount += file.rows.size();
+        }
+        std::unordered_map<std::string, std::string> elementIds;
+        elementIds.reserve(rowCount);
+        for (const ElementCsvFile& file : files) {
+            for (const ElementCsvRow& row : file.rows) {
+                elementIds.emplace(row.meshHash, row.elementId);
+            }
+        }
+        return elementIds;
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,42 @@
+﻿#ifndef ELEMENT_CSV_H
+#define ELEMENT_CSV_H
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GltfInstancing {
+
+    // One row of an *_IDExport.csv file: a source mesh name (hash) and the element (component)
+    // it belongs to.
+    struct ElementCsvRow {
+        std::string meshHash;
+        std::string elementId;
+    };
+
+    struct ElementCsvFile {
+        std::filesystem::path path;
+        std::vector<ElementCsvRow> rows;
+    };
+
+    // Parses an _IDExport.csv file (a header row, then "meshHash,elementId" rows) in one pass over
+    // a memory mapping of the file. The first field may be double-quoted ("" escapes a quote);
+    // the element ID is the rest of the row, unquoted if it is a single quoted field. Whitespace
+    // around fields and \r line ends are dropped; rows without a comma or with an empty mesh hash
+    // are skipped with a warning. Returns std::nullopt (logged) if the file cannot be read.
+    std::optional<std::vector<ElementCsvRow>> parseElementCsv(const std::filesystem::path& csvPath);
+
+    // Parses every *_IDExport.csv file of directory (not recursive), files in parallel on
+    // threadCount workers (0 = all hardware threads). Files come back sorted by path; files that
+    // cannot be read are logged and left out.
+    std::vector<ElementCsvFile> loadElementCsvFiles(const std::filesystem::path& directory, int threadCount);
+
+    // Element ID by mesh hash over all files, for the hash join. The first file (in path order)
+    // and row that names a mesh hash wins.
+    std::unordered_map<std::string, std::string> buildElementIdMap(const std::vector<ElementCsvFile>& files);
+
+} // namespace GltfInstancing
+
+#endif // ELEMENT_CSV_H
@@ -0,0 +1,124 @@
+﻿#include "geometry_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <CesiumGltf/Accessor.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <meshoptimizer.h>
+
+namespace GltfInstancing {
+
+    namespace {
+        // Writes count components of a vertex (as T) into a zero-padded element.
+        template <typename T>
+        void storeComponents(std::byte* element, const T* values, size_t count) {
+            std::memcpy(element, values, count * sizeof(T));
+        }
+    }
+
+    glm::dmat4 PositionQuantization::dequantizationMatrix() const {
+        return glm::scale(glm::translate(glm::dmat4(1.0), offset), step);
+    }
+
+    PositionQuantization computePositionQuantization(const BoundingBox& bounds, int bits) {
+        PositionQuantization quantization;
+        if (!bounds.isValid()) {
+            return quantization;
+        }
+        const double maxValue = static_cast<double>((1u << std::clamp(bits, 1, 16)) - 1u);
+        quantization.offset = bounds.min;
+        // One step for all axes: a non-uniform dequantization scale on the node would make
+        // renderers skew NORMAL by its inverse transpose.
+        const glm::dvec3 extent = bounds.max - bounds.min;
+        const double largestExtent = std::max({ extent.x, extent.y, extent.z });
+        quantization.step = glm::dvec3(largestExtent > 0.0 ? largestExtent / maxValue : 1.0);
+        return quantization;
+    }
+
+    QuantizedAttribute quantizePositions(const float* positions, size_t vertexCount, const PositionQuantization& quantization) {
+        QuantizedAttribute result;
+        result.componentType = CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT;
+        result.byteStride = 8; // 3 x uint16 + padding
+        result.data.resize(vertexCount * result.byteStride);
+        result.min.assign(3, 65535.0);
+        result.max.assign(3, 0.0);
+        for (size_t i = 0; i < vertexCount; ++i) {
+            uint16_t q[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                const double value = (static_cast<double>(positions[i * 3 + axis]) - quantization.offset[axis]) / quantization.step[axis];
+                q[axis] = static_cast<uint16_t>(std::clamp(std::lround(value), 0L, 65535L));
+                result.min[axis] = std::min(result.min[axis], static_cast<double>(q[axis]));
+                result.max[axis] = std::max(result.max[axis], static_cast<double>(q[axis]));
+            }
+            storeComponents(result.data.data() + i * result.byteStride, q, 3);
+        }
+        return result;
+    }
+
+    QuantizedAttribute quantizeNormals(const float* normals, size_t vertexCount, int bits) {
+        QuantizedAttribute result;
+        result.normalized = true;
+        if (bits <= 8) {
+            result.componentType = CesiumGltf::Accessor::ComponentType::BYTE;
+            result.byteStride = 4; // 3 x int8 + padding
+        } else {
+            result.componentType = CesiumGltf::Accessor::ComponentType::SHORT;
+            result.byteStride = 8; // 3 x int16 + padding
+        }
+        result.data.resize(vertexCount * result.byteStride);
+        for (size_t i = 0; i < vertexCount; ++i) {
+            std::byte* element = result.data.data() + i * result.byteStride;
+            if (bits <= 8) {
+                int8_t q[3];
+                for (int c = 0; c < 3; ++c) q[c] = static_cast<int8_t>(meshopt_quantizeSnorm(normals[i * 3 + c], 8));
+                storeComponents(element, q, 3);
+            } else {
+                int16_t q[3];
+                for (int c = 0; c < 3; ++c) q[c] = static_cast<int16_t>(meshopt_quantizeSnorm(normals[i * 3 + c], 16));
+                storeComponents(element, q, 3);
+            }
+        }
+        return result;
+    }
+
+    std::optional<QuantizedAttribute> quantizeTexCoords(const float* texCoords, size_t vertexCount, int bits) {
+        if (std::any_of(texCoords, texCoords + vertexCount * 2, [](float v) { return !(v >= 0.0f && v <= 1.0f); })) {
+            return std::nullopt;
+        }
+        QuantizedAttribute result;
+        result.normalized = true;
+        result.byteStride = 4; // 2 x uint8 + padding, or 2 x uint16
+        result.componentType = bits <= 8
+            ? CesiumGltf::Accessor::ComponentType::UNSIGNED_BYTE
+            : CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT;
+        result.data.resize(vertexCount * result.byteStride);
+        for (size_t i = 0; i < vertexCount; ++i) {
+            std::byte* element = result.data.data() + i * result.byteStride;
+            if (bits <= 8) {
+                uint8_t q[2] = { static_cast<uint8_t>(meshopt_quantizeUnorm(texCoords[i * 2], 8)), static_cast<uint8_t>(meshopt_quantizeUnorm(texCoords[i * 2 + 1], 8)) };
+                storeComponents(element, q, 2);
+            } else {
+                uint16_t q[2] = { static_cast<uint16_t>(meshopt_quantizeUnorm(texCoords[i * 2], 16)), static_cast<uint16_t>(meshopt_quantizeUnorm(texCoords[i * 2 + 1], 16)) };
+                storeComponents(element, q, 2);
+            }
+        }
+        return result;
+    }
+
+    std::vector<std::byte> encodeVertexStream(const std::byte* data, size_t vertexCount, size_t byteStride) {
+        std::vector<std::byte> encoded(meshopt_encodeVertexBufferBound(vertexCount, byteStride));
+        encoded.resize(meshopt_encodeVertexBuffer(reinterpret_cast<unsigned char*>(encoded.data()), encoded.size(), data, vertexCount, byteStride));
+        return encoded;
+    }
+
+    std::vector<std::byte> encodeTriangleIndices(const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+        std::vector<std::byte> encoded(meshopt_encodeIndexBufferBound(indexCount, vertexCount));
+        encoded.resize(meshopt_encodeIndexBuffer(reinterpret_cast<unsigned char*>(encoded.data()), encoded.size(), indices, indexCount));
+        return encoded;
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,72 @@
+﻿#ifndef GEOMETRY_COMPRESSION_H
+#define GEOMETRY_COMPRESSION_H
+
+#include "utilities.h" // For BoundingBox
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace GltfInstancing {
+
+    // Output geometry encoding, applied to every mesh GlbWriter rewrites (see
+    // GlbWriterOptions::compression). Instance transforms, images and metadata are not touched.
+    struct GeometryCompressionOptions {
+        // EXT_meshopt_compression: vertex streams (ATTRIBUTES) and index buffers (TRIANGLES) are
+        // meshopt-encoded in the BIN chunk; the buffer views point into a fallback buffer without
+        // data, so the extension is required.
+        bool meshoptCompression = false;
+        // KHR_mesh_quantization; 0 keeps FLOAT.
+        // POSITION: 1..16 bits per axis, UNSIGNED_SHORT on a grid over the mesh bounds. The
+        // dequantization (offset + scale) goes on the node, or into the instance transforms.
+        int positionBits = 0;
+        // NORMAL: 8 (normalized BYTE) or 16 (normalized SHORT).
+        int normalBits = 0;
+        // TEXCOORD_n: 8 (normalized UNSIGNED_BYTE) or 16 (normalized UNSIGNED_SHORT); sets with
+        // coordinates outside [0, 1] stay FLOAT.
+        int texCoordBits = 0;
+
+        bool enabled() const { return meshoptCompression || positionBits > 0 || normalBits > 0 || texCoordBits > 0; }
+        bool quantizes() const { return positionBits > 0 || normalBits > 0 || texCoordBits > 0; }
+    };
+
+    // A quantized vertex stream. Elements are byteStride apart, padded to a multiple of 4 bytes
+    // as glTF requires for vertex attributes.
+    struct QuantizedAttribute {
+        int32_t componentType = 0; // CesiumGltf::Accessor::ComponentType
+        bool normalized = false;
+        size_t byteStride = 0;
+        std::vector<std::byte> data;
+        std::vector<double> min; // Set for POSITION (in quantized units)
+        std::vector<double> max;
+    };
+
+    // Maps quantized positions back to mesh units: position = offset + q * step.
+    struct PositionQuantization {
+        glm::dvec3 offset{ 0.0 };
+        glm::dvec3 step{ 1.0 };
+
+        glm::dmat4 dequantizationMatrix() const;
+    };
+
+    // Cubic grid over bounds (the mesh-unit bounds of every primitive sharing the node): the
+    // largest extent is split into 2^bits - 1 steps, the same step is used on every axis.
+    PositionQuantization computePositionQuantization(const BoundingBox& bounds, int bits);
+
+    // positions/normals/texCoords: tightly packed FLOAT vectors of vertexCount elements.
+    QuantizedAttribute quantizePositions(const float* positions, size_t vertexCount, const PositionQuantization& quantization);
+    QuantizedAttribute quantizeNormals(const float* normals, size_t vertexCount, int bits);
+    // std::nullopt if a coordinate lies outside [0, 1] (normalized storage cannot represent it).
+    std::optional<QuantizedAttribute> quantizeTexCoords(const float* texCoords, size_t vertexCount, int bits);
+
+    // meshopt encodings for EXT_meshopt_compression. encodeVertexStream requires byteStride to
+    // be a multiple of 4, at most 256; encodeTriangleIndices an index count divisible by 3.
+    std::vector<std::byte> encodeVertexStream(const std::byte* data, size_t vertexCount, size_t byteStride);
+    std::vector<std::byte> encodeTriangleIndices(const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+} // namespace GltfInstancing
+
+#endif // GEOMETRY_COMPRESSION_H
@@ -3,7 +3,10 @@
 #include <glm/gtx/transform.hpp>
 
 #include "glb_reader.h"
-#include "utilities.h" // For readFileBytes, calculateFileSHA256, logging
+#include "utilities.h" // For readFileBytes, logging
+#include "mapped_file.h"
+#include "content_hash.h"
+#include "metrics.h"
 
 #include <CesiumGltfReader/GltfReader.h> // Changed from GltfReaderResult.h
 #include <gsl/span>                      // For gsl::span in readGltf
@@ -23,25 +26,64 @@
 
 namespace GltfInstancing {
 
-    GlbReader::GlbReader() {
-        // Initialize any reader options if necessary
+    std::optional<std::string> computeFileContentHash(const std::filesystem::path& filePath) {
+        std::optional<MappedFile> mappedFile = MappedFile::open(filePath);
+        if (mappedFile) {
+            addBytesRead(mappedFile->size());
+            return hashBytes128(mappedFile->data(), mappedFile->size()).toHexString();
+        }
+        std::optional<std::vector<char>> fileBytes = readFileBytes(filePath);
+        if (!fileBytes) {
+            logError("Failed to read bytes from: " + filePath.string());
+            return std::nullopt;
+        }
+        addBytesRead(fileBytes->size());
+        return hashBytes128(fileBytes->data(), fileBytes->size()).toHexString();
+    }
+
+    GlbReader::GlbReader(const GlbReaderOptions& options) {
+        if (!options.decodeImages) {
+            _readerOptions.decodeEmbeddedImages = false;
+            _readerOptions.resolveExternalImages = false;
+        }
     }
 
     std::optional<LoadedGltfModel> GlbReader::readGlb(const std::filesystem::path& glbPath, int modelId) {
+        return readGlbWithReader(_gltfReader, _readerOptions, glbPath, modelId);
+    }
+
+    std::optional<LoadedGltfModel> GlbReader::readGlbWithReader(
+        CesiumGltfReader::GltfReader& gltfReader,
+        const CesiumGltfReader::GltfReaderOptions& readerOptions,
+        const std::filesystem::path& glbPath,
+        int modelId) {
         logMessage("Reading GLB: " + glbPath.string());
 
-        auto bytes = readFileBytes(glbPath);
-        if (!bytes) {
-            logError("Failed to read bytes from: " + glbPath.string());
-            return std::nullopt;
+        // Map the file instead of copying it to the heap; the parser reads straight from the
+        // mapping and the content hash is computed over the very same bytes.
+        std::optional<MappedFile> mappedFile = MappedFile::open(glbPath);
+        std::optional<std::vector<char>> fallbackBytes;
+        gsl::span<const std::byte> byte_span;
+        if (mappedFile) {
+            byte_span = mappedFile->bytes();
         }
+        else {
+            logWarning("Memory mapping failed, falling back to buffered read: " + glbPath.string());
+            fallbackBytes = readFileBytes(glbPath);
+            if (!fallbackBytes) {
+                logError("Failed to read bytes from: " + glbPath.string());
+                return std::nullopt;
+            }
+            byte_span = gsl::span<const std::byte>(
+                reinterpret_cast<const std::byte*>(fallbackBytes->data()),
+                fallbackBytes->size()
+            );
+        }
+
+        addBytesRead(byte_span.size());
+        const ContentHash128 contentHash = hashBytes128(byte_span.data(), byte_span.size());
 
-        // Construct gsl::span from the vector's data and size
-        gsl::span<const std::byte> byte_span(
-            reinterpret_cast<const std::byte*>(bytes->data()),
-            bytes->size()
-        );
-        CesiumGltfReader::GltfReaderResult readerResult = _gltfReader.readGltf(byte_span);
+        CesiumGltfReader::GltfReaderResult readerResult = gltfReader.readGltf(byte_span, readerOptions);
 
         if (!readerResult.model) {
             logError("Failed to parse GLB: " + glbPath.string());
@@ -59,7 +101,7 @@ namespace GltfInstancing {
         LoadedGltfModel loadedModel;
         loadedModel.model = std::move(*readerResult.model);
         loadedModel.originalPath = glbPath;
-        loadedModel.fileHash = calculateFileSHA256(glbPath);
+        loadedModel.fileHash = contentHash.toHexString();
         loadedModel.uniqueId = modelId;
 
         logMessage("Successfully read GLB: " + glbPath.string() + " (Hash: " + loadedModel.fileHash + ")");
@@ -238,20 +280,50 @@ namespace GltfInstancing {
     }
 
     std::vector<LoadedGltfModel> GlbReader::loadGltfModels(
-        const std::set<std::filesystem::path>& glbPaths) {
-        std::vector<LoadedGltfModel> loadedModels;
-        loadedModels.reserve(glbPaths.size());
-        int currentModelId = 0;
-        for (const auto& path : glbPaths) {
-            if (std::filesystem::exists(path)) { // Double check existence before reading
-                auto loadedModelOpt = readGlb(path, currentModelId);
-                if (loadedModelOpt) {
-                    loadedModels.push_back(std::move(*loadedModelOpt));
-                    currentModelId++;
+        const std::set<std::filesystem::path>& glbPaths,
+        int threadCount) {
+        const std::vector<std::filesystem::path> orderedPaths(glbPaths.begin(), glbPaths.end());
+        const int workerCount = static_cast<int>(std::min(
+            static_cast<size_t>(resolveThreadCount(threadCount)),
+            std::max<size_t>(orderedPaths.size(), 1)));
+
+        // One slot per input path: workers never touch the same slot, and the final
+        // ordering (and therefore the model IDs) only depends on the path order.
+        std::vector<std::optional<LoadedGltfModel>> slots(orderedPaths.size());
+
+        if (workerCount <= 1) {
+            for (size_t i = 0; i < orderedPaths.size(); ++i) {
+                const auto& path = orderedPaths[i];
+                if (std::filesystem::exists(path)) { // Double check existence before reading
+                    slots[i] = readGlbWithReader(_gltfReader, _readerOptions, path, -1);
+                }
+                else {
+                    logError("GLB file path does not exist (or no permission), skipping: " + path.string());
                 }
             }
-            else {
-                logError("GLB file path does not exist (or no permission), skipping: " + path.string());
+        }
+        else {
+            logInfo("Loading " + std::to_string(orderedPaths.size()) + " GLB file(s) with " + std::to_string(workerCount) + " worker thread(s).");
+            // GltfReader is not safe to share between threads, so every worker gets its own.
+            std::vector<CesiumGltfReader::GltfReader> workerReaders(static_cast<size_t>(workerCount));
+            parallelFor(orderedPaths.size(), workerCount, [&](size_t i, int workerIndex) {
+                const auto& path = orderedPaths[i];
+                if (std::filesystem::exists(path)) {
+                    slots[i] = readGlbWithReader(workerReaders[static_cast<size_t>(workerIndex)], _readerOptions, path, -1);
+                }
+                else {
+                    logError("GLB file path does not exist (or no permission), skipping: " + path.string());
+                }
+            });
+        }
+
+        std::vector<LoadedGltfModel> loadedModels;
+        loadedModels.reserve(orderedPaths.size());
+        int currentModelId = 0;
+        for (auto& slot : slots) {
+            if (slot) {
+                slot->uniqueId = currentModelId++;
+                loadedModels.push_back(std::move(*slot));
             }
         }
         return loadedModels;
@@ -14,20 +14,31 @@
 
 namespace GltfInstancing {
 
-   
+    struct GlbReaderOptions {
+        // Geometry-only load profile: embedded and external images are not decoded, the
+        // encoded bytes stay in their buffer views (or URIs) as opaque blobs. Detection only
+        // needs geometry and material parameters, and GlbWriter::copyImage passes the encoded
+        // bytes through unchanged, so decoded pixels would only cost load time and memory.
+        bool decodeImages = false;
+    };
+
     struct LoadedGltfModel {
         CesiumGltf::Model model;
         std::filesystem::path originalPath;
-        std::string fileHash; // SHA256 hash of the original file for quick identity check
+        std::string fileHash; // 128-bit content hash (hex) of the original file bytes, used to collapse identical files
         int uniqueId; // A unique ID assigned to this loaded model for easy reference
 
         // Default constructor for invalid state
         LoadedGltfModel() : uniqueId(-1) {}
     };
 
+    // Content hash of a file's bytes as GlbReader stores it in LoadedGltfModel::fileHash,
+    // without parsing the file. Returns std::nullopt (logged) if the file cannot be read.
+    std::optional<std::string> computeFileContentHash(const std::filesystem::path& filePath);
+
     class GlbReader {
     public:
-        GlbReader();
+        explicit GlbReader(const GlbReaderOptions& options = GlbReaderOptions());
 
         std::optional<LoadedGltfModel> readGlb(const std::filesystem::path& glbPath, int modelId);
 
@@ -38,10 +49,22 @@ namespace GltfInstancing {
             const std::filesystem::path& directoryPath,
             bool recursive = true);
 
+        // Loads all given GLB files. With threadCount != 1 the files are parsed concurrently
+        // (threadCount <= 0 uses all hardware threads), each worker owning its own GltfReader.
+        // Model IDs are assigned after loading in path order, so the result is identical to
+        // the serial load regardless of the thread count.
         std::vector<LoadedGltfModel> loadGltfModels(
-            const std::set<std::filesystem::path>& glbPaths);
+            const std::set<std::filesystem::path>& glbPaths,
+            int threadCount = 1);
 
     private:
+        static std::optional<LoadedGltfModel> readGlbWithReader(
+            CesiumGltfReader::GltfReader& gltfReader,
+            const CesiumGltfReader::GltfReaderOptions& readerOptions,
+            const std::filesystem::path& glbPath,
+            int modelId);
+
+        CesiumGltfReader::GltfReaderOptions _readerOptions;
         CesiumGltfReader::GltfReader _gltfReader;
     };
 
@@ -1,5 +1,9 @@
 ﻿#include "glb_writer.h"
 #include "utilities.h"
+#include "transform_batch.h"
+#include "mesh_optimization.h"
+#include "geometry_compression.h"
+#include "metrics.h"
 #include <sstream> // For std::ostringstream
 
 #include <CesiumGltfContent\GltfUtilities.h>
@@ -22,11 +26,19 @@
 #include <nlohmann/json.hpp> // For direct JSON construction for extensions
 #include <fstream>
 #include <algorithm>
+#include <cstring> // For std::memcpy
+#include <cmath>
 #include <vector> // Ensure included for std::vector usage
+#include <unordered_set>
 
 // Corrected include for EXT_mesh_gpu_instancing related struct
 // Please verify this exact filename and path in your Cesium Native install/source
 #include <CesiumGltf/ExtensionExtMeshGpuInstancing.h>
+#include <CesiumGltf/ExtensionExtMeshFeatures.h>
+#include <CesiumGltf/ExtensionExtInstanceFeatures.h>
+#include <CesiumGltf/ExtensionModelExtStructuralMetadata.h>
+#include <CesiumGltf/ExtensionBufferExtMeshoptCompression.h>
+#include <CesiumGltf/ExtensionBufferViewExtMeshoptCompression.h>
 // ExtensionSerialization.h is not used now, we use nlohmann::json directly
 
 #include <glm/glm.hpp>
@@ -36,16 +48,60 @@
 
 namespace GltfInstancing {
 
+    namespace {
+        template <size_t ElementSize>
+        void gatherFixed(std::byte* destination, const std::byte* source, size_t sourceStride, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                std::memcpy(destination + i * ElementSize, source + i * sourceStride, ElementSize);
+            }
+        }
+
+        // Packs count strided elements tightly into destination. The common vertex and index
+        // element sizes get a fixed-size copy the compiler can turn into plain loads and stores.
+        void gatherStridedElements(std::byte* destination, const std::byte* source, size_t sourceStride, size_t elementSize, size_t count) {
+            switch (elementSize) {
+            case 2: gatherFixed<2>(destination, source, sourceStride, count); return;
+            case 4: gatherFixed<4>(destination, source, sourceStride, count); return;
+            case 8: gatherFixed<8>(destination, source, sourceStride, count); return;
+            case 12: gatherFixed<12>(destination, source, sourceStride, count); return;
+            case 16: gatherFixed<16>(destination, source, sourceStride, count); return;
+            default:
+                for (size_t i = 0; i < count; ++i) {
+                    std::memcpy(destination + i * elementSize, source + i * sourceStride, elementSize);
+                }
+            }
+        }
+
+        void addExtensionOnce(std::vector<std::string>& list, const std::string& name) {
+            if (std::find(list.begin(), list.end(), name) == list.end()) {
+                list.push_back(name);
+            }
+        }
+
+        // POSITION accessors require min/max; attribute is FLOAT VEC3 (see unpackTriangleMesh).
+        void setFloatPositionBounds(CesiumGltf::Accessor& accessor, const SimplifiedAttribute& attribute, size_t vertexCount) {
+            const float* positions = reinterpret_cast<const float*>(attribute.data.data());
+            accessor.min.assign(3, std::numeric_limits<double>::max());
+            accessor.max.assign(3, std::numeric_limits<double>::lowest());
+            for (size_t i = 0; i < vertexCount * 3; ++i) {
+                accessor.min[i % 3] = std::min(accessor.min[i % 3], static_cast<double>(positions[i]));
+                accessor.max[i % 3] = std::max(accessor.max[i % 3], static_cast<double>(positions[i]));
+            }
+        }
+    }
+
     // ... (GlbWriter constructor, reset, getOriginalModelById, addDataToBuffer - keep as corrected before) ...
     // For brevity, I'm showing only the functions with significant changes based on the latest errors.
     // You need to merge these into your existing glb_writer.cpp.
 
     // --- Start of existing GlbWriter constructor, reset, getOriginalModelById, addDataToBuffer ---
-    GlbWriter::GlbWriter() {}
+    GlbWriter::GlbWriter(const GlbWriterOptions& options) : _options(options) {}
 
     void GlbWriter::resetInternalState() {
         _outputGltf = CesiumGltf::Model();
         _outputBufferData.clear();
+        _plannedBufferSize = 0;
+        _pendingWrites.clear();
 
         if (_outputGltf.buffers.empty()) {
             _outputGltf.buffers.emplace_back();
@@ -56,13 +112,36 @@ namespace GltfInstancing {
         _textureRemapping.clear();
         _samplerRemapping.clear();
         _imageRemapping.clear();
+        _meshLods = nullptr;
+        _rewrittenMeshes.clear();
+        _meshDequantization.clear();
+        _dequantizedInstances.clear();
+        _meshoptFallbackBuffer = -1;
+        _meshoptFallbackSize = 0;
+        _lastOutput.reset();
+    }
+
+    void GlbWriter::removeUnusedObjects() {
+        CesiumGltfContent::GltfUtilities::removeUnusedAccessors(_outputGltf);
+        CesiumGltfContent::GltfUtilities::removeUnusedBufferViews(_outputGltf);
+        // With meshopt views the BIN buffer may only be referenced from their extension, and
+        // the fallback buffer index is recorded; both stay as laid out.
+        if (_meshoptFallbackBuffer < 0) {
+            CesiumGltfContent::GltfUtilities::removeUnusedBuffers(_outputGltf);
+        }
     }
 
     const CesiumGltf::Model* GlbWriter::getOriginalModelById(
         const std::vector<LoadedGltfModel>& originalModels,
         int modelId) const {
-
-
+        if (_modelSource) {
+            _pinnedSourceModel = _modelSource->acquire(modelId);
+            if (!_pinnedSourceModel) {
+                logError("Could not load original model with ID: " + std::to_string(modelId));
+                return nullptr;
+            }
+            return &_pinnedSourceModel->model;
+        }
 
         for (const auto& loadedModel : originalModels) {
             if (loadedModel.uniqueId == modelId) {
@@ -74,25 +153,241 @@ namespace GltfInstancing {
     }
 
    int32_t GlbWriter::addDataToBuffer(const gsl::span<const std::byte>& data, int32_t byteStrideOptional, bool isVertexBuffer) {
+        int32_t bufferViewIndex = addStridedDataToBuffer(data.data(), data.size(), data.size(), data.empty() ? 0 : 1);
+        if (bufferViewIndex >= 0 && isVertexBuffer && byteStrideOptional > 0) {
+            _outputGltf.bufferViews[bufferViewIndex].byteStride = byteStrideOptional;
+        }
+        return bufferViewIndex;
+    }
+
+    int32_t GlbWriter::addStridedDataToBuffer(const std::byte* source, size_t sourceStride, size_t elementSize, size_t elementCount) {
+        int32_t bufferViewIndex = reserveBufferView(elementSize * elementCount);
+        if (bufferViewIndex < 0) {
+            return -1;
+        }
+        if (elementCount > 0) {
+            PendingBufferWrite& write = _pendingWrites.emplace_back();
+            write.destinationOffset = static_cast<size_t>(_outputGltf.bufferViews[bufferViewIndex].byteOffset);
+            write.byteLength = elementSize * elementCount;
+            write.source = source;
+            write.sourceStride = sourceStride;
+            write.elementSize = elementSize;
+            write.elementCount = elementCount;
+        }
+        return bufferViewIndex;
+    }
+
+    int32_t GlbWriter::addSourceDataToBuffer(
+        const CesiumGltf::Model& sourceModel,
+        int sourceModelId,
+        int32_t bufferIndex,
+        size_t byteOffset,
+        size_t sourceStride,
+        size_t elementSize,
+        size_t elementCount) {
+        if (!_modelSource) {
+            return addStridedDataToBuffer(sourceModel.buffers[static_cast<size_t>(bufferIndex)].cesium.data.data() + byteOffset,
+                sourceStride, elementSize, elementCount);
+        }
+        int32_t bufferViewIndex = reserveBufferView(elementSize * elementCount);
+        if (bufferViewIndex < 0 || elementCount == 0) {
+            return bufferViewIndex;
+        }
+        ModelCache* modelSource = _modelSource;
+        queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[bufferViewIndex].byteOffset), elementSize * elementCount,
+            [modelSource, sourceModelId, bufferIndex, byteOffset, sourceStride, elementSize, elementCount](std::byte* destination) {
+                std::shared_ptr<const LoadedGltfModel> model = modelSource->acquire(sourceModelId);
+                if (!model) {
+                    return; // Logged by the cache; the region stays zero-filled
+                }
+                const std::byte* source = model->model.buffers[static_cast<size_t>(bufferIndex)].cesium.data.data() + byteOffset;
+                if (sourceStride == elementSize) {
+                    std::memcpy(destination, source, elementSize * elementCount);
+                    return;
+                }
+                for (size_t i = 0; i < elementCount; ++i) {
+                    std::memcpy(destination + i * elementSize, source + i * sourceStride, elementSize);
+                }
+            });
+        return bufferViewIndex;
+    }
+
+    int32_t GlbWriter::reserveBufferView(size_t byteLength, size_t alignment) {
         if (_outputGltf.buffers.empty()) {
-            logError("addDataToBuffer called before main buffer was initialized.");
+            logError("reserveBufferView called before main buffer was initialized.");
             return -1;
         }
-        size_t currentOffset = _outputBufferData.size();
-        size_t padding = (4 - (currentOffset % 4)) % 4;
-        _outputBufferData.insert(_outputBufferData.end(), padding, std::byte(0));
-        currentOffset = _outputBufferData.size();
-        _outputBufferData.insert(_outputBufferData.end(), data.begin(), data.end());
+        size_t currentOffset = _plannedBufferSize;
+        size_t padding = (alignment - (currentOffset % alignment)) % alignment;
+        currentOffset += padding;
+        _plannedBufferSize = currentOffset + byteLength;
 
         CesiumGltf::BufferView& bv = _outputGltf.bufferViews.emplace_back();
         bv.buffer = 0;
         bv.byteOffset = static_cast<int64_t>(currentOffset);
-        bv.byteLength = static_cast<int64_t>(data.size());
-        if (isVertexBuffer && byteStrideOptional > 0) {
-            bv.byteStride = byteStrideOptional;
-        }
+        bv.byteLength = static_cast<int64_t>(byteLength);
         return static_cast<int32_t>(_outputGltf.bufferViews.size() - 1);
     }
+
+    void GlbWriter::queueBufferGenerator(size_t destinationOffset, size_t byteLength, std::function<void(std::byte* destination)> generate) {
+        PendingBufferWrite& write = _pendingWrites.emplace_back();
+        write.destinationOffset = destinationOffset;
+        write.byteLength = byteLength;
+        write.generate = std::move(generate);
+    }
+
+    void GlbWriter::finalizeOutputBuffer() {
+        // One allocation for the whole buffer; padding between views stays zero.
+        _outputBufferData.assign(_plannedBufferSize, std::byte(0));
+        std::byte* bufferBase = _outputBufferData.data();
+        for (const PendingBufferWrite& write : _pendingWrites) {
+            if (write.generate) {
+                write.generate(bufferBase + write.destinationOffset);
+            } else if (write.sourceStride == write.elementSize || write.elementCount == 1) {
+                std::memcpy(bufferBase + write.destinationOffset, write.source, write.elementSize * write.elementCount);
+            } else {
+                gatherStridedElements(bufferBase + write.destinationOffset, write.source, write.sourceStride, write.elementSize, write.elementCount);
+            }
+        }
+        _pendingWrites.clear();
+        if (!_outputGltf.buffers.empty()) {
+            _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_outputBufferData.size());
+        }
+    }
+
+    bool GlbWriter::writeGlbStreamed(
+        const std::filesystem::path& outputPath,
+        const BoundingBox& bounds,
+        const std::vector<std::string>& elementNames) {
+        // Retained outputs are built in memory once; the whole buffer then streams as one write.
+        const bool retainModel = _options.retainOutputModels && _meshoptFallbackBuffer < 0;
+        if (retainModel) {
+            finalizeOutputBuffer();
+            if (!_outputBufferData.empty()) {
+                PendingBufferWrite& write = _pendingWrites.emplace_back();
+                write.byteLength = _outputBufferData.size();
+                write.source = _outputBufferData.data();
+                write.sourceStride = _outputBufferData.size();
+                write.elementSize = _outputBufferData.size();
+                write.elementCount = 1;
+            }
+        }
+
+        const bool hasBinChunk = !_outputGltf.buffers.empty() && _plannedBufferSize > 0;
+        if (!_outputGltf.buffers.empty()) {
+            _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_plannedBufferSize);
+        }
+
+        // JSON only: the BIN chunk is streamed below instead of being handed to writeGlb.
+        CesiumGltfWriter::GltfWriterOptions writerOptions;
+        CesiumGltfWriter::GltfWriterResult jsonResult = _gltfWriter.writeGltf(_outputGltf, writerOptions);
+        for (const auto& warn : jsonResult.warnings) logMessage("Writer Warning: " + warn);
+        if (jsonResult.gltfBytes.empty() || !jsonResult.errors.empty()) {
+            logError("Failed to serialize glTF JSON for: " + outputPath.string());
+            for (const auto& err : jsonResult.errors) logError("Writer Error: " + err);
+            return false;
+        }
+
+        const size_t jsonLength = jsonResult.gltfBytes.size();
+        const size_t jsonPadding = (4 - (jsonLength % 4)) % 4;
+        const size_t binLength = hasBinChunk ? _plannedBufferSize + (4 - (_plannedBufferSize % 4)) % 4 : 0;
+        const uint64_t totalLength = 12 + 8 + jsonLength + jsonPadding + (hasBinChunk ? 8 + binLength : 0);
+        if (totalLength > std::numeric_limits<uint32_t>::max()) {
+            logError("GLB would exceed the 4 GB format limit (" + std::to_string(totalLength) + " bytes): " + outputPath.string());
+            return false;
+        }
+
+        std::ofstream outFile(outputPath, std::ios::binary);
+        if (!outFile) {
+            logError("Failed to open file for writing: " + outputPath.string());
+            return false;
+        }
+        auto writeU32 = [&outFile](uint32_t value) {
+            outFile.write(reinterpret_cast<const char*>(&value), sizeof(value)); // GLB is little-endian
+        };
+        const char zeros[256] = {};
+        auto writeZeros = [&outFile, &zeros](size_t count) {
+            while (count > 0) {
+                size_t n = std::min(count, sizeof(zeros));
+                outFile.write(zeros, static_cast<std::streamsize>(n));
+                count -= n;
+            }
+        };
+
+        writeU32(0x46546C67); // "glTF"
+        writeU32(2);
+        writeU32(static_cast<uint32_t>(totalLength));
+        writeU32(static_cast<uint32_t>(jsonLength + jsonPadding));
+        writeU32(0x4E4F534A); // "JSON"
+        outFile.write(reinterpret_cast<const char*>(jsonResult.gltfBytes.data()), static_cast<std::streamsize>(jsonLength));
+        outFile.write("    ", static_cast<std::streamsize>(jsonPadding));
+        jsonResult.gltfBytes = std::vector<std::byte>();
+
+        if (hasBinChunk) {
+            writeU32(static_cast<uint32_t>(binLength));
+            writeU32(0x004E4942); // "BIN\0"
+
+            std::stable_sort(_pendingWrites.begin(), _pendingWrites.end(),
+                [](const PendingBufferWrite& a, const PendingBufferWrite& b) { return a.destinationOffset < b.destinationOffset; });
+
+            // Gathers and generators go through a bounded scratch buffer; packed sources are written in place.
+            const size_t gatherChunkBytes = size_t(4) << 20;
+            std::vector<std::byte> scratch;
+            size_t written = 0;
+            for (const PendingBufferWrite& write : _pendingWrites) {
+                if (write.destinationOffset < written) {
+                    logError("Overlapping buffer writes while streaming: " + outputPath.string());
+                    return false;
+                }
+                writeZeros(write.destinationOffset - written);
+                if (write.generate) {
+                    scratch.assign(write.byteLength, std::byte(0));
+                    write.generate(scratch.data());
+                    outFile.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(write.byteLength));
+                } else if (write.sourceStride == write.elementSize || write.elementCount == 1) {
+                    outFile.write(reinterpret_cast<const char*>(write.source), static_cast<std::streamsize>(write.byteLength));
+                } else {
+                    const size_t elementsPerChunk = std::max<size_t>(1, gatherChunkBytes / write.elementSize);
+                    scratch.resize(std::min(write.elementCount, elementsPerChunk) * write.elementSize);
+                    for (size_t first = 0; first < write.elementCount; first += elementsPerChunk) {
+                        const size_t n = std::min(elementsPerChunk, write.elementCount - first);
+                        gatherStridedElements(scratch.data(), write.source + first * write.sourceStride, write.sourceStride, write.elementSize, n);
+                        outFile.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(n * write.elementSize));
+                    }
+                }
+                written = write.destinationOffset + write.byteLength;
+            }
+            writeZeros(binLength - written);
+        }
+        _pendingWrites.clear();
+
+        outFile.close();
+        if (!outFile) {
+            logError("Failed to write GLB file: " + outputPath.string());
+            return false;
+        }
+        addBytesWritten(totalLength);
+
+        GlbOutputArtifact artifact;
+        artifact.path = outputPath;
+        artifact.bounds = bounds;
+        for (const CesiumGltf::Mesh& mesh : _outputGltf.meshes) {
+            artifact.meshNames.push_back(mesh.name);
+        }
+        artifact.meshNames.insert(artifact.meshNames.end(), elementNames.begin(), elementNames.end());
+        if (retainModel) {
+            LoadedGltfModel& loaded = artifact.model.emplace();
+            loaded.model = std::move(_outputGltf);
+            if (!loaded.model.buffers.empty()) {
+                loaded.model.buffers[0].cesium.data = std::move(_outputBufferData);
+            }
+            loaded.originalPath = outputPath;
+            loaded.uniqueId = 0; // As GlbReader numbers a file loaded on its own
+            resetInternalState();
+        }
+        _lastOutput = std::move(artifact);
+        return true;
+    }
     // --- End of existing GlbWriter constructor, reset, getOriginalModelById, addDataToBuffer ---
 
 
@@ -103,8 +398,19 @@ namespace GltfInstancing {
         auto key = std::make_pair(oldModelId, oldImageIndex);
         if (remapping.images.count(key)) { return remapping.images[key]; }
         if (oldImageIndex < 0 || static_cast<size_t>(oldImageIndex) >= oldModel.images.size()) { return -1; }
+        std::optional<ContentHash128> contentHash = remapping.hasherFor(oldModelId, oldModel).image(oldImageIndex);
+        if (contentHash) {
+            auto existing = remapping.imagesByContent.find(*contentHash);
+            if (existing != remapping.imagesByContent.end()) { // Same image already copied from another file
+                remapping.images[key] = existing->second;
+                return existing->second;
+            }
+        }
         const auto& oldImage = oldModel.images[oldImageIndex];
         CesiumGltf::Image newImage = oldImage;
+        // The encoded bytes (bufferView or URI) are passed through as they are; decoded pixels
+        // are never written, so they are not copied into the output model.
+        newImage.cesium = CesiumGltf::ImageCesium();
         if (newImage.bufferView >= 0) {
             newImage.bufferView = copyBufferView(oldModel, oldImage.bufferView, oldModelId, remapping);
             if (newImage.bufferView < 0) return -1;
@@ -121,6 +427,7 @@ namespace GltfInstancing {
         _outputGltf.images.push_back(std::move(newImage));
         int32_t newIndex = static_cast<int32_t>(_outputGltf.images.size() - 1);
         remapping.images[key] = newIndex;
+        if (contentHash) remapping.imagesByContent.emplace(*contentHash, newIndex);
         return newIndex;
     }
 
@@ -128,9 +435,18 @@ namespace GltfInstancing {
         auto key = std::make_pair(oldModelId, oldSamplerIndex);
         if (remapping.samplers.count(key)) { return remapping.samplers[key]; }
         if (oldSamplerIndex < 0 || static_cast<size_t>(oldSamplerIndex) >= oldModel.samplers.size()) { return -1; }
+        std::optional<ContentHash128> contentHash = remapping.hasherFor(oldModelId, oldModel).sampler(oldSamplerIndex);
+        if (contentHash) {
+            auto existing = remapping.samplersByContent.find(*contentHash);
+            if (existing != remapping.samplersByContent.end()) {
+                remapping.samplers[key] = existing->second;
+                return existing->second;
+            }
+        }
         _outputGltf.samplers.push_back(oldModel.samplers[oldSamplerIndex]);
         int32_t newIndex = static_cast<int32_t>(_outputGltf.samplers.size() - 1);
         remapping.samplers[key] = newIndex;
+        if (contentHash) remapping.samplersByContent.emplace(*contentHash, newIndex);
         return newIndex;
     }
 
@@ -138,6 +454,14 @@ namespace GltfInstancing {
         auto key = std::make_pair(oldModelId, oldTextureIndex);
         if (remapping.textures.count(key)) { return remapping.textures[key]; }
         if (oldTextureIndex < 0 || static_cast<size_t>(oldTextureIndex) >= oldModel.textures.size()) { return -1; }
+        std::optional<ContentHash128> contentHash = remapping.hasherFor(oldModelId, oldModel).texture(oldTextureIndex);
+        if (contentHash) {
+            auto existing = remapping.texturesByContent.find(*contentHash);
+            if (existing != remapping.texturesByContent.end()) {
+                remapping.textures[key] = existing->second;
+                return existing->second;
+            }
+        }
         const auto& oldTexture = oldModel.textures[oldTextureIndex];
         CesiumGltf::Texture newTexture = oldTexture;
         if (oldTexture.sampler >= 0) { newTexture.sampler = copySampler(oldModel, oldTexture.sampler, oldModelId, remapping); }
@@ -148,6 +472,7 @@ namespace GltfInstancing {
         _outputGltf.textures.push_back(std::move(newTexture));
         int32_t newIndex = static_cast<int32_t>(_outputGltf.textures.size() - 1);
         remapping.textures[key] = newIndex;
+        if (contentHash) remapping.texturesByContent.emplace(*contentHash, newIndex);
         return newIndex;
     }
 
@@ -164,6 +489,14 @@ namespace GltfInstancing {
         if (oldMaterialIndex < 0 || static_cast<size_t>(oldMaterialIndex) >= oldModel.materials.size()) {
             return -1;
         }
+        std::optional<ContentHash128> contentHash = remapping.hasherFor(oldModelId, oldModel).material(oldMaterialIndex);
+        if (contentHash) {
+            auto existing = remapping.materialsByContent.find(*contentHash);
+            if (existing != remapping.materialsByContent.end()) { // Identical material from another file
+                remapping.materials[key] = existing->second;
+                return existing->second;
+            }
+        }
 
         const auto& oldMaterial = oldModel.materials[oldMaterialIndex];
         CesiumGltf::Material newMaterial = oldMaterial;
@@ -292,6 +625,7 @@ namespace GltfInstancing {
         _outputGltf.materials.push_back(std::move(newMaterial));
         int32_t newIndex = static_cast<int32_t>(_outputGltf.materials.size() - 1);
         remapping.materials[key] = newIndex;
+        if (contentHash) remapping.materialsByContent.emplace(*contentHash, newIndex);
         return newIndex;
     }
 
@@ -312,6 +646,15 @@ int32_t GlbWriter::copyBufferView(
         return -1;
     }
 
+    std::optional<ContentHash128> contentHash = remapping.hasherFor(oldModelId, oldModel).bufferView(oldBufferViewIndex);
+    if (contentHash) {
+        auto existing = remapping.bufferViewsByContent.find(*contentHash);
+        if (existing != remapping.bufferViewsByContent.end()) {
+            remapping.bufferViews[key] = existing->second;
+            return existing->second;
+        }
+    }
+
     const auto& oldBufferView = oldModel.bufferViews[oldBufferViewIndex];
     if (oldBufferView.buffer < 0 || static_cast<size_t>(oldBufferView.buffer) >= oldModel.buffers.size()) {
         logError("Invalid buffer index in oldBufferView " + std::to_string(oldBufferViewIndex) + ": " + std::to_string(oldBufferView.buffer));
@@ -319,7 +662,6 @@ int32_t GlbWriter::copyBufferView(
     }
 
     const auto& oldBuffer = oldModel.buffers[oldBufferView.buffer];
-    gsl::span<const std::byte> oldDataSpan;
 
     //int64_t bvByteLength = oldBufferView.byteLength.value_or(0);
     int64_t bvByteLength = oldBufferView.byteLength;
@@ -332,10 +674,6 @@ int32_t GlbWriter::copyBufferView(
             logError(oss_bv_err.str());
             return -1;
         }
-        oldDataSpan = gsl::span<const std::byte>(
-            oldBuffer.cesium.data.data() + oldBufferView.byteOffset,
-            static_cast<size_t>(bvByteLength)
-        );
     } else if (oldBuffer.uri && !oldBuffer.uri->empty()) {
         std::ostringstream oss_bv_uri_err;
         //oss_bv_uri_err << "BufferView " << oldBufferViewIndex << " references unhandled URI: " << oldBuffer.uri;
@@ -349,8 +687,9 @@ int32_t GlbWriter::copyBufferView(
         return -1;
     }
 
-    int32_t strideForAddData = static_cast<int32_t>(oldBufferView.byteStride.value_or(0));
-    int32_t newBufferViewIndex = addDataToBuffer(oldDataSpan, strideForAddData, false); // 不是顶点属性
+    // 不是顶点属性: the view is copied as one block, without byteStride
+    int32_t newBufferViewIndex = addSourceDataToBuffer(oldModel, oldModelId, oldBufferView.buffer,
+        static_cast<size_t>(oldBufferView.byteOffset), static_cast<size_t>(bvByteLength), static_cast<size_t>(bvByteLength), bvByteLength > 0 ? 1 : 0);
     if (newBufferViewIndex < 0) {
         return -1;
     }
@@ -366,10 +705,15 @@ int32_t GlbWriter::copyBufferView(
         }
     }
     remapping.bufferViews[key] = newBufferViewIndex;
+    if (contentHash) remapping.bufferViewsByContent.emplace(*contentHash, newBufferViewIndex);
     return newBufferViewIndex;
 }
 
 int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAccessorIndex, int oldModelId, ResourceRemapping& remapping, bool skipBufferViewRemap) {
+    return copyAccessor(oldModel, oldAccessorIndex, oldModelId, remapping, skipBufferViewRemap, false);
+}
+
+int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAccessorIndex, int oldModelId, ResourceRemapping& remapping, bool skipBufferViewRemap, bool isIndicesAccessor) {
     auto key = std::make_pair(oldModelId, oldAccessorIndex);
     if (remapping.accessors.count(key)) { return remapping.accessors[key]; }
     if (oldAccessorIndex < 0 || static_cast<size_t>(oldAccessorIndex) >= oldModel.accessors.size()) {
@@ -378,6 +722,27 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
     }
 
     const auto& oldAccessor = oldModel.accessors[oldAccessorIndex];
+
+    // Identical data with identical metadata (and role, since index and vertex views get different
+    // targets) is stored once. Sparse accessors are always copied.
+    std::optional<ContentHash128> contentHash;
+    if (!skipBufferViewRemap && !oldAccessor.sparse && oldAccessor.bufferView >= 0) {
+        contentHash = hashAccessorContent128(oldModel, oldAccessor, isIndicesAccessor ? 1 : 0);
+        if (contentHash) {
+            ContentHasher128 keyHasher;
+            keyHasher.updateValue(*contentHash);
+            keyHasher.updateValue(static_cast<uint64_t>(oldAccessor.min.size()));
+            keyHasher.update(oldAccessor.min.data(), oldAccessor.min.size() * sizeof(double));
+            keyHasher.updateValue(static_cast<uint64_t>(oldAccessor.max.size()));
+            keyHasher.update(oldAccessor.max.data(), oldAccessor.max.size() * sizeof(double));
+            contentHash = keyHasher.finalize();
+            auto existing = remapping.accessorsByContent.find(*contentHash);
+            if (existing != remapping.accessorsByContent.end()) {
+                remapping.accessors[key] = existing->second;
+                return existing->second;
+            }
+        }
+    }
     CesiumGltf::Accessor newAccessor = oldAccessor; // Copy metadata
 
     if (!skipBufferViewRemap) {
@@ -415,60 +780,26 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
                 return -1;
             }
 
-            // If the accessor is interleaved, AccessorView is still the best way to get de-interleaved data.
-            // However, our goal here is to copy the raw *referenced* data segment.
-            // For non-interleaved data (bufferView.byteStride is 0 or elementByteLength), we can directly copy.
-            // For interleaved data, we MUST use AccessorView to read element by element.
-            // Let's reconsider. The `AccessorView<std::byte>` was an attempt to get a view of the raw bytes
-            // *as defined by the accessor*, which means it should handle stride correctly.
-            // The issue was `sizeof(T)` check.
-
-            // Correct approach for copying raw data using AccessorView by iterating:
-            // This will correctly handle strides and de-interleave data if necessary.
-            std::vector<std::byte> accessorDataBytes;
-            accessorDataBytes.reserve(static_cast<size_t>(totalAccessorByteLength));
-
-            // We need to pick a T for AccessorView that matches the component type and size.
-            // This is getting complicated. Let's simplify: copy the raw segment from BufferView.
-            // This assumes AccessorView is NOT strictly needed if we just want the bytes
-            // that the accessor *could* point to within its buffer view segment.
-            // This is only correct if there's no interleaving (i.e., accessor.byteStride == elementSize).
-            // If there IS interleaving, we must read element-by-element.
-
-            // Let's go back to using AccessorView<std::byte> but understand its limitations.
-            // The status check is key. Why is it failing?
-            // The `create` function in AccessorView.h has:
-            // `if (sizeof(T) != accessorBytesPerStride)`
-            // For `AccessorView<std::byte>`, `sizeof(T)` is 1.
-            // `accessorBytesPerStride` is `accessorComponentElements * accessorComponentBytes`.
-            // So, this will only be `Valid` if `accessorComponentElements * accessorComponentBytes == 1`.
-            // This means it only works for SCALAR of BYTE/UNSIGNED_BYTE. This is too restrictive.
-
-            // *** Revised strategy for copyAccessor's data copying: ***
-            // We need to get the raw bytes that this accessor's data occupies.
-            // If the data is interleaved (bufferView.byteStride > elementSize), we must
-            // read it element by element and pack it.
-            // If it's not interleaved, we can copy a contiguous block.
-
-            const CesiumGltf::BufferView& bufferView = *pOldBv; // We know pOldBv is valid
+            // Tightly packed data is copied with one memcpy, interleaved data is gathered
+            // element by element; both happen in finalizeOutputBuffer() straight from the source buffer.
             const std::vector<std::byte>& bufferData = pOldBuffer->cesium.data;
-
             int64_t actualStride = oldAccessor.computeByteStride(oldModel); // This considers bufferView.byteStride
-            std::vector<std::byte> collectedBytes;
-            collectedBytes.reserve(static_cast<size_t>(totalAccessorByteLength));
-
-            for (int64_t i = 0; i < oldAccessor.count; ++i) {
-                const std::byte* pElementStart = bufferData.data() + bufferView.byteOffset + oldAccessor.byteOffset + i * actualStride;
-                // Boundary check for each element read
-                if (pElementStart < bufferData.data() || (pElementStart + elementByteLength) >(bufferData.data() + bufferData.size())) {
-                    logError("copyAccessor: Element " + std::to_string(i) + " of accessor " + std::to_string(oldAccessorIndex) + " is out of buffer bounds.");
+            if (oldAccessor.count > 0) {
+                int64_t lastElementEnd = accessorStartOffsetInBuffer + (oldAccessor.count - 1) * actualStride + elementByteLength;
+                if (actualStride < elementByteLength || lastElementEnd > static_cast<int64_t>(bufferData.size())) {
+                    logError("copyAccessor: Strided data of accessor " + std::to_string(oldAccessorIndex) + " is out of buffer bounds.");
                     return -1;
                 }
-                collectedBytes.insert(collectedBytes.end(), pElementStart, pElementStart + elementByteLength);
             }
 
-            gsl::span<const std::byte> data_to_copy(collectedBytes.data(), collectedBytes.size());
-            int32_t newBufferViewIdx = addDataToBuffer(data_to_copy, static_cast<int32_t>(elementByteLength), false); // 不是顶点属性
+            int32_t newBufferViewIdx = addSourceDataToBuffer(
+                oldModel,
+                oldModelId,
+                pOldBv->buffer,
+                static_cast<size_t>(accessorStartOffsetInBuffer),
+                static_cast<size_t>(actualStride),
+                static_cast<size_t>(elementByteLength),
+                static_cast<size_t>(oldAccessor.count));
 
             if (newBufferViewIdx < 0) return -1;
             newAccessor.bufferView = newBufferViewIdx;
@@ -488,6 +819,7 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
 
     int32_t newIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
     remapping.accessors[key] = newIndex;
+    if (contentHash) remapping.accessorsByContent.emplace(*contentHash, newIndex);
     return newIndex;
 }
     // ... (copyMeshDefinition should be mostly fine if copyAccessor is fixed) ...
@@ -496,8 +828,26 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         const CesiumGltf::Model& originalModel,
         int32_t originalMeshIndex,
         int originalModelId,
-        ResourceRemapping& remapping) {
+        ResourceRemapping& remapping,
+        bool allowPositionQuantization) {
         if (originalMeshIndex < 0 || static_cast<size_t>(originalMeshIndex) >= originalModel.meshes.size()) { return -1; }
+        const SimplifiedMesh* simplified = findSimplifiedMesh(originalModelId, originalMeshIndex);
+        if (_options.optimizeMeshes || (!simplified && _options.compression.enabled())) {
+            std::optional<SimplifiedMesh> rewritten = simplified
+                ? std::optional<SimplifiedMesh>(*simplified)
+                : unpackTriangleMesh(originalModel, originalModel.meshes[originalMeshIndex]);
+            if (rewritten) {
+                for (SimplifiedPrimitive& primitive : rewritten->primitives) {
+                    if (_options.optimizeMeshes) {
+                        optimizePrimitive(primitive);
+                    }
+                }
+                simplified = &_rewrittenMeshes.emplace_back(std::move(*rewritten));
+            }
+        }
+        if (simplified) {
+            return copySimplifiedMesh(originalModel, originalMeshIndex, originalModelId, *simplified, remapping, allowPositionQuantization);
+        }
         const auto& oldMesh = originalModel.meshes[originalMeshIndex];
         CesiumGltf::Mesh newMesh;
         newMesh.name = oldMesh.name;
@@ -512,7 +862,7 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             else { newPrimitive.material = -1; }
 
             if (oldPrimitive.indices >= 0) {
-                newPrimitive.indices = copyAccessor(originalModel, oldPrimitive.indices, originalModelId, remapping);
+                newPrimitive.indices = copyAccessor(originalModel, oldPrimitive.indices, originalModelId, remapping, false, true);
                 if (newPrimitive.indices < 0) return -1;
                 const auto& idxAccessor = _outputGltf.accessors[newPrimitive.indices];
                 if (idxAccessor.bufferView >= 0 && static_cast<size_t>(idxAccessor.bufferView) < _outputGltf.bufferViews.size()) {
@@ -548,73 +898,252 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         return static_cast<int32_t>(_outputGltf.meshes.size() - 1);
     }
 
+    const SimplifiedMesh* GlbWriter::findSimplifiedMesh(int modelId, int32_t meshIndex) const {
+        if (!_meshLods) {
+            return nullptr;
+        }
+        auto it = _meshLods->find({ modelId, meshIndex });
+        return it != _meshLods->end() ? &it->second : nullptr;
+    }
+
+    int32_t GlbWriter::copySimplifiedMesh(
+        const CesiumGltf::Model& originalModel,
+        int32_t originalMeshIndex,
+        int originalModelId,
+        const SimplifiedMesh& simplified,
+        ResourceRemapping& remapping,
+        bool allowPositionQuantization) {
+        const auto& oldMesh = originalModel.meshes[originalMeshIndex];
+        if (simplified.primitives.empty()) {
+            logDebug("Mesh '" + oldMesh.name + "' collapsed at this level of detail; leaving it out.");
+            return -1;
+        }
+        CesiumGltf::Mesh newMesh;
+        newMesh.name = oldMesh.name;
+
+        // One position grid for the whole mesh, since all its primitives share the node.
+        const GeometryCompressionOptions& compression = _options.compression;
+        std::optional<PositionQuantization> positionQuantization;
+        if (allowPositionQuantization && compression.positionBits > 0) {
+            BoundingBox meshBounds;
+            for (const SimplifiedPrimitive& simplifiedPrimitive : simplified.primitives) {
+                const SimplifiedAttribute* position = simplifiedPrimitive.findAttribute("POSITION");
+                const float* values = position ? reinterpret_cast<const float*>(position->data.data()) : nullptr;
+                for (size_t i = 0; values && i < simplifiedPrimitive.vertexCount; ++i) {
+                    const glm::dvec3 point(values[i * 3], values[i * 3 + 1], values[i * 3 + 2]);
+                    meshBounds.min = glm::min(meshBounds.min, point);
+                    meshBounds.max = glm::max(meshBounds.max, point);
+                }
+            }
+            if (meshBounds.isValid()) {
+                positionQuantization = computePositionQuantization(meshBounds, compression.positionBits);
+            }
+        }
+
+        for (const SimplifiedPrimitive& simplifiedPrimitive : simplified.primitives) {
+            if (simplifiedPrimitive.sourcePrimitiveIndex >= oldMesh.primitives.size()) { return -1; }
+            const auto& oldPrimitive = oldMesh.primitives[simplifiedPrimitive.sourcePrimitiveIndex];
+            CesiumGltf::MeshPrimitive newPrimitive;
+            newPrimitive.mode = CesiumGltf::MeshPrimitive::Mode::TRIANGLES;
+            if (oldPrimitive.material >= 0) {
+                newPrimitive.material = copyMaterial(originalModel, oldPrimitive.material, originalModelId, remapping);
+                if (newPrimitive.material < 0) { return -1; }
+            }
+
+            newPrimitive.indices = addTriangleIndexAccessor(std::vector<uint32_t>(simplifiedPrimitive.indices), simplifiedPrimitive.vertexCount);
+            if (newPrimitive.indices < 0) { return -1; }
+
+            for (const auto& [name, attribute] : simplifiedPrimitive.attributes) {
+                const size_t vertexCount = simplifiedPrimitive.vertexCount;
+                std::optional<QuantizedAttribute> quantized;
+                if (attribute.componentType == CesiumGltf::Accessor::ComponentType::FLOAT) {
+                    const float* values = reinterpret_cast<const float*>(attribute.data.data());
+                    if (name == "POSITION" && positionQuantization) {
+                        quantized = quantizePositions(values, vertexCount, *positionQuantization);
+                    } else if (name == "NORMAL" && compression.normalBits > 0 && attribute.type == CesiumGltf::Accessor::Type::VEC3) {
+                        quantized = quantizeNormals(values, vertexCount, compression.normalBits);
+                    } else if (name.rfind("TEXCOORD_", 0) == 0 && compression.texCoordBits > 0 && attribute.type == CesiumGltf::Accessor::Type::VEC2) {
+                        quantized = quantizeTexCoords(values, vertexCount, compression.texCoordBits);
+                    }
+                }
+                if (quantized) {
+                    int32_t accessorIndex = addQuantizedAccessor(std::move(*quantized), attribute.type, vertexCount);
+                    if (accessorIndex < 0) { return -1; }
+                    newPrimitive.attributes[name] = accessorIndex;
+                    continue;
+                }
+                if (compression.meshoptCompression && vertexCount > 0) {
+                    int32_t accessorIndex = addVertexAccessor(std::vector<std::byte>(attribute.data), attribute.data.size() / vertexCount,
+                        attribute.componentType, attribute.type, attribute.normalized, vertexCount);
+                    if (accessorIndex < 0) { return -1; }
+                    if (name == "POSITION") {
+                        setFloatPositionBounds(_outputGltf.accessors[accessorIndex], attribute, vertexCount);
+                    }
+                    newPrimitive.attributes[name] = accessorIndex;
+                    continue;
+                }
+
+                // The attribute data lives in _meshLods or _rewrittenMeshes, which outlive the write.
+                int32_t bufferViewIndex = addDataToBuffer(gsl::span<const std::byte>(attribute.data), 0, true);
+                if (bufferViewIndex < 0) { return -1; }
+                _outputGltf.bufferViews[bufferViewIndex].target = CesiumGltf::BufferView::Target::ARRAY_BUFFER;
+                CesiumGltf::Accessor& accessor = _outputGltf.accessors.emplace_back();
+                accessor.bufferView = bufferViewIndex;
+                accessor.componentType = attribute.componentType;
+                accessor.type = attribute.type;
+                accessor.normalized = attribute.normalized;
+                accessor.count = static_cast<int64_t>(simplifiedPrimitive.vertexCount);
+                if (name == "POSITION") {
+                    setFloatPositionBounds(accessor, attribute, vertexCount);
+                }
+                newPrimitive.attributes[name] = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+            }
+            newMesh.primitives.push_back(std::move(newPrimitive));
+        }
+        _outputGltf.meshes.push_back(std::move(newMesh));
+        const int32_t newMeshIndex = static_cast<int32_t>(_outputGltf.meshes.size() - 1);
+        if (positionQuantization) {
+            _meshDequantization[newMeshIndex] = positionQuantization->dequantizationMatrix();
+        }
+        return newMeshIndex;
+    }
+
 
     void GlbWriter::createInstanceTRS_Accessors(
         const std::vector<MeshInstanceInfo>& instances,
+        const glm::dvec3& translationOrigin,
         int32_t& translationAccessorIndex,
         int32_t& rotationAccessorIndex,
         int32_t& scaleAccessorIndex) {
-        std::vector<float> translationData;
-        std::vector<float> rotationData;
-        std::vector<float> scaleData;
-
-        translationData.reserve(instances.size() * 3);
-        rotationData.reserve(instances.size() * 4);
-        scaleData.reserve(instances.size() * 3);
-
-        for (const auto& instance : instances) {
-            translationData.push_back(static_cast<float>(instance.transform.translation.x));
-            translationData.push_back(static_cast<float>(instance.transform.translation.y));
-            translationData.push_back(static_cast<float>(instance.transform.translation.z));
-
-            rotationData.push_back(static_cast<float>(instance.transform.rotation.x));
-            rotationData.push_back(static_cast<float>(instance.transform.rotation.y));
-            rotationData.push_back(static_cast<float>(instance.transform.rotation.z));
-            rotationData.push_back(static_cast<float>(instance.transform.rotation.w));
+        translationAccessorIndex = -1; rotationAccessorIndex = -1; scaleAccessorIndex = -1;
+        if (instances.empty()) {
+            return;
+        }
 
-            scaleData.push_back(static_cast<float>(instance.transform.scale.x));
-            scaleData.push_back(static_cast<float>(instance.transform.scale.y));
-            scaleData.push_back(static_cast<float>(instance.transform.scale.z));
+        const size_t count = instances.size();
+        int32_t transBvIdx = reserveBufferView(count * 3 * sizeof(float));
+        if (transBvIdx < 0) {
+            return;
         }
+        const size_t translationOffset = static_cast<size_t>(_outputGltf.bufferViews[transBvIdx].byteOffset);
+
+        int32_t rotBvIdx = -1;
+        int32_t scaleBvIdx = -1;
+        bool writeScale = true;
+        if (!_options.compactInstanceAttributes) {
+            rotBvIdx = reserveBufferView(count * 4 * sizeof(float));
+            scaleBvIdx = reserveBufferView(count * 3 * sizeof(float));
+            if (rotBvIdx < 0 || scaleBvIdx < 0) {
+                return;
+            }
+            const size_t rotationOffset = static_cast<size_t>(_outputGltf.bufferViews[rotBvIdx].byteOffset);
+            const size_t scaleOffset = static_cast<size_t>(_outputGltf.bufferViews[scaleBvIdx].byteOffset);
+            // Decompose every instance matrix straight into the reserved regions once the buffer
+            // exists. instances belongs to the detection result (or _dequantizedInstances), which outlives the write.
+            // The three views are contiguous (their lengths are multiples of 4), so one generator fills them.
+            const MeshInstanceInfo* firstInstance = instances.data();
+            const size_t regionLength = scaleOffset + count * 3 * sizeof(float) - translationOffset;
+            queueBufferGenerator(translationOffset, regionLength, [=](std::byte* destination) {
+                decomposeTransformsBatch(&firstInstance->worldMatrix, sizeof(MeshInstanceInfo), count,
+                    reinterpret_cast<float*>(destination),
+                    reinterpret_cast<float*>(destination + (rotationOffset - translationOffset)),
+                    reinterpret_cast<float*>(destination + (scaleOffset - translationOffset)),
+                    translationOrigin);
+            });
+        } else {
+            std::vector<float> translationData(count * 3);
+            std::vector<float> rotationData(count * 4);
+            std::vector<float> scaleData(count * 3);
+            decomposeTransformsBatch(&instances[0].worldMatrix, sizeof(MeshInstanceInfo), count,
+                translationData.data(), rotationData.data(), scaleData.data(), translationOrigin);
+
+            // Normalized SHORT rotation: c = round(value * 32767). EXT_mesh_gpu_instancing allows
+            // this component type itself, so no KHR_mesh_quantization is declared for it.
+            std::vector<int16_t> rotationShorts(rotationData.size());
+            for (size_t i = 0; i < rotationData.size(); ++i) {
+                float clamped = std::max(-1.0f, std::min(1.0f, rotationData[i]));
+                rotationShorts[i] = static_cast<int16_t>(std::lround(clamped * 32767.0f));
+            }
+            rotBvIdx = reserveBufferView(rotationShorts.size() * sizeof(int16_t));
+            if (rotBvIdx < 0) {
+                return;
+            }
+            const size_t rotationOffset = static_cast<size_t>(_outputGltf.bufferViews[rotBvIdx].byteOffset);
+
+            const float unitScaleEpsilon = 1e-6f;
+            writeScale = std::any_of(scaleData.begin(), scaleData.end(),
+                [&](float value) { return std::abs(value - 1.0f) > unitScaleEpsilon; });
+            size_t scaleOffset = 0;
+            if (writeScale) {
+                scaleBvIdx = reserveBufferView(scaleData.size() * sizeof(float));
+                if (scaleBvIdx < 0) {
+                    return;
+                }
+                scaleOffset = static_cast<size_t>(_outputGltf.bufferViews[scaleBvIdx].byteOffset);
+            }
 
-        translationAccessorIndex = -1; rotationAccessorIndex = -1; scaleAccessorIndex = -1;
+            queueBufferGenerator(translationOffset, translationData.size() * sizeof(float),
+                [translationData = std::move(translationData)](std::byte* destination) {
+                    std::memcpy(destination, translationData.data(), translationData.size() * sizeof(float));
+                });
+            queueBufferGenerator(rotationOffset, rotationShorts.size() * sizeof(int16_t),
+                [rotationShorts = std::move(rotationShorts)](std::byte* destination) {
+                    std::memcpy(destination, rotationShorts.data(), rotationShorts.size() * sizeof(int16_t));
+                });
+            if (writeScale) {
+                queueBufferGenerator(scaleOffset, scaleData.size() * sizeof(float),
+                    [scaleData = std::move(scaleData)](std::byte* destination) {
+                        std::memcpy(destination, scaleData.data(), scaleData.size() * sizeof(float));
+                    });
+            }
+        }
 
-        if (!translationData.empty()) {
-            gsl::span<const std::byte> trans_span(reinterpret_cast<const std::byte*>(translationData.data()), translationData.size() * sizeof(float));
-            int32_t transBvIdx = addDataToBuffer(trans_span, 0, false);
-            CesiumGltf::Accessor& transAcc = _outputGltf.accessors.emplace_back();
-            transAcc.bufferView = transBvIdx;
-            transAcc.componentType = CesiumGltf::Accessor::ComponentType::FLOAT;
-            transAcc.type = CesiumGltf::Accessor::Type::VEC3;
-            transAcc.count = static_cast<int64_t>(instances.size());
-            translationAccessorIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
-        }
-        if (!rotationData.empty()) {
-            gsl::span<const std::byte> rot_span(reinterpret_cast<const std::byte*>(rotationData.data()), rotationData.size() * sizeof(float));
-            int32_t rotBvIdx = addDataToBuffer(rot_span, 0, false);
-            CesiumGltf::Accessor& rotAcc = _outputGltf.accessors.emplace_back();
-            rotAcc.bufferView = rotBvIdx;
+        CesiumGltf::Accessor& transAcc = _outputGltf.accessors.emplace_back();
+        transAcc.bufferView = transBvIdx;
+        transAcc.componentType = CesiumGltf::Accessor::ComponentType::FLOAT;
+        transAcc.type = CesiumGltf::Accessor::Type::VEC3;
+        transAcc.count = static_cast<int64_t>(count);
+        translationAccessorIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+
+        CesiumGltf::Accessor& rotAcc = _outputGltf.accessors.emplace_back();
+        rotAcc.bufferView = rotBvIdx;
+        rotAcc.type = CesiumGltf::Accessor::Type::VEC4;
+        if (_options.compactInstanceAttributes) {
+            rotAcc.componentType = CesiumGltf::Accessor::ComponentType::SHORT;
+            rotAcc.normalized = true;
+        } else {
             rotAcc.componentType = CesiumGltf::Accessor::ComponentType::FLOAT;
-            rotAcc.type = CesiumGltf::Accessor::Type::VEC4;
-            rotAcc.count = static_cast<int64_t>(instances.size());
-            rotationAccessorIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
         }
-        if (!scaleData.empty()) {
-            gsl::span<const std::byte> scale_span(reinterpret_cast<const std::byte*>(scaleData.data()), scaleData.size() * sizeof(float));
-            int32_t scaleBvIdx = addDataToBuffer(scale_span, 0, false);
+        rotAcc.count = static_cast<int64_t>(count);
+        rotationAccessorIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+
+        if (writeScale) {
             CesiumGltf::Accessor& scaleAcc = _outputGltf.accessors.emplace_back();
             scaleAcc.bufferView = scaleBvIdx;
             scaleAcc.componentType = CesiumGltf::Accessor::ComponentType::FLOAT;
             scaleAcc.type = CesiumGltf::Accessor::Type::VEC3;
-            scaleAcc.count = static_cast<int64_t>(instances.size());
+            scaleAcc.count = static_cast<int64_t>(count);
             scaleAccessorIndex = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
         }
     }
 
     int32_t GlbWriter::createInstancedNode(
         int32_t meshIndexInOutputGltf,
-        const std::vector<MeshInstanceInfo>& instances,
+        const std::vector<MeshInstanceInfo>& groupInstances,
         const std::string& representativeMeshName) {
+        // Quantized positions: instance transforms are applied after the vertices are
+        // dequantized, so the dequantization is baked into copies of the instance matrices
+        // (kept until the GLB is written, as createInstanceTRS_Accessors reads them late).
+        auto dequantization = _meshDequantization.find(meshIndexInOutputGltf);
+        const std::vector<MeshInstanceInfo>* placedInstances = &groupInstances;
+        if (dequantization != _meshDequantization.end()) {
+            std::vector<MeshInstanceInfo>& adjusted = _dequantizedInstances.emplace_back(groupInstances);
+            for (MeshInstanceInfo& instance : adjusted) {
+                instance.worldMatrix = instance.worldMatrix * dequantization->second;
+            }
+            placedInstances = &adjusted;
+        }
+        const std::vector<MeshInstanceInfo>& instances = *placedInstances;
         CesiumGltf::Node newNode;
         newNode.mesh = meshIndexInOutputGltf;
         if (!representativeMeshName.empty()) {
@@ -623,8 +1152,19 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             newNode.name = "instanced_node_mesh_" + std::to_string(meshIndexInOutputGltf);
         }
 
+        // Compact mode: instance translations become offsets from the group centre (RTC origin),
+        // which is applied once on the node.
+        glm::dvec3 groupCenter(0.0);
+        if (_options.compactInstanceAttributes && !instances.empty()) {
+            for (const auto& instance : instances) {
+                groupCenter += glm::dvec3(instance.worldMatrix[3]);
+            }
+            groupCenter /= static_cast<double>(instances.size());
+            newNode.translation = { groupCenter.x, groupCenter.y, groupCenter.z };
+        }
+
         int32_t transAccIdx = -1, rotAccIdx = -1, scaleAccIdx = -1;
-        createInstanceTRS_Accessors(instances, transAccIdx, rotAccIdx, scaleAccIdx);
+        createInstanceTRS_Accessors(instances, groupCenter, transAccIdx, rotAccIdx, scaleAccIdx);
 
         if (transAccIdx != -1 || rotAccIdx != -1 || scaleAccIdx != -1) {
             CesiumGltf::ExtensionExtMeshGpuInstancing instancingExtensionData; 
@@ -654,10 +1194,84 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         return static_cast<int32_t>(_outputGltf.nodes.size() - 1);
     }
 
+    void GlbWriter::addInstanceFeatures(
+        const std::vector<LoadedGltfModel>& originalModels,
+        int32_t nodeIndex,
+        const std::vector<MeshInstanceInfo>& instances,
+        std::vector<std::string>& elementNames) {
+        if (!_options.elementIds || _modelSource || instances.empty()) {
+            return;
+        }
+        if (elementNames.size() + instances.size() > MeshBatcher::kMaxFeatureCount) {
+            logWarning("Element table is full; instances of node " + std::to_string(nodeIndex) + " get no feature IDs.");
+            return;
+        }
+
+        // Model IDs are assigned in load order, so originalModels[id] is model id unless loading skipped files.
+        auto sourceMeshName = [&](const MeshInstanceInfo& instance) -> std::string {
+            const LoadedGltfModel* sourceModel = nullptr;
+            if (instance.originalGltfIndex >= 0 && static_cast<size_t>(instance.originalGltfIndex) < originalModels.size() &&
+                originalModels[static_cast<size_t>(instance.originalGltfIndex)].uniqueId == instance.originalGltfIndex) {
+                sourceModel = &originalModels[static_cast<size_t>(instance.originalGltfIndex)];
+            } else {
+                for (const auto& loadedModel : originalModels) {
+                    if (loadedModel.uniqueId == instance.originalGltfIndex) {
+                        sourceModel = &loadedModel;
+                        break;
+                    }
+                }
+            }
+            const CesiumGltf::Mesh* mesh = sourceModel ? CesiumGltf::Model::getSafe(&sourceModel->model.meshes, instance.originalMeshIndex) : nullptr;
+            return mesh ? mesh->name : std::string();
+        };
+
+        const size_t count = instances.size();
+        std::vector<float> featureIds(count);
+        for (size_t i = 0; i < count; ++i) {
+            featureIds[i] = static_cast<float>(elementNames.size());
+            elementNames.push_back(sourceMeshName(instances[i]));
+        }
+        int32_t featureIdView = reserveBufferView(count * sizeof(float));
+        if (featureIdView < 0) {
+            return;
+        }
+        queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[featureIdView].byteOffset), count * sizeof(float),
+            [featureIds = std::move(featureIds)](std::byte* destination) {
+                std::memcpy(destination, featureIds.data(), featureIds.size() * sizeof(float));
+            });
+        CesiumGltf::Accessor& featureIdAccessor = _outputGltf.accessors.emplace_back();
+        featureIdAccessor.bufferView = featureIdView;
+        featureIdAccessor.componentType = CesiumGltf::Accessor::ComponentType::FLOAT;
+        featureIdAccessor.type = CesiumGltf::Accessor::Type::SCALAR;
+        featureIdAccessor.count = static_cast<int64_t>(count);
+
+        CesiumGltf::Node& node = _outputGltf.nodes[static_cast<size_t>(nodeIndex)];
+        auto* instancing = node.getExtension<CesiumGltf::ExtensionExtMeshGpuInstancing>();
+        if (!instancing) {
+            return;
+        }
+        instancing->attributes["_FEATURE_ID_0"] = static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+
+        // Feature IDs are rows of the element table (property table 0).
+        CesiumGltf::ExtensionExtInstanceFeatures instanceFeatures;
+        CesiumGltf::ExtensionExtInstanceFeaturesFeatureId& featureIdSet = instanceFeatures.featureIds.emplace_back();
+        featureIdSet.featureCount = static_cast<int64_t>(count);
+        featureIdSet.attribute = 0;
+        featureIdSet.propertyTable = 0;
+        featureIdSet.label = std::string(kBatchElementClass);
+        node.extensions["EXT_instance_features"] = instanceFeatures;
+        addExtensionOnce(_outputGltf.extensionsUsed, "EXT_instance_features");
+    }
+
     // ... (createNonInstancedNode should be fine with previous corrections) ...
     int32_t GlbWriter::createNonInstancedNode(
         int32_t meshIndexInOutputGltf,
-        const TransformComponents& transform) {
+        const TransformComponents& meshTransform) {
+        // Quantized positions: the node also carries the dequantization (applied first).
+        auto dequantization = _meshDequantization.find(meshIndexInOutputGltf);
+        const TransformComponents transform = dequantization != _meshDequantization.end()
+            ? TransformComponents::fromMat4(meshTransform.toMat4() * dequantization->second)
+            : meshTransform;
         CesiumGltf::Node newNode;
         newNode.mesh = meshIndexInOutputGltf;
         
@@ -692,17 +1306,349 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         return static_cast<int32_t>(_outputGltf.nodes.size() - 1);
     }
 
+    void GlbWriter::moveToMeshoptFallback(int32_t bufferViewIndex, size_t byteLength, size_t byteStride, size_t count, const std::string& mode) {
+        if (_meshoptFallbackBuffer < 0) {
+            _meshoptFallbackBuffer = static_cast<int32_t>(_outputGltf.buffers.size());
+            CesiumGltf::Buffer& fallback = _outputGltf.buffers.emplace_back();
+            CesiumGltf::ExtensionBufferExtMeshoptCompression fallbackExtension;
+            fallbackExtension.fallback = true;
+            fallback.extensions["EXT_meshopt_compression"] = fallbackExtension;
+            // The fallback buffer has no data, so loaders must decode.
+            addExtensionOnce(_outputGltf.extensionsUsed, "EXT_meshopt_compression");
+            addExtensionOnce(_outputGltf.extensionsRequired, "EXT_meshopt_compression");
+        }
+        CesiumGltf::BufferView& bufferView = _outputGltf.bufferViews[bufferViewIndex];
+        CesiumGltf::ExtensionBufferViewExtMeshoptCompression compression;
+        compression.buffer = bufferView.buffer;
+        compression.byteOffset = bufferView.byteOffset;
+        compression.byteLength = bufferView.byteLength;
+        compression.byteStride = static_cast<int64_t>(byteStride);
+        compression.count = static_cast<int64_t>(count);
+        compression.mode = mode;
+        bufferView.extensions["EXT_meshopt_compression"] = compression;
+
+        _meshoptFallbackSize += (4 - _meshoptFallbackSize % 4) % 4;
+        bufferView.buffer = _meshoptFallbackBuffer;
+        bufferView.byteOffset = static_cast<int64_t>(_meshoptFallbackSize);
+        bufferView.byteLength = static_cast<int64_t>(byteLength);
+        _meshoptFallbackSize += byteLength;
+        _outputGltf.buffers[_meshoptFallbackBuffer].byteLength = static_cast<int64_t>(_meshoptFallbackSize);
+    }
+
+    int32_t GlbWriter::addVertexBufferView(std::vector<std::byte>&& data, size_t byteStride, size_t vertexCount) {
+        const size_t byteLength = data.size();
+        const bool compress = _options.compression.meshoptCompression && vertexCount > 0 && byteStride % 4 == 0 && byteStride <= 256;
+        std::vector<std::byte> stored = compress ? encodeVertexStream(data.data(), vertexCount, byteStride) : std::move(data);
+        const size_t storedLength = stored.size();
+        int32_t bufferViewIndex = reserveBufferView(storedLength);
+        if (bufferViewIndex < 0) {
+            return -1;
+        }
+        queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[bufferViewIndex].byteOffset), storedLength,
+            [stored = std::move(stored)](std::byte* destination) {
+                std::memcpy(destination, stored.data(), stored.size());
+            });
+        CesiumGltf::BufferView& bufferView = _outputGltf.bufferViews[bufferViewIndex];
+        bufferView.target = CesiumGltf::BufferView::Target::ARRAY_BUFFER;
+        if (byteStride > 0 && byteStride % 4 == 0) {
+            bufferView.byteStride = static_cast<int64_t>(byteStride);
+        }
+        if (compress) {
+            moveToMeshoptFallback(bufferViewIndex, byteLength, byteStride, vertexCount,
+                CesiumGltf::ExtensionBufferViewExtMeshoptCompression::Mode::ATTRIBUTES);
+        }
+        return bufferViewIndex;
+    }
+
+    int32_t GlbWriter::addVertexAccessor(
+        std::vector<std::byte>&& data,
+        size_t byteStride,
+        int32_t componentType,
+        const std::string& type,
+        bool normalized,
+        size_t vertexCount) {
+        int32_t bufferViewIndex = addVertexBufferView(std::move(data), byteStride, vertexCount);
+        if (bufferViewIndex < 0) {
+            return -1;
+        }
+        CesiumGltf::Accessor& accessor = _outputGltf.accessors.emplace_back();
+        accessor.bufferView = bufferViewIndex;
+        accessor.componentType = componentType;
+        accessor.type = type;
+        accessor.normalized = normalized;
+        accessor.count = static_cast<int64_t>(vertexCount);
+        return static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+    }
+
+    int32_t GlbWriter::addQuantizedAccessor(QuantizedAttribute&& attribute, const std::string& type, size_t vertexCount) {
+        int32_t accessorIndex = addVertexAccessor(std::move(attribute.data), attribute.byteStride,
+            attribute.componentType, type, attribute.normalized, vertexCount);
+        if (accessorIndex < 0) {
+            return -1;
+        }
+        _outputGltf.accessors[accessorIndex].min = std::move(attribute.min);
+        _outputGltf.accessors[accessorIndex].max = std::move(attribute.max);
+        addExtensionOnce(_outputGltf.extensionsUsed, "KHR_mesh_quantization");
+        addExtensionOnce(_outputGltf.extensionsRequired, "KHR_mesh_quantization");
+        return accessorIndex;
+    }
+
+    void GlbWriter::applyMeshDequantization(CesiumGltf::Node& node) const {
+        auto dequantization = _meshDequantization.find(node.mesh);
+        if (dequantization == _meshDequantization.end()) {
+            return;
+        }
+        const TransformComponents transform = TransformComponents::fromMat4(getLocalTransformMatrix(node) * dequantization->second);
+        node.matrix.clear();
+        node.translation = { transform.translation.x, transform.translation.y, transform.translation.z };
+        node.rotation = { transform.rotation.x, transform.rotation.y, transform.rotation.z, transform.rotation.w };
+        node.scale = { transform.scale.x, transform.scale.y, transform.scale.z };
+    }
+
+    int32_t GlbWriter::addTriangleIndexAccessor(std::vector<uint32_t>&& indices, size_t vertexCount) {
+        const bool shortIndices = vertexCount <= 65535; // 65535 is the primitive restart value, not an index
+        const size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+        const size_t indexCount = indices.size();
+        int32_t indexBufferView = -1;
+        if (_options.compression.meshoptCompression && indexCount > 0 && indexCount % 3 == 0) {
+            // Decodes to indexSize-byte indices in the fallback buffer.
+            std::vector<std::byte> encoded = encodeTriangleIndices(indices.data(), indexCount, vertexCount);
+            indexBufferView = reserveBufferView(encoded.size());
+            if (indexBufferView < 0) {
+                return -1;
+            }
+            const size_t encodedLength = encoded.size();
+            queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[indexBufferView].byteOffset), encodedLength,
+                [encoded = std::move(encoded)](std::byte* destination) {
+                    std::memcpy(destination, encoded.data(), encoded.size());
+                });
+            moveToMeshoptFallback(indexBufferView, indexCount * indexSize, indexSize, indexCount,
+                CesiumGltf::ExtensionBufferViewExtMeshoptCompression::Mode::TRIANGLES);
+        } else {
+            indexBufferView = reserveBufferView(indexCount * indexSize);
+            if (indexBufferView < 0) {
+                return -1;
+            }
+            queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[indexBufferView].byteOffset), indexCount * indexSize,
+                [indices = std::move(indices), shortIndices](std::byte* destination) {
+                    if (shortIndices) {
+                        uint16_t* out = reinterpret_cast<uint16_t*>(destination);
+                        for (size_t i = 0; i < indices.size(); ++i) {
+                            out[i] = static_cast<uint16_t>(indices[i]);
+                        }
+                    } else {
+                        std::memcpy(destination, indices.data(), indices.size() * sizeof(uint32_t));
+                    }
+                });
+        }
+        _outputGltf.bufferViews[indexBufferView].target = CesiumGltf::BufferView::Target::ELEMENT_ARRAY_BUFFER;
+        CesiumGltf::Accessor& indexAccessor = _outputGltf.accessors.emplace_back();
+        indexAccessor.bufferView = indexBufferView;
+        indexAccessor.componentType = shortIndices
+            ? CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT
+            : CesiumGltf::Accessor::ComponentType::UNSIGNED_INT;
+        indexAccessor.type = CesiumGltf::Accessor::Type::SCALAR;
+        indexAccessor.count = static_cast<int64_t>(indexCount);
+        return static_cast<int32_t>(_outputGltf.accessors.size() - 1);
+    }
+
+    int32_t GlbWriter::createBatchedNode(GeometryBatch&& batch, size_t batchIndex) {
+        if (_options.optimizeMeshes) {
+            optimizeBatch(batch);
+        }
+        const size_t vertexCount = batch.vertexCount();
+        if (vertexCount == 0 || batch.indices.empty()) {
+            return -1;
+        }
+
+        // Hands a FLOAT vertex stream with `components` values per vertex over to the buffer.
+        auto addFloatAccessor = [&](std::vector<float>&& data, const std::string& type, size_t components) -> int32_t {
+            std::vector<std::byte> bytes(data.size() * sizeof(float));
+            std::memcpy(bytes.data(), data.data(), bytes.size());
+            data = std::vector<float>();
+            return addVertexAccessor(std::move(bytes), components * sizeof(float),
+                CesiumGltf::Accessor::ComponentType::FLOAT, type, false, vertexCount);
+        };
+
+        // POSITION requires min/max
+        std::vector<double> positionMin(3, std::numeric_limits<double>::max());
+        std::vector<double> positionMax(3, std::numeric_limits<double>::lowest());
+        for (size_t i = 0; i < batch.positions.size(); ++i) {
+            positionMin[i % 3] = std::min(positionMin[i % 3], static_cast<double>(batch.positions[i]));
+            positionMax[i % 3] = std::max(positionMax[i % 3], static_cast<double>(batch.positions[i]));
+        }
+        // Feature IDs are appended in increasing order, so unique IDs are the number of runs.
+        int64_t uniqueFeatureCount = 0;
+        for (size_t i = 0; i < batch.featureIds.size(); ++i) {
+            if (i == 0 || batch.featureIds[i] != batch.featureIds[i - 1]) {
+                ++uniqueFeatureCount;
+            }
+        }
+
+        CesiumGltf::MeshPrimitive primitive;
+        primitive.mode = CesiumGltf::MeshPrimitive::Mode::TRIANGLES;
+        primitive.material = batch.material;
+
+        const GeometryCompressionOptions& compression = _options.compression;
+        std::optional<PositionQuantization> positionQuantization;
+        int32_t positionAccessor = -1;
+        if (compression.positionBits > 0) {
+            BoundingBox localBounds;
+            localBounds.min = glm::dvec3(positionMin[0], positionMin[1], positionMin[2]);
+            localBounds.max = glm::dvec3(positionMax[0], positionMax[1], positionMax[2]);
+            positionQuantization = computePositionQuantization(localBounds, compression.positionBits);
+            positionAccessor = addQuantizedAccessor(quantizePositions(batch.positions.data(), vertexCount, *positionQuantization),
+                CesiumGltf::Accessor::Type::VEC3, vertexCount);
+            batch.positions = std::vector<float>();
+        } else {
+            positionAccessor = addFloatAccessor(std::move(batch.positions), CesiumGltf::Accessor::Type::VEC3, 3);
+            if (positionAccessor >= 0) {
+                _outputGltf.accessors[positionAccessor].min = positionMin;
+                _outputGltf.accessors[positionAccessor].max = positionMax;
+            }
+        }
+        if (positionAccessor < 0) {
+            return -1;
+        }
+        primitive.attributes["POSITION"] = positionAccessor;
+        if (batch.hasNormals) {
+            primitive.attributes["NORMAL"] = compression.normalBits > 0
+                ? addQuantizedAccessor(quantizeNormals(batch.normals.data(), vertexCount, compression.normalBits), CesiumGltf::Accessor::Type::VEC3, vertexCount)
+                : addFloatAccessor(std::move(batch.normals), CesiumGltf::Accessor::Type::VEC3, 3);
+        }
+        if (batch.hasTexCoords) {
+            std::optional<QuantizedAttribute> texCoords;
+            if (compression.texCoordBits > 0) {
+                texCoords = quantizeTexCoords(batch.texCoords.data(), vertexCount, compression.texCoordBits);
+            }
+            primitive.attributes["TEXCOORD_0"] = texCoords
+                ? addQuantizedAccessor(std::move(*texCoords), CesiumGltf::Accessor::Type::VEC2, vertexCount)
+                : addFloatAccessor(std::move(batch.texCoords), CesiumGltf::Accessor::Type::VEC2, 2);
+        }
+        primitive.attributes["_FEATURE_ID_0"] = addFloatAccessor(std::move(batch.featureIds), CesiumGltf::Accessor::Type::SCALAR, 1);
+        for (const auto& attribute : primitive.attributes) {
+            if (attribute.second < 0) {
+                return -1;
+            }
+        }
+
+        primitive.indices = addTriangleIndexAccessor(std::move(batch.indices), vertexCount);
+        if (primitive.indices < 0) {
+            return -1;
+        }
+
+        // Feature IDs are rows of the element name table (property table 0).
+        CesiumGltf::ExtensionExtMeshFeatures meshFeatures;
+        CesiumGltf::FeatureId& featureIdSet = meshFeatures.featureIds.emplace_back();
+        featureIdSet.featureCount = uniqueFeatureCount;
+        featureIdSet.attribute = 0;
+        featureIdSet.propertyTable = 0;
+        featureIdSet.label = std::string(kBatchElementClass);
+        primitive.extensions["EXT_mesh_features"] = meshFeatures;
+        addExtensionOnce(_outputGltf.extensionsUsed, "EXT_mesh_features");
+
+        CesiumGltf::Mesh& mesh = _outputGltf.meshes.emplace_back();
+        mesh.name = "batch_" + std::to_string(batchIndex);
+        mesh.primitives.push_back(std::move(primitive));
+
+        CesiumGltf::Node& node = _outputGltf.nodes.emplace_back();
+        node.mesh = static_cast<int32_t>(_outputGltf.meshes.size() - 1);
+        node.name = mesh.name;
+        if (positionQuantization) { // Dequantize on the node: origin + offset + q * step
+            const glm::dvec3 translation = batch.origin + positionQuantization->offset;
+            node.translation = { translation.x, translation.y, translation.z };
+            node.scale = { positionQuantization->step.x, positionQuantization->step.y, positionQuantization->step.z };
+        } else {
+            node.translation = { batch.origin.x, batch.origin.y, batch.origin.z };
+        }
+        return static_cast<int32_t>(_outputGltf.nodes.size() - 1);
+    }
+
+    bool GlbWriter::addElementNameTable(const std::vector<std::string>& names) {
+        if (names.empty()) {
+            return true;
+        }
+
+        CesiumGltf::ExtensionModelExtStructuralMetadata metadata;
+        CesiumGltf::Schema& schema = metadata.schema.emplace();
+        schema.id = "gltf_instancing";
+        CesiumGltf::PropertyTable& table = metadata.propertyTables.emplace_back();
+        table.name = "elements";
+        table.classProperty = kBatchElementClass;
+        table.count = static_cast<int64_t>(names.size());
+
+        // STRING column: UTF-8 bytes back to back, plus count + 1 UINT32 offsets.
+        auto addStringColumn = [&](const char* propertyName, const std::function<const std::string&(size_t row)>& valueOfRow) {
+            std::string values;
+            std::vector<uint32_t> offsets;
+            offsets.reserve(names.size() + 1);
+            offsets.push_back(0);
+            for (size_t row = 0; row < names.size(); ++row) {
+                values += valueOfRow(row);
+                if (values.size() > std::numeric_limits<uint32_t>::max()) {
+                    logError("Element " + std::string(propertyName) + " values exceed the 4GB limit of UINT32 string offsets.");
+                    return false;
+                }
+                offsets.push_back(static_cast<uint32_t>(values.size()));
+            }
+
+            // EXT_structural_metadata requires 8-byte aligned property buffer views.
+            const size_t valuesLength = values.size();
+            const size_t offsetsLength = offsets.size() * sizeof(uint32_t);
+            int32_t valuesView = reserveBufferView(std::max<size_t>(valuesLength, 1), 8);
+            int32_t offsetsView = reserveBufferView(offsetsLength, 8);
+            if (valuesView < 0 || offsetsView < 0) {
+                return false;
+            }
+            queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[valuesView].byteOffset), valuesLength,
+                [values = std::move(values)](std::byte* destination) {
+                    std::memcpy(destination, values.data(), values.size());
+                });
+            queueBufferGenerator(static_cast<size_t>(_outputGltf.bufferViews[offsetsView].byteOffset), offsetsLength,
+                [offsets = std::move(offsets)](std::byte* destination) {
+                    std::memcpy(destination, offsets.data(), offsets.size() * sizeof(uint32_t));
+                });
+
+            schema.classes[kBatchElementClass].properties[propertyName].type = CesiumGltf::ClassProperty::Type::STRING;
+            CesiumGltf::PropertyTableProperty& column = table.properties[propertyName];
+            column.values = valuesView;
+            column.stringOffsets = offsetsView;
+            column.stringOffsetType = CesiumGltf::PropertyTableProperty::StringOffsetType::UINT32;
+            return true;
+        };
+
+        if (!addStringColumn(kBatchElementNameProperty, [&](size_t row) -> const std::string& { return names[row]; })) {
+            return false;
+        }
+        if (_options.elementIds) {
+            static const std::string noElementId;
+            const auto& elementIds = *_options.elementIds;
+            if (!addStringColumn(kElementIdProperty, [&](size_t row) -> const std::string& {
+                    auto found = elementIds.find(names[row]);
+                    return found != elementIds.end() ? found->second : noElementId;
+                })) {
+                return false;
+            }
+        }
+
+        _outputGltf.extensions["EXT_structural_metadata"] = metadata;
+        addExtensionOnce(_outputGltf.extensionsUsed, "EXT_structural_metadata");
+        return true;
+    }
 
     // ... (writeInstancedGlb - ensure Model::scene is used, and GltfWriterResult is handled) ...
     std::optional<std::pair<std::filesystem::path, BoundingBox>> GlbWriter::writeInstancedGlb(
         const std::vector<LoadedGltfModel>& originalModels,
         const InstancingDetectionResult& detectionResult,
-        const std::filesystem::path& outputPath) {
+        const std::filesystem::path& outputPath,
+        const MeshLodSet* meshLods) {
         logMessage("Starting GLB generation: " + outputPath.string());
         resetInternalState();
+        _meshLods = meshLods;
         ResourceRemapping remapping;
         std::vector<int32_t> rootNodeIndices;
         BoundingBox overallBoundingBox;
+        std::vector<std::string> elementNames; // Feature ID -> source mesh name (instances and batched meshes)
 
         // Process Instanced Groups
         for (const auto& group : detectionResult.instancedGroups) {
@@ -714,12 +1660,14 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             int32_t instancedNodeIndex = createInstancedNode(newMeshIndex, group.instances, group.representativeMeshName);
             if (instancedNodeIndex >= 0) {
                 rootNodeIndices.push_back(instancedNodeIndex);
+                addInstanceFeatures(originalModels, instancedNodeIndex, group.instances, elementNames);
                 if (static_cast<size_t>(newMeshIndex) < _outputGltf.meshes.size()) { // Bounds check
-                    BoundingBox meshLocalBox = getMeshBoundingBox(_outputGltf, _outputGltf.meshes[newMeshIndex]);
+                    // The output buffer is only filled at the end, so bounds come from the source mesh
+                    BoundingBox meshLocalBox = getMeshBoundingBox(*representativeModel, representativeModel->meshes[group.representativeMeshIndexInModel]);
                     if (meshLocalBox.isValid()) {
                         for (const auto& instanceInfo : group.instances) {
                             BoundingBox instanceBox = meshLocalBox;
-                            instanceBox.transform(instanceInfo.transform.toMat4());
+                            instanceBox.transform(instanceInfo.worldMatrix);
                             overallBoundingBox.merge(instanceBox);
                         }
                     }
@@ -728,23 +1676,7 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         }
 
         // Process Non-Instanced Meshes
-        for (const auto& niMeshInfo : detectionResult.nonInstancedMeshes) {
-            const CesiumGltf::Model* originalModel = getOriginalModelById(originalModels, niMeshInfo.originalGltfModelIndex);
-            if (!originalModel) { continue; }
-            int32_t newMeshIndex = copyMeshDefinition(*originalModel, niMeshInfo.originalMeshIndexInModel, niMeshInfo.originalGltfModelIndex, remapping);
-            if (newMeshIndex < 0) { continue; }
-            int32_t regularNodeIndex = createNonInstancedNode(newMeshIndex, niMeshInfo.transform);
-            if (regularNodeIndex >= 0) {
-                rootNodeIndices.push_back(regularNodeIndex);
-                if (static_cast<size_t>(newMeshIndex) < _outputGltf.meshes.size()) { // Bounds check
-                    BoundingBox meshLocalBox = getMeshBoundingBox(_outputGltf, _outputGltf.meshes[newMeshIndex]);
-                    if (meshLocalBox.isValid()) {
-                        meshLocalBox.transform(niMeshInfo.transform.toMat4());
-                        overallBoundingBox.merge(meshLocalBox);
-                    }
-                }
-            }
-        }
+        addNonInstancedMeshes(originalModels, detectionResult.nonInstancedMeshes, remapping, rootNodeIndices, overallBoundingBox, elementNames);
 
         if (rootNodeIndices.empty() && _outputGltf.meshes.empty()) {
             logMessage("No meshes or nodes were processed. Output GLB will be empty or invalid.");
@@ -759,44 +1691,21 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             logMessage("Warning: Output GLB has meshes but no nodes in the scene.");
         }
 
-        if (!_outputGltf.buffers.empty()) {
-            _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_outputBufferData.size());
-        }
-        else if (!_outputBufferData.empty()) {
+        if (_outputGltf.buffers.empty() && _plannedBufferSize > 0) {
             logError("Output buffer data exists, but no buffer definition in glTF model!");
             return std::nullopt;
         }
 
-        CesiumGltfContent::GltfUtilities::removeUnusedAccessors(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBufferViews(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBuffers(_outputGltf);
+        removeUnusedObjects();
 
-        CesiumGltfWriter::GltfWriterOptions writerOptions;
-        CesiumGltfWriter::GltfWriterResult writerResult = _gltfWriter.writeGlb(_outputGltf, _outputBufferData, writerOptions);
-
-        if (writerResult.gltfBytes.empty() && !writerResult.errors.empty()) { // Check if gltfBytes is empty AND there are errors
-            logError("Failed to serialize GLB.");
-            for (const auto& err : writerResult.errors) logError("Writer Error: " + err);
-            for (const auto& warn : writerResult.warnings) logMessage("Writer Warning: " + warn); // Also log warnings
+        if (!elementNames.empty() && !addElementNameTable(elementNames)) {
             return std::nullopt;
         }
 
-        // Even if there are warnings, gltfBytes might still be valid if not empty.
-        // If gltfBytes is empty but no errors, it's also a failure.
-        if (writerResult.gltfBytes.empty()) {
-            logError("Failed to serialize GLB: GltfWriter result has empty gltfBytes, but no explicit errors reported by it (or errors were already logged).");
-            for (const auto& warn : writerResult.warnings) logMessage("Writer Warning: " + warn);
+        if (!writeGlbStreamed(outputPath, overallBoundingBox, elementNames)) {
             return std::nullopt;
         }
 
-        std::vector<std::byte> glbBytes = std::move(writerResult.gltfBytes);
-
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) { /* ... error handling ... */ return std::nullopt; }
-        outFile.write(reinterpret_cast<const char*>(glbBytes.data()), glbBytes.size());
-        outFile.close();
-        if (!outFile) { /* ... error handling ... */ return std::nullopt; }
-
         logMessage("Successfully wrote instanced GLB to: " + outputPath.string());
         return std::make_pair(outputPath, overallBoundingBox);
     }
@@ -812,6 +1721,7 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
         ResourceRemapping remapping;
         std::vector<int32_t> rootNodeIndices;
         BoundingBox overallBoundingBox;
+        std::vector<std::string> elementNames; // Feature ID -> source mesh name of each instance (with elementIds)
 
         // 只处理实例化组
         for (const auto& group : detectionResult.instancedGroups) {
@@ -823,12 +1733,13 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             int32_t instancedNodeIndex = createInstancedNode(newMeshIndex, group.instances, group.representativeMeshName);
             if (instancedNodeIndex >= 0) {
                 rootNodeIndices.push_back(instancedNodeIndex);
+                addInstanceFeatures(originalModels, instancedNodeIndex, group.instances, elementNames);
                 if (static_cast<size_t>(newMeshIndex) < _outputGltf.meshes.size()) {
-                    BoundingBox meshLocalBox = getMeshBoundingBox(_outputGltf, _outputGltf.meshes[newMeshIndex]);
+                    BoundingBox meshLocalBox = getMeshBoundingBox(*representativeModel, representativeModel->meshes[group.representativeMeshIndexInModel]);
                     if (meshLocalBox.isValid()) {
                         for (const auto& instanceInfo : group.instances) {
                             BoundingBox instanceBox = meshLocalBox;
-                            instanceBox.transform(instanceInfo.transform.toMat4());
+                            instanceBox.transform(instanceInfo.worldMatrix);
                             overallBoundingBox.merge(instanceBox);
                         }
                     } else {
@@ -848,56 +1759,75 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             _outputGltf.scene = static_cast<int32_t>(_outputGltf.scenes.size() - 1);
         }
 
-        if (!_outputGltf.buffers.empty()) {
-            _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_outputBufferData.size());
-        }
-
         // 清理未使用的对象
-        CesiumGltfContent::GltfUtilities::removeUnusedAccessors(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBufferViews(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBuffers(_outputGltf);
-
-        CesiumGltfWriter::GltfWriterOptions writerOptions;
-        CesiumGltfWriter::GltfWriterResult writerResult = _gltfWriter.writeGlb(_outputGltf, _outputBufferData, writerOptions);
+        removeUnusedObjects();
 
-        if (writerResult.gltfBytes.empty()) {
-            logError("Failed to serialize instanced GLB.");
+        if (!elementNames.empty() && !addElementNameTable(elementNames)) {
             return std::nullopt;
         }
 
-        std::vector<std::byte> glbBytes = std::move(writerResult.gltfBytes);
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) { return std::nullopt; }
-        outFile.write(reinterpret_cast<const char*>(glbBytes.data()), glbBytes.size());
-        outFile.close();
+        if (!writeGlbStreamed(outputPath, overallBoundingBox, elementNames)) {
+            return std::nullopt;
+        }
 
         logMessage("Successfully wrote instanced GLB to: " + outputPath.string());
         return std::make_pair(outputPath, overallBoundingBox);
     }
 
     // 新增：只输出非实例化的mesh
-    std::optional<std::pair<std::filesystem::path, BoundingBox>> GlbWriter::writeNonInstancedMeshesOnly(
+    void GlbWriter::addNonInstancedMeshes(
         const std::vector<LoadedGltfModel>& originalModels,
-        const InstancingDetectionResult& detectionResult,
-        const std::filesystem::path& outputPath) {
-        
-        logMessage("Starting GLB generation (non-instanced meshes only): " + outputPath.string());
-        resetInternalState();
-        ResourceRemapping remapping;
-        std::vector<int32_t> rootNodeIndices;
-        BoundingBox overallBoundingBox;
+        const std::vector<NonInstancedMeshInfo>& nonInstancedMeshes,
+        ResourceRemapping& remapping,
+        std::vector<int32_t>& rootNodeIndices,
+        BoundingBox& overallBoundingBox,
+        std::vector<std::string>& elementNames) {
+        MeshBatcher batcher(_options.batchVertexBudget);
+        size_t unbatchedMeshCount = 0;
+        const size_t firstElement = elementNames.size(); // Instance features come first
 
         // 只处理非实例化的Mesh
-        for (const auto& niMeshInfo : detectionResult.nonInstancedMeshes) {
+        for (const auto& niMeshInfo : nonInstancedMeshes) {
             const CesiumGltf::Model* originalModel = getOriginalModelById(originalModels, niMeshInfo.originalGltfModelIndex);
             if (!originalModel) { continue; }
+            if (_options.batchNonInstancedMeshes &&
+                static_cast<size_t>(niMeshInfo.originalMeshIndexInModel) < originalModel->meshes.size() &&
+                elementNames.size() < MeshBatcher::kMaxFeatureCount) {
+                const CesiumGltf::Mesh& mesh = originalModel->meshes[niMeshInfo.originalMeshIndexInModel];
+                if (MeshBatcher::canBatch(*originalModel, mesh)) {
+                    // Materials are content-deduplicated on copy, so equal materials from different
+                    // source files share an output index and therefore a batch.
+                    std::vector<int32_t> outputMaterials;
+                    bool materialsCopied = true;
+                    for (const auto& primitive : mesh.primitives) {
+                        int32_t material = primitive.material >= 0
+                            ? copyMaterial(*originalModel, primitive.material, niMeshInfo.originalGltfModelIndex, remapping)
+                            : -1;
+                        materialsCopied = materialsCopied && (primitive.material < 0 || material >= 0);
+                        outputMaterials.push_back(material);
+                    }
+                    const uint32_t featureId = static_cast<uint32_t>(elementNames.size());
+                    if (materialsCopied && batcher.addMesh(*originalModel, mesh, niMeshInfo.transform.toMat4(), outputMaterials, featureId,
+                                                              findSimplifiedMesh(niMeshInfo.originalGltfModelIndex, niMeshInfo.originalMeshIndexInModel))) {
+                        elementNames.push_back(mesh.name);
+                        continue;
+                    }
+                }
+                ++unbatchedMeshCount;
+            }
             int32_t newMeshIndex = copyMeshDefinition(*originalModel, niMeshInfo.originalMeshIndexInModel, niMeshInfo.originalGltfModelIndex, remapping);
             if (newMeshIndex < 0) { continue; }
             int32_t regularNodeIndex = createNonInstancedNode(newMeshIndex, niMeshInfo.transform);
             if (regularNodeIndex >= 0) {
                 rootNodeIndices.push_back(regularNodeIndex);
+                if (_options.elementIds) {
+                    auto elementId = _options.elementIds->find(originalModel->meshes[niMeshInfo.originalMeshIndexInModel].name);
+                    if (elementId != _options.elementIds->end()) {
+                        _outputGltf.nodes[static_cast<size_t>(regularNodeIndex)].extras["elementId"] = elementId->second;
+                    }
+                }
                 if (static_cast<size_t>(newMeshIndex) < _outputGltf.meshes.size()) {
-                    BoundingBox meshLocalBox = getMeshBoundingBox(_outputGltf, _outputGltf.meshes[newMeshIndex]);
+                    BoundingBox meshLocalBox = getMeshBoundingBox(*originalModel, originalModel->meshes[niMeshInfo.originalMeshIndexInModel]);
                     if (meshLocalBox.isValid()) {
                         meshLocalBox.transform(niMeshInfo.transform.toMat4());
                         overallBoundingBox.merge(meshLocalBox);
@@ -908,6 +1838,35 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             }
         }
 
+        if (!batcher.empty()) {
+            std::vector<GeometryBatch> batches = batcher.takeBatches();
+            const size_t batchCount = batches.size();
+            for (size_t i = 0; i < batchCount; ++i) {
+                overallBoundingBox.merge(batches[i].bounds);
+                int32_t batchNodeIndex = createBatchedNode(std::move(batches[i]), i);
+                if (batchNodeIndex >= 0) {
+                    rootNodeIndices.push_back(batchNodeIndex);
+                }
+            }
+            logMessage("Batched " + std::to_string(elementNames.size() - firstElement) + " non-instanced meshes into " +
+                       std::to_string(batchCount) + " primitives (" + std::to_string(unbatchedMeshCount) + " meshes kept as separate nodes).");
+        }
+    }
+
+    std::optional<std::pair<std::filesystem::path, BoundingBox>> GlbWriter::writeNonInstancedMeshesOnly(
+        const std::vector<LoadedGltfModel>& originalModels,
+        const InstancingDetectionResult& detectionResult,
+        const std::filesystem::path& outputPath) {
+        
+        logMessage("Starting GLB generation (non-instanced meshes only): " + outputPath.string());
+        resetInternalState();
+        ResourceRemapping remapping;
+        std::vector<int32_t> rootNodeIndices;
+        BoundingBox overallBoundingBox;
+
+        std::vector<std::string> elementNames; // Feature ID -> source mesh name (batched meshes only)
+        addNonInstancedMeshes(originalModels, detectionResult.nonInstancedMeshes, remapping, rootNodeIndices, overallBoundingBox, elementNames);
+
         if (rootNodeIndices.empty() && _outputGltf.meshes.empty()) {
             logMessage("No non-instanced meshes were processed.");
         }
@@ -918,301 +1877,426 @@ int32_t GlbWriter::copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAc
             _outputGltf.scene = static_cast<int32_t>(_outputGltf.scenes.size() - 1);
         }
 
-        if (!_outputGltf.buffers.empty()) {
-            _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_outputBufferData.size());
-        }
-
         // 清理未使用的对象
-        CesiumGltfContent::GltfUtilities::removeUnusedAccessors(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBufferViews(_outputGltf);
-        CesiumGltfContent::GltfUtilities::removeUnusedBuffers(_outputGltf);
-
-        CesiumGltfWriter::GltfWriterOptions writerOptions;
-        CesiumGltfWriter::GltfWriterResult writerResult = _gltfWriter.writeGlb(_outputGltf, _outputBufferData, writerOptions);
+        removeUnusedObjects();
 
-        if (writerResult.gltfBytes.empty()) {
-            logError("Failed to serialize non-instanced GLB.");
+        if (!elementNames.empty() && !addElementNameTable(elementNames)) {
             return std::nullopt;
         }
 
-        std::vector<std::byte> glbBytes = std::move(writerResult.gltfBytes);
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) { return std::nullopt; }
-        outFile.write(reinterpret_cast<const char*>(glbBytes.data()), glbBytes.size());
-        outFile.close();
+        if (!writeGlbStreamed(outputPath, overallBoundingBox, elementNames)) {
+            return std::nullopt;
+        }
 
         logMessage("Successfully wrote non-instanced GLB to: " + outputPath.string());
         return std::make_pair(outputPath, overallBoundingBox);
     }
     
+    namespace {
+        // Reverse index of one source model: for every mesh the first node that draws it through
+        // EXT_mesh_gpu_instancing and the first node that references it at all (-1 if none).
+        // Built in a single pass over the nodes instead of scanning them once per mesh.
+        struct MeshNodeIndex {
+            std::vector<int32_t> instancingNode;
+            std::vector<int32_t> transformNode;
+        };
+
+        MeshNodeIndex buildMeshNodeIndex(const CesiumGltf::Model& model) {
+            MeshNodeIndex index;
+            index.instancingNode.assign(model.meshes.size(), -1);
+            index.transformNode.assign(model.meshes.size(), -1);
+            for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+                const CesiumGltf::Node& node = model.nodes[nodeIdx];
+                if (node.mesh < 0 || static_cast<size_t>(node.mesh) >= model.meshes.size()) {
+                    continue;
+                }
+                const size_t meshIdx = static_cast<size_t>(node.mesh);
+                if (index.transformNode[meshIdx] < 0) {
+                    index.transformNode[meshIdx] = static_cast<int32_t>(nodeIdx);
+                }
+                if (index.instancingNode[meshIdx] < 0 && node.extensions.count("EXT_mesh_gpu_instancing")) {
+                    index.instancingNode[meshIdx] = static_cast<int32_t>(nodeIdx);
+                }
+            }
+            return index;
+        }
+
+        // One segmented GLB to build: mesh meshIdx of source model modelIdx.
+        struct SegmentationTask {
+            size_t modelIdx = 0;
+            size_t meshIdx = 0;
+            std::string fileName;
+        };
+
+        std::string segmentedMeshNamePart(const CesiumGltf::Mesh& mesh, size_t meshIdx) {
+            if (mesh.name.empty()) {
+                return "mesh_" + std::to_string(meshIdx);
+            }
+            std::string sanitizedMeshName;
+            for (char c : mesh.name) {
+                if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.') {
+                    sanitizedMeshName += c;
+                } else {
+                    sanitizedMeshName += '_';
+                }
+            }
+            return sanitizedMeshName;
+        }
+
+        bool writeSegmentedGlbFile(const std::filesystem::path& outputPath, const std::vector<std::byte>& glbBytes) {
+            std::ofstream outFile(outputPath, std::ios::binary);
+            if (!outFile.is_open()) {
+                // Called from worker threads, where strerror is not safe to use.
+                logError("Failed to open file for writing: " + outputPath.string());
+                return false;
+            }
+            outFile.write(reinterpret_cast<const char*>(glbBytes.data()), static_cast<std::streamsize>(glbBytes.size()));
+            if (outFile.fail()) {
+                logError("Failed to write all data to file: " + outputPath.string());
+                return false;
+            }
+            addBytesWritten(glbBytes.size());
+            GLTF_LOG_DEBUG("Successfully wrote segmented GLB: " + outputPath.string());
+            return true;
+        }
+    } // namespace
+
     bool GlbWriter::writeMeshesAsSeparateGlbs(
         const std::vector<LoadedGltfModel>& sourceModels,
-        const std::filesystem::path& outputDirectory) {
+        const std::filesystem::path& outputDirectory,
+        const SegmentationOptions& segmentationOptions) {
         bool overallSuccess = true;
 
+        std::vector<MeshNodeIndex> nodeIndices(sourceModels.size());
+        std::vector<SegmentationTask> tasks;
+        std::unordered_set<std::string> usedFileNames;
         for (size_t modelIdx = 0; modelIdx < sourceModels.size(); ++modelIdx) {
             const auto& loadedModel = sourceModels[modelIdx];
-            const CesiumGltf::Model* originalGltf = &loadedModel.model; 
-
-            if (!originalGltf) {
-                GltfInstancing::logError("Internal error with loaded model at index " + std::to_string(modelIdx) + ". Skipping segmentation for this model.");
-                overallSuccess = false;
-                continue;
-            }
-            
-            if (originalGltf->meshes.empty()) {
+            const CesiumGltf::Model& originalGltf = loadedModel.model;
+            if (originalGltf.meshes.empty()) {
                 logMessage("Source model " + loadedModel.originalPath.string() + " has no meshes to segment.");
                 continue;
             }
 
             logMessage("Segmenting meshes from: " + loadedModel.originalPath.string());
+            nodeIndices[modelIdx] = buildMeshNodeIndex(originalGltf);
+            for (size_t meshIdx = 0; meshIdx < originalGltf.meshes.size(); ++meshIdx) {
+                SegmentationTask task;
+                task.modelIdx = modelIdx;
+                task.meshIdx = meshIdx;
+                const std::string baseName = loadedModel.originalPath.stem().string() + "_" + segmentedMeshNamePart(originalGltf.meshes[meshIdx], meshIdx);
+                // Meshes with the same name used to overwrite each other's file; with concurrent
+                // writers they would race, so a taken name gets a numeric suffix until it is unused.
+                // A suffixed name can equal another mesh's own name, hence the check against every
+                // name issued so far, compared case-insensitively for Windows file systems.
+                std::string fileName = baseName;
+                for (size_t suffix = meshIdx;; ++suffix) {
+                    std::string fileNameKey = fileName;
+                    std::transform(fileNameKey.begin(), fileNameKey.end(), fileNameKey.begin(),
+                                   [](unsigned char c) { return static_cast<char>(::tolower(c)); });
+                    if (usedFileNames.insert(fileNameKey).second) {
+                        break;
+                    }
+                    fileName = baseName + "_" + std::to_string(suffix);
+                }
+                task.fileName = fileName + ".glb";
+                tasks.push_back(std::move(task));
+            }
+        }
+        if (tasks.empty()) {
+            return overallSuccess;
+        }
 
-            for (size_t meshIdx = 0; meshIdx < originalGltf->meshes.size(); ++meshIdx) {
-                resetInternalState(); 
-                ResourceRemapping remapping; 
-
-                const CesiumGltf::Mesh& currentOriginalMesh = originalGltf->meshes[meshIdx];
-                std::string originalMeshNameInfo = currentOriginalMesh.name.empty() ? "" : " (name: " + currentOriginalMesh.name + ")";
-
-                logMessage("Processing mesh " + std::to_string(meshIdx) + originalMeshNameInfo + " for segmentation.");
-
-                int32_t newMeshIndexInOutput = copyMeshDefinition(*originalGltf, static_cast<int32_t>(meshIdx), static_cast<int>(modelIdx), remapping);
+        const std::filesystem::path archivePath = outputDirectory / (segmentationOptions.archiveName + ".bin");
+        std::ofstream archiveFile;
+        nlohmann::json manifestEntries = nlohmann::json::array();
+        uint64_t archiveSize = 0;
+        if (segmentationOptions.packArchive) {
+            archiveFile.open(archivePath, std::ios::binary);
+            if (!archiveFile.is_open()) {
+                logError("Failed to open segmentation archive for writing: " + archivePath.string() + " - Error: " + strerror(errno));
+                return false;
+            }
+        }
 
-                if (newMeshIndexInOutput < 0) {
-                    logError("Failed to copy mesh definition for model " + loadedModel.originalPath.stem().string() + 
-                             ", mesh index " + std::to_string(meshIdx) + originalMeshNameInfo);
-                    overallSuccess = false;
-                    continue; 
+        // Every segmented GLB is built by a writer of its own worker over the same read-only
+        // source models. GLBs are built in batches and handed out in task order, so the archive
+        // layout is deterministic and only one batch of encoded GLBs is held in memory.
+        const int workerCount = static_cast<int>(std::min(static_cast<size_t>(resolveThreadCount(segmentationOptions.threadCount)), tasks.size()));
+        std::vector<std::unique_ptr<GlbWriter>> workers(static_cast<size_t>(workerCount));
+        const size_t batchSize = static_cast<size_t>(workerCount) * 16;
+        for (size_t batchBegin = 0; batchBegin < tasks.size(); batchBegin += batchSize) {
+            const size_t batchEnd = std::min(tasks.size(), batchBegin + batchSize);
+            std::vector<std::optional<std::vector<std::byte>>> glbs(batchEnd - batchBegin);
+            std::vector<char> taskSucceeded(batchEnd - batchBegin, 0);
+
+            parallelFor(glbs.size(), workerCount, [&](size_t slot, int workerIndex) {
+                std::unique_ptr<GlbWriter>& worker = workers[static_cast<size_t>(workerIndex)];
+                if (!worker) {
+                    worker = std::make_unique<GlbWriter>(_options);
                 }
-            
-                CesiumGltf::Node nodeForExportedGlb;
-                nodeForExportedGlb.mesh = newMeshIndexInOutput; 
-                if (!currentOriginalMesh.name.empty()) {
-                    nodeForExportedGlb.name = currentOriginalMesh.name; // Use mesh name for the node
+                const SegmentationTask& task = tasks[batchBegin + slot];
+                const LoadedGltfModel& loadedModel = sourceModels[task.modelIdx];
+                const int32_t instancingNode = nodeIndices[task.modelIdx].instancingNode[task.meshIdx];
+                const int32_t transformNode = nodeIndices[task.modelIdx].transformNode[task.meshIdx];
+                glbs[slot] = worker->buildSegmentedMeshGlb(
+                    loadedModel,
+                    static_cast<int>(task.modelIdx),
+                    task.meshIdx,
+                    instancingNode >= 0 ? &loadedModel.model.nodes[static_cast<size_t>(instancingNode)] : nullptr,
+                    instancingNode < 0 && transformNode >= 0 ? &loadedModel.model.nodes[static_cast<size_t>(transformNode)] : nullptr);
+                if (!glbs[slot]) {
+                    return;
+                }
+                if (segmentationOptions.packArchive) {
+                    taskSucceeded[slot] = 1;
                 } else {
-                    // Fallback name if original mesh had no name
-                    nodeForExportedGlb.name = loadedModel.originalPath.stem().string() + "_mesh_" + std::to_string(meshIdx);
+                    taskSucceeded[slot] = writeSegmentedGlbFile(outputDirectory / task.fileName, *glbs[slot]) ? 1 : 0;
+                    glbs[slot].reset();
                 }
+            });
 
-                // Try to find and apply TRS from the original node using this mesh
-                // bool appliedOriginalNodeTransform = false; // Original variable, now replaced by more specific pointers
-                const CesiumGltf::Node* pOriginalNodeProvidingTransform = nullptr;
-                const CesiumGltf::Node* pOriginalNodeProvidingInstancing = nullptr;
-
-                // First, try to find a node that both references this mesh AND uses instancing for it.
-                for (const auto& candidateNode : originalGltf->nodes) {
-                    if (candidateNode.mesh == static_cast<int32_t>(meshIdx) && 
-                        candidateNode.extensions.count("EXT_mesh_gpu_instancing")) {
-                        pOriginalNodeProvidingInstancing = &candidateNode;
-                        break; 
-                    }
+            for (size_t slot = 0; slot < glbs.size(); ++slot) {
+                if (!taskSucceeded[slot]) {
+                    overallSuccess = false;
+                    continue;
                 }
-
-                // If no instancing node was found directly referencing this mesh,
-                // find any node that directly references this mesh to get its standard TRS.
-                if (!pOriginalNodeProvidingInstancing) {
-                    for (const auto& candidateNode : originalGltf->nodes) {
-                        if (candidateNode.mesh == static_cast<int32_t>(meshIdx)) {
-                            pOriginalNodeProvidingTransform = &candidateNode;
-                            
-                            nodeForExportedGlb.translation = pOriginalNodeProvidingTransform->translation;
-                            nodeForExportedGlb.rotation    = pOriginalNodeProvidingTransform->rotation;
-                            nodeForExportedGlb.scale       = pOriginalNodeProvidingTransform->scale;
-                            nodeForExportedGlb.matrix      = pOriginalNodeProvidingTransform->matrix;
-                            break; 
-                        }
-                    }
+                if (!segmentationOptions.packArchive) {
+                    continue;
                 }
-                
-                // Now, specifically handle EXT_mesh_gpu_instancing if the original node (pOriginalNodeProvidingInstancing) had it.
-                if (pOriginalNodeProvidingInstancing) {
-                    // If we found an instancing node, its extension data takes precedence.
-                    // Clear any TRS that might have been tentatively copied from a non-instancing node.
-                    // (This path is less likely if pOriginalNodeProvidingInstancing is found first, but good for clarity)
-                    // Actually, the logic above ensures if pOriginalNodeProvidingInstancing is set, pOriginalNodeProvidingTransform path is skipped.
-                    // So, nodeForExportedGlb's TRS should be default/empty here unless explicitly set by pOriginalNodeProvidingTransform.
-                    // If we want to be absolutely sure that the exported node for an instanced mesh has identity TRS (because TRS comes from extension)
-                    // we can clear it here.
-                    nodeForExportedGlb.translation.clear();
-                    nodeForExportedGlb.rotation.clear();
-                    nodeForExportedGlb.scale.clear();
-                    nodeForExportedGlb.matrix.clear();
-                    
-                    auto instancingIt = pOriginalNodeProvidingInstancing->extensions.find("EXT_mesh_gpu_instancing");
-                    if (instancingIt != pOriginalNodeProvidingInstancing->extensions.end()) { // Check if the key exists
-                        try {
-                            // Cast the std::any payload to nlohmann::json const reference
-                            const nlohmann::json& originalInstancingJson = std::any_cast<const nlohmann::json&>(instancingIt->second);
-
-                            if (originalInstancingJson.is_object()) {
-                                nlohmann::json newInstancingAttributesJson; // For storing remapped attributes
-
-                                // Check for "attributes" field in the extension JSON
-                                if (originalInstancingJson.count("attributes") && originalInstancingJson.at("attributes").is_object()) {
-                                    const nlohmann::json& originalAttributes = originalInstancingJson.at("attributes");
-
-                                    // Iterate through the attributes (e.g., TRANSLATION, ROTATION, SCALE)
-                                    for (auto attrIt = originalAttributes.items().begin(); attrIt != originalAttributes.items().end(); ++attrIt) {
-                                        const std::string& attributeName = attrIt.key();
-                                        const nlohmann::json& attributeValue = attrIt.value();
-
-                                        if (attributeValue.is_number_integer()) {
-                                            int32_t oldAccessorIndex = attributeValue.get<int32_t>(); // Use get<int32_t>() for direct conversion
-                                            
-                                            int32_t newAccessorIndex = copyAccessor(*originalGltf, oldAccessorIndex, static_cast<int>(modelIdx), remapping, false);
-
-                                            if (newAccessorIndex >= 0) {
-                                                newInstancingAttributesJson[attributeName] = newAccessorIndex;
-                                            } else {
-                                                logError("Failed to copy accessor " + std::to_string(oldAccessorIndex) + 
-                                                         " for EXT_mesh_gpu_instancing attribute " + attributeName + 
-                                                         " while segmenting mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name);
-                                            }
-                                        }
+                // Entries start 8-byte aligned, so each GLB can be parsed in place.
+                static const char padding[8] = {};
+                const uint64_t entryOffset = (archiveSize + 7) & ~uint64_t(7);
+                archiveFile.write(padding, static_cast<std::streamsize>(entryOffset - archiveSize));
+                const std::vector<std::byte>& glbBytes = *glbs[slot];
+                archiveFile.write(reinterpret_cast<const char*>(glbBytes.data()), static_cast<std::streamsize>(glbBytes.size()));
+                archiveSize = entryOffset + glbBytes.size();
+
+                const SegmentationTask& task = tasks[batchBegin + slot];
+                nlohmann::json entry;
+                entry["name"] = task.fileName;
+                entry["source"] = sourceModels[task.modelIdx].originalPath.filename().string();
+                entry["mesh"] = task.meshIdx;
+                entry["byteOffset"] = entryOffset;
+                entry["byteLength"] = glbBytes.size();
+                manifestEntries.push_back(std::move(entry));
+            }
+        }
+
+        if (segmentationOptions.packArchive) {
+            archiveFile.close();
+            if (archiveFile.fail()) {
+                logError("Failed to write segmentation archive: " + archivePath.string() + " - Error: " + strerror(errno));
+                return false;
+            }
+            addBytesWritten(archiveSize);
+            nlohmann::json manifest;
+            manifest["archive"] = archivePath.filename().string();
+            manifest["byteLength"] = archiveSize;
+            manifest["entries"] = std::move(manifestEntries);
+            const std::filesystem::path manifestPath = outputDirectory / (segmentationOptions.archiveName + ".json");
+            std::ofstream manifestFile(manifestPath);
+            manifestFile << manifest.dump(2);
+            if (!manifestFile) {
+                logError("Failed to write segmentation manifest: " + manifestPath.string());
+                return false;
+            }
+            logMessage("Packed " + std::to_string(manifest["entries"].size()) + " segmented GLB(s) into: " + archivePath.string());
+        }
+        return overallSuccess;
+    }
+
+    std::optional<std::vector<std::byte>> GlbWriter::buildSegmentedMeshGlb(
+        const LoadedGltfModel& loadedModel,
+        int modelIdx,
+        size_t meshIdx,
+        const CesiumGltf::Node* pOriginalNodeProvidingInstancing,
+        const CesiumGltf::Node* pOriginalNodeProvidingTransform) {
+        resetInternalState();
+        ResourceRemapping remapping;
+
+        const CesiumGltf::Model* originalGltf = &loadedModel.model;
+        const CesiumGltf::Mesh& currentOriginalMesh = originalGltf->meshes[meshIdx];
+        std::string originalMeshNameInfo = currentOriginalMesh.name.empty() ? "" : " (name: " + currentOriginalMesh.name + ")";
+
+        GLTF_LOG_DEBUG("Processing mesh " + std::to_string(meshIdx) + originalMeshNameInfo + " for segmentation.");
+
+        // Meshes drawn through EXT_mesh_gpu_instancing keep float positions: their instance
+        // accessors are copied as they are, so there is nowhere to put a dequantization.
+        const bool meshIsInstanced = pOriginalNodeProvidingInstancing != nullptr;
+        int32_t newMeshIndexInOutput = copyMeshDefinition(*originalGltf, static_cast<int32_t>(meshIdx), modelIdx, remapping, !meshIsInstanced);
+
+        if (newMeshIndexInOutput < 0) {
+            logError("Failed to copy mesh definition for model " + loadedModel.originalPath.stem().string() +
+                     ", mesh index " + std::to_string(meshIdx) + originalMeshNameInfo);
+            return std::nullopt;
+        }
+
+        CesiumGltf::Node nodeForExportedGlb;
+        nodeForExportedGlb.mesh = newMeshIndexInOutput;
+        if (!currentOriginalMesh.name.empty()) {
+            nodeForExportedGlb.name = currentOriginalMesh.name; // Use mesh name for the node
+        } else {
+            // Fallback name if original mesh had no name
+            nodeForExportedGlb.name = loadedModel.originalPath.stem().string() + "_mesh_" + std::to_string(meshIdx);
+        }
+
+        // Without an instancing node, the first node that references this mesh provides its standard TRS.
+        if (pOriginalNodeProvidingTransform) {
+            nodeForExportedGlb.translation = pOriginalNodeProvidingTransform->translation;
+            nodeForExportedGlb.rotation    = pOriginalNodeProvidingTransform->rotation;
+            nodeForExportedGlb.scale       = pOriginalNodeProvidingTransform->scale;
+            nodeForExportedGlb.matrix      = pOriginalNodeProvidingTransform->matrix;
+        }
+
+        // Now, specifically handle EXT_mesh_gpu_instancing if the original node (pOriginalNodeProvidingInstancing) had it.
+        if (pOriginalNodeProvidingInstancing) {
+            // If we found an instancing node, its extension data takes precedence.
+            // Clear any TRS that might have been tentatively copied from a non-instancing node.
+            // (This path is less likely if pOriginalNodeProvidingInstancing is found first, but good for clarity)
+            // Actually, the logic above ensures if pOriginalNodeProvidingInstancing is set, pOriginalNodeProvidingTransform path is skipped.
+            // So, nodeForExportedGlb's TRS should be default/empty here unless explicitly set by pOriginalNodeProvidingTransform.
+            // If we want to be absolutely sure that the exported node for an instanced mesh has identity TRS (because TRS comes from extension)
+            // we can clear it here.
+            nodeForExportedGlb.translation.clear();
+            nodeForExportedGlb.rotation.clear();
+            nodeForExportedGlb.scale.clear();
+            nodeForExportedGlb.matrix.clear();
+            
+            auto instancingIt = pOriginalNodeProvidingInstancing->extensions.find("EXT_mesh_gpu_instancing");
+            if (instancingIt != pOriginalNodeProvidingInstancing->extensions.end()) { // Check if the key exists
+                try {
+                    // Cast the std::any payload to nlohmann::json const reference
+                    const nlohmann::json& originalInstancingJson = std::any_cast<const nlohmann::json&>(instancingIt->second);
+
+                    if (originalInstancingJson.is_object()) {
+                        nlohmann::json newInstancingAttributesJson; // For storing remapped attributes
+
+                        // Check for "attributes" field in the extension JSON
+                        if (originalInstancingJson.count("attributes") && originalInstancingJson.at("attributes").is_object()) {
+                            const nlohmann::json& originalAttributes = originalInstancingJson.at("attributes");
+
+                            // Iterate through the attributes (e.g., TRANSLATION, ROTATION, SCALE)
+                            for (auto attrIt = originalAttributes.items().begin(); attrIt != originalAttributes.items().end(); ++attrIt) {
+                                const std::string& attributeName = attrIt.key();
+                                const nlohmann::json& attributeValue = attrIt.value();
+
+                                if (attributeValue.is_number_integer()) {
+                                    int32_t oldAccessorIndex = attributeValue.get<int32_t>(); // Use get<int32_t>() for direct conversion
+                                    
+                                    int32_t newAccessorIndex = copyAccessor(*originalGltf, oldAccessorIndex, static_cast<int>(modelIdx), remapping, false);
+
+                                    if (newAccessorIndex >= 0) {
+                                        newInstancingAttributesJson[attributeName] = newAccessorIndex;
+                                    } else {
+                                        logError("Failed to copy accessor " + std::to_string(oldAccessorIndex) + 
+                                                 " for EXT_mesh_gpu_instancing attribute " + attributeName + 
+                                                 " while segmenting mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name);
                                     }
                                 }
+                            }
+                        }
 
-                                if (!newInstancingAttributesJson.empty()) {
-                                    CesiumGltf::ExtensionExtMeshGpuInstancing newGpuInstancingExtensionStruct;
-                                    // Populate attributes from newInstancingAttributesJson (which is nlohmann::json)
-                                    for (auto it = newInstancingAttributesJson.items().begin(); it != newInstancingAttributesJson.items().end(); ++it) {
-                                        if (it.value().is_number_integer()) {
-                                            newGpuInstancingExtensionStruct.attributes[it.key()] = it.value().get<int32_t>();
-                                        } else {
-                                            logError("EXT_mesh_gpu_instancing: Attribute '" + it.key() + "' for mesh " + std::to_string(meshIdx) + " has non-integer value '" + it.value().dump() + "' during struct conversion. Skipping attribute.");
-                                        }
-                                    }
+                        if (!newInstancingAttributesJson.empty()) {
+                            CesiumGltf::ExtensionExtMeshGpuInstancing newGpuInstancingExtensionStruct;
+                            // Populate attributes from newInstancingAttributesJson (which is nlohmann::json)
+                            for (auto it = newInstancingAttributesJson.items().begin(); it != newInstancingAttributesJson.items().end(); ++it) {
+                                if (it.value().is_number_integer()) {
+                                    newGpuInstancingExtensionStruct.attributes[it.key()] = it.value().get<int32_t>();
+                                } else {
+                                    logError("EXT_mesh_gpu_instancing: Attribute '" + it.key() + "' for mesh " + std::to_string(meshIdx) + " has non-integer value '" + it.value().dump() + "' during struct conversion. Skipping attribute.");
+                                }
+                            }
 
-                                    // Only add the extension if attributes were successfully populated
-                                    if (!newGpuInstancingExtensionStruct.attributes.empty()) {
-                                        // The if block for originalInstancingJson.count("extras") is removed here.
-                                        
-                                        nodeForExportedGlb.extensions["EXT_mesh_gpu_instancing"] = newGpuInstancingExtensionStruct; 
-
-                                        // Add to extensionsUsed and extensionsRequired
-                                        bool foundExtUsed = false;
-                                        for (const auto& extName : _outputGltf.extensionsUsed) {
-                                            if (extName == "EXT_mesh_gpu_instancing") {
-                                                foundExtUsed = true;
-                                                break;
-                                            }
-                                        }
-                                        if (!foundExtUsed) {
-                                            _outputGltf.extensionsUsed.push_back("EXT_mesh_gpu_instancing");
-                                            // Check originalGltf->extensionsRequired too
-                                            for(const auto& reqExt : originalGltf->extensionsRequired){
-                                                if(reqExt == "EXT_mesh_gpu_instancing"){
-                                                    bool alreadyRequired = false;
-                                                    for(const auto& outReqExt : _outputGltf.extensionsRequired){
-                                                        if(outReqExt == "EXT_mesh_gpu_instancing"){
-                                                            alreadyRequired = true;
-                                                            break;
-                                                        }
-                                                    }
-                                                    if(!alreadyRequired){
-                                                        _outputGltf.extensionsRequired.push_back("EXT_mesh_gpu_instancing");
-                                                    }
-                                                    break; 
+                            // Only add the extension if attributes were successfully populated
+                            if (!newGpuInstancingExtensionStruct.attributes.empty()) {
+                                // The if block for originalInstancingJson.count("extras") is removed here.
+                                
+                                nodeForExportedGlb.extensions["EXT_mesh_gpu_instancing"] = newGpuInstancingExtensionStruct; 
+
+                                // Add to extensionsUsed and extensionsRequired
+                                bool foundExtUsed = false;
+                                for (const auto& extName : _outputGltf.extensionsUsed) {
+                                    if (extName == "EXT_mesh_gpu_instancing") {
+                                        foundExtUsed = true;
+                                        break;
+                                    }
+                                }
+                                if (!foundExtUsed) {
+                                    _outputGltf.extensionsUsed.push_back("EXT_mesh_gpu_instancing");
+                                    // Check originalGltf->extensionsRequired too
+                                    for(const auto& reqExt : originalGltf->extensionsRequired){
+                                        if(reqExt == "EXT_mesh_gpu_instancing"){
+                                            bool alreadyRequired = false;
+                                            for(const auto& outReqExt : _outputGltf.extensionsRequired){
+                                                if(outReqExt == "EXT_mesh_gpu_instancing"){
+                                                    alreadyRequired = true;
+                                                    break;
                                                 }
                                             }
+                                            if(!alreadyRequired){
+                                                _outputGltf.extensionsRequired.push_back("EXT_mesh_gpu_instancing");
+                                            }
+                                            break; 
                                         }
-                                    } else if (!newInstancingAttributesJson.empty()) {
-                                         // This case means newInstancingAttributesJson was not empty initially, but all attributes failed conversion or were skipped.
-                                    } else if (originalInstancingJson.count("attributes") && !originalInstancingJson.at("attributes").empty()) {
-                                         // This case means newInstancingAttributesJson was empty, but original had attributes.
-                                         // This implies all accessor copies failed for the attributes before this stage.
                                     }
-                                } else {
-                                     // This case means originalInstancingJson didn't have attributes or they were empty, and newInstancingAttributesJson is consequently empty.
                                 }
-                            } else {
+                            } else if (!newInstancingAttributesJson.empty()) {
+                                 // This case means newInstancingAttributesJson was not empty initially, but all attributes failed conversion or were skipped.
+                            } else if (originalInstancingJson.count("attributes") && !originalInstancingJson.at("attributes").empty()) {
+                                 // This case means newInstancingAttributesJson was empty, but original had attributes.
+                                 // This implies all accessor copies failed for the attributes before this stage.
                             }
-                        } catch (const std::bad_any_cast& e) {
-                            logError("Failed to cast EXT_mesh_gpu_instancing extension content for mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name + ". Error: " + std::string(e.what()));
-                        } catch (const nlohmann::json::exception& e) {
-                            logError("JSON processing error for EXT_mesh_gpu_instancing for mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name + ". Error: " + std::string(e.what()));
+                        } else {
+                             // This case means originalInstancingJson didn't have attributes or they were empty, and newInstancingAttributesJson is consequently empty.
                         }
                     } else {
                     }
-                } else if (!pOriginalNodeProvidingTransform) { 
-                }
-                
-                _outputGltf.nodes.push_back(std::move(nodeForExportedGlb));
-                int32_t nodeIndexInOutput = static_cast<int32_t>(_outputGltf.nodes.size() - 1);
-
-                CesiumGltf::Scene scene;
-                scene.nodes.push_back(nodeIndexInOutput);
-                if (!currentOriginalMesh.name.empty()) {
-                     scene.name = "scene_for_" + currentOriginalMesh.name;
-                } else {
-                     scene.name = "scene_for_mesh_" + std::to_string(meshIdx);
+                } catch (const std::bad_any_cast& e) {
+                    logError("Failed to cast EXT_mesh_gpu_instancing extension content for mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name + ". Error: " + std::string(e.what()));
+                } catch (const nlohmann::json::exception& e) {
+                    logError("JSON processing error for EXT_mesh_gpu_instancing for mesh " + std::to_string(meshIdx) + " from node " + pOriginalNodeProvidingInstancing->name + ". Error: " + std::string(e.what()));
                 }
-                _outputGltf.scenes.push_back(std::move(scene));
-                _outputGltf.scene = static_cast<int32_t>(_outputGltf.scenes.size() - 1);
+            } else {
+            }
+        } else if (!pOriginalNodeProvidingTransform) { 
+        }
 
-                if (!_outputGltf.buffers.empty()) {
-                    _outputGltf.buffers[0].byteLength = static_cast<int64_t>(_outputBufferData.size());
-                } else {
-                    logError("CRITICAL: Output GLTF model has no buffers defined after resetInternalState. Skipping GLB write for mesh " + std::to_string(meshIdx));
-                    overallSuccess = false;
-                    continue;
-                }
-                
-                std::string meshNamePart = currentOriginalMesh.name;
-                if (meshNamePart.empty()) {
-                    meshNamePart = "mesh_" + std::to_string(meshIdx);
-                } else {
-                    std::string sanitizedMeshName;
-                    for (char c : meshNamePart) {
-                        if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.') { 
-                            sanitizedMeshName += c;
-                        } else {
-                            sanitizedMeshName += '_'; 
-                        }
-                    }
-                    meshNamePart = sanitizedMeshName;
-                }
+        applyMeshDequantization(nodeForExportedGlb);
+        _outputGltf.nodes.push_back(std::move(nodeForExportedGlb));
+        int32_t nodeIndexInOutput = static_cast<int32_t>(_outputGltf.nodes.size() - 1);
 
-                std::filesystem::path originalFileStem = loadedModel.originalPath.stem();
-                std::filesystem::path outputFileName = originalFileStem.string() + "_" + meshNamePart + ".glb";
-                std::filesystem::path outputPath = outputDirectory / outputFileName;
+        CesiumGltf::Scene scene;
+        scene.nodes.push_back(nodeIndexInOutput);
+        if (!currentOriginalMesh.name.empty()) {
+             scene.name = "scene_for_" + currentOriginalMesh.name;
+        } else {
+             scene.name = "scene_for_mesh_" + std::to_string(meshIdx);
+        }
+        _outputGltf.scenes.push_back(std::move(scene));
+        _outputGltf.scene = static_cast<int32_t>(_outputGltf.scenes.size() - 1);
 
-                logMessage("Serializing segmented GLB for: " + outputPath.string());
-                gsl::span<const std::byte> bufferSpan(_outputBufferData);
-                
-                CesiumGltfWriter::GltfWriterOptions writerOptions; 
-                CesiumGltfWriter::GltfWriterResult result = _gltfWriter.writeGlb(_outputGltf, bufferSpan, writerOptions);
+        if (_outputGltf.buffers.empty()) {
+            logError("CRITICAL: Output GLTF model has no buffers defined after resetInternalState. Skipping GLB write for mesh " + std::to_string(meshIdx));
+            return std::nullopt;
+        }
+        finalizeOutputBuffer();
 
-                for(const auto& error : result.errors) {
-                    GltfInstancing::logError("GLB Writer Error (mesh " + std::to_string(meshIdx) + "): " + error);
-                }
-                for(const auto& warning : result.warnings) {
-                    GltfInstancing::logMessage("WARNING: GLB Writer Warning (mesh " + std::to_string(meshIdx) + "): " + warning);
-                }
+        gsl::span<const std::byte> bufferSpan(_outputBufferData);
+        CesiumGltfWriter::GltfWriterOptions writerOptions;
+        CesiumGltfWriter::GltfWriterResult result = _gltfWriter.writeGlb(_outputGltf, bufferSpan, writerOptions);
 
-                if (result.gltfBytes.empty()) { 
-                    logError("Failed to serialize GLB (mesh " + std::to_string(meshIdx) + ", GltfWriterResult has empty gltfBytes) for: " + outputPath.string());
-                    overallSuccess = false;
-                } else {
-                    std::vector<std::byte> glbBytes = std::move(result.gltfBytes);
-                    std::ofstream outFile(outputPath, std::ios::binary);
-                    if (!outFile.is_open()) { 
-                        logError("Failed to open file for writing (mesh " + std::to_string(meshIdx) + "): " + outputPath.string() + " - Error: " + strerror(errno));
-                        overallSuccess = false;
-                    } else {
-                        outFile.write(reinterpret_cast<const char*>(glbBytes.data()), static_cast<std::streamsize>(glbBytes.size()));
-                        if (outFile.fail()) { 
-                            logError("Failed to write all data to file (mesh " + std::to_string(meshIdx) + "): " + outputPath.string() + " - Error: " + strerror(errno));
-                            overallSuccess = false;
-                        }
-                        outFile.close(); 
-                        if(overallSuccess && !outFile.fail()){ 
-                             logMessage("Successfully wrote segmented GLB: " + outputPath.string());
-                        }
-                    }
-                }
-            }
+        for(const auto& error : result.errors) {
+            GltfInstancing::logError("GLB Writer Error (mesh " + std::to_string(meshIdx) + "): " + error);
         }
-        return overallSuccess;
+        for(const auto& warning : result.warnings) {
+            GltfInstancing::logMessage("WARNING: GLB Writer Warning (mesh " + std::to_string(meshIdx) + "): " + warning);
+        }
+
+        if (result.gltfBytes.empty()) {
+            logError("Failed to serialize GLB (mesh " + std::to_string(meshIdx) + " of " + loadedModel.originalPath.string() + ", GltfWriterResult has empty gltfBytes).");
+            return std::nullopt;
+        }
+        return std::move(result.gltfBytes);
     }
 } // namespace GltfInstancing
\ No newline at end of file
@@ -4,12 +4,23 @@
 #include "utilities.h"
 #include "instancing_detector.h" // For InstancingDetectionResult and related structs
 #include "glb_reader.h"         // For LoadedGltfModel (to access original model data)
+#include "resource_hashing.h"   // For content-based resource deduplication
+#include "mesh_batcher.h"       // For batching non-instanced meshes
+#include "lod_generator.h"      // For MeshLodSet
+#include "geometry_compression.h" // For GeometryCompressionOptions
+#include "model_cache.h"        // For ModelCache (out-of-core model source)
 
 #include <vector>
 #include <string>
 #include <filesystem>
 #include <map>
+#include <unordered_map>
 #include <optional>
+#include <functional>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <utility>
 
 #include <CesiumGltf/Model.h>
 #include <CesiumGltfWriter/GltfWriter.h>
@@ -39,12 +50,120 @@ namespace GltfInstancing {
         // However, for simplicity initially, we might copy entire buffers if they are referenced.
         // Let's refine this: we'll have one main new buffer.
         // map (originalModelId, originalBufferViewIndex) -> new BufferView index which points to new combined buffer
+
+        // Content-addressed dedup across source models: identical resources (by ResourceContentHasher,
+        // or accessor data hash) map to the single copy already in the output. The per-index maps
+        // above stay the fast path; these are consulted on the first copy of each source resource.
+        using ContentIndexMap = std::unordered_map<ContentHash128, int, ContentHash128Hasher>;
+        ContentIndexMap bufferViewsByContent;
+        ContentIndexMap accessorsByContent;
+        ContentIndexMap materialsByContent;
+        ContentIndexMap texturesByContent;
+        ContentIndexMap samplersByContent;
+        ContentIndexMap imagesByContent;
+        std::map<int, ResourceContentHasher> contentHashers; // originalModelId -> memoized hasher
+
+        ResourceContentHasher& hasherFor(int originalModelId, const CesiumGltf::Model& model) {
+            ResourceContentHasher& hasher = contentHashers.try_emplace(originalModelId, model).first->second;
+            hasher.rebind(model); // Out of core the model may have been reloaded since
+            return hasher;
+        }
+    };
+
+
+    // A copy into the output buffer that is deferred until the layout of the whole GLB is known.
+    // Fills byteLength bytes at destinationOffset. Either gathers elementCount elements of
+    // elementSize bytes, sourceStride apart, from source (a source model's buffer, which must stay
+    // alive until the GLB is written), or runs generate on the destination region.
+    struct PendingBufferWrite {
+        size_t destinationOffset = 0;
+        size_t byteLength = 0;
+        const std::byte* source = nullptr;
+        size_t sourceStride = 0;
+        size_t elementSize = 0;
+        size_t elementCount = 0;
+        std::function<void(std::byte* destination)> generate;
+    };
+
+    // Output encoding options for GlbWriter.
+    struct GlbWriterOptions {
+        // Compact EXT_mesh_gpu_instancing attributes: TRANSLATION relative to a per-group centre
+        // stored on the instanced node (keeps float precision at georeferenced coordinates),
+        // ROTATION as normalized SHORT (allowed by EXT_mesh_gpu_instancing), SCALE omitted when every
+        // instance has unit scale. Default: plain FLOAT VEC3/VEC4/VEC3 in world coordinates.
+        bool compactInstanceAttributes = false;
+
+        // Merge non-instanced meshes that share an output material into large primitives with
+        // their transforms baked in (see MeshBatcher), at most batchVertexBudget vertices each.
+        // Every source mesh stays pickable as a feature (_FEATURE_ID_0, EXT_mesh_features) whose
+        // name is kept in an EXT_structural_metadata property table. Meshes the batcher cannot
+        // merge are written as regular nodes.
+        bool batchNonInstancedMeshes = false;
+        size_t batchVertexBudget = 262144;
+
+        // Rewrite every written mesh (instanced representatives once per group, regular
+        // non-instanced nodes, LOD meshes, batches) through optimizePrimitive / optimizeBatch:
+        // duplicate vertices welded, triangles ordered for vertex cache and overdraw, vertices
+        // for fetch locality. Meshes unpackTriangleMesh cannot read are copied verbatim.
+        bool optimizeMeshes = false;
+
+        // Quantization (KHR_mesh_quantization) and EXT_meshopt_compression of the written
+        // geometry. Applies to meshes that are rewritten anyway (LODs, optimizeMeshes, batches)
+        // and to every mesh unpackTriangleMesh can read; other meshes are copied as they are.
+        GeometryCompressionOptions compression;
+
+        // Keep each written GLB in memory (glTF model plus BIN buffer) in its GlbOutputArtifact,
+        // so later stages can use it without parsing the file again. Ignored for GLBs with
+        // EXT_meshopt_compression, whose views only decode on load; those are re-read from disk.
+        bool retainOutputModels = false;
+
+        // Element IDs by source mesh name (the *_IDExport.csv join). When set, every instance of
+        // the instanced GLBs becomes a feature of the element table (_FEATURE_ID_0 instance
+        // attribute, EXT_instance_features), the table gets an elementId column next to the
+        // source mesh names, and regular non-instanced nodes carry theirs in extras.elementId.
+        // Ignored for instances when the writer reads an out-of-core model source.
+        const std::unordered_map<std::string, std::string>* elementIds = nullptr;
+    };
+
+    // What a write call produced, for the stages that consume Stage 1 outputs.
+    struct GlbOutputArtifact {
+        std::filesystem::path path;
+        BoundingBox bounds; // World bounds in glTF (y-up) coordinates
+        // Names of the written meshes and of the source meshes batched into them (feature names).
+        std::vector<std::string> meshNames;
+        // The GLB as GlbReader would load it; only with GlbWriterOptions::retainOutputModels.
+        std::optional<LoadedGltfModel> model;
     };
 
+    // How writeMeshesAsSeparateGlbs lays out its output.
+    struct SegmentationOptions {
+        // Worker threads building segmented GLBs; values <= 0 use all hardware threads.
+        int threadCount = 1;
 
+        // Pack all segmented GLBs, 8-byte aligned, into <archiveName>.bin and list them in
+        // <archiveName>.json (name, source file, mesh index, byteOffset, byteLength) instead of
+        // writing one file per mesh.
+        bool packArchive = false;
+        std::string archiveName = "segmented_meshes";
+    };
+
+    // All state of a GLB being built lives in the writer instance, so one writer is one build
+    // context. Separate writers over the same read-only source models (or the same ModelCache)
+    // may run concurrently; a single writer must not be shared between threads.
     class GlbWriter {
     public:
-        GlbWriter();
+        explicit GlbWriter(const GlbWriterOptions& options = GlbWriterOptions());
+
+        // Out-of-core pass 2: source models are acquired from modelSource by model ID instead of
+        // being looked up in originalModels (which may then be empty). Source buffer data is
+        // not referenced between layout and output; each copy re-acquires its model when the
+        // GLB is written, so resident memory stays bounded by the cache. nullptr restores the
+        // in-memory behaviour. The cache must outlive the write calls.
+        void setModelSource(ModelCache* modelSource) { _modelSource = modelSource; }
+
+        // The artifact of the last successful writeInstancedGlb / writeInstancedMeshesOnly /
+        // writeNonInstancedMeshesOnly call, moved out of the writer; std::nullopt if there is none.
+        std::optional<GlbOutputArtifact> takeOutputArtifact() { return std::exchange(_lastOutput, std::nullopt); }
 
         // Main function to generate a new GLB file
         // loadedModels: Vector of original models, needed for accessing mesh/material data.
@@ -52,10 +171,14 @@ namespace GltfInstancing {
         // outputPath: Path to write the new GLB file.
         // Returns the path to the generated GLB if successful, std::nullopt otherwise.
         // Also returns the overall bounding box of the generated content.
+        // meshLods: simplified meshes written in place of their source meshes, for coarser tile
+        // levels; meshes without an entry are copied as they are. Meshes that collapsed
+        // completely are left out.
         std::optional<std::pair<std::filesystem::path, BoundingBox>> writeInstancedGlb(
             const std::vector<LoadedGltfModel>& originalModels,
             const InstancingDetectionResult& detectionResult,
-            const std::filesystem::path& outputPath);
+            const std::filesystem::path& outputPath,
+            const MeshLodSet* meshLods = nullptr);
 
         // 新增：只输出实例化的mesh
         std::optional<std::pair<std::filesystem::path, BoundingBox>> writeInstancedMeshesOnly(
@@ -70,27 +193,103 @@ namespace GltfInstancing {
             const std::filesystem::path& outputPath);
 
         // New method for mesh segmentation
+        // Writes every mesh of sourceModels as a GLB of its own, carrying the transform or the
+        // EXT_mesh_gpu_instancing data of the first node that uses the mesh. The GLBs are built
+        // concurrently by per-worker writers created with this writer's options.
         bool writeMeshesAsSeparateGlbs(
             const std::vector<LoadedGltfModel>& sourceModels,
-            const std::filesystem::path& outputDirectory
+            const std::filesystem::path& outputDirectory,
+            const SegmentationOptions& segmentationOptions = SegmentationOptions()
         );
 
     private:
+        GlbWriterOptions _options;
         CesiumGltfWriter::GltfWriter _gltfWriter;
         CesiumGltf::Model _outputGltf; // The glTF model we are building
         std::vector<std::byte> _outputBufferData; // Combined binary buffer for the new GLB
+        // Two-phase buffer construction: copy* calls only lay out bufferViews (advancing
+        // _plannedBufferSize) and queue their copies; finalizeOutputBuffer() sizes
+        // _outputBufferData once and performs all queued copies.
+        size_t _plannedBufferSize = 0;
+        std::vector<PendingBufferWrite> _pendingWrites;
         std::map<std::pair<int, int>, int> _materialRemapping; // modelId, oldMaterialId -> newMaterialId
         std::map<std::pair<int, int>, int> _textureRemapping;  // modelId, oldTextureId -> newTextureId
         std::map<std::pair<int, int>, int> _samplerRemapping;  // modelId, oldSamplerId -> newSamplerId
         std::map<std::pair<int, int>, int> _imageRemapping;    // modelId, oldImageId -> newImageId
+        const MeshLodSet* _meshLods = nullptr; // Set for the duration of writeInstancedGlb
+        ModelCache* _modelSource = nullptr;
+        // Keeps the model last returned by getOriginalModelById alive while it is being copied.
+        mutable std::shared_ptr<const LoadedGltfModel> _pinnedSourceModel;
+        // Meshes re-encoded for this GLB (optimizeMeshes); the buffer writes point into them.
+        // A deque, so adding meshes never moves the data of earlier ones.
+        std::deque<SimplifiedMesh> _rewrittenMeshes;
+        // Output mesh index -> matrix its quantized positions must be multiplied with; applied
+        // by the nodes that place the mesh.
+        std::map<int32_t, glm::dmat4> _meshDequantization;
+        // Instance lists with the dequantization baked in; read when the GLB is written.
+        std::deque<std::vector<MeshInstanceInfo>> _dequantizedInstances;
+        // Buffer the meshopt-compressed views decode into (no data of its own), -1 until used.
+        int32_t _meshoptFallbackBuffer = -1;
+        size_t _meshoptFallbackSize = 0;
+        std::optional<GlbOutputArtifact> _lastOutput;
         
         // Helper to reset internalState for a new GLB file construction
         void resetInternalState();
 
-        // Helper to add data to the main output buffer and create a bufferView for it
+        // Builds the GLB of mesh meshIdx of loadedModel for writeMeshesAsSeparateGlbs and returns
+        // its bytes; std::nullopt if the mesh could not be copied or serialized.
+        std::optional<std::vector<std::byte>> buildSegmentedMeshGlb(
+            const LoadedGltfModel& loadedModel,
+            int modelIdx,
+            size_t meshIdx,
+            const CesiumGltf::Node* pOriginalNodeProvidingInstancing,
+            const CesiumGltf::Node* pOriginalNodeProvidingTransform);
+
+        // Helper to lay out data in the main output buffer and create a bufferView for it.
+        // The bytes are copied by finalizeOutputBuffer(), so data must stay valid until then.
         // Returns the index of the newly created BufferView.
         int32_t addDataToBuffer(const gsl::span<const std::byte>& data, int32_t byteStrideOptional, bool isVertexBuffer);
 
+        // Same as addDataToBuffer for elementCount elements of elementSize bytes that lie
+        // sourceStride bytes apart; they are packed tightly in the output.
+        int32_t addStridedDataToBuffer(const std::byte* source, size_t sourceStride, size_t elementSize, size_t elementCount);
+
+        // addStridedDataToBuffer for data at byteOffset of buffer bufferIndex of a source model.
+        // With a model source the copy re-acquires the model when the GLB is written instead of
+        // keeping a pointer into it.
+        int32_t addSourceDataToBuffer(
+            const CesiumGltf::Model& sourceModel,
+            int sourceModelId,
+            int32_t bufferIndex,
+            size_t byteOffset,
+            size_t sourceStride,
+            size_t elementSize,
+            size_t elementCount);
+
+        // Lays out a zero-filled region of byteLength bytes, aligned to alignment (a multiple of 4)
+        // in the main buffer and creates its BufferView. Fill it with queueBufferGenerator.
+        // Returns the BufferView index, or -1 on failure.
+        int32_t reserveBufferView(size_t byteLength, size_t alignment = 4);
+
+        // Queues generate to fill byteLength bytes at destinationOffset of the output buffer
+        // (regions laid out with reserveBufferView).
+        void queueBufferGenerator(size_t destinationOffset, size_t byteLength, std::function<void(std::byte* destination)> generate);
+
+        // Second phase: allocates the output buffer once at its planned size, performs all queued
+        // writes (memcpy for tightly packed sources, a gather for strided ones) and sets
+        // buffers[0].byteLength. Used where the GLB is serialized in memory.
+        void finalizeOutputBuffer();
+
+        // Second phase for file output: writes the GLB header and JSON chunk, then streams the
+        // BIN chunk to outputPath by running the queued writes in offset order. The BIN content
+        // never exists in memory as a whole; only one write's worth of gather/generator scratch.
+        // On success records _lastOutput for bounds and elementNames (batched mesh names); with
+        // retainOutputModels the buffer is built in memory first and kept in the artifact.
+        bool writeGlbStreamed(
+            const std::filesystem::path& outputPath,
+            const BoundingBox& bounds,
+            const std::vector<std::string>& elementNames = {});
+
         // Helpers for copying resources and managing remapping
         int32_t copyBufferView(const CesiumGltf::Model& oldModel, int32_t oldBufferViewIndex, int oldModelId, ResourceRemapping& remapping);
         int32_t copyAccessor(const CesiumGltf::Model& oldModel, int32_t oldAccessorIndex, int oldModelId, ResourceRemapping& remapping, bool skipBufferViewRemap, bool isIndicesAccessor);
@@ -102,15 +301,71 @@ namespace GltfInstancing {
 
         // Helper to copy a mesh definition (primitives, materials, etc.)
         // Returns the index of the newly copied mesh in _outputGltf.
+        // Writes the simplified mesh instead when _meshLods has one, and optimizes the mesh
+        // first when optimizeMeshes is set.
         int32_t copyMeshDefinition(
             const CesiumGltf::Model& originalModel,
             int32_t originalMeshIndex,
             int originalModelId, // To use in remapping keys
-            ResourceRemapping& remapping);
+            ResourceRemapping& remapping,
+            bool allowPositionQuantization = true); // false if the caller cannot dequantize
+
+        // The entry of _meshLods for (modelId, meshIndex), or nullptr.
+        const SimplifiedMesh* findSimplifiedMesh(int modelId, int32_t meshIndex) const;
+
+        // Writes simplified as a new mesh (new accessors in the source formats, source materials).
+        // Its data must stay valid until the GLB is written (_meshLods, _rewrittenMeshes).
+        // Returns -1 if it has no primitives left.
+        int32_t copySimplifiedMesh(
+            const CesiumGltf::Model& originalModel,
+            int32_t originalMeshIndex,
+            int originalModelId,
+            const SimplifiedMesh& simplified,
+            ResourceRemapping& remapping,
+            bool allowPositionQuantization = true);
+
+        // Creates the index accessor of a TRIANGLES primitive with vertexCount vertices:
+        // UNSIGNED_SHORT up to 65535 vertices (glTF reserves index 65535), UNSIGNED_INT otherwise.
+        // Returns -1 on failure.
+        // Meshopt-encoded (TRIANGLES mode) when compression.meshoptCompression is set.
+        int32_t addTriangleIndexAccessor(std::vector<uint32_t>&& indices, size_t vertexCount);
+
+        // Lays out a vertex stream of vertexCount elements, byteStride bytes each, as an
+        // ARRAY_BUFFER view; meshopt-encoded (ATTRIBUTES mode) when compression is on and the
+        // stride allows it. Takes ownership of data. Returns the BufferView index, or -1.
+        int32_t addVertexBufferView(std::vector<std::byte>&& data, size_t byteStride, size_t vertexCount);
+
+        // addVertexBufferView plus an accessor of the given format over it.
+        int32_t addVertexAccessor(
+            std::vector<std::byte>&& data,
+            size_t byteStride,
+            int32_t componentType,
+            const std::string& type,
+            bool normalized,
+            size_t vertexCount);
 
-        // Creates TRS accessors for EXT_mesh_gpu_instancing
+        // addVertexAccessor for a quantized stream; copies its min/max and declares
+        // KHR_mesh_quantization.
+        int32_t addQuantizedAccessor(QuantizedAttribute&& attribute, const std::string& type, size_t vertexCount);
+
+        // Turns the view (currently holding the encoded bytes in buffer 0) into an
+        // EXT_meshopt_compression view: the extension points at the encoded bytes, the view
+        // itself at byteLength decoded bytes in the fallback buffer, created on first use.
+        void moveToMeshoptFallback(int32_t bufferViewIndex, size_t byteLength, size_t byteStride, size_t count, const std::string& mode);
+
+        // Folds the dequantization of node.mesh (if any) into the node's TRS.
+        void applyMeshDequantization(CesiumGltf::Node& node) const;
+
+        // removeUnusedAccessors / BufferViews / Buffers; buffers are kept as they are once the
+        // meshopt fallback buffer exists.
+        void removeUnusedObjects();
+
+        // Creates TRS accessors for EXT_mesh_gpu_instancing. All instance matrices are decomposed
+        // in one batch directly into the output buffer. Translations are written relative to
+        // translationOrigin (the instanced node's translation).
         void createInstanceTRS_Accessors(
             const std::vector<MeshInstanceInfo>& instances,
+            const glm::dvec3& translationOrigin,
             int32_t& translationAccessorIndex,
             int32_t& rotationAccessorIndex,
             int32_t& scaleAccessorIndex
@@ -125,12 +380,48 @@ namespace GltfInstancing {
             const std::string& representativeMeshName // Added for node name
         );
 
+        // Makes the instances of the instanced node at nodeIndex features of the element table:
+        // instance i gets feature ID elementNames.size() + i through a _FEATURE_ID_0 instance
+        // attribute and EXT_instance_features, and its source mesh name is appended to
+        // elementNames. Does nothing without GlbWriterOptions::elementIds or beyond
+        // MeshBatcher::kMaxFeatureCount features.
+        void addInstanceFeatures(
+            const std::vector<LoadedGltfModel>& originalModels,
+            int32_t nodeIndex,
+            const std::vector<MeshInstanceInfo>& instances,
+            std::vector<std::string>& elementNames);
+
+        // Writes one merged primitive (vertex data, indices, _FEATURE_ID_0 and EXT_mesh_features
+        // referring to property table 0) as a mesh and a node placed at batch.origin.
+        // Returns the node index, or -1 on failure.
+        int32_t createBatchedNode(GeometryBatch&& batch, size_t batchIndex);
+
+        // Adds the EXT_structural_metadata schema and the element name property table (row i is
+        // feature ID i), with an elementId column when GlbWriterOptions::elementIds is set.
+        // Must run after removeUnused*, which does not see buffer views referenced only from the
+        // metadata extension.
+        bool addElementNameTable(const std::vector<std::string>& names);
+
+        // Adds nonInstancedMeshes to the output: merged by MeshBatcher when batchNonInstancedMeshes
+        // is set, as one node per mesh otherwise (and for meshes the batcher cannot merge). Appends
+        // the created nodes to rootNodeIndices, merges their world bounds into overallBoundingBox and
+        // appends the name of every batched mesh (its feature ID) to elementNames, for
+        // addElementNameTable.
+        void addNonInstancedMeshes(
+            const std::vector<LoadedGltfModel>& originalModels,
+            const std::vector<NonInstancedMeshInfo>& nonInstancedMeshes,
+            ResourceRemapping& remapping,
+            std::vector<int32_t>& rootNodeIndices,
+            BoundingBox& overallBoundingBox,
+            std::vector<std::string>& elementNames);
+
         // Helper to create a standard node for non-instanced meshes
         int32_t createNonInstancedNode(
             int32_t meshIndex,
             const TransformComponents& transform);
 
-        // Validates if an original model is accessible
+        // Validates if an original model is accessible. With a model source the model is acquired
+        // from it and stays valid until the next call.
         const CesiumGltf::Model* getOriginalModelById(
             const std::vector<LoadedGltfModel>& originalModels,
             int modelId) const;
@@ -1,5 +1,8 @@
 ﻿#include "instancing_detector.h"
+#include "model_cache.h"
 #include "utilities.h" // For logging, transform math, compare functions (though signature is preferred)
+#include "pose_canonicalizer.h"
+#include "metrics.h"
 
 #include <CesiumGltf/Accessor.h> // Ensure Accessor.h is included for its static methods
 #include <CesiumGltf/AccessorView.h>
@@ -19,26 +22,15 @@
 #include <functional> // For std::hash
 #include <spdlog/spdlog.h> // 确保 spdlog 已包含
 #include <cctype> // For isprint
+#include <algorithm> // For std::min, std::max
+#include <cmath> // For std::floor
+#include <optional>
 
 namespace GltfInstancing {
 
-    // TARGET_MESH_NAMES and hash_combine, hashAccessorData remain here as they are specific to instancing_detector logic
-    // or are helper functions closely tied to it and not general utilities.
-    const std::set<std::string> TARGET_MESH_NAMES = {
-        "16e8662fce06bb27a5f40e5b910eeaee", // mesh105
-        "e07caf21ead09641c32f8692d73e913e", // mesh103
-        "4c70cee7887fa7ac24f1a9bf0a3a272e", // mesh146
-        // Removed other mesh names to reduce log verbosity for now
-        // "b1fc7322806483e4b3c352e26e5cc623", // mesh110
-        // "15d378bda51d9e0b24e2924a8f1c95db", // mesh111 
-        // "0c72923173eb539adffbe05dbf5c9500", // mesh64 - was part of original debug set
-        // "d5b342d0dde053f350500bd0acd93a58", // mesh36 - was part of original debug set
-        // "13be3312e3f71a73611e544c6cfa60bf", // mesh41 - was part of original debug set
-        // "989a1deb55f36defd9e9d4faaa8a9a36", // mesh32 - was part of original debug set
-        // "54b9250c8a0322b4050558c4e6d5659c", // mesh34 - was part of original debug set
-        // "a9b637f5b5b96691dd9385e77d018083"  // mesh20 - was part of original debug set      
-    };
-    
+    // hash_combine and hashAccessorData remain here as they are specific to instancing_detector logic
+    // or are helper functions closely tied to it and not general utilities. Detailed signature logs
+    // are written for the meshes of the trace_meshes filter only (see isMeshTraced).
     // Combined hash function (from various sources, e.g., Boost)
     // Moved to GltfInstancing namespace
     template <class T>
@@ -47,6 +39,8 @@ namespace GltfInstancing {
         seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     }
 
+    std::string componentTypeToString(int32_t componentType);
+
     // Hashes the data of an accessor.
     // Moved to GltfInstancing namespace
     // accessorIndex is the index in model.accessors
@@ -55,7 +49,7 @@ namespace GltfInstancing {
         const CesiumGltf::Model& model,
         int32_t accessorIndex,                      // Use index to construct AccessorView
         bool logDetailsForThisAccessor,
-        const std::string& meshNameParam,               // Parameter for context if needed, e.g. for TARGET_MESH_NAMES checks
+        const std::string& meshNameParam,               // Mesh name, for log context
         const std::string& attributeName,                   // Name of the attribute being hashed (e.g., "NORMAL", "TEXCOORD_0")
         double attributeSpecificTolerance = 0.0) {          // Specific tolerance for this attribute (e.g., normalTolerance)
 
@@ -115,124 +109,23 @@ namespace GltfInstancing {
         }
         // ---- END OF TOLERANCE HASHING FOR NORMALS ----
 
-        CesiumGltf::AccessorView<std::byte> byteView(model, accessorIndex);
-
-        // If AccessorView<std::byte> is valid (i.e. accessor data is single bytes), hash its content directly.
-        // This case is unlikely for POSITION, NORMAL etc. but good to have.
-        if (byteView.status() == CesiumGltf::AccessorViewStatus::Valid) {
-            std::string_view data_view(
-                reinterpret_cast<const char*>(byteView.data()),
-                static_cast<size_t>(byteView.size()) // byteView.size() is number of bytes here
-            );
-            size_t currentHash = std::hash<std::string_view>{}(data_view);
+        // Stream the element bytes straight out of the buffer into a 128-bit hash. This handles
+        // tightly packed and interleaved (byteStride) layouts alike, with no intermediate copy.
+        std::optional<ContentHash128> contentHash = hashAccessorContent128(model, accessor);
+        if (contentHash) {
+            size_t currentHash = contentHash->toSizeT();
             if (logDetailsForThisAccessor) {
-                logMessage("      DEBUG_SIGNATURE: Hashed directly using AccessorView<std::byte> (valid). Hash: " + std::to_string(currentHash));
+                logMessage("      DEBUG_SIGNATURE: Hashed accessor data (streamed). Accessor: " + std::to_string(accessorIndex) + ", Type: " + accessor.type +
+                           ", CompType: " + componentTypeToString(accessor.componentType) + ". Hash128: " + contentHash->toHexString());
             }
             return currentHash;
         }
 
-        // Log details if byteView failed (which is expected for multi-byte elements due to WrongSizeT)
-        // This logging block is mostly kept for debugging consistency if we see unexpected byteView statuses.
-        if (byteView.status() != CesiumGltf::AccessorViewStatus::Valid && logDetailsForThisAccessor) {
-             spdlog::info("      DEBUG_SIGNATURE: AccessorView<std::byte> initial status: {} (Enum val {}) for Accessor Index: {}. This is often expected (e.g. WrongSizeT for multi-byte elements).",
-                         static_cast<int>(byteView.status()), static_cast<int>(byteView.status()), accessorIndex);
-            // The detailed logging about accessor.type, bufferView, buffer etc. that was here previously
-            // can be re-enabled if further deep debugging of the byteView failure (beyond WrongSizeT) is needed.
-            // For now, we assume WrongSizeT is the primary reason and proceed to typed views.
-        }
-        
-        // Attempt to use a typed AccessorView to get raw data
-        // Calculate total byte size for hashing later, assuming data is tightly packed.
-        int64_t numComponents = CesiumGltf::Accessor::computeNumberOfComponents(accessor.type);
-        int64_t componentSizeInBytes = CesiumGltf::Accessor::computeByteSizeOfComponent(accessor.componentType);
-        
-        if (numComponents == 0 || componentSizeInBytes == 0) {
-             spdlog::warn("      DEBUG_SIGNATURE: Accessor {} has numComponents ({}) or componentSizeInBytes ({}) as 0. Cannot determine element size for typed view hash.", accessorIndex, numComponents, componentSizeInBytes);
-             // Fallback to min/max hash if element size cannot be determined
-        } else {
-            size_t totalByteSizeForAccessor = static_cast<size_t>(accessor.count) * static_cast<size_t>(numComponents) * static_cast<size_t>(componentSizeInBytes);
-            const std::byte* rawDataPtr = nullptr;
-            bool typedViewValid = false;
-
-            // VEC3 / FLOAT (e.g., POSITION, NORMAL)
-            if (typeString == CesiumGltf::Accessor::Type::VEC3 && accessor.componentType == CesiumGltf::Accessor::ComponentType::FLOAT) {
-                CesiumGltf::AccessorView<glm::vec3> typedView(model, accessorIndex);
-                if (typedView.status() == CesiumGltf::AccessorViewStatus::Valid) {
-                    rawDataPtr = reinterpret_cast<const std::byte*>(typedView.data());
-                    typedViewValid = true;
-
-                    if (logDetailsForThisAccessor) {
-                        spdlog::info("      DEBUG_SIGNATURE: Accessor {} is VEC3 FLOAT. TypedView is valid.");
-                        spdlog::info("      DEBUG_SIGNATURE: First up to 3 VEC3 float values:");
-                        for (int64_t i = 0; i < std::min(3LL, typedView.size()); ++i) {
-                            glm::vec3 val = typedView[i];
-                            spdlog::info("        [{}]: ({:.8f}, {:.8f}, {:.8f})", i, val.x, val.y, val.z);
-                        }
-                    }
-                } else if (logDetailsForThisAccessor) {
-                    spdlog::warn("      DEBUG_SIGNATURE: AccessorView<glm::vec3> for Accessor {} failed with status: {}", accessorIndex, static_cast<int>(typedView.status()));
-                }
-            } else if (accessor.type == CesiumGltf::Accessor::Type::SCALAR && accessor.componentType == CesiumGltf::Accessor::ComponentType::UNSIGNED_INT) {
-                CesiumGltf::AccessorView<uint32_t> typedView(model, accessorIndex);
-                if (typedView.status() == CesiumGltf::AccessorViewStatus::Valid) {
-                    rawDataPtr = reinterpret_cast<const std::byte*>(typedView.data());
-                    typedViewValid = true;
-                } else if (logDetailsForThisAccessor) {
-                    spdlog::warn("      DEBUG_SIGNATURE: AccessorView<uint32_t> for Accessor {} failed with status: {}", accessorIndex, static_cast<int>(typedView.status()));
-                }
-            } else if (accessor.type == CesiumGltf::Accessor::Type::VEC2 && accessor.componentType == CesiumGltf::Accessor::ComponentType::FLOAT) {
-                CesiumGltf::AccessorView<glm::vec2> typedView(model, accessorIndex);
-                if (typedView.status() == CesiumGltf::AccessorViewStatus::Valid) {
-                    rawDataPtr = reinterpret_cast<const std::byte*>(typedView.data());
-                    typedViewValid = true;
-                } else if (logDetailsForThisAccessor) {
-                     spdlog::warn("      DEBUG_SIGNATURE: AccessorView<glm::vec2> for Accessor {} failed with status: {}", accessorIndex, static_cast<int>(typedView.status()));
-                }
-            } else if (accessor.type == CesiumGltf::Accessor::Type::SCALAR && accessor.componentType == CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT) {
-                CesiumGltf::AccessorView<uint16_t> typedView(model, accessorIndex);
-                if (typedView.status() == CesiumGltf::AccessorViewStatus::Valid) {
-                    rawDataPtr = reinterpret_cast<const std::byte*>(typedView.data());
-                    typedViewValid = true;
-                } else if (logDetailsForThisAccessor) {
-                     spdlog::warn("      DEBUG_SIGNATURE: AccessorView<uint16_t> for Accessor {} failed with status: {}", accessorIndex, static_cast<int>(typedView.status()));
-                }
-            }
-            // Add more 'else if' blocks here for other common accessor type/componentType combinations if needed
-
-            if (typedViewValid && rawDataPtr) {
-                std::string_view data_view(reinterpret_cast<const char*>(rawDataPtr), totalByteSizeForAccessor);
-                size_t currentHash = std::hash<std::string_view>{}(data_view);
-                if (logDetailsForThisAccessor) {
-                    logMessage("      DEBUG_SIGNATURE: Hashed using typed AccessorView. Accessor: " + std::to_string(accessorIndex) + ", Type: " + accessor.type + ", CompType: " + std::to_string(accessor.componentType) + ". Hash: " + std::to_string(currentHash));
-                    // Optionally log first few bytes if needed for extreme debugging
-                    // std::ostringstream oss_bytes;
-                    // oss_bytes << "        First 16 bytes: ";
-                    // for (size_t k=0; k < std::min(totalByteSizeForAccessor, static_cast<size_t>(16)); ++k) {
-                    //    oss_bytes << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(rawDataPtr[k]) << " ";
-                    // }
-                    // logMessage(oss_bytes.str());
-                }
-                return currentHash;
-            } else if (logDetailsForThisAccessor) {
-                 logMessage("      DEBUG_SIGNATURE: Typed AccessorView approach failed or not applicable for Accessor " + std::to_string(accessorIndex) + ". Type: " + accessor.type + ", CompType: " + std::to_string(accessor.componentType) + ". Proceeding to fallback hash.");
-            }
-        } // End of if (numComponents > 0 && componentSizeInBytes > 0)
-
-        // Fallback: Hash accessor properties including min/max if typed view failed or was not applicable
-        // The detailed logging that was previously inside the 'if (byteView.status() != CesiumGltf::AccessorViewStatus::Valid)' block
-        // regarding accessor.type, componentType, bufferView, buffer, etc. is now implicitly covered by the fact we reached here.
-        // If we still want that explicit logging, it can be re-added here, perhaps conditioned on logDetailsForThisAccessor.
-        // For now, assume it was logged if byteView failed initially with logDetailsForThisAccessor.
-
-        if (logDetailsForThisAccessor) { // This implies we are already logging details for this accessor
-             spdlog::info("      DEBUG_SIGNATURE: Fallback hashing for Accessor Index: {}. Original byteView status: {} (likely WrongSizeT)", 
-                         accessorIndex, static_cast<int>(byteView.status()));
-             // We can re-add the very detailed logs (type hex, buffer details etc.) here if the typed view strategy
-             // fails often and we need to re-investigate the byteView path.
-             // Example:
-             // std::string typeDetailsMsg = "      DEBUG_SIGNATURE: Fallback - Detailed Type Check for Accessor " + ...
-             // logMessage(typeDetailsMsg);
-             // logMessage("      DEBUG_SIGNATURE: Fallback - Accessor Details: Index: " + ...);
+        // Fallback: only reached when the bytes cannot be located (no bufferView, sparse accessor,
+        // or an out-of-range view). Hash the accessor properties including min/max.
+        countMetric(MetricCounter::FallbackHashes);
+        if (logDetailsForThisAccessor) {
+             spdlog::info("      DEBUG_SIGNATURE: Fallback hashing for Accessor Index: {} (no bufferView, sparse or invalid view).", accessorIndex);
         }
         
         size_t fallback_seed = 0;
@@ -262,9 +155,9 @@ namespace GltfInstancing {
         } else {
             hash_combine(fallback_seed, static_cast<size_t>(0xBAADF00D)); 
         }
-        
-        // Include original byteView status in fallback hash to differentiate if needed
-        hash_combine(fallback_seed, static_cast<int>(byteView.status())); 
+        if (accessor.sparse) {
+            hash_combine(fallback_seed, accessor.sparse->count);
+        }
 
         if (logDetailsForThisAccessor) {
              logMessage("      DEBUG_SIGNATURE: Accessor data hash (from FALLBACK properties): " + std::to_string(fallback_seed));
@@ -295,11 +188,19 @@ namespace GltfInstancing {
     InstancingDetector::InstancingDetector(double tolerance, 
                                            const std::set<std::string>& skipAttributes,
                                            double normalSpecificTolerance,
-                                           int instanceLimit)
+                                           int instanceLimit,
+                                           int threadCount,
+                                           bool verifyMatches,
+                                           bool canonicalizePose,
+                                           double canonicalQuantization)
         : geometryTolerance(tolerance), 
           attributesToSkipDataHashInToleranceMode(skipAttributes),
           normalTolerance(normalSpecificTolerance),
-          _instanceLimit(instanceLimit) {
+          _instanceLimit(instanceLimit),
+          _threadCount(threadCount),
+          _verifyMatches(verifyMatches),
+          _canonicalizePose(canonicalizePose),
+          _canonicalQuantization(canonicalQuantization > 0.0 ? canonicalQuantization : 1e-4) {
         if (tolerance > 0.0) {
             logMessage("InstancingDetector initialized with geometry tolerance: " + std::to_string(tolerance));
             if (normalTolerance > 0.0 && !attributesToSkipDataHashInToleranceMode.count("NORMAL")) {
@@ -327,17 +228,51 @@ namespace GltfInstancing {
             logMessage("InstancingDetector initialized with exact matching (geometry tolerance <= 0.0).");
         }
         logMessage("Instance limit for forming groups: " + std::to_string(_instanceLimit));
+        if (_verifyMatches) {
+            if (tolerance > 1e-9) {
+                logMessage("  Signature match verification is only applied in exact mode; ignored with tolerance > 0.");
+            } else {
+                logMessage("  Signature matches will be verified with a full attribute comparison.");
+            }
+        }
+        if (_canonicalizePose) {
+            if (tolerance > 1e-9) {
+                logMessage("  Pose canonicalization is only applied in exact mode; ignored with tolerance > 0.");
+            } else {
+                logMessage("  Pose canonicalization enabled (position quantization: " + std::to_string(_canonicalQuantization) + ").");
+            }
+        }
     }
 
     // Helper to hash binary data (e.g., from accessors)
     size_t hashAccessorData(const CesiumGltf::Model& model, int32_t accessorIndex, bool logDetailsForThisAccessor); // Forward declare if not already
 
+    size_t InstancingDetector::MaterialKeys::keyFor(int32_t materialIndex) const {
+        if (materialIndex < 0) {
+            return static_cast<size_t>(-1);
+        }
+        if (static_cast<size_t>(materialIndex) < hashes.size() && hashes[static_cast<size_t>(materialIndex)]) {
+            return hashes[static_cast<size_t>(materialIndex)]->toSizeT();
+        }
+        // No content identity: fall back to (file content, index)
+        if (!fileHash.empty()) {
+            ContentHasher128 hasher;
+            hasher.updateString(fileHash);
+            hasher.updateValue(materialIndex);
+            return hasher.finalize().toSizeT();
+        }
+        size_t seed = std::hash<int32_t>()(modelId);
+        seed ^= std::hash<int32_t>()(materialIndex) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        return seed;
+    }
+
     // Definition for calculatePrimitiveSignatureExact
     size_t InstancingDetector::calculatePrimitiveSignatureExact(
         const CesiumGltf::Model& model,
         const CesiumGltf::MeshPrimitive& primitive,
         bool logDetailsForThisPrimitive,
-        const std::string& meshName) {
+        const std::string& meshName,
+        const MaterialKeys& materialKeys) {
         size_t seed = 0;
         // Existing hash_combine calls from the original calculatePrimitiveSignature
         // This includes hashing material, attributes (including POSITION), and morph targets exactly.
@@ -353,7 +288,7 @@ namespace GltfInstancing {
             logMessage("    DEBUG_SIGNATURE_EXACT: Mode: " + std::to_string(primitive.mode));
         }
 
-        GltfInstancing::hash_combine(seed, primitive.material); 
+        GltfInstancing::hash_combine(seed, materialKeys.keyFor(primitive.material)); // Material content, not its index
         GltfInstancing::hash_combine(seed, primitive.mode); // Primitive mode (POINTS, LINES, TRIANGLES, etc.)
 
         // Hash indices accessor if it exists
@@ -377,13 +312,8 @@ namespace GltfInstancing {
         for (const auto& attr_pair : primitive.attributes) {
             const std::string& attrName = attr_pair.first;
             int32_t accessorIndexForAttribute = attr_pair.second;
-            // Corrected usage of meshName for determining logThisAttribute
-            bool logThisAttribute = logDetailsForThisPrimitive && GltfInstancing::TARGET_MESH_NAMES.count(meshName);
-            // If only primitive-level logging is generally on, but not for a specific mesh, this logic is fine.
-            // If the intent is to always log attributes if logDetailsForThisPrimitive is true, then it should be:
-            // bool logThisAttribute = logDetailsForThisPrimitive;
-            // The line below makes it so attributes are only logged in detail if the mesh itself is a target *and* primitive logging is on.
-            // This seems a reasonable interpretation of the original intent of TARGET_MESH_NAMES combined with primitive-specific logging flag.
+            // Primitive logging is only on for traced meshes, so their attributes are logged in detail too.
+            const bool logThisAttribute = logDetailsForThisPrimitive;
 
             if (logDetailsForThisPrimitive) {
                  logMessage("    DEBUG_SIGNATURE_EXACT: Processing Attribute: " + attrName + " (Accessor Index: " + std::to_string(accessorIndexForAttribute) + ") for mesh " + meshName);
@@ -453,11 +383,12 @@ namespace GltfInstancing {
         const CesiumGltf::Model& model,
         const CesiumGltf::MeshPrimitive& primitive,
         bool logDetailsForThisPrimitive,
-        const std::string& meshName) {
+        const std::string& meshName,
+        const MaterialKeys& materialKeys) {
 
         if (geometryTolerance <= 1e-9) { // Use a small epsilon for floating point comparison
             if (logDetailsForThisPrimitive) logMessage("    DEBUG_SIGNATURE: Using EXACT signature calculation (tolerance = " + std::to_string(geometryTolerance) + ") for mesh " + meshName);
-            return calculatePrimitiveSignatureExact(model, primitive, logDetailsForThisPrimitive, meshName);
+            return calculatePrimitiveSignatureExact(model, primitive, logDetailsForThisPrimitive, meshName, materialKeys);
         }
 
         if (logDetailsForThisPrimitive) {
@@ -469,8 +400,8 @@ namespace GltfInstancing {
 
         size_t seed = 0;
 
-        // Hash material (exact match still required)
-        GltfInstancing::hash_combine(seed, primitive.material);
+        // Hash material content (exact match still required)
+        GltfInstancing::hash_combine(seed, materialKeys.keyFor(primitive.material));
         // Hash primitive mode (POINTS, LINES, TRIANGLES, etc. - exact match required)
         GltfInstancing::hash_combine(seed, primitive.mode);
 
@@ -546,8 +477,8 @@ namespace GltfInstancing {
                 if (logDetailsForThisPrimitive) logMessage("    DEBUG_SIGNATURE: (Tolerance Mode) Hashed attribute name '" + attrName + "' for presence, skipped data hash.");
             } else {
                 // Determine if detailed data logging should be enabled for this specific attribute
-                if (logDetailsForThisPrimitive && GltfInstancing::TARGET_MESH_NAMES.count(meshName)) {
-                    // Only enable detailed data logging if it's a target mesh, primitive logging is on,
+                if (logDetailsForThisPrimitive) {
+                    // Only enable detailed data logging if it's a traced mesh (primitive logging is on),
                     // AND it's not POSITION (already handled) and not NORMAL if normal tolerance is active 
                     // (because NORMAL with tolerance has its own specific logging within hashAccessorData).
                     if (attrName != "POSITION" && !(attrName == "NORMAL" && this->normalTolerance > 1e-9)) {
@@ -610,9 +541,10 @@ namespace GltfInstancing {
     size_t InstancingDetector::calculateMeshSignature(
         const CesiumGltf::Model& model,
         const CesiumGltf::Mesh& mesh,
-        const std::string& meshName) { 
+        const std::string& meshName,
+        const MaterialKeys& materialKeys) { 
         size_t seed = 0;
-        bool logDetailsForThisMesh = GltfInstancing::TARGET_MESH_NAMES.count(meshName) > 0;
+        const bool logDetailsForThisMesh = GltfInstancing::isMeshTraced(meshName);
 
         if (logDetailsForThisMesh) {
             logMessage("  DEBUG_SIGNATURE: Calculating signature for TARGET MESH: " + meshName + 
@@ -625,7 +557,7 @@ namespace GltfInstancing {
                 logMessage("  DEBUG_SIGNATURE: Processing Primitive " + std::to_string(i) + " for mesh " + meshName);
             }
             // Pass meshName here
-            GltfInstancing::hash_combine(seed, calculatePrimitiveSignature(model, primitive, logDetailsForThisMesh, meshName));
+            GltfInstancing::hash_combine(seed, calculatePrimitiveSignature(model, primitive, logDetailsForThisMesh, meshName, materialKeys));
         }
         
         if (logDetailsForThisMesh) {
@@ -634,25 +566,350 @@ namespace GltfInstancing {
         return seed;
     }
 
-    void InstancingDetector::traverseNode(
+    void InstancingDetector::computeMeshSignatureEntry(
+        const CesiumGltf::Model& model,
+        int32_t meshIndex,
+        const MaterialKeys& materialKeys,
+        MeshSignatureEntry& entry) {
+        const CesiumGltf::Mesh& mesh = model.meshes[static_cast<size_t>(meshIndex)];
+        if (_canonicalizePose && geometryTolerance <= 1e-9) {
+            // Meshes without a reliable canonical frame keep the regular exact signature.
+            if (auto pose = computeCanonicalPose(model, mesh)) {
+                std::vector<uint64_t> primitiveMaterialKeys;
+                primitiveMaterialKeys.reserve(mesh.primitives.size());
+                for (const auto& primitive : mesh.primitives) {
+                    primitiveMaterialKeys.push_back(static_cast<uint64_t>(materialKeys.keyFor(primitive.material)));
+                }
+                if (auto canonicalHash = hashCanonicalMesh(model, mesh, *pose, _canonicalQuantization, primitiveMaterialKeys)) {
+                    size_t seed = canonicalHash->toSizeT();
+                    hash_combine(seed, std::string("canonical_pose")); // Keep apart from regular signatures
+                    entry.signature = seed;
+                    entry.poseCanonicalized = true;
+                    entry.canonicalToLocal = pose->canonicalToLocal;
+                    entry.localToCanonical = pose->localToCanonical;
+                    return;
+                }
+            }
+        }
+        entry.signature = calculateMeshSignature(model, mesh, mesh.name, materialKeys);
+        if (geometryTolerance > 1e-9) {
+            entry.primitiveBoundingBoxes.reserve(mesh.primitives.size());
+            for (const auto& prim : mesh.primitives) {
+                entry.primitiveBoundingBoxes.push_back(GltfInstancing::getPrimitiveBoundingBox(model, prim));
+            }
+        }
+    }
+
+    std::vector<InstancingDetector::MeshSignatureEntry> InstancingDetector::computeModelMeshSignatures(const LoadedGltfModel& loadedGltf) {
+        const CesiumGltf::Model& model = loadedGltf.model;
+        std::vector<MeshSignatureEntry> row(model.meshes.size());
+        std::vector<bool> referenced(model.meshes.size(), false);
+        for (const auto& node : model.nodes) {
+            if (node.mesh >= 0 && static_cast<size_t>(node.mesh) < model.meshes.size()) {
+                referenced[static_cast<size_t>(node.mesh)] = true;
+            }
+        }
+        std::vector<int32_t> meshIndices;
+        for (size_t meshIndex = 0; meshIndex < referenced.size(); ++meshIndex) {
+            if (referenced[meshIndex]) {
+                meshIndices.push_back(static_cast<int32_t>(meshIndex));
+            }
+        }
+        const MaterialKeys& materialKeys = _materialKeysByModelId.at(loadedGltf.uniqueId);
+        parallelFor(meshIndices.size(), _threadCount, [&](size_t taskIndex, int /*workerIndex*/) {
+            computeMeshSignatureEntry(model, meshIndices[taskIndex], materialKeys, row[static_cast<size_t>(meshIndices[taskIndex])]);
+        });
+        return row;
+    }
+
+    InstancingDetector::MeshSignatureTable InstancingDetector::computeMeshSignatureTable(
+        const std::vector<LoadedGltfModel>& loadedModels,
+        const std::vector<size_t>& representativeModelPosition) {
+        MeshSignatureTable table(loadedModels.size());
+
+        // Flatten the work into (model, mesh) tasks. Only meshes referenced by a node are hashed,
+        // and byte-identical files are hashed once (their row is copied from the representative).
+        std::vector<std::pair<size_t, int32_t>> tasks;
+        for (size_t modelPosition = 0; modelPosition < loadedModels.size(); ++modelPosition) {
+            const CesiumGltf::Model& model = loadedModels[modelPosition].model;
+            table[modelPosition].resize(model.meshes.size());
+            if (representativeModelPosition[modelPosition] != modelPosition) {
+                continue;
+            }
+            std::vector<bool> referenced(model.meshes.size(), false);
+            for (const auto& node : model.nodes) {
+                if (node.mesh >= 0 && static_cast<size_t>(node.mesh) < model.meshes.size()) {
+                    referenced[static_cast<size_t>(node.mesh)] = true;
+                }
+            }
+            for (size_t meshIndex = 0; meshIndex < referenced.size(); ++meshIndex) {
+                if (referenced[meshIndex]) {
+                    tasks.emplace_back(modelPosition, static_cast<int32_t>(meshIndex));
+                }
+            }
+        }
+
+        logMessage("Computing signatures for " + std::to_string(tasks.size()) + " unique mesh(es) using " +
+            std::to_string(std::min(static_cast<size_t>(resolveThreadCount(_threadCount)), std::max<size_t>(tasks.size(), 1))) + " thread(s).");
+
+        // Each task writes only its own pre-sized slot, so no locking is needed.
+        parallelFor(tasks.size(), _threadCount, [&](size_t taskIndex, int /*workerIndex*/) {
+            const size_t modelPosition = tasks[taskIndex].first;
+            const int32_t meshIndex = tasks[taskIndex].second;
+            computeMeshSignatureEntry(loadedModels[modelPosition].model, meshIndex,
+                _materialKeysByModelId.at(loadedModels[modelPosition].uniqueId),
+                table[modelPosition][static_cast<size_t>(meshIndex)]);
+        });
+
+        for (size_t modelPosition = 0; modelPosition < loadedModels.size(); ++modelPosition) {
+            size_t representative = representativeModelPosition[modelPosition];
+            if (representative != modelPosition) {
+                table[modelPosition] = table[representative];
+            }
+        }
+        return table;
+    }
+
+    InstancingDetector::ToleranceCellKey InstancingDetector::toleranceCellKey(const std::vector<BoundingBox>& primitiveBoxes) const {
+        ToleranceCellKey key;
+        if (primitiveBoxes.empty() || !primitiveBoxes.front().isValid()) {
+            return key; // Meshes without a usable box share cell (0,0,0)
+        }
+        const glm::dvec3& anchor = primitiveBoxes.front().min;
+        key.x = static_cast<int64_t>(std::floor(anchor.x / geometryTolerance));
+        key.y = static_cast<int64_t>(std::floor(anchor.y / geometryTolerance));
+        key.z = static_cast<int64_t>(std::floor(anchor.z / geometryTolerance));
+        return key;
+    }
+
+    InstancedMeshGroup& InstancingDetector::findOrCreateToleranceGroup(
+        std::vector<InstancedMeshGroup>& candidates,
+        size_t signature,
+        const std::vector<BoundingBox>& primitiveBoxes) {
+        ToleranceCellIndex& cellIndex = _toleranceGroupIndex[signature];
+        const ToleranceCellKey key = toleranceCellKey(primitiveBoxes);
+
+        size_t bestPosition = candidates.size();
+        double bestDeviation = std::numeric_limits<double>::max();
+        for (int64_t dx = -1; dx <= 1; ++dx) {
+            for (int64_t dy = -1; dy <= 1; ++dy) {
+                for (int64_t dz = -1; dz <= 1; ++dz) {
+                    auto cellIt = cellIndex.find(ToleranceCellKey{key.x + dx, key.y + dy, key.z + dz});
+                    if (cellIt == cellIndex.end()) {
+                        continue;
+                    }
+                    for (size_t position : cellIt->second) {
+                        const std::vector<BoundingBox>& repBoxes = candidates[position].representativePrimitiveBoundingBoxes;
+                        if (repBoxes.size() != primitiveBoxes.size()) {
+                            continue;
+                        }
+                        // Largest per-axis corner offset over all primitives; the mesh must be within
+                        // tolerance of the representative on every primitive.
+                        double deviation = 0.0;
+                        bool compatible = true;
+                        for (size_t i = 0; i < primitiveBoxes.size(); ++i) {
+                            if (!GltfInstancing::areBoundingBoxesSimilar(repBoxes[i], primitiveBoxes[i], geometryTolerance)) {
+                                compatible = false;
+                                countMetric(MetricCounter::BoundingBoxRejections);
+                                break;
+                            }
+                            const glm::dvec3 minOffset = glm::abs(repBoxes[i].min - primitiveBoxes[i].min);
+                            const glm::dvec3 maxOffset = glm::abs(repBoxes[i].max - primitiveBoxes[i].max);
+                            deviation = std::max({deviation, minOffset.x, minOffset.y, minOffset.z, maxOffset.x, maxOffset.y, maxOffset.z});
+                        }
+                        if (compatible && (deviation < bestDeviation || (deviation == bestDeviation && position < bestPosition))) {
+                            bestDeviation = deviation;
+                            bestPosition = position;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (bestPosition < candidates.size()) {
+            return candidates[bestPosition];
+        }
+        cellIndex[key].push_back(candidates.size());
+        return candidates.emplace_back();
+    }
+
+    bool InstancingDetector::meshMatchesRepresentative(
+        const InstancedMeshGroup& group,
+        const LoadedGltfModel& loadedGltf,
+        int32_t meshIndex) const {
+        // Out of core the representative's file may no longer be resident; it is re-acquired
+        // through the model cache (and kept alive for the comparison).
+        std::shared_ptr<const LoadedGltfModel> reacquired;
+        const LoadedGltfModel* representativeModel = nullptr;
+        auto repIt = _modelsById.find(group.representativeGltfModelIndex);
+        if (repIt != _modelsById.end()) {
+            representativeModel = repIt->second;
+        } else if (_modelCache) {
+            reacquired = _modelCache->acquire(group.representativeGltfModelIndex);
+            representativeModel = reacquired.get();
+        }
+        if (!representativeModel) {
+            return false;
+        }
+        const LoadedGltfModel& representative = *representativeModel;
+        if (group.representativeMeshIndexInModel == meshIndex &&
+            (representative.uniqueId == loadedGltf.uniqueId ||
+             (!representative.fileHash.empty() && representative.fileHash == loadedGltf.fileHash))) {
+            return true; // Same mesh of the same (or a byte-identical) file
+        }
+
+        const CesiumGltf::Model& repModel = representative.model;
+        if (group.representativeMeshIndexInModel < 0 || static_cast<size_t>(group.representativeMeshIndexInModel) >= repModel.meshes.size()) {
+            return false;
+        }
+        const CesiumGltf::Mesh& repMesh = repModel.meshes[static_cast<size_t>(group.representativeMeshIndexInModel)];
+        const CesiumGltf::Mesh& mesh = loadedGltf.model.meshes[static_cast<size_t>(meshIndex)];
+        if (repMesh.primitives.size() != mesh.primitives.size()) {
+            return false;
+        }
+        const MaterialKeys& repMaterialKeys = _materialKeysByModelId.at(representative.uniqueId);
+        const MaterialKeys& materialKeys = _materialKeysByModelId.at(loadedGltf.uniqueId);
+        for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+            // Material indices are file-local; compare the material content instead.
+            if (repMaterialKeys.keyFor(repMesh.primitives[i].material) != materialKeys.keyFor(mesh.primitives[i].material) ||
+                !comparePrimitiveAttributes(repModel, repMesh.primitives[i], loadedGltf.model, mesh.primitives[i], false)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    InstancedMeshGroup& InstancingDetector::findOrCreateExactGroup(
+        std::vector<InstancedMeshGroup>& candidates,
+        const LoadedGltfModel& loadedGltf,
+        int32_t meshIndex,
+        bool poseCanonicalized) {
+        if (!_verifyMatches || poseCanonicalized) {
+            if (candidates.empty()) {
+                candidates.emplace_back();
+            }
+            return candidates.front();
+        }
+
+        // Nodes re-using the same mesh reuse the first verification result.
+        const auto cacheKey = std::make_pair(loadedGltf.uniqueId, meshIndex);
+        auto cachedIt = _verifiedGroupPositions.find(cacheKey);
+        if (cachedIt != _verifiedGroupPositions.end()) {
+            return candidates[cachedIt->second];
+        }
+
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (meshMatchesRepresentative(candidates[i], loadedGltf, meshIndex)) {
+                _verifiedGroupPositions[cacheKey] = i;
+                return candidates[i];
+            }
+        }
+
+        if (!candidates.empty()) {
+            const std::string& meshName = loadedGltf.model.meshes[static_cast<size_t>(meshIndex)].name;
+            logWarning("Signature collision: mesh '" + meshName + "' (model " + std::to_string(loadedGltf.uniqueId) + ", mesh " + std::to_string(meshIndex) +
+                       ") has signature " + std::to_string(candidates.front().meshSignature) + " but differs from its representative(s). Creating a separate group.");
+        }
+        _verifiedGroupPositions[cacheKey] = candidates.size();
+        return candidates.emplace_back();
+    }
+
+    namespace {
+        // World matrices of the EXT_mesh_gpu_instancing instances of a node, whose own world
+        // transform is worldTransform. Empty if no attribute accessor gives an instance count.
+        std::vector<glm::dmat4> gpuInstanceWorldMatrices(
+            const CesiumGltf::Model& model,
+            const CesiumGltf::ExtensionExtMeshGpuInstancing& extData,
+            int32_t nodeIndex,
+            const glm::dmat4& worldTransform) {
+            int32_t translationAccessorIdx = extData.attributes.count("TRANSLATION") ? extData.attributes.at("TRANSLATION") : -1;
+            int32_t rotationAccessorIdx = extData.attributes.count("ROTATION") ? extData.attributes.at("ROTATION") : -1;
+            int32_t scaleAccessorIdx = extData.attributes.count("SCALE") ? extData.attributes.at("SCALE") : -1;
+
+            int64_t instanceCount = 0;
+            // Determine instance count more robustly
+            if (translationAccessorIdx != -1 && static_cast<size_t>(translationAccessorIdx) < model.accessors.size()) {
+                instanceCount = model.accessors[translationAccessorIdx].count;
+            } else if (rotationAccessorIdx != -1 && static_cast<size_t>(rotationAccessorIdx) < model.accessors.size()) {
+                instanceCount = model.accessors[rotationAccessorIdx].count;
+            } else if (scaleAccessorIdx != -1 && static_cast<size_t>(scaleAccessorIdx) < model.accessors.size()) {
+                instanceCount = model.accessors[scaleAccessorIdx].count;
+            } else {
+                // Log if attributes are present but all accessors are invalid or missing count
+                if (!extData.attributes.empty()) {
+                    logError("Node " + std::to_string(nodeIndex) + " has EXT_mesh_gpu_instancing but cannot determine instance count from its attributes.");
+                }
+                // instanceCount remains 0 if no valid accessor provides a count
+            }
+
+            std::vector<glm::dmat4> matrices;
+            if (instanceCount <= 0) {
+                return matrices;
+            }
+            std::optional<CesiumGltf::AccessorView<glm::vec3>> tView;
+            std::optional<CesiumGltf::AccessorView<glm::vec4>> rView;
+            std::optional<CesiumGltf::AccessorView<glm::vec3>> sView;
+            if (translationAccessorIdx != -1) {
+                tView.emplace(model, translationAccessorIdx);
+                if (tView->status() != CesiumGltf::AccessorViewStatus::Valid) {
+                    logError("EXT_mesh_gpu_instancing: Invalid AccessorView for TRANSLATION on node " + std::to_string(nodeIndex));
+                }
+            }
+            if (rotationAccessorIdx != -1) {
+                rView.emplace(model, rotationAccessorIdx);
+                if (rView->status() != CesiumGltf::AccessorViewStatus::Valid) {
+                    logError("EXT_mesh_gpu_instancing: Invalid AccessorView for ROTATION on node " + std::to_string(nodeIndex));
+                }
+            }
+            if (scaleAccessorIdx != -1) {
+                sView.emplace(model, scaleAccessorIdx);
+                if (sView->status() != CesiumGltf::AccessorViewStatus::Valid) {
+                    logError("EXT_mesh_gpu_instancing: Invalid AccessorView for SCALE on node " + std::to_string(nodeIndex));
+                }
+            }
+
+            matrices.reserve(static_cast<size_t>(instanceCount));
+            for (int64_t i = 0; i < instanceCount; ++i) {
+                glm::dvec3 instTranslation(0.0);
+                glm::dquat instRotation(1.0, 0.0, 0.0, 0.0); // Identity: w,x,y,z
+                glm::dvec3 instScale(1.0);
+
+                // 1. 读取平移 (TRANSLATION) 数据
+                if (tView && tView->status() == CesiumGltf::AccessorViewStatus::Valid && i < tView->size()) {
+                    instTranslation = glm::dvec3((*tView)[i]);
+                }
+                // 2. 读取旋转 (ROTATION) 数据
+                if (rView && rView->status() == CesiumGltf::AccessorViewStatus::Valid && i < rView->size()) {
+                    glm::vec4 q_xyzw = (*rView)[i];
+                    instRotation = glm::normalize(glm::dquat(q_xyzw.w, q_xyzw.x, q_xyzw.y, q_xyzw.z));
+                }
+                // 3. 读取缩放 (SCALE) 数据
+                if (sView && sView->status() == CesiumGltf::AccessorViewStatus::Valid && i < sView->size()) {
+                    instScale = glm::dvec3((*sView)[i]);
+                }
+                // 4. 计算实例的局部变换矩阵
+                glm::dmat4 instanceLocalTRSMatrix = glm::translate(glm::dmat4(1.0), instTranslation) *
+                                                    glm::mat4_cast(instRotation) *
+                                                    glm::scale(glm::dmat4(1.0), instScale);
+
+                // 5. 计算实例的世界变换矩阵
+                // worldTransform 是持有 EXT_mesh_gpu_instancing 扩展的那个节点的自身世界变换
+                matrices.push_back(worldTransform * instanceLocalTRSMatrix);
+            }
+            return matrices;
+        }
+    } // namespace
+
+    void InstancingDetector::collectNodeInstances(
         const LoadedGltfModel& loadedGltf,
         int32_t nodeIndex,
-        const glm::dmat4& currentWorldTransform,
-        std::map<size_t, InstancedMeshGroup>& potentialInstanceGroups,
+        const glm::dmat4& worldTransform,
+        PotentialGroupMap& potentialInstanceGroups,
         std::vector<NonInstancedMeshInfo>& nonInstancedItems,
-        std::map<std::pair<int, int>, size_t>& meshToSignatureCache,
-        std::vector<int32_t>& parentNodeIndicesChainForChildren 
+        const std::vector<MeshSignatureEntry>& meshSignatures
     ) {
-        if (nodeIndex < 0 || static_cast<size_t>(nodeIndex) >= loadedGltf.model.nodes.size()) {
-            logError("traverseNode: Invalid nodeIndex " + std::to_string(nodeIndex) + " for model " + loadedGltf.originalPath.string());
-            return;
-        }
-
         const CesiumGltf::Node& node = loadedGltf.model.nodes[nodeIndex];
         
-        glm::dmat4 localTransform = getLocalTransformMatrix(node);
-        glm::dmat4 worldTransform = currentWorldTransform * localTransform;
-        
         if (node.mesh >= 0) {
             if (static_cast<size_t>(node.mesh) < loadedGltf.model.meshes.size()) {
                 const CesiumGltf::Mesh& mesh = loadedGltf.model.meshes[node.mesh];
@@ -664,101 +921,41 @@ namespace GltfInstancing {
                     try {
                         const auto* extData = std::any_cast<CesiumGltf::ExtensionExtMeshGpuInstancing>(&instancingExtIt->second);
                         if (extData) {
-                            size_t baseMeshSignature;
-                            auto cacheKey = std::make_pair(loadedGltf.uniqueId, node.mesh);
-                            auto cacheIt = meshToSignatureCache.find(cacheKey);
-                            if (cacheIt != meshToSignatureCache.end()) {
-                                baseMeshSignature = cacheIt->second;
-                            } else {
-                                baseMeshSignature = calculateMeshSignature(loadedGltf.model, mesh, mesh.name);
-                                meshToSignatureCache[cacheKey] = baseMeshSignature;
-                            }
-
-                            int32_t translationAccessorIdx = extData->attributes.count("TRANSLATION") ? extData->attributes.at("TRANSLATION") : -1;
-                            int32_t rotationAccessorIdx = extData->attributes.count("ROTATION") ? extData->attributes.at("ROTATION") : -1;
-                            int32_t scaleAccessorIdx = extData->attributes.count("SCALE") ? extData->attributes.at("SCALE") : -1;
-                            
-                            int64_t instanceCount = 0;
-                            // Determine instance count more robustly
-                            if (translationAccessorIdx != -1 && static_cast<size_t>(translationAccessorIdx) < loadedGltf.model.accessors.size()) {
-                                instanceCount = loadedGltf.model.accessors[translationAccessorIdx].count;
-                            } else if (rotationAccessorIdx != -1 && static_cast<size_t>(rotationAccessorIdx) < loadedGltf.model.accessors.size()) {
-                                instanceCount = loadedGltf.model.accessors[rotationAccessorIdx].count;
-                            } else if (scaleAccessorIdx != -1 && static_cast<size_t>(scaleAccessorIdx) < loadedGltf.model.accessors.size()) {
-                                instanceCount = loadedGltf.model.accessors[scaleAccessorIdx].count;
-                            } else {
-                                // Log if attributes are present but all accessors are invalid or missing count
-                                if (!extData->attributes.empty()){
-                                    logError("Node " + std::to_string(nodeIndex) + " has EXT_mesh_gpu_instancing but cannot determine instance count from its attributes.");
-                                }
-                                // instanceCount remains 0 if no valid accessor provides a count
-                            }
-
-                            if (instanceCount > 0) {
-                                auto& group = potentialInstanceGroups[baseMeshSignature];
+                            const MeshSignatureEntry& signatureEntry = meshSignatures[static_cast<size_t>(node.mesh)];
+                            size_t baseMeshSignature = signatureEntry.signature;
+
+                            const std::vector<glm::dmat4> instanceWorldMatrices = gpuInstanceWorldMatrices(loadedGltf.model, *extData, nodeIndex, worldTransform);
+                            if (!instanceWorldMatrices.empty()) {
+                                auto& candidateGroups = potentialInstanceGroups[baseMeshSignature];
+                                InstancedMeshGroup& group = geometryTolerance > 1e-9
+                                    ? findOrCreateToleranceGroup(candidateGroups, baseMeshSignature, signatureEntry.primitiveBoundingBoxes)
+                                    : findOrCreateExactGroup(candidateGroups, loadedGltf, node.mesh, signatureEntry.poseCanonicalized);
                                 if (group.instances.empty()) { // First time encountering this base mesh (for exact or tolerance mode)
                                     group.representativeGltfModelIndex = loadedGltf.uniqueId;
                                     group.representativeMeshIndexInModel = node.mesh;
                                     group.meshSignature = baseMeshSignature;
                                     group.representativeMeshName = mesh.name;
-                                    if (geometryTolerance > 1e-9) { // Tolerance mode: compute and store representative bounding boxes
-                                        for (const auto& prim : mesh.primitives) {
-                                            group.representativePrimitiveBoundingBoxes.push_back(GltfInstancing::getPrimitiveBoundingBox(loadedGltf.model, prim));
-                                        }
-                                }
-                            }
-                            
-                            for (int64_t i = 0; i < instanceCount; ++i) {
-                                MeshInstanceInfo instanceInfo;
-                                instanceInfo.originalGltfIndex = loadedGltf.uniqueId;
-                                instanceInfo.originalNodeIndex = nodeIndex;
-                                instanceInfo.originalMeshIndex = node.mesh;
-                                
-                                    
-                                    glm::dvec3 instTranslation(0.0);
-                                    glm::dquat instRotation(1.0, 0.0, 0.0, 0.0); // Identity: w,x,y,z
-                                    glm::dvec3 instScale(1.0);
-                                    
-                                    // 1. 读取平移 (TRANSLATION) 数据
-                                    if (translationAccessorIdx != -1) {
-                                        CesiumGltf::AccessorView<glm::vec3> tView(loadedGltf.model, translationAccessorIdx);
-                                        if (tView.status() == CesiumGltf::AccessorViewStatus::Valid && i < tView.size()) {
-                                            instTranslation = glm::dvec3(tView[i]);
-                                        } else if (tView.status() != CesiumGltf::AccessorViewStatus::Valid) {
-                                            logError("EXT_mesh_gpu_instancing: Invalid AccessorView for TRANSLATION on node " + std::to_string(nodeIndex));
-                                        }
-                                    }
-                                    // 2. 读取旋转 (ROTATION) 数据
-                                    if (rotationAccessorIdx != -1) {
-                                        CesiumGltf::AccessorView<glm::vec4> rView(loadedGltf.model, rotationAccessorIdx);
-                                        if (rView.status() == CesiumGltf::AccessorViewStatus::Valid && i < rView.size()) {
-                                            glm::vec4 q_xyzw = rView[i];
-                                            instRotation = glm::normalize(glm::dquat(q_xyzw.w, q_xyzw.x, q_xyzw.y, q_xyzw.z));
-                                        } else if (rView.status() != CesiumGltf::AccessorViewStatus::Valid) {
-                                            logError("EXT_mesh_gpu_instancing: Invalid AccessorView for ROTATION on node " + std::to_string(nodeIndex));
-                                        }
+                                    group.representativeLocalToCanonical = signatureEntry.localToCanonical;
+                                    if (geometryTolerance > 1e-9) { // Tolerance mode: store representative bounding boxes
+                                        group.representativePrimitiveBoundingBoxes = signatureEntry.primitiveBoundingBoxes;
                                     }
-                                    // 3. 读取缩放 (SCALE) 数据
-                                    if (scaleAccessorIdx != -1) {
-                                        CesiumGltf::AccessorView<glm::vec3> sView(loadedGltf.model, scaleAccessorIdx);
-                                        if (sView.status() == CesiumGltf::AccessorViewStatus::Valid && i < sView.size()) {
-                                            instScale = glm::dvec3(sView[i]);
-                                        } else if (sView.status() != CesiumGltf::AccessorViewStatus::Valid) {
-                                            logError("EXT_mesh_gpu_instancing: Invalid AccessorView for SCALE on node " + std::to_string(nodeIndex));
-                                        }
+                                }
+
+                                for (const glm::dmat4& finalInstanceWorldTransform : instanceWorldMatrices) {
+                                    MeshInstanceInfo instanceInfo;
+                                    instanceInfo.originalGltfIndex = loadedGltf.uniqueId;
+                                    instanceInfo.originalNodeIndex = nodeIndex;
+                                    instanceInfo.originalMeshIndex = node.mesh;
+
+                                    // 保存世界矩阵（TRS 分解由 GlbWriter 批量完成）
+                                    instanceInfo.sourceWorldMatrix = finalInstanceWorldTransform;
+                                    if (signatureEntry.poseCanonicalized) {
+                                        // 姿态规范化：把代表网格从其规范坐标系映射到本实例网格的位置
+                                        instanceInfo.worldMatrix = finalInstanceWorldTransform * signatureEntry.canonicalToLocal * group.representativeLocalToCanonical;
+                                    } else {
+                                        instanceInfo.worldMatrix = finalInstanceWorldTransform;
                                     }
-                                    // 4. 计算实例的局部变换矩阵
-                                    glm::dmat4 instanceLocalTRSMatrix = glm::translate(glm::dmat4(1.0), instTranslation) *
-                                                                   glm::mat4_cast(instRotation) *
-                                                                   glm::scale(glm::dmat4(1.0), instScale);                                    
-                                    
-                                    // 5. 计算实例的世界变换矩阵
-                                    // worldTransform 是持有 EXT_mesh_gpu_instancing 扩展的那个节点的自身世界变换
-                                    glm::dmat4 finalInstanceWorldTransform = worldTransform * instanceLocalTRSMatrix;
-
-                                    // 6. 将实例的世界变换矩阵转换为 TransformComponents 结构
-                                    instanceInfo.transform = TransformComponents::fromMat4(finalInstanceWorldTransform);
-                                    
+
                                     group.instances.push_back(instanceInfo);
                                 }
                             }
@@ -768,117 +965,52 @@ namespace GltfInstancing {
                     }
 
                 } else { // Regular node mesh, apply custom instancing logic
-                    size_t signature;
-                    auto cacheKey = std::make_pair(loadedGltf.uniqueId, node.mesh); // Use uniqueId and mesh index
-                    auto cacheIt = meshToSignatureCache.find(cacheKey);
-                    if (cacheIt != meshToSignatureCache.end()) {
-                        signature = cacheIt->second;
-                    } else {
-                        // calculateMeshSignature internally calls calculatePrimitiveSignature, which now handles tolerance
-                        signature = calculateMeshSignature(loadedGltf.model, mesh, mesh.name);
-                        meshToSignatureCache[cacheKey] = signature;
-                    }
+                    // Precomputed in phase 1 (calculateMeshSignature handles tolerance internally)
+                    const MeshSignatureEntry& signatureEntry = meshSignatures[static_cast<size_t>(node.mesh)];
+                    size_t signature = signatureEntry.signature;
 
                     MeshInstanceInfo instanceInfo;
                     instanceInfo.originalGltfIndex = loadedGltf.uniqueId;
                     instanceInfo.originalNodeIndex = nodeIndex;
                     instanceInfo.originalMeshIndex = node.mesh;
-                    instanceInfo.transform = TransformComponents::fromMat4(worldTransform);
+                    instanceInfo.worldMatrix = worldTransform;
+                    instanceInfo.sourceWorldMatrix = worldTransform;
                     
-                    if (GltfInstancing::TARGET_MESH_NAMES.count(mesh.name)) { 
-                        logMessage("Node " + std::to_string(nodeIndex) + " (mesh name: " + mesh.name + ", mesh index: " + std::to_string(node.mesh) + ") uses mesh with signature: " + std::to_string(signature) + (geometryTolerance > 1e-9 ? " (Tolerance Mode)" : " (Exact Mode)"));
-                    }
+                    GLTF_TRACE_MESH(mesh.name, "Node " + std::to_string(nodeIndex) + " (mesh name: " + mesh.name + ", mesh index: " + std::to_string(node.mesh) + ") uses mesh with signature: " + std::to_string(signature) + (geometryTolerance > 1e-9 ? " (Tolerance Mode)" : " (Exact Mode)"));
 
                     if (geometryTolerance <= 1e-9) { // Exact matching mode
-                    auto& group = potentialInstanceGroups[signature]; 
+                    InstancedMeshGroup& group = findOrCreateExactGroup(potentialInstanceGroups[signature], loadedGltf, node.mesh, signatureEntry.poseCanonicalized);
                     if (group.instances.empty()) { 
                         group.representativeGltfModelIndex = loadedGltf.uniqueId;
                         group.representativeMeshIndexInModel = node.mesh;
                         group.meshSignature = signature;
                         group.representativeMeshName = mesh.name; 
+                        group.representativeLocalToCanonical = signatureEntry.localToCanonical;
+                    }
+                    if (signatureEntry.poseCanonicalized) {
+                        // Instance = node world * (representative canonical frame -> this mesh's frame)
+                        instanceInfo.worldMatrix = worldTransform * signatureEntry.canonicalToLocal * group.representativeLocalToCanonical;
                     }
                     group.instances.push_back(instanceInfo);
                     } else { // Tolerance-based matching mode
-                        auto groupIt = potentialInstanceGroups.find(signature);
-                        bool foundMatchingGroup = false;
-                        if (groupIt != potentialInstanceGroups.end()) {
-                            // Group with matching base signature found, now compare bounding boxes
-                            InstancedMeshGroup& existingGroup = groupIt->second;
-                            if (existingGroup.representativePrimitiveBoundingBoxes.size() == mesh.primitives.size()) {
-                                bool allPrimitivesSimilar = true;
-                                std::vector<BoundingBox> currentPrimitiveBoundingBoxes;
-                                for(const auto& prim : mesh.primitives) {
-                                    currentPrimitiveBoundingBoxes.push_back(GltfInstancing::getPrimitiveBoundingBox(loadedGltf.model, prim));
-                                }
-
-                                for (size_t i = 0; i < mesh.primitives.size(); ++i) {
-                                    if (!GltfInstancing::areBoundingBoxesSimilar(existingGroup.representativePrimitiveBoundingBoxes[i],
-                                                                               currentPrimitiveBoundingBoxes[i], 
-                                                                               geometryTolerance)) {
-                                        allPrimitivesSimilar = false;
-                                        if (GltfInstancing::TARGET_MESH_NAMES.count(mesh.name)) {
-                                            // logMessage("    Mesh " + mesh.name + ": Primitive " + std::to_string(i) + " BBox mismatch with group representative.");
-                                            const auto& repBox = existingGroup.representativePrimitiveBoundingBoxes[i];
-                                            const auto& currentBox = currentPrimitiveBoundingBoxes[i];
-                                            std::string reason = "    Mesh " + mesh.name + " (Node " + std::to_string(nodeIndex) + 
-                                                                 ", Signature: " + std::to_string(signature) +")" +
-                                                                 ": Primitive " + std::to_string(i) + " BBox mismatch with group representative.\n" +
-                                                                 "      Tolerance: " + std::to_string(geometryTolerance) + "\n" +
-                                                                 "      Rep. BBox Min: (" + std::to_string(repBox.min.x) + ", " + std::to_string(repBox.min.y) + ", " + std::to_string(repBox.min.z) + ")\n" +
-                                                                 "      Rep. BBox Max: (" + std::to_string(repBox.max.x) + ", " + std::to_string(repBox.max.y) + ", " + std::to_string(repBox.max.z) + ")\n" +
-                                                                 "      Cur. BBox Min: (" + std::to_string(currentBox.min.x) + ", " + std::to_string(currentBox.min.y) + ", " + std::to_string(currentBox.min.z) + ")\n" +
-                                                                 "      Cur. BBox Max: (" + std::to_string(currentBox.max.x) + ", " + std::to_string(currentBox.max.y) + ", " + std::to_string(currentBox.max.z) + ")";
-                                            GltfInstancing::logError(reason); // Using logError to make it stand out
-                                        }
-                                        break;
-                                    }
-                                }
-                                if (allPrimitivesSimilar) {
-                                    existingGroup.instances.push_back(instanceInfo);
-                                    foundMatchingGroup = true;
-                                    if (GltfInstancing::TARGET_MESH_NAMES.count(mesh.name)) {
-                                         logMessage("    Mesh " + mesh.name + ": Added to existing group (Signature: " + std::to_string(signature) + ") based on BBox tolerance.");
-                                    }
-                                }
-                            }
+                        // Each base signature holds several sub-groups; the mesh joins the nearest
+                        // compatible representative or becomes the representative of a new one.
+                        auto& candidateGroups = potentialInstanceGroups[signature];
+                        InstancedMeshGroup& group = findOrCreateToleranceGroup(candidateGroups, signature, signatureEntry.primitiveBoundingBoxes);
+                        const bool createdGroup = group.instances.empty();
+                        if (createdGroup) {
+                            group.representativeGltfModelIndex = loadedGltf.uniqueId;
+                            group.representativeMeshIndexInModel = node.mesh;
+                            group.meshSignature = signature;
+                            group.representativeMeshName = mesh.name;
+                            group.representativePrimitiveBoundingBoxes = signatureEntry.primitiveBoundingBoxes;
                         }
-
-                        if (!foundMatchingGroup) {
-                            // No existing group fully matched, or no group with this base signature yet.
-                            // This mesh becomes a new representative for this base signature (if none existed) or a non-instanced mesh.
-                            // For simplicity, if a group with this base signature existed but BBoxes didn't match,
-                            // we treat this as non-instanced. A more complex strategy could form a new group.
-                            
-                            if (groupIt == potentialInstanceGroups.end()) { // This is the first mesh with this base signature
-                                auto& newGroup = potentialInstanceGroups[signature]; // Creates new group
-                                newGroup.representativeGltfModelIndex = loadedGltf.uniqueId;
-                                newGroup.representativeMeshIndexInModel = node.mesh;
-                                newGroup.meshSignature = signature;
-                                newGroup.representativeMeshName = mesh.name;
-                                for (const auto& prim : mesh.primitives) {
-                                    newGroup.representativePrimitiveBoundingBoxes.push_back(GltfInstancing::getPrimitiveBoundingBox(loadedGltf.model, prim));
-                                }
-                                newGroup.instances.push_back(instanceInfo);
-                                if (GltfInstancing::TARGET_MESH_NAMES.count(mesh.name)) {
-                                     logMessage("    Mesh " + mesh.name + ": Created NEW group (Signature: " + std::to_string(signature) + ") and set as representative.");
-                                }
-                            } else {
-                                // Base signature matched an existing group, but BBoxes didn't. Treat as non-instanced.
-                                NonInstancedMeshInfo nonInstanced;
-                                nonInstanced.originalGltfModelIndex = loadedGltf.uniqueId;
-                                nonInstanced.originalMeshIndexInModel = node.mesh;
-                                nonInstanced.originalNodeIndexInModel = nodeIndex;
-                                nonInstanced.transform = instanceInfo.transform;
-                                nonInstancedItems.push_back(nonInstanced);
-                                if (GltfInstancing::TARGET_MESH_NAMES.count(mesh.name)) {
-                                     // logMessage("    Mesh " + mesh.name + ": Base signature match, but BBox FAILED. Marked as non-instanced.");
-                                     std::string reason = "WARNING: Mesh " + mesh.name + " (Node " + std::to_string(nodeIndex) +
-                                                          ", Signature: " + std::to_string(signature) +
-                                                          "): Base signature matched existing group, but BBox comparison FAILED overall. Marked as non-instanced.\n" +
-                                                          "      Check BBox mismatch details for its primitives above if logged (search for logError with this mesh name/signature).";
-                                     GltfInstancing::logMessage(reason); // Using logMessage with WARNING prefix
-                                }
-                            }
+                        group.instances.push_back(instanceInfo);
+                        if (createdGroup) {
+                            GLTF_TRACE_MESH(mesh.name, "    Mesh " + mesh.name + ": Created NEW sub-group " + std::to_string(candidateGroups.size() - 1) +
+                                                       " (Signature: " + std::to_string(signature) + ") and set as representative.");
+                        } else {
+                            GLTF_TRACE_MESH(mesh.name, "    Mesh " + mesh.name + ": Added to existing sub-group (Signature: " + std::to_string(signature) + ") based on BBox tolerance.");
                         }
                     }
                 }
@@ -886,126 +1018,672 @@ namespace GltfInstancing {
                 logError("Node " + std::to_string(nodeIndex) + " in " + loadedGltf.originalPath.string() + " references invalid mesh index " + std::to_string(node.mesh));
             }
         }
-
-        parentNodeIndicesChainForChildren.push_back(nodeIndex);
-        for (int32_t childNodeIndex : node.children) {
-            traverseNode(loadedGltf, childNodeIndex, worldTransform, potentialInstanceGroups, nonInstancedItems, meshToSignatureCache, parentNodeIndicesChainForChildren);
-        }
-        parentNodeIndicesChainForChildren.pop_back(); 
     }
 
 
     InstancingDetectionResult InstancingDetector::detect(const std::vector<LoadedGltfModel>& loadedModels) {
         logMessage("Starting instancing detection with instance limit: " + std::to_string(_instanceLimit));
         InstancingDetectionResult result;
-        std::map<size_t, InstancedMeshGroup> potentialInstanceGroups; 
-        std::map<std::pair<int, int>, size_t> meshToSignatureCache; 
+        PotentialGroupMap potentialInstanceGroups; 
+        _modelsById.clear();
+        _verifiedGroupPositions.clear();
+        _toleranceGroupIndex.clear();
+        for (const auto& loadedGltf : loadedModels) {
+            _modelsById[loadedGltf.uniqueId] = &loadedGltf;
+        }
 
         std::map<std::string, int> fileHashToRepresentativeModelId;
         std::map<int, int> modelIdToRepresentativeModelId; 
+        std::map<std::string, size_t> fileHashToRepresentativePosition;
+        std::vector<size_t> representativeModelPosition(loadedModels.size());
 
-        for (const auto& loadedGltf : loadedModels) {
+        for (size_t modelPosition = 0; modelPosition < loadedModels.size(); ++modelPosition) {
+            const auto& loadedGltf = loadedModels[modelPosition];
+            representativeModelPosition[modelPosition] = modelPosition;
             if (loadedGltf.fileHash.empty()) continue; 
 
             auto it = fileHashToRepresentativeModelId.find(loadedGltf.fileHash);
             if (it == fileHashToRepresentativeModelId.end()) {
                 fileHashToRepresentativeModelId[loadedGltf.fileHash] = loadedGltf.uniqueId;
+                fileHashToRepresentativePosition[loadedGltf.fileHash] = modelPosition;
                 modelIdToRepresentativeModelId[loadedGltf.uniqueId] = loadedGltf.uniqueId; 
             } else {
                 modelIdToRepresentativeModelId[loadedGltf.uniqueId] = it->second; 
+                representativeModelPosition[modelPosition] = fileHashToRepresentativePosition.at(loadedGltf.fileHash);
                 logMessage("GLB " + loadedGltf.originalPath.string() + " (ID: " + std::to_string(loadedGltf.uniqueId) +
                     ") is identical to GLB with ID: " + std::to_string(it->second) + ". Its meshes will be treated as instances of the first.");
             }
         }
 
-        for (const auto& loadedGltf : loadedModels) {
-            if (loadedGltf.model.scenes.empty()) {
-                logMessage("Model " + loadedGltf.originalPath.string() + " has no scenes. Skipping node traversal.");
-                continue;
+        // Material content hashes per distinct file (parallel); byte-identical files share them.
+        std::vector<MaterialKeys> materialKeys(loadedModels.size());
+        parallelFor(loadedModels.size(), _threadCount, [&](size_t modelPosition, int /*workerIndex*/) {
+            if (representativeModelPosition[modelPosition] == modelPosition) {
+                materialKeys[modelPosition].hashes = computeMaterialContentHashes(loadedModels[modelPosition].model);
+                materialKeys[modelPosition].fileHash = loadedModels[modelPosition].fileHash;
+                materialKeys[modelPosition].modelId = loadedModels[modelPosition].uniqueId;
             }
+        });
+        _materialKeysByModelId.clear();
+        for (size_t modelPosition = 0; modelPosition < loadedModels.size(); ++modelPosition) {
+            _materialKeysByModelId[loadedModels[modelPosition].uniqueId] = materialKeys[representativeModelPosition[modelPosition]];
+        }
 
-            int32_t sceneIndex = loadedGltf.model.scene >= 0 ? loadedGltf.model.scene : 0;
-            if (static_cast<size_t>(sceneIndex) >= loadedGltf.model.scenes.size()) {
-                logError("Model " + loadedGltf.originalPath.string() + " has invalid default scene index. Skipping node traversal.");
-                continue;
-            }
-            const CesiumGltf::Scene& scene = loadedGltf.model.scenes[sceneIndex];
+        // Phase 1: hash every mesh up front (parallel), phase 2 below only does lookups and grouping.
+        const MeshSignatureTable signatureTable = computeMeshSignatureTable(loadedModels, representativeModelPosition);
 
-            std::vector<int32_t> initialParentChain; 
-            for (int32_t rootNodeIndex : scene.nodes) {
-                traverseNode(loadedGltf, rootNodeIndex, glm::dmat4(1.0), 
-                    potentialInstanceGroups, result.nonInstancedMeshes, meshToSignatureCache, initialParentChain);
+        // Flatten every scene graph into world matrices once (independent per model, so parallel);
+        // grouping below is a linear walk over the flattened node list in DFS order.
+        std::vector<FlattenedSceneGraph> flattenedScenes(loadedModels.size());
+        parallelFor(loadedModels.size(), _threadCount, [&](size_t modelPosition, int /*workerIndex*/) {
+            const CesiumGltf::Model& model = loadedModels[modelPosition].model;
+            if (!model.scenes.empty()) {
+                flattenedScenes[modelPosition] = flattenSceneGraph(model);
             }
+        });
+
+        for (size_t modelPosition = 0; modelPosition < loadedModels.size(); ++modelPosition) {
+            collectModelInstances(loadedModels[modelPosition], flattenedScenes[modelPosition],
+                potentialInstanceGroups, result.nonInstancedMeshes, signatureTable[modelPosition]);
         }
 
-        for (auto const& [signature, group] : potentialInstanceGroups) {
-            bool isTargetGroup = false;
-            if (!group.instances.empty()){
-                if(GltfInstancing::TARGET_MESH_NAMES.count(group.representativeMeshName)){
-                    isTargetGroup = true;
-                    logMessage("DEBUG_SIGNATURE: Evaluating potential group for TARGET mesh name: " + group.representativeMeshName +
-                               " with signature: " + std::to_string(signature) + 
-                               " and " + std::to_string(group.instances.size()) + " potential instances. Limit: " + std::to_string(_instanceLimit));
-                }
+        finalizeGroups(potentialInstanceGroups, modelIdToRepresentativeModelId, result);
+
+        _modelsById.clear();
+        _verifiedGroupPositions.clear();
+        _toleranceGroupIndex.clear();
+
+        logMessage("Instancing detection complete. Found " + std::to_string(result.instancedGroups.size()) + " instanced groups (limit: " + std::to_string(_instanceLimit) + ") and " +
+            std::to_string(result.nonInstancedMeshes.size()) + " non-instanced meshes.");
+        return result;
+    }
+
+    void InstancingDetector::collectModelInstances(
+        const LoadedGltfModel& loadedGltf,
+        const FlattenedSceneGraph& flattened,
+        PotentialGroupMap& potentialInstanceGroups,
+        std::vector<NonInstancedMeshInfo>& nonInstancedItems,
+        const std::vector<MeshSignatureEntry>& meshSignatures) {
+        if (loadedGltf.model.scenes.empty()) {
+            logMessage("Model " + loadedGltf.originalPath.string() + " has no scenes. Skipping node traversal.");
+            return;
+        }
+
+        int32_t sceneIndex = loadedGltf.model.scene >= 0 ? loadedGltf.model.scene : 0;
+        if (static_cast<size_t>(sceneIndex) >= loadedGltf.model.scenes.size()) {
+            logError("Model " + loadedGltf.originalPath.string() + " has invalid default scene index. Skipping node traversal.");
+            return;
+        }
+
+        for (size_t entry = 0; entry < flattened.size(); ++entry) {
+            if (flattened.meshIndices[entry] < 0) {
+                continue;
             }
+            collectNodeInstances(loadedGltf, flattened.nodeIndices[entry], flattened.worldMatrices[entry],
+                potentialInstanceGroups, nonInstancedItems, meshSignatures);
+        }
+    }
 
-            // Apply instanceLimit logic HERE
-            if (group.instances.size() >= static_cast<size_t>(_instanceLimit)) {
-                InstancedMeshGroup finalGroup = group;
-                if (modelIdToRepresentativeModelId.count(group.representativeGltfModelIndex)) {
-                    int representativeModelId = modelIdToRepresentativeModelId.at(group.representativeGltfModelIndex);
-                    finalGroup.representativeGltfModelIndex = representativeModelId;
-                } else {
-                    logError("Error: representativeGltfModelIndex " + std::to_string(group.representativeGltfModelIndex) + " not found in modelIdToRepresentativeModelId map.");
+    void InstancingDetector::finalizeGroups(
+        const PotentialGroupMap& potentialInstanceGroups,
+        const std::map<int, int>& modelIdToRepresentativeModelId,
+        InstancingDetectionResult& result) const {
+        for (auto const& [signature, signatureGroups] : potentialInstanceGroups) {
+            for (const auto& group : signatureGroups) {
+                const bool isTracedGroup = !group.instances.empty() && GltfInstancing::isMeshTraced(group.representativeMeshName);
+                if (isTracedGroup) {
+                    logDebug("DEBUG_SIGNATURE: Evaluating potential group for traced mesh name: " + group.representativeMeshName +
+                             " with signature: " + std::to_string(signature) +
+                             " and " + std::to_string(group.instances.size()) + " potential instances. Limit: " + std::to_string(_instanceLimit));
                 }
 
-                for (auto& instance : finalGroup.instances) {
-                    if (modelIdToRepresentativeModelId.count(instance.originalGltfIndex)) {
-                        instance.originalGltfIndex = modelIdToRepresentativeModelId.at(instance.originalGltfIndex);
+                // Apply instanceLimit logic HERE
+                if (group.instances.size() >= static_cast<size_t>(_instanceLimit)) {
+                    InstancedMeshGroup finalGroup = group;
+                    if (modelIdToRepresentativeModelId.count(group.representativeGltfModelIndex)) {
+                        int representativeModelId = modelIdToRepresentativeModelId.at(group.representativeGltfModelIndex);
+                        finalGroup.representativeGltfModelIndex = representativeModelId;
                     } else {
-                         logError("Error: instance.originalGltfIndex " + std::to_string(instance.originalGltfIndex) + " not found in map during group finalization.");
+                        logError("Error: representativeGltfModelIndex " + std::to_string(group.representativeGltfModelIndex) + " not found in modelIdToRepresentativeModelId map.");
                     }
-                }
-                result.instancedGroups.push_back(finalGroup);
+
+                    for (auto& instance : finalGroup.instances) {
+                        if (modelIdToRepresentativeModelId.count(instance.originalGltfIndex)) {
+                            instance.originalGltfIndex = modelIdToRepresentativeModelId.at(instance.originalGltfIndex);
+                        } else {
+                             logError("Error: instance.originalGltfIndex " + std::to_string(instance.originalGltfIndex) + " not found in map during group finalization.");
+                        }
+                    }
+                    result.instancedGroups.push_back(finalGroup);
                 
-                if (isTargetGroup || GltfInstancing::TARGET_MESH_NAMES.count(group.representativeMeshName)) { 
-                     logMessage("  DEBUG_SIGNATURE: Instanced group FORMED for signature " + std::to_string(signature) +
-                        " (Mesh Name: " + group.representativeMeshName + ")" + 
-                        " with " + std::to_string(finalGroup.instances.size()) + " instances (limit was " + std::to_string(_instanceLimit) + "). " +
-                        "Representative: Model ID " + std::to_string(finalGroup.representativeGltfModelIndex) +
-                        ", Mesh Index " + std::to_string(finalGroup.representativeMeshIndexInModel));
-                }
-            } else if (!group.instances.empty()) { 
-                // Not enough instances to form a group, move all to non-instanced
-                if (isTargetGroup || GltfInstancing::TARGET_MESH_NAMES.count(group.representativeMeshName)) {
-                    logMessage("  DEBUG_SIGNATURE: Mesh group for " + group.representativeMeshName + " (Sig: " + std::to_string(signature) +
-                               ") has " + std::to_string(group.instances.size()) + " instances, which is LESS than limit " + std::to_string(_instanceLimit) + ". Moving to non-instanced.");
-                }
-                for (const auto& instanceData : group.instances) {
-                    NonInstancedMeshInfo niInfo;
-                    if (modelIdToRepresentativeModelId.count(instanceData.originalGltfIndex)) {
-                        niInfo.originalGltfModelIndex = modelIdToRepresentativeModelId.at(instanceData.originalGltfIndex);
-                    } else {
-                        logError("Error: instanceData.originalGltfIndex " + std::to_string(instanceData.originalGltfIndex) + " not found in map for non-instanced.");
-                        niInfo.originalGltfModelIndex = instanceData.originalGltfIndex; // Fallback
+                    if (isTracedGroup) {
+                         logDebug("  DEBUG_SIGNATURE: Instanced group FORMED for signature " + std::to_string(signature) +
+                            " (Mesh Name: " + group.representativeMeshName + ")" + 
+                            " with " + std::to_string(finalGroup.instances.size()) + " instances (limit was " + std::to_string(_instanceLimit) + "). " +
+                            "Representative: Model ID " + std::to_string(finalGroup.representativeGltfModelIndex) +
+                            ", Mesh Index " + std::to_string(finalGroup.representativeMeshIndexInModel));
                     }
-                    // The representativeMeshIndexInModel from the group is the correct mesh index for these non-instanced items
-                    niInfo.originalMeshIndexInModel = instanceData.originalMeshIndex; 
-                    niInfo.originalNodeIndexInModel = instanceData.originalNodeIndex; 
-                    niInfo.transform = instanceData.transform;
-                    result.nonInstancedMeshes.push_back(niInfo);
-                    if (isTargetGroup || GltfInstancing::TARGET_MESH_NAMES.count(group.representativeMeshName)) { 
-                        logMessage("    DEBUG_SIGNATURE: Moved instance (Orig Node: " + std::to_string(niInfo.originalNodeIndexInModel) + 
-                                   ", Orig Model ID: " + std::to_string(instanceData.originalGltfIndex) + ") of mesh " + group.representativeMeshName +
-                                   " to non-instanced list.");
+                } else if (!group.instances.empty()) { 
+                    // Not enough instances to form a group, move all to non-instanced
+                    if (isTracedGroup) {
+                        logDebug("  DEBUG_SIGNATURE: Mesh group for " + group.representativeMeshName + " (Sig: " + std::to_string(signature) +
+                                   ") has " + std::to_string(group.instances.size()) + " instances, which is LESS than limit " + std::to_string(_instanceLimit) + ". Moving to non-instanced.");
+                    }
+                    for (const auto& instanceData : group.instances) {
+                        NonInstancedMeshInfo niInfo;
+                        if (modelIdToRepresentativeModelId.count(instanceData.originalGltfIndex)) {
+                            niInfo.originalGltfModelIndex = modelIdToRepresentativeModelId.at(instanceData.originalGltfIndex);
+                        } else {
+                            logError("Error: instanceData.originalGltfIndex " + std::to_string(instanceData.originalGltfIndex) + " not found in map for non-instanced.");
+                            niInfo.originalGltfModelIndex = instanceData.originalGltfIndex; // Fallback
+                        }
+                        // The representativeMeshIndexInModel from the group is the correct mesh index for these non-instanced items
+                        niInfo.originalMeshIndexInModel = instanceData.originalMeshIndex; 
+                        niInfo.originalNodeIndexInModel = instanceData.originalNodeIndex; 
+                        niInfo.transform = TransformComponents::fromMat4(instanceData.sourceWorldMatrix);
+                        result.nonInstancedMeshes.push_back(niInfo);
+                        if (isTracedGroup) {
+                            logDebug("    DEBUG_SIGNATURE: Moved instance (Orig Node: " + std::to_string(niInfo.originalNodeIndexInModel) + 
+                                       ", Orig Model ID: " + std::to_string(instanceData.originalGltfIndex) + ") of mesh " + group.representativeMeshName +
+                                       " to non-instanced list.");
+                        }
                     }
                 }
             }
         }
+    }
 
-        logMessage("Instancing detection complete. Found " + std::to_string(result.instancedGroups.size()) + " instanced groups (limit: " + std::to_string(_instanceLimit) + ") and " +
-            std::to_string(result.nonInstancedMeshes.size()) + " non-instanced meshes.");
+    InstancingDetectionResult InstancingDetector::detectStreaming(
+        ModelCache& modelCache,
+        const std::function<void(const ModelStatistics&)>& inspectModel,
+        SignatureCache* signatureCache) {
+        logMessage("Starting out-of-core instancing detection over " + std::to_string(modelCache.modelCount()) +
+            " file(s) with instance limit: " + std::to_string(_instanceLimit));
+        InstancingDetectionResult result;
+        PotentialGroupMap potentialInstanceGroups;
+        _modelsById.clear();
+        _verifiedGroupPositions.clear();
+        _toleranceGroupIndex.clear();
+        _materialKeysByModelId.clear();
+        _modelCache = &modelCache;
+
+        std::map<std::string, int> fileHashToRepresentativeModelId;
+        std::map<int, int> modelIdToRepresentativeModelId;
+        // Signature rows of distinct files, reused by byte-identical files that come later.
+        std::map<int, std::vector<MeshSignatureEntry>> signatureRowsByModelId;
+        size_t modelsRead = 0;
+
+        const bool useSignatureCache = signatureCache && !_verifyMatches;
+        if (signatureCache && _verifyMatches) {
+            logMessage("Signature cache is not used with match verification; every file is parsed.");
+        }
+
+        // Pass 1: one model at a time. Everything kept from a model is its index entry; the model
+        // itself is left to the cache, which releases it under memory pressure.
+        for (size_t position = 0; position < modelCache.modelCount(); ++position) {
+            const int modelId = static_cast<int>(position);
+            if (useSignatureCache) {
+                // Only the file bytes are hashed; the model is parsed only without a record.
+                std::optional<std::string> fileHash = computeFileContentHash(modelCache.path(modelId));
+                if (!fileHash) {
+                    continue;
+                }
+                const SignatureCacheRecord* record = findOrIndexRecord(modelCache, modelId, *fileHash, *signatureCache);
+                if (!record) {
+                    continue;
+                }
+                ++modelsRead;
+                if (inspectModel) {
+                    inspectModel(record->statistics);
+                }
+
+                auto [it, inserted] = fileHashToRepresentativeModelId.emplace(*fileHash, modelId);
+                modelIdToRepresentativeModelId[modelId] = it->second;
+                if (!inserted) {
+                    logMessage("GLB " + modelCache.path(modelId).string() + " (ID: " + std::to_string(modelId) +
+                        ") is identical to GLB with ID: " + std::to_string(it->second) + ". Its meshes will be treated as instances of the first.");
+                }
+                collectCachedInstances(modelId, *record, potentialInstanceGroups);
+                continue;
+            }
+
+            std::shared_ptr<const LoadedGltfModel> loadedGltf = modelCache.acquire(modelId);
+            if (!loadedGltf) {
+                continue;
+            }
+            ++modelsRead;
+            if (inspectModel) {
+                inspectModel(computeModelStatistics(loadedGltf->model));
+            }
+
+            int representativeModelId = modelId;
+            if (!loadedGltf->fileHash.empty()) {
+                auto [it, inserted] = fileHashToRepresentativeModelId.emplace(loadedGltf->fileHash, modelId);
+                representativeModelId = it->second;
+                modelIdToRepresentativeModelId[modelId] = representativeModelId;
+                if (!inserted) {
+                    logMessage("GLB " + loadedGltf->originalPath.string() + " (ID: " + std::to_string(modelId) +
+                        ") is identical to GLB with ID: " + std::to_string(representativeModelId) + ". Its meshes will be treated as instances of the first.");
+                }
+            }
+            if (representativeModelId == modelId) {
+                MaterialKeys materialKeys;
+                materialKeys.hashes = computeMaterialContentHashes(loadedGltf->model);
+                materialKeys.fileHash = loadedGltf->fileHash;
+                materialKeys.modelId = modelId;
+                _materialKeysByModelId[modelId] = std::move(materialKeys);
+                signatureRowsByModelId.emplace(modelId, computeModelMeshSignatures(*loadedGltf));
+            } else {
+                _materialKeysByModelId[modelId] = _materialKeysByModelId.at(representativeModelId);
+            }
+
+            _modelsById[modelId] = loadedGltf.get();
+            const FlattenedSceneGraph flattened = loadedGltf->model.scenes.empty() ? FlattenedSceneGraph() : flattenSceneGraph(loadedGltf->model);
+            collectModelInstances(*loadedGltf, flattened, potentialInstanceGroups, result.nonInstancedMeshes,
+                signatureRowsByModelId.at(representativeModelId));
+            _modelsById.erase(modelId);
+        }
+
+        finalizeGroups(potentialInstanceGroups, modelIdToRepresentativeModelId, result);
+
+        // Pass 2 re-opens the files in this order: keeping each file's work together lets the
+        // model cache serve consecutive copies from one load.
+        std::stable_sort(result.instancedGroups.begin(), result.instancedGroups.end(),
+            [](const InstancedMeshGroup& a, const InstancedMeshGroup& b) { return a.representativeGltfModelIndex < b.representativeGltfModelIndex; });
+        std::stable_sort(result.nonInstancedMeshes.begin(), result.nonInstancedMeshes.end(),
+            [](const NonInstancedMeshInfo& a, const NonInstancedMeshInfo& b) { return a.originalGltfModelIndex < b.originalGltfModelIndex; });
+
+        _modelsById.clear();
+        _verifiedGroupPositions.clear();
+        _toleranceGroupIndex.clear();
+        _modelCache = nullptr;
+
+        if (useSignatureCache) {
+            logMessage("Signature cache: " + std::to_string(signatureCache->hitCount()) + " of " + std::to_string(modelsRead) + " file(s) reused without parsing.");
+        }
+        logMessage("Out-of-core instancing detection complete. Read " + std::to_string(modelsRead) + " of " + std::to_string(modelCache.modelCount()) +
+            " file(s) with " + std::to_string(modelCache.loadCount()) + " load(s). Found " + std::to_string(result.instancedGroups.size()) +
+            " instanced groups (limit: " + std::to_string(_instanceLimit) + ") and " + std::to_string(result.nonInstancedMeshes.size()) + " non-instanced meshes.");
         return result;
     }
 
-} // namespace GltfInstancing
\ No newline at end of file
+    void InstancingDetector::splitSharedPrimitives(std::vector<LoadedGltfModel>& loadedModels, InstancingDetectionResult& result) {
+        if (geometryTolerance > 0.0) {
+            // Tolerance-mode primitive signatures need the bounding box checks of the mesh groups.
+            logWarning("Primitive granularity requires exact mode (tolerance = 0); keeping mesh granularity.");
+            return;
+        }
+        std::map<int32_t, LoadedGltfModel*> modelsById;
+        for (auto& loadedGltf : loadedModels) {
+            modelsById[loadedGltf.uniqueId] = &loadedGltf;
+        }
+
+        // Distinct (modelId, meshIndex) of the non-instanced list and how often each is placed.
+        using MeshKey = std::pair<int32_t, int32_t>;
+        std::map<MeshKey, size_t> meshPositions;
+        std::vector<MeshKey> meshKeys;
+        std::vector<size_t> placementCounts;
+        for (const auto& item : result.nonInstancedMeshes) {
+            auto modelIt = modelsById.find(item.originalGltfModelIndex);
+            if (modelIt == modelsById.end() || item.originalMeshIndexInModel < 0 ||
+                static_cast<size_t>(item.originalMeshIndexInModel) >= modelIt->second->model.meshes.size()) {
+                continue;
+            }
+            const MeshKey key(item.originalGltfModelIndex, item.originalMeshIndexInModel);
+            auto [positionIt, inserted] = meshPositions.emplace(key, meshKeys.size());
+            if (inserted) {
+                meshKeys.push_back(key);
+                placementCounts.push_back(0);
+            }
+            ++placementCounts[positionIt->second];
+        }
+        if (meshKeys.empty()) {
+            return;
+        }
+
+        // Material keys of the models involved, then every primitive signature (both parallel).
+        std::vector<int32_t> modelIds;
+        for (const MeshKey& key : meshKeys) {
+            if (std::find(modelIds.begin(), modelIds.end(), key.first) == modelIds.end()) {
+                modelIds.push_back(key.first);
+            }
+        }
+        std::vector<MaterialKeys> modelMaterialKeys(modelIds.size());
+        parallelFor(modelIds.size(), _threadCount, [&](size_t position, int /*workerIndex*/) {
+            modelMaterialKeys[position].hashes = computeMaterialContentHashes(modelsById.at(modelIds[position])->model);
+            modelMaterialKeys[position].fileHash = modelsById.at(modelIds[position])->fileHash;
+            modelMaterialKeys[position].modelId = modelIds[position];
+        });
+        std::map<int32_t, MaterialKeys> materialKeysByModelId;
+        for (size_t position = 0; position < modelIds.size(); ++position) {
+            materialKeysByModelId[modelIds[position]] = std::move(modelMaterialKeys[position]);
+        }
+
+        std::vector<std::vector<size_t>> primitiveSignatures(meshKeys.size());
+        parallelFor(meshKeys.size(), _threadCount, [&](size_t position, int /*workerIndex*/) {
+            const CesiumGltf::Model& model = modelsById.at(meshKeys[position].first)->model;
+            const CesiumGltf::Mesh& mesh = model.meshes[static_cast<size_t>(meshKeys[position].second)];
+            const MaterialKeys& materialKeys = materialKeysByModelId.at(meshKeys[position].first);
+            const bool isTraced = GltfInstancing::isMeshTraced(mesh.name);
+            for (const auto& primitive : mesh.primitives) {
+                primitiveSignatures[position].push_back(calculatePrimitiveSignatureExact(model, primitive, isTraced, mesh.name, materialKeys));
+            }
+        });
+
+        // Group the primitives. With verifyMatches a signature can hold several candidates, each
+        // confirmed against its first primitive like meshMatchesRepresentative does for meshes.
+        struct PrimitiveCandidate {
+            size_t signature = 0;
+            std::vector<std::pair<size_t, size_t>> members; // (mesh position, primitive index); the first is the representative
+            size_t placementCount = 0;
+        };
+        std::vector<PrimitiveCandidate> candidates;
+        std::map<size_t, std::vector<size_t>> candidatesBySignature;
+        for (size_t position = 0; position < meshKeys.size(); ++position) {
+            const LoadedGltfModel& loadedGltf = *modelsById.at(meshKeys[position].first);
+            const CesiumGltf::Mesh& mesh = loadedGltf.model.meshes[static_cast<size_t>(meshKeys[position].second)];
+            for (size_t primitiveIndex = 0; primitiveIndex < mesh.primitives.size(); ++primitiveIndex) {
+                const size_t signature = primitiveSignatures[position][primitiveIndex];
+                std::vector<size_t>& signatureCandidates = candidatesBySignature[signature];
+                size_t candidateIndex = candidates.size();
+                for (size_t existing : signatureCandidates) {
+                    if (!_verifyMatches) {
+                        candidateIndex = existing;
+                        break;
+                    }
+                    const auto [repPosition, repPrimitiveIndex] = candidates[existing].members.front();
+                    const LoadedGltfModel& representative = *modelsById.at(meshKeys[repPosition].first);
+                    const CesiumGltf::MeshPrimitive& repPrimitive =
+                        representative.model.meshes[static_cast<size_t>(meshKeys[repPosition].second)].primitives[repPrimitiveIndex];
+                    const CesiumGltf::MeshPrimitive& primitive = mesh.primitives[primitiveIndex];
+                    if (materialKeysByModelId.at(representative.uniqueId).keyFor(repPrimitive.material) ==
+                            materialKeysByModelId.at(loadedGltf.uniqueId).keyFor(primitive.material) &&
+                        comparePrimitiveAttributes(representative.model, repPrimitive, loadedGltf.model, primitive, false)) {
+                        candidateIndex = existing;
+                        break;
+                    }
+                }
+                if (candidateIndex == candidates.size()) {
+                    candidates.emplace_back();
+                    candidates.back().signature = signature;
+                    signatureCandidates.push_back(candidateIndex);
+                }
+                candidates[candidateIndex].members.emplace_back(position, primitiveIndex);
+                candidates[candidateIndex].placementCount += placementCounts[position];
+            }
+        }
+
+        // A single placement is not an instance, whatever the limit says.
+        const size_t primitiveInstanceLimit = static_cast<size_t>(std::max(_instanceLimit, 2));
+        std::vector<std::vector<int32_t>> sharedCandidateOfPrimitive(meshKeys.size()); // -1 = stays with its mesh
+        for (size_t position = 0; position < meshKeys.size(); ++position) {
+            sharedCandidateOfPrimitive[position].assign(primitiveSignatures[position].size(), -1);
+        }
+        std::vector<size_t> sharedCandidates;
+        for (size_t candidateIndex = 0; candidateIndex < candidates.size(); ++candidateIndex) {
+            if (candidates[candidateIndex].placementCount < primitiveInstanceLimit) {
+                continue;
+            }
+            for (const auto& [position, primitiveIndex] : candidates[candidateIndex].members) {
+                sharedCandidateOfPrimitive[position][primitiveIndex] = static_cast<int32_t>(sharedCandidates.size());
+            }
+            sharedCandidates.push_back(candidateIndex);
+        }
+        if (sharedCandidates.empty()) {
+            logMessage("Primitive granularity: no primitive is shared by " + std::to_string(primitiveInstanceLimit) + " or more placements.");
+            return;
+        }
+
+        // One single-primitive mesh per shared candidate, appended to its representative's model.
+        std::vector<InstancedMeshGroup> primitiveGroups(sharedCandidates.size());
+        for (size_t shared = 0; shared < sharedCandidates.size(); ++shared) {
+            const PrimitiveCandidate& candidate = candidates[sharedCandidates[shared]];
+            const auto [repPosition, repPrimitiveIndex] = candidate.members.front();
+            CesiumGltf::Model& repModel = modelsById.at(meshKeys[repPosition].first)->model;
+            const CesiumGltf::Mesh& sourceMesh = repModel.meshes[static_cast<size_t>(meshKeys[repPosition].second)];
+            CesiumGltf::Mesh primitiveMesh;
+            primitiveMesh.name = sourceMesh.name;
+            primitiveMesh.primitives.push_back(sourceMesh.primitives[repPrimitiveIndex]);
+            if (!primitiveMesh.primitives.front().targets.empty()) {
+                primitiveMesh.weights = sourceMesh.weights;
+            }
+            repModel.meshes.push_back(std::move(primitiveMesh));
+
+            InstancedMeshGroup& group = primitiveGroups[shared];
+            group.representativeGltfModelIndex = meshKeys[repPosition].first;
+            group.representativeMeshIndexInModel = static_cast<int32_t>(repModel.meshes.size() - 1);
+            group.representativeMeshName = repModel.meshes.back().name;
+            group.meshSignature = candidate.signature;
+            group.instances.reserve(candidate.placementCount);
+            GLTF_TRACE_MESH(group.representativeMeshName, "DEBUG_SIGNATURE: Primitive " + std::to_string(repPrimitiveIndex) + " of mesh " +
+                group.representativeMeshName + " (Sig: " + std::to_string(candidate.signature) + ") is shared by " +
+                std::to_string(candidate.placementCount) + " placements.");
+        }
+
+        // Meshes that lost primitives keep the rest as a new mesh (-1: all of them were shared).
+        std::vector<int32_t> remainderMeshIndex(meshKeys.size());
+        size_t splitMeshCount = 0;
+        size_t dissolvedMeshCount = 0;
+        for (size_t position = 0; position < meshKeys.size(); ++position) {
+            const std::vector<int32_t>& sharedOfPrimitive = sharedCandidateOfPrimitive[position];
+            remainderMeshIndex[position] = meshKeys[position].second;
+            if (std::all_of(sharedOfPrimitive.begin(), sharedOfPrimitive.end(), [](int32_t shared) { return shared < 0; })) {
+                continue;
+            }
+            CesiumGltf::Model& model = modelsById.at(meshKeys[position].first)->model;
+            const CesiumGltf::Mesh& sourceMesh = model.meshes[static_cast<size_t>(meshKeys[position].second)];
+            CesiumGltf::Mesh remainder;
+            remainder.name = sourceMesh.name;
+            remainder.weights = sourceMesh.weights;
+            for (size_t primitiveIndex = 0; primitiveIndex < sourceMesh.primitives.size(); ++primitiveIndex) {
+                if (sharedOfPrimitive[primitiveIndex] < 0) {
+                    remainder.primitives.push_back(sourceMesh.primitives[primitiveIndex]);
+                }
+            }
+            if (remainder.primitives.empty()) {
+                remainderMeshIndex[position] = -1;
+                ++dissolvedMeshCount;
+                continue;
+            }
+            model.meshes.push_back(std::move(remainder));
+            remainderMeshIndex[position] = static_cast<int32_t>(model.meshes.size() - 1);
+            ++splitMeshCount;
+        }
+
+        std::vector<NonInstancedMeshInfo> remainingItems;
+        remainingItems.reserve(result.nonInstancedMeshes.size());
+        for (const auto& item : result.nonInstancedMeshes) {
+            auto positionIt = meshPositions.find(MeshKey(item.originalGltfModelIndex, item.originalMeshIndexInModel));
+            if (positionIt == meshPositions.end()) {
+                remainingItems.push_back(item);
+                continue;
+            }
+            const size_t position = positionIt->second;
+            const glm::dmat4 worldMatrix = item.transform.toMat4();
+            const std::vector<int32_t>& sharedOfPrimitive = sharedCandidateOfPrimitive[position];
+            for (size_t primitiveIndex = 0; primitiveIndex < sharedOfPrimitive.size(); ++primitiveIndex) {
+                const int32_t shared = sharedOfPrimitive[primitiveIndex];
+                if (shared < 0) {
+                    continue;
+                }
+                MeshInstanceInfo instance;
+                instance.originalGltfIndex = item.originalGltfModelIndex;
+                instance.originalNodeIndex = item.originalNodeIndexInModel;
+                instance.originalMeshIndex = item.originalMeshIndexInModel; // Source mesh, for element names
+                instance.sourcePrimitiveIndex = static_cast<int32_t>(primitiveIndex);
+                instance.worldMatrix = worldMatrix;
+                instance.sourceWorldMatrix = worldMatrix;
+                primitiveGroups[static_cast<size_t>(shared)].instances.push_back(instance);
+            }
+            if (remainderMeshIndex[position] >= 0) {
+                NonInstancedMeshInfo remainder = item;
+                remainder.originalMeshIndexInModel = remainderMeshIndex[position];
+                remainingItems.push_back(remainder);
+            }
+        }
+        result.nonInstancedMeshes = std::move(remainingItems);
+
+        size_t primitiveInstanceCount = 0;
+        for (auto& group : primitiveGroups) {
+            primitiveInstanceCount += group.instances.size();
+            result.instancedGroups.push_back(std::move(group));
+        }
+        logMessage("Primitive granularity: " + std::to_string(sharedCandidates.size()) + " shared primitive(s) form instanced groups with " +
+            std::to_string(primitiveInstanceCount) + " instances; " + std::to_string(splitMeshCount) + " mesh(es) keep their unique primitives, " +
+            std::to_string(dissolvedMeshCount) + " were fully instanced.");
+    }
+
+    const SignatureCacheRecord* InstancingDetector::findOrIndexRecord(
+        ModelCache& modelCache,
+        int modelId,
+        const std::string& fileHash,
+        SignatureCache& signatureCache) {
+        if (const SignatureCacheRecord* record = signatureCache.find(fileHash)) {
+            return record;
+        }
+        std::shared_ptr<const LoadedGltfModel> loadedGltf = modelCache.acquire(modelId);
+        if (!loadedGltf) {
+            return nullptr;
+        }
+        MaterialKeys materialKeys;
+        materialKeys.hashes = computeMaterialContentHashes(loadedGltf->model);
+        // Model IDs restart at 0 in every shard and run, so the record's signatures must key
+        // hashless materials by file content; verification cannot catch a mix-up here.
+        materialKeys.fileHash = fileHash;
+        materialKeys.modelId = modelId;
+        _materialKeysByModelId[modelId] = std::move(materialKeys);
+        const FlattenedSceneGraph flattened = loadedGltf->model.scenes.empty() ? FlattenedSceneGraph() : flattenSceneGraph(loadedGltf->model);
+        const SignatureCacheRecord& record = signatureCache.store(fileHash, buildSignatureCacheRecord(*loadedGltf, flattened, computeModelMeshSignatures(*loadedGltf)));
+        _materialKeysByModelId.erase(modelId); // Only verification reads them later
+        return &record;
+    }
+
+    size_t InstancingDetector::indexShard(ModelCache& modelCache, SignatureCache& shardIndex) {
+        logMessage("Indexing shard of " + std::to_string(modelCache.modelCount()) + " file(s).");
+        _materialKeysByModelId.clear();
+        size_t indexedCount = 0;
+        for (size_t position = 0; position < modelCache.modelCount(); ++position) {
+            const int modelId = static_cast<int>(position);
+            std::optional<std::string> fileHash = computeFileContentHash(modelCache.path(modelId));
+            if (!fileHash) {
+                continue;
+            }
+            if (findOrIndexRecord(modelCache, modelId, *fileHash, shardIndex)) {
+                ++indexedCount;
+            }
+            modelCache.release(modelId); // Nothing is grouped, so no file is needed twice
+        }
+        logMessage("Shard indexing complete. Indexed " + std::to_string(indexedCount) + " of " + std::to_string(modelCache.modelCount()) +
+            " file(s), " + std::to_string(shardIndex.hitCount()) + " reused from the previous shard index.");
+        return indexedCount;
+    }
+
+    uint64_t InstancingDetector::signatureSettingsKey() const {
+        ContentHasher128 hasher;
+        // Bumped whenever signatures change for the same settings, so older caches are rejected.
+        constexpr uint32_t kSignatureAlgorithmVersion = 2;
+        hasher.updateValue(kSignatureAlgorithmVersion);
+        hasher.updateValue(static_cast<uint64_t>(sizeof(size_t)));
+        hasher.updateValue(geometryTolerance);
+        hasher.updateValue(normalTolerance);
+        hasher.updateValue(static_cast<uint64_t>(attributesToSkipDataHashInToleranceMode.size()));
+        for (const std::string& attribute : attributesToSkipDataHashInToleranceMode) {
+            hasher.updateString(attribute);
+        }
+        hasher.updateValue(_canonicalizePose);
+        hasher.updateValue(_canonicalQuantization);
+        return hasher.finalize().low;
+    }
+
+    SignatureCacheRecord InstancingDetector::buildSignatureCacheRecord(
+        const LoadedGltfModel& loadedGltf,
+        const FlattenedSceneGraph& flattened,
+        const std::vector<MeshSignatureEntry>& meshSignatures) const {
+        const CesiumGltf::Model& model = loadedGltf.model;
+        SignatureCacheRecord record;
+        record.statistics = computeModelStatistics(model);
+        record.meshes.resize(model.meshes.size());
+        for (size_t meshIndex = 0; meshIndex < model.meshes.size(); ++meshIndex) {
+            CachedMeshSignature& cached = record.meshes[meshIndex];
+            const MeshSignatureEntry& entry = meshSignatures[meshIndex];
+            cached.meshName = model.meshes[meshIndex].name;
+            cached.signature = static_cast<uint64_t>(entry.signature);
+            cached.poseCanonicalized = entry.poseCanonicalized;
+            cached.canonicalToLocal = entry.canonicalToLocal;
+            cached.localToCanonical = entry.localToCanonical;
+            cached.primitiveBoundingBoxes = entry.primitiveBoundingBoxes;
+        }
+
+        // Same traversal as collectModelInstances / collectNodeInstances.
+        const int32_t sceneIndex = model.scene >= 0 ? model.scene : 0;
+        if (model.scenes.empty() || static_cast<size_t>(sceneIndex) >= model.scenes.size()) {
+            return record;
+        }
+        for (size_t entry = 0; entry < flattened.size(); ++entry) {
+            const int32_t meshIndex = flattened.meshIndices[entry];
+            if (meshIndex < 0 || static_cast<size_t>(meshIndex) >= model.meshes.size()) {
+                continue;
+            }
+            const int32_t nodeIndex = flattened.nodeIndices[entry];
+            const CesiumGltf::Node& node = model.nodes[static_cast<size_t>(nodeIndex)];
+            auto instancingExtIt = node.extensions.find("EXT_mesh_gpu_instancing");
+            if (instancingExtIt == node.extensions.end()) {
+                record.placements.push_back({ nodeIndex, meshIndex, flattened.worldMatrices[entry] });
+                continue;
+            }
+            const auto* extData = std::any_cast<CesiumGltf::ExtensionExtMeshGpuInstancing>(&instancingExtIt->second);
+            if (!extData) {
+                continue;
+            }
+            for (const glm::dmat4& instanceWorldMatrix : gpuInstanceWorldMatrices(model, *extData, nodeIndex, flattened.worldMatrices[entry])) {
+                record.placements.push_back({ nodeIndex, meshIndex, instanceWorldMatrix });
+            }
+        }
+        return record;
+    }
+
+    void InstancingDetector::collectCachedInstances(
+        int32_t modelId,
+        const SignatureCacheRecord& record,
+        PotentialGroupMap& potentialInstanceGroups) {
+        for (const CachedMeshPlacement& placement : record.placements) {
+            if (placement.meshIndex < 0 || static_cast<size_t>(placement.meshIndex) >= record.meshes.size()) {
+                continue;
+            }
+            const CachedMeshSignature& mesh = record.meshes[static_cast<size_t>(placement.meshIndex)];
+            const size_t signature = static_cast<size_t>(mesh.signature);
+            auto& candidateGroups = potentialInstanceGroups[signature];
+            InstancedMeshGroup* group = nullptr;
+            if (geometryTolerance > 1e-9) {
+                group = &findOrCreateToleranceGroup(candidateGroups, signature, mesh.primitiveBoundingBoxes);
+            } else {
+                // Without verification an exact signature has a single candidate group.
+                if (candidateGroups.empty()) {
+                    candidateGroups.emplace_back();
+                }
+                group = &candidateGroups.front();
+            }
+            if (group->instances.empty()) {
+                group->representativeGltfModelIndex = modelId;
+                group->representativeMeshIndexInModel = placement.meshIndex;
+                group->meshSignature = signature;
+                group->representativeMeshName = mesh.meshName;
+                group->representativeLocalToCanonical = mesh.localToCanonical;
+                if (geometryTolerance > 1e-9) {
+                    group->representativePrimitiveBoundingBoxes = mesh.primitiveBoundingBoxes;
+                }
+            }
+
+            MeshInstanceInfo instanceInfo;
+            instanceInfo.originalGltfIndex = modelId;
+            instanceInfo.originalNodeIndex = placement.nodeIndex;
+            instanceInfo.originalMeshIndex = placement.meshIndex;
+            instanceInfo.sourceWorldMatrix = placement.worldMatrix;
+            instanceInfo.worldMatrix = mesh.poseCanonicalized
+                ? placement.worldMatrix * mesh.canonicalToLocal * group->representativeLocalToCanonical
+                : placement.worldMatrix;
+            group->instances.push_back(instanceInfo);
+        }
+    }
+
+} // namespace GltfInstancing
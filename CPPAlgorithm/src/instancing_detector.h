@@ -3,8 +3,11 @@
 
 #include "utilities.h"     // For MeshInstanceInfo, InstancedMeshGroup, NonInstancedMeshInfo, etc.
 #include "glb_reader.h"    // For LoadedGltfModel
+#include "resource_hashing.h" // For material content hashes
+#include "signature_cache.h" // For SignatureCache, ModelStatistics
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <functional> // For std::hash
 #include <set> // Required for std::set
@@ -19,6 +22,7 @@ namespace GltfInstancing {
 
     // Forward declaration
     class GlbReader;
+    class ModelCache;
 
     // Structure to hold the results of the detection process
     struct InstancingDetectionResult {
@@ -31,21 +35,119 @@ namespace GltfInstancing {
     public:
         // Constructor now accepts a set of attribute names to skip data hashing in tolerance mode
         // and a specific tolerance for normal attributes.
+        // threadCount controls the parallel signature phase (1 = serial, 0 = all hardware threads).
+        // verifyMatches confirms every exact-mode signature match with a full byte comparison
+        // (comparePrimitiveAttributes); colliding meshes are split into separate groups.
+        // canonicalizePose (exact mode only) matches meshes whose vertices were baked into different
+        // world poses by hashing them in a canonical frame (see pose_canonicalizer.h); positions are
+        // quantized to canonicalQuantization model units.
         InstancingDetector(double tolerance, 
                            const std::set<std::string>& skipAttributes = {},
                            double normalSpecificTolerance = 0.0,
-                           int instanceLimit = 0);
+                           int instanceLimit = 0,
+                           int threadCount = 1,
+                           bool verifyMatches = false,
+                           bool canonicalizePose = false,
+                           double canonicalQuantization = 1e-4);
 
         // Main function to detect instancing opportunities
         InstancingDetectionResult detect(const std::vector<LoadedGltfModel>& loadedModels);
 
+        // Out-of-core variant of detect() for input sets that do not fit in memory. Pass 1 of the
+        // two-pass pipeline: every file of modelCache (model ID = path position) is loaded, hashed,
+        // grouped and left to the cache, so only the compact detection index (signatures, material
+        // keys, candidate groups with their instance transforms) stays resident. Verification
+        // re-acquires representatives through the cache. Finds the same groups as detect() on the
+        // same files; groups and non-instanced meshes are ordered by source file for pass 2.
+        // inspectModel, if set, receives the statistics of every file once (e.g. input totals).
+        // With signatureCache, files whose content hash has a record are not parsed at all: their
+        // signatures and mesh placements are replayed from the record, and new files are added
+        // to it. Not used with verifyMatches, which has to compare the geometry itself.
+        InstancingDetectionResult detectStreaming(
+            ModelCache& modelCache,
+            const std::function<void(const ModelStatistics&)>& inspectModel = {},
+            SignatureCache* signatureCache = nullptr);
+
+        // Shard mode of a sharded (multi-node) run: indexes every file of modelCache into
+        // shardIndex, one SignatureCacheRecord per file content hash, without grouping anything.
+        // Files that already have a record (the same shard's previous run) are not parsed. A
+        // merge run loads the shard indexes as its signature cache, so detectStreaming() groups
+        // the whole input and applies the instance limit globally. Returns the files indexed.
+        size_t indexShard(ModelCache& modelCache, SignatureCache& shardIndex);
+
+        // Identifies the settings mesh signatures depend on (tolerances, skipped attributes,
+        // pose canonicalization, algorithm version); the key of a SignatureCache filled by this detector.
+        uint64_t signatureSettingsKey() const;
+
+        // Primitive granularity, run on the result of detect(): the non-instanced meshes are
+        // compared primitive by primitive (exact mode only), so meshes that share most of their
+        // parts still instance those parts. Every primitive signature placed at least instanceLimit
+        // times (and at least twice) becomes an instanced group of its own; the meshes keep only
+        // their unique primitives, and meshes without any are dropped from nonInstancedMeshes.
+        // The split meshes are appended to loadedModels (same name as the source mesh, no node
+        // references them), so the writer copies them like any other mesh.
+        void splitSharedPrimitives(std::vector<LoadedGltfModel>& loadedModels, InstancingDetectionResult& result);
+
     private:
+        // Per-mesh result of the parallel signature phase, indexed by mesh index within a model.
+        struct MeshSignatureEntry {
+            size_t signature = 0; // Left at 0 for meshes no node references
+            std::vector<BoundingBox> primitiveBoundingBoxes; // Only filled in tolerance mode
+            bool poseCanonicalized = false; // signature was computed in the canonical frame
+            glm::dmat4 canonicalToLocal{ 1.0 };
+            glm::dmat4 localToCanonical{ 1.0 };
+        };
+        using MeshSignatureTable = std::vector<std::vector<MeshSignatureEntry>>; // [model position][mesh index]
+
+        // Content-based material identity of one model (computeMaterialContentHashes), used in
+        // place of the raw material index so identical meshes from different files can group.
+        struct MaterialKeys {
+            std::vector<std::optional<ContentHash128>> hashes; // Indexed like model.materials
+            // Materials without a content hash only match within the same file content. The key
+            // is cached by file hash, so it must not depend on the model ID of one run or shard.
+            std::string fileHash;
+            int32_t modelId = -1; // Used instead when the file hash is unknown
+            size_t keyFor(int32_t materialIndex) const;
+        };
+
+        // Candidate groups per mesh signature. Normally one entry; more when verification splits
+        // a hash collision into distinct groups.
+        using PotentialGroupMap = std::map<size_t, std::vector<InstancedMeshGroup>>;
+
+        // Tolerance mode: grid cell of a representative's first primitive bbox min, quantized to
+        // the geometric tolerance. Any compatible box lies in the same or one of the 26 neighbours.
+        struct ToleranceCellKey {
+            int64_t x = 0;
+            int64_t y = 0;
+            int64_t z = 0;
+            bool operator==(const ToleranceCellKey& other) const { return x == other.x && y == other.y && z == other.z; }
+        };
+        struct ToleranceCellKeyHasher {
+            size_t operator()(const ToleranceCellKey& key) const {
+                return static_cast<size_t>(key.x * 73856093LL ^ key.y * 19349663LL ^ key.z * 83492791LL);
+            }
+        };
+        // Cell -> positions of the representatives (sub-groups) in a signature's candidate list.
+        using ToleranceCellIndex = std::unordered_map<ToleranceCellKey, std::vector<size_t>, ToleranceCellKeyHasher>;
+
         double geometryTolerance;
         // Set of attribute semantic names whose data should NOT be hashed when geometryTolerance > 0
         // POSITION is implicitly always skipped in tolerance mode regarding data hashing.
         const std::set<std::string> attributesToSkipDataHashInToleranceMode;
         double normalTolerance; // Tolerance for comparing NORMAL attributes, if geometryTolerance > 0 and NORMAL is not skipped
         int _instanceLimit;
+        int _threadCount;
+        bool _verifyMatches;
+        bool _canonicalizePose;
+        double _canonicalQuantization;
+
+        // Only valid during detect(): uniqueId -> model, and the verified group position of each
+        // (modelId, meshIndex) within its signature's candidate list.
+        std::map<int32_t, const LoadedGltfModel*> _modelsById;
+        std::map<std::pair<int32_t, int32_t>, size_t> _verifiedGroupPositions;
+        std::map<size_t, ToleranceCellIndex> _toleranceGroupIndex; // Per signature, tolerance mode only
+        std::map<int32_t, MaterialKeys> _materialKeysByModelId; // Byte-identical files share their representative's keys
+        ModelCache* _modelCache = nullptr; // Only set during detectStreaming()
 
         // Calculates a signature for a glTF mesh primitive based on its geometry and material.
         // This signature is used to determine if two primitives are identical.
@@ -53,7 +155,8 @@ namespace GltfInstancing {
             const CesiumGltf::Model& model,
             const CesiumGltf::MeshPrimitive& primitive,
             bool logDetailsForThisPrimitive,
-            const std::string& meshName
+            const std::string& meshName,
+            const MaterialKeys& materialKeys
         );
 
         // Calculates an exact signature for a glTF mesh primitive (used when tolerance is zero)
@@ -61,26 +164,106 @@ namespace GltfInstancing {
             const CesiumGltf::Model& model,
             const CesiumGltf::MeshPrimitive& primitive,
             bool logDetailsForThisPrimitive,
-            const std::string& meshName
+            const std::string& meshName,
+            const MaterialKeys& materialKeys
         );
 
         // Calculates a signature for a glTF mesh based on the signatures of its primitives.
+        // Only reads the model and the detector's immutable settings, so it is safe to call
+        // concurrently for different meshes.
         size_t calculateMeshSignature(
             const CesiumGltf::Model& model,
             const CesiumGltf::Mesh& mesh,
-            const std::string& meshName);
+            const std::string& meshName,
+            const MaterialKeys& materialKeys);
 
-        // Traverses the scene graph to collect mesh instances and their transforms
-        void traverseNode(
+        // Phase 1: computes the signature of every node-referenced mesh of every model in parallel.
+        // Models whose file hash duplicates an earlier model reuse that model's row.
+        MeshSignatureTable computeMeshSignatureTable(
+            const std::vector<LoadedGltfModel>& loadedModels,
+            const std::vector<size_t>& representativeModelPosition);
+
+        // Signature of one mesh (canonical-pose or regular, plus tolerance-mode boxes) into entry.
+        void computeMeshSignatureEntry(
+            const CesiumGltf::Model& model,
+            int32_t meshIndex,
+            const MaterialKeys& materialKeys,
+            MeshSignatureEntry& entry);
+
+        // Signature row of a single model (its node-referenced meshes hashed in parallel).
+        std::vector<MeshSignatureEntry> computeModelMeshSignatures(const LoadedGltfModel& loadedGltf);
+
+        // Runs collectNodeInstances over every mesh node of the model's flattened default scene.
+        void collectModelInstances(
+            const LoadedGltfModel& loadedGltf,
+            const FlattenedSceneGraph& flattened,
+            PotentialGroupMap& potentialInstanceGroups,
+            std::vector<NonInstancedMeshInfo>& nonInstancedItems,
+            const std::vector<MeshSignatureEntry>& meshSignatures);
+
+        // Cache record of a loaded model: its signature row and the placements of its meshes in
+        // the flattened default scene (EXT_mesh_gpu_instancing nodes expanded per instance).
+        SignatureCacheRecord buildSignatureCacheRecord(
+            const LoadedGltfModel& loadedGltf,
+            const FlattenedSceneGraph& flattened,
+            const std::vector<MeshSignatureEntry>& meshSignatures) const;
+
+        // The record of file modelId in signatureCache, built from the parsed file and stored when
+        // the cache has none for fileHash. Returns nullptr if the file cannot be loaded.
+        const SignatureCacheRecord* findOrIndexRecord(
+            ModelCache& modelCache,
+            int modelId,
+            const std::string& fileHash,
+            SignatureCache& signatureCache);
+
+        // Groups the placements of a cached file like collectModelInstances groups a loaded one.
+        void collectCachedInstances(
+            int32_t modelId,
+            const SignatureCacheRecord& record,
+            PotentialGroupMap& potentialInstanceGroups);
+
+        // Applies the instance limit: groups that reach it become instancedGroups (model IDs of
+        // byte-identical files mapped to their first file), the others are moved to nonInstancedMeshes.
+        void finalizeGroups(
+            const PotentialGroupMap& potentialInstanceGroups,
+            const std::map<int, int>& modelIdToRepresentativeModelId,
+            InstancingDetectionResult& result) const;
+
+        // Phase 2: collects the instance(s) of one mesh node of the flattened scene graph,
+        // looking its signature up in the precomputed table row of this model.
+        void collectNodeInstances(
             const LoadedGltfModel& loadedGltf,
             int32_t nodeIndex,
-            const glm::dmat4& parentTransform,
-            std::map<size_t, InstancedMeshGroup>& potentialInstanceGroups,
+            const glm::dmat4& worldTransform,
+            PotentialGroupMap& potentialInstanceGroups,
             std::vector<NonInstancedMeshInfo>& nonInstancedItems,
-            std::map<std::pair<int, int>, size_t>& meshToSignatureCache, // Cache for (modelId, meshIdx) -> signature
-            std::vector<int32_t>& parentNodeIndicesChain // For getNodeWorldTransform
+            const std::vector<MeshSignatureEntry>& meshSignatures
         );
 
+        // Exact mode: returns the candidate group whose representative mesh matches meshIndex.
+        // Without verification this is simply the (single) group for the signature; with it, the
+        // representative is compared byte-for-byte and a new group is appended on a collision.
+        // Pose-canonicalized meshes differ byte-wise by construction and are not verified.
+        InstancedMeshGroup& findOrCreateExactGroup(
+            std::vector<InstancedMeshGroup>& candidates,
+            const LoadedGltfModel& loadedGltf,
+            int32_t meshIndex,
+            bool poseCanonicalized);
+
+        // Tolerance mode: returns the sub-group of the signature whose representative boxes are all
+        // within tolerance and closest to primitiveBoxes, or appends a new (empty) sub-group.
+        InstancedMeshGroup& findOrCreateToleranceGroup(
+            std::vector<InstancedMeshGroup>& candidates,
+            size_t signature,
+            const std::vector<BoundingBox>& primitiveBoxes);
+
+        ToleranceCellKey toleranceCellKey(const std::vector<BoundingBox>& primitiveBoxes) const;
+
+        bool meshMatchesRepresentative(
+            const InstancedMeshGroup& group,
+            const LoadedGltfModel& loadedGltf,
+            int32_t meshIndex) const;
+
         // Helper to combine hashes (used for creating signatures)
         template <class T>
         inline void hash_combine(std::size_t& seed, const T& v) {
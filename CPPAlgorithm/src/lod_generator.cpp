@@ -0,0 +1,163 @@
+﻿#include "lod_generator.h"
+#include "utilities.h"
+#include "mesh_optimization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include <meshoptimizer.h>
+
+namespace GltfInstancing {
+
+    namespace {
+        // Largest axis scale of a placement, converting mesh-unit errors to world units.
+        double maxAxisScale(const glm::dmat4& matrix) {
+            return std::max({ glm::length(glm::dvec3(matrix[0])), glm::length(glm::dvec3(matrix[1])), glm::length(glm::dvec3(matrix[2])) });
+        }
+
+        // Appends the placements of from to into; instanced groups with the same representative
+        // mesh become one group.
+        void mergeContent(const InstancingDetectionResult& from, InstancingDetectionResult& into) {
+            into.nonInstancedMeshes.insert(into.nonInstancedMeshes.end(), from.nonInstancedMeshes.begin(), from.nonInstancedMeshes.end());
+            for (const InstancedMeshGroup& group : from.instancedGroups) {
+                auto existing = std::find_if(into.instancedGroups.begin(), into.instancedGroups.end(), [&](const InstancedMeshGroup& candidate) {
+                    return candidate.representativeGltfModelIndex == group.representativeGltfModelIndex &&
+                           candidate.representativeMeshIndexInModel == group.representativeMeshIndexInModel;
+                });
+                if (existing == into.instancedGroups.end()) {
+                    into.instancedGroups.push_back(group);
+                } else {
+                    existing->instances.insert(existing->instances.end(), group.instances.begin(), group.instances.end());
+                }
+            }
+        }
+    }
+
+    std::optional<SimplifiedMesh> simplifyMesh(
+        const CesiumGltf::Model& model,
+        const CesiumGltf::Mesh& mesh,
+        double targetRatio,
+        float targetError) {
+        std::optional<SimplifiedMesh> source = unpackTriangleMesh(model, mesh);
+        if (!source) {
+            return std::nullopt;
+        }
+        SimplifiedMesh result;
+        result.sourceTriangleCount = source->sourceTriangleCount;
+        for (SimplifiedPrimitive& primitive : source->primitives) {
+            const float* positions = reinterpret_cast<const float*>(primitive.findAttribute("POSITION")->data.data());
+            const size_t positionStride = sizeof(float) * 3;
+            const size_t targetIndexCount = static_cast<size_t>(static_cast<double>(primitive.indices.size() / 3) * targetRatio) * 3;
+
+            std::vector<uint32_t> simplifiedIndices(primitive.indices.size());
+            float relativeError = 0.0f;
+            simplifiedIndices.resize(meshopt_simplify(
+                simplifiedIndices.data(), primitive.indices.data(), primitive.indices.size(),
+                positions, primitive.vertexCount, positionStride,
+                targetIndexCount, targetError, 0, &relativeError));
+            const double scale = meshopt_simplifyScale(positions, primitive.vertexCount, positionStride);
+            result.geometricError = std::max(result.geometricError, static_cast<double>(relativeError) * scale);
+            result.triangleCount += simplifiedIndices.size() / 3;
+            if (simplifiedIndices.empty()) {
+                continue; // Collapsed completely
+            }
+
+            // Keep only the referenced vertices, in first-use order.
+            primitive.indices = std::move(simplifiedIndices);
+            std::vector<uint32_t> remap(primitive.vertexCount);
+            const size_t newVertexCount = meshopt_optimizeVertexFetchRemap(remap.data(), primitive.indices.data(), primitive.indices.size(), primitive.vertexCount);
+            remapPrimitiveVertices(primitive, remap.data(), newVertexCount);
+            result.primitives.push_back(std::move(primitive));
+        }
+        return result;
+    }
+
+    std::vector<MeshLodSet> generateTileLods(
+        const std::vector<LoadedGltfModel>& originalModels,
+        SpatialTileTree& tree,
+        const LodOptions& options) {
+        std::vector<MeshLodSet> lods;
+        if (tree.tiles.empty()) {
+            return lods;
+        }
+        std::map<int, const CesiumGltf::Model*> modelsById;
+        for (const auto& loadedModel : originalModels) {
+            modelsById[loadedModel.uniqueId] = &loadedModel.model;
+        }
+
+        const int maxHeight = tree.tiles[0].height;
+        lods.resize(static_cast<size_t>(maxHeight));
+        std::vector<std::set<std::pair<int, int>>> unsimplified(lods.size()); // Failed once, not retried
+
+        // Mesh-unit error of (modelId, meshIndex) at height, simplifying it on first use (0 if
+        // the mesh stays at full detail).
+        auto meshError = [&](int modelId, int meshIndex, int height) -> double {
+            const size_t slot = static_cast<size_t>(height - 1);
+            const std::pair<int, int> key(modelId, meshIndex);
+            auto cached = lods[slot].find(key);
+            if (cached != lods[slot].end()) {
+                return cached->second.geometricError;
+            }
+            if (unsimplified[slot].count(key)) {
+                return 0.0;
+            }
+            auto model = modelsById.find(modelId);
+            if (model != modelsById.end() && meshIndex >= 0 && static_cast<size_t>(meshIndex) < model->second->meshes.size()) {
+                const double ratio = std::pow(options.ratio, height);
+                const float error = std::min(1.0f, options.errorBudget * std::pow(2.0f, static_cast<float>(height - 1)));
+                std::optional<SimplifiedMesh> simplified = simplifyMesh(*model->second, model->second->meshes[meshIndex], ratio, error);
+                if (simplified) {
+                    return lods[slot].emplace(key, std::move(*simplified)).first->second.geometricError;
+                }
+            }
+            unsimplified[slot].insert(key);
+            return 0.0;
+        };
+
+        // Children come after their parent in tiles, so a reverse pass sees them first.
+        for (size_t t = tree.tiles.size(); t-- > 0;) {
+            SpatialTile& tile = tree.tiles[t];
+            if (tile.isLeaf()) {
+                tile.geometricError = 0.0;
+                continue;
+            }
+            double error = 0.0;
+            for (size_t child : tile.children) {
+                mergeContent(tree.tiles[child].content, tile.content);
+                error = std::max(error, tree.tiles[child].geometricError.value_or(0.0));
+            }
+            for (const NonInstancedMeshInfo& mesh : tile.content.nonInstancedMeshes) {
+                const double localError = meshError(mesh.originalGltfModelIndex, mesh.originalMeshIndexInModel, tile.height);
+                if (localError > 0.0) {
+                    error = std::max(error, localError * maxAxisScale(mesh.transform.toMat4()));
+                }
+            }
+            for (const InstancedMeshGroup& group : tile.content.instancedGroups) {
+                const double localError = meshError(group.representativeGltfModelIndex, group.representativeMeshIndexInModel, tile.height);
+                if (localError <= 0.0) {
+                    continue;
+                }
+                for (const MeshInstanceInfo& instance : group.instances) {
+                    error = std::max(error, localError * maxAxisScale(instance.worldMatrix));
+                }
+            }
+            tile.geometricError = error;
+        }
+        tree.replaceRefinement = true;
+
+        for (size_t h = 0; h < lods.size(); ++h) {
+            size_t sourceTriangles = 0;
+            size_t triangles = 0;
+            for (const auto& entry : lods[h]) {
+                sourceTriangles += entry.second.sourceTriangleCount;
+                triangles += entry.second.triangleCount;
+            }
+            logInfo("LOD height " + std::to_string(h + 1) + ": " + std::to_string(lods[h].size()) + " meshes simplified, " +
+                    std::to_string(sourceTriangles) + " -> " + std::to_string(triangles) + " triangles (" +
+                    std::to_string(unsimplified[h].size()) + " kept at full detail).");
+        }
+        return lods;
+    }
+
+} // namespace GltfInstancing
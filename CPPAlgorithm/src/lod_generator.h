@@ -0,0 +1,87 @@
+﻿#ifndef LOD_GENERATOR_H
+#define LOD_GENERATOR_H
+
+#include "spatial_tiler.h"      // For SpatialTileTree
+#include "glb_reader.h"         // For LoadedGltfModel
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+#include <CesiumGltf/Mesh.h>
+
+namespace GltfInstancing {
+
+    // One vertex attribute of a simplified primitive, tightly packed in the format of the
+    // source accessor.
+    struct SimplifiedAttribute {
+        std::string type;          // CesiumGltf::Accessor::Type
+        int32_t componentType = 0; // CesiumGltf::Accessor::ComponentType
+        bool normalized = false;
+        std::vector<std::byte> data;
+    };
+
+    struct SimplifiedPrimitive {
+        size_t sourcePrimitiveIndex = 0; // Material and mode come from this source primitive
+        size_t vertexCount = 0;
+        std::map<std::string, SimplifiedAttribute> attributes;
+        std::vector<uint32_t> indices;   // TRIANGLES
+
+        const SimplifiedAttribute* findAttribute(const std::string& name) const {
+            auto it = attributes.find(name);
+            return it != attributes.end() ? &it->second : nullptr;
+        }
+    };
+
+    // Reduced copy of a mesh. Primitives that collapsed completely are dropped, so primitives
+    // may be empty.
+    struct SimplifiedMesh {
+        std::vector<SimplifiedPrimitive> primitives;
+        double geometricError = 0.0; // Largest deviation from the source, in mesh units
+        size_t sourceTriangleCount = 0;
+        size_t triangleCount = 0;
+    };
+
+    // (modelId, meshIndex) -> simplified mesh. GlbWriter writes these in place of the source
+    // meshes (see GlbWriter::writeInstancedGlb).
+    using MeshLodSet = std::map<std::pair<int, int>, SimplifiedMesh>;
+
+    struct LodOptions {
+        // Fraction of triangles kept per tile level: a tile h levels above the leaves targets
+        // ratio^h of the source triangles.
+        double ratio = 0.25;
+        // Simplification error allowed one level above the leaves, relative to the mesh extents;
+        // it doubles with every further level (capped at 1).
+        float errorBudget = 0.01f;
+    };
+
+    // Quadric-error simplification (meshoptimizer) of every primitive of mesh towards
+    // targetRatio of its triangles, stopping before the error exceeds targetError (relative to
+    // the mesh extents). Vertices are compacted to those still referenced; every attribute is
+    // kept. Returns std::nullopt for meshes that cannot be simplified (non-TRIANGLES primitives,
+    // morph targets, non-float positions, unreadable data); those stay at full detail.
+    std::optional<SimplifiedMesh> simplifyMesh(
+        const CesiumGltf::Model& model,
+        const CesiumGltf::Mesh& mesh,
+        double targetRatio,
+        float targetError);
+
+    // Turns tree into a REPLACE-refined hierarchy: every inner tile gets the content of all
+    // leaves below it (instanced groups merged by representative mesh), to be written with the
+    // simplified meshes of its height, and every tile gets a geometric error (the largest world
+    // space simplification error of its content, never below its children's; 0 for leaves).
+    // Returns the simplified meshes per height: element h - 1 is used by tiles of height h.
+    // Meshes are simplified once per height, not per tile.
+    std::vector<MeshLodSet> generateTileLods(
+        const std::vector<LoadedGltfModel>& originalModels,
+        SpatialTileTree& tree,
+        const LodOptions& options);
+
+} // namespace GltfInstancing
+
+#endif // LOD_GENERATOR_H
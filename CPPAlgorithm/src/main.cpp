@@ -1,15 +1,23 @@
 ﻿#include "glb_reader.h"
 #include "instancing_detector.h"
 #include "glb_writer.h"
+#include "model_cache.h"
+#include "signature_cache.h"
+#include "metrics.h"
 #include "tileset_writer.h"
+#include "spatial_tiler.h"
+#include "lod_generator.h"
+#include "element_csv.h"
 #include "utilities.h" // For logging
 
 
 
 #include <iostream>
+#include <memory>
 #include <filesystem>
 #include <string>
 #include <vector>
+#include <map>
 #include <cstdlib> // For std::atof
 #include <set> // Required for std::set
 #include <sstream> // Required for std::stringstream
@@ -17,6 +25,15 @@
 #include <fstream>   // Required for std::ifstream
 #include <iomanip>   // For std::setprecision
 #include <any>       // For std::any_cast
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <nlohmann/json.hpp>
 #include <CesiumGltf\ExtensionExtMeshGpuInstancing.h>
 
 // Structure to hold all configuration parameters
@@ -29,8 +46,40 @@ struct ToolConfiguration {
     bool mergeAllGlb = false;
     int instanceLimit = 2; // Default to 2 (original behavior: >1 instance is grouped)
     bool meshSegmentation = false; // New flag, default to false
+    bool segmentationArchive = false; // Pack segmented GLBs into one archive + JSON manifest
     std::string csvDirectory;
     bool csvDirectorySet = false;
+    bool embedElementIds = false; // Write the CSV element IDs into the Stage 1 GLBs (instance / mesh features)
+    bool embedElementIdsSet = false;
+    int threadCount = 1; // Worker threads for parallel stages. 1 = serial, 0 = all hardware threads
+    bool decodeImages = false; // Decode texture images on load (not needed: images are passed through encoded)
+    bool outOfCore = false; // Two-pass pipeline: models are indexed one at a time, re-opened for writing
+    int modelCacheMb = 4096; // Resident model budget of the out-of-core pipeline
+    bool signatureCache = false; // Persist per-file detection records in the output directory (out-of-core)
+    int shardIndex = 0; // Shard mode: index every shardCount-th input file, starting at this one
+    int shardCount = 0; // 0 = no shard mode
+    std::string mergeShardsDirectory; // Shard indexes whose records drive out-of-core detection
+    bool verifySignatureMatches = false; // Confirm exact-mode signature matches with a full attribute comparison
+    bool canonicalizePose = false; // Match meshes with baked-in world transforms via a canonical frame (exact mode)
+    double canonicalQuantization = 1e-4; // Position quantization step in the canonical frame (model units)
+    std::string instancingGranularity = "mesh"; // "mesh" or "primitive" (shared primitives of unmatched meshes instanced too)
+    bool compactInstanceAttributes = false; // RTC-relative translations, SHORT rotations, unit scale omitted
+    bool batchNonInstancedMeshes = false; // Merge non-instanced meshes by material, element identity kept as feature IDs
+    int batchVertexBudget = 262144; // Maximum vertices per batched primitive
+    bool optimizeMeshes = false; // Vertex cache / overdraw / vertex fetch reordering of written meshes
+    bool meshoptCompression = false; // EXT_meshopt_compression for vertex and index buffer views
+    int quantizePositionBits = 0; // KHR_mesh_quantization: 0 (FLOAT) or 1..16
+    int quantizeNormalBits = 0; // 0, 8 or 16
+    int quantizeTexCoordBits = 0; // 0, 8 or 16
+    bool spatialTiling = false; // Additionally write a hierarchical tileset with per-tile GLBs
+    std::string tilingScheme = "octree"; // "octree" or "quadtree"
+    int tileMaxItems = 4096; // Mesh placements (meshes + instances) per leaf tile
+    int tileMaxDepth = 10;
+    bool lodGeneration = false; // Simplified content on inner tiles of the spatial tileset (REPLACE refinement)
+    double lodRatio = 0.25; // Fraction of triangles kept per tile level
+    double lodErrorBudget = 0.01; // Relative simplification error one level above the leaves
+    bool metricsReport = false; // Write per-stage metrics (time, memory, I/O, counters) to metrics.json
+    std::set<std::string> traceMeshNames; // Meshes whose detection is traced at DEBUG level
 
     // Flags to track if a parameter was set, can be useful for merging/override logic
     bool inputDirectorySet = false;
@@ -41,6 +90,35 @@ struct ToolConfiguration {
     bool mergeAllGlbSet = false;
     bool instanceLimitSet = false;
     bool meshSegmentationSet = false; // Flag to track if meshSegmentation was set
+    bool segmentationArchiveSet = false;
+    bool threadCountSet = false;
+    bool decodeImagesSet = false;
+    bool outOfCoreSet = false;
+    bool modelCacheMbSet = false;
+    bool signatureCacheSet = false;
+    bool shardSet = false;
+    bool mergeShardsDirectorySet = false;
+    bool verifySignatureMatchesSet = false;
+    bool canonicalizePoseSet = false;
+    bool canonicalQuantizationSet = false;
+    bool instancingGranularitySet = false;
+    bool compactInstanceAttributesSet = false;
+    bool batchNonInstancedMeshesSet = false;
+    bool batchVertexBudgetSet = false;
+    bool optimizeMeshesSet = false;
+    bool meshoptCompressionSet = false;
+    bool quantizePositionBitsSet = false;
+    bool quantizeNormalBitsSet = false;
+    bool quantizeTexCoordBitsSet = false;
+    bool spatialTilingSet = false;
+    bool tilingSchemeSet = false;
+    bool tileMaxItemsSet = false;
+    bool tileMaxDepthSet = false;
+    bool lodGenerationSet = false;
+    bool lodRatioSet = false;
+    bool lodErrorBudgetSet = false;
+    bool metricsReportSet = false;
+    bool traceMeshNamesSet = false;
 
     // Flags to track if a parameter was set from any source (config or CLI)
     bool inputDirectorySource = false; // True if set by config or CLI
@@ -71,6 +149,35 @@ std::set<std::string> splitAndTrim(const std::string& s, char delimiter) {
     return tokens;
 }
 
+// Parses a shard specification "<index>/<count>" with 0 <= index < count.
+bool parseShardSpecification(const std::string& value, int& shardIndex, int& shardCount) {
+    const size_t slashPos = value.find('/');
+    if (slashPos == std::string::npos) {
+        return false;
+    }
+    try {
+        size_t indexLength = 0;
+        size_t countLength = 0;
+        const std::string indexText = trim(value.substr(0, slashPos));
+        const std::string countText = trim(value.substr(slashPos + 1));
+        const int index = std::stoi(indexText, &indexLength);
+        const int count = std::stoi(countText, &countLength);
+        if (indexLength != indexText.size() || countLength != countText.size() || count <= 0 || index < 0 || index >= count) {
+            return false;
+        }
+        shardIndex = index;
+        shardCount = count;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// File name of the shard index a shard mode run writes to its output directory.
+std::string shardIndexFileName(int shardIndex, int shardCount) {
+    return "detection_shard_" + std::to_string(shardIndex) + "_of_" + std::to_string(shardCount) + ".bin";
+}
+
 // Function to parse a key-value pair from a line
 bool parseKeyValuePair(const std::string& line, std::string& key, std::string& value) {
     size_t delimiterPos = line.find('=');
@@ -84,6 +191,371 @@ bool parseKeyValuePair(const std::string& line, std::string& key, std::string& v
     return !key.empty(); // Key cannot be empty
 }
 
+// Applies one configuration setting (config file key and value) to config; source names where it
+// came from in warnings about invalid values. Returns false for unknown keys.
+bool applyConfigurationValue(ToolConfiguration& config, const std::string& key, std::string value, const std::string& source) {
+    if (key == "input_directory") {
+        config.inputDirectory = value;
+        config.inputDirectorySet = true;
+    } else if (key == "output_directory") {
+        config.outputDirectory = value;
+        config.outputDirectorySet = true;
+    } else if (key == "tolerance" || key == "geometry_tolerance") {
+        try {
+            config.geometryTolerance = std::stod(value);
+            config.geometryToleranceSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for '" + key + "' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "normal_tolerance") {
+        try {
+            config.normalTolerance = std::stod(value);
+            if (config.normalTolerance < 0.0) {
+                GltfInstancing::logWarning("Negative normal_tolerance in " + source + " adjusted to 0.0.");
+                config.normalTolerance = 0.0;
+            }
+            config.normalToleranceSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'normal_tolerance' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "skip_attribute_data_hash") {
+        config.attributesToSkipDataHash = splitAndTrim(value, ',');
+        config.attributesToSkipDataHashSet = true;
+    } else if (key == "merge_all_glb") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.mergeAllGlb = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.mergeAllGlb = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'merge_all_glb' in " + source + ": " + value);
+        }
+        config.mergeAllGlbSet = true;
+    } else if (key == "instance_limit") {
+        try {
+            config.instanceLimit = std::stoi(value);
+            if (config.instanceLimit < 1) { // Instance limit cannot be less than 1
+                GltfInstancing::logWarning("Invalid value for 'instance_limit' (must be >= 1) in " + source + ": " + value + ". Using default 2.");
+                config.instanceLimit = 2;
+            }
+            config.instanceLimitSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'instance_limit' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "mesh_segmentation") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.meshSegmentation = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.meshSegmentation = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'mesh_segmentation' in " + source + ": " + value);
+        }
+        config.meshSegmentationSet = true;
+    } else if (key == "segmentation_archive") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.segmentationArchive = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.segmentationArchive = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'segmentation_archive' in " + source + ": " + value);
+        }
+        config.segmentationArchiveSet = true;
+    } else if (key == "csv_directory") {
+        config.csvDirectory = value;
+        config.csvDirectorySet = true;
+    } else if (key == "embed_element_ids") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.embedElementIds = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.embedElementIds = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'embed_element_ids' in " + source + ": " + value);
+        }
+        config.embedElementIdsSet = true;
+    } else if (key == "threads") {
+        try {
+            config.threadCount = std::stoi(value);
+            if (config.threadCount < 0) {
+                GltfInstancing::logWarning("Negative 'threads' in " + source + " adjusted to 0 (all hardware threads).");
+                config.threadCount = 0;
+            }
+            config.threadCountSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'threads' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "decode_images") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.decodeImages = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.decodeImages = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'decode_images' in " + source + ": " + value);
+        }
+        config.decodeImagesSet = true;
+    } else if (key == "out_of_core") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.outOfCore = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.outOfCore = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'out_of_core' in " + source + ": " + value);
+        }
+        config.outOfCoreSet = true;
+    } else if (key == "model_cache_mb") {
+        try {
+            config.modelCacheMb = std::stoi(value);
+            if (config.modelCacheMb < 1) {
+                GltfInstancing::logWarning("model_cache_mb must be at least 1 in " + source + "; adjusted to 4096.");
+                config.modelCacheMb = 4096;
+            }
+            config.modelCacheMbSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'model_cache_mb' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "signature_cache") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.signatureCache = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.signatureCache = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'signature_cache' in " + source + ": " + value);
+        }
+        config.signatureCacheSet = true;
+    } else if (key == "shard") {
+        if (value.empty()) {
+            config.shardCount = 0;
+            config.shardSet = true;
+        } else if (parseShardSpecification(value, config.shardIndex, config.shardCount)) {
+            config.shardSet = true;
+        } else {
+            GltfInstancing::logWarning("Invalid value for 'shard' in " + source + ": " + value + ". Expected <index>/<count>, e.g. 0/4.");
+        }
+    } else if (key == "merge_shards_directory") {
+        config.mergeShardsDirectory = value;
+        config.mergeShardsDirectorySet = true;
+    } else if (key == "verify_signature_matches") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.verifySignatureMatches = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.verifySignatureMatches = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'verify_signature_matches' in " + source + ": " + value);
+        }
+        config.verifySignatureMatchesSet = true;
+    } else if (key == "canonicalize_pose") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.canonicalizePose = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.canonicalizePose = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'canonicalize_pose' in " + source + ": " + value);
+        }
+        config.canonicalizePoseSet = true;
+    } else if (key == "canonical_quantization") {
+        try {
+            config.canonicalQuantization = std::stod(value);
+            if (config.canonicalQuantization <= 0.0) {
+                GltfInstancing::logWarning("Non-positive canonical_quantization in " + source + " adjusted to 0.0001.");
+                config.canonicalQuantization = 1e-4;
+            }
+            config.canonicalQuantizationSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'canonical_quantization' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "instancing_granularity") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "mesh" || value == "primitive") {
+            config.instancingGranularity = value;
+            config.instancingGranularitySet = true;
+        } else {
+            GltfInstancing::logWarning("Invalid value for 'instancing_granularity' in " + source + ": " + value + ". Expected mesh or primitive.");
+        }
+    } else if (key == "compact_instance_attributes") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.compactInstanceAttributes = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.compactInstanceAttributes = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'compact_instance_attributes' in " + source + ": " + value);
+        }
+        config.compactInstanceAttributesSet = true;
+    } else if (key == "batch_non_instanced_meshes") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.batchNonInstancedMeshes = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.batchNonInstancedMeshes = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'batch_non_instanced_meshes' in " + source + ": " + value);
+        }
+        config.batchNonInstancedMeshesSet = true;
+    } else if (key == "batch_vertex_budget") {
+        try {
+            config.batchVertexBudget = std::stoi(value);
+            if (config.batchVertexBudget <= 0) {
+                GltfInstancing::logWarning("Non-positive batch_vertex_budget in " + source + " adjusted to 262144.");
+                config.batchVertexBudget = 262144;
+            }
+            config.batchVertexBudgetSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'batch_vertex_budget' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "optimize_meshes") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.optimizeMeshes = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.optimizeMeshes = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'optimize_meshes' in " + source + ": " + value);
+        }
+        config.optimizeMeshesSet = true;
+    } else if (key == "meshopt_compression") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.meshoptCompression = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.meshoptCompression = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'meshopt_compression' in " + source + ": " + value);
+        }
+        config.meshoptCompressionSet = true;
+    } else if (key == "quantize_position_bits") {
+        try {
+            int bits = std::stoi(value);
+            if (bits < 0 || bits > 16) {
+                GltfInstancing::logWarning("quantize_position_bits must be between 0 and 16 in " + source + "; adjusted to 0 (no quantization).");
+                bits = 0;
+            }
+            config.quantizePositionBits = bits;
+            config.quantizePositionBitsSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'quantize_position_bits' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "quantize_normal_bits") {
+        try {
+            int bits = std::stoi(value);
+            if (bits != 0 && bits != 8 && bits != 16) {
+                GltfInstancing::logWarning("quantize_normal_bits must be 0, 8 or 16 in " + source + "; adjusted to 0 (no quantization).");
+                bits = 0;
+            }
+            config.quantizeNormalBits = bits;
+            config.quantizeNormalBitsSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'quantize_normal_bits' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "quantize_texcoord_bits") {
+        try {
+            int bits = std::stoi(value);
+            if (bits != 0 && bits != 8 && bits != 16) {
+                GltfInstancing::logWarning("quantize_texcoord_bits must be 0, 8 or 16 in " + source + "; adjusted to 0 (no quantization).");
+                bits = 0;
+            }
+            config.quantizeTexCoordBits = bits;
+            config.quantizeTexCoordBitsSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'quantize_texcoord_bits' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "spatial_tiling") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.spatialTiling = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.spatialTiling = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'spatial_tiling' in " + source + ": " + value);
+        }
+        config.spatialTilingSet = true;
+    } else if (key == "tiling_scheme") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "octree" || value == "quadtree") {
+            config.tilingScheme = value;
+            config.tilingSchemeSet = true;
+        } else {
+            GltfInstancing::logWarning("Invalid value for 'tiling_scheme' in " + source + ": " + value + ". Expected octree or quadtree.");
+        }
+    } else if (key == "tile_max_items") {
+        try {
+            config.tileMaxItems = std::stoi(value);
+            if (config.tileMaxItems <= 0) {
+                GltfInstancing::logWarning("Non-positive tile_max_items in " + source + " adjusted to 4096.");
+                config.tileMaxItems = 4096;
+            }
+            config.tileMaxItemsSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'tile_max_items' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "tile_max_depth") {
+        try {
+            config.tileMaxDepth = std::stoi(value);
+            if (config.tileMaxDepth < 0) {
+                GltfInstancing::logWarning("Negative tile_max_depth in " + source + " adjusted to 0.");
+                config.tileMaxDepth = 0;
+            }
+            config.tileMaxDepthSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'tile_max_depth' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "lod_generation") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.lodGeneration = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.lodGeneration = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'lod_generation' in " + source + ": " + value);
+        }
+        config.lodGenerationSet = true;
+    } else if (key == "lod_ratio") {
+        try {
+            config.lodRatio = std::stod(value);
+            if (config.lodRatio <= 0.0 || config.lodRatio >= 1.0) {
+                GltfInstancing::logWarning("lod_ratio outside (0, 1) in " + source + " adjusted to 0.25.");
+                config.lodRatio = 0.25;
+            }
+            config.lodRatioSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'lod_ratio' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "lod_error_budget") {
+        try {
+            config.lodErrorBudget = std::stod(value);
+            if (config.lodErrorBudget <= 0.0) {
+                GltfInstancing::logWarning("Non-positive lod_error_budget in " + source + " adjusted to 0.01.");
+                config.lodErrorBudget = 0.01;
+            }
+            config.lodErrorBudgetSet = true;
+        } catch (const std::exception& e) {
+            GltfInstancing::logWarning("Invalid value for 'lod_error_budget' in " + source + ": " + value + ". Error: " + e.what());
+        }
+    } else if (key == "metrics_report") {
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "true" || value == "1" || value == "yes") {
+            config.metricsReport = true;
+        } else if (value == "false" || value == "0" || value == "no") {
+            config.metricsReport = false;
+        } else {
+            GltfInstancing::logWarning("Invalid boolean value for 'metrics_report' in " + source + ": " + value);
+        }
+        config.metricsReportSet = true;
+    } else if (key == "trace_meshes") {
+        config.traceMeshNames = splitAndTrim(value, ',');
+        config.traceMeshNamesSet = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 // Function to load configuration from a file
 bool loadConfigurationFromFile(const std::string& configFilePath, ToolConfiguration& config) {
     std::ifstream configFile(configFilePath);
@@ -104,69 +576,9 @@ bool loadConfigurationFromFile(const std::string& configFilePath, ToolConfigurat
 
         std::string key, value;
         if (parseKeyValuePair(line, key, value)) {
-            if (key == "input_directory") {
-                config.inputDirectory = value;
-                config.inputDirectorySet = true;
-            } else if (key == "output_directory") {
-                config.outputDirectory = value;
-                config.outputDirectorySet = true;
-            } else if (key == "tolerance" || key == "geometry_tolerance") {
-                try {
-                    config.geometryTolerance = std::stod(value);
-                    config.geometryToleranceSet = true;
-                } catch (const std::exception& e) {
-                    GltfInstancing::logWarning("Invalid value for '" + key + "' in config file (line " + std::to_string(lineNumber) + "): " + value + ". Error: " + e.what());
-                }
-            } else if (key == "normal_tolerance") {
-                try {
-                    config.normalTolerance = std::stod(value);
-                    if (config.normalTolerance < 0.0) {
-                        GltfInstancing::logWarning("Negative normal_tolerance in config (line " + std::to_string(lineNumber) + ") adjusted to 0.0.");
-                        config.normalTolerance = 0.0;
-                    }
-                    config.normalToleranceSet = true;
-                } catch (const std::exception& e) {
-                    GltfInstancing::logWarning("Invalid value for 'normal_tolerance' in config file (line " + std::to_string(lineNumber) + "): " + value + ". Error: " + e.what());
-                }
-            } else if (key == "skip_attribute_data_hash") {
-                config.attributesToSkipDataHash = splitAndTrim(value, ',');
-                config.attributesToSkipDataHashSet = true;
-            } else if (key == "merge_all_glb") {
-                std::transform(value.begin(), value.end(), value.begin(), ::tolower);
-                if (value == "true" || value == "1" || value == "yes") {
-                    config.mergeAllGlb = true;
-                } else if (value == "false" || value == "0" || value == "no") {
-                    config.mergeAllGlb = false;
-                } else {
-                    GltfInstancing::logWarning("Invalid boolean value for 'merge_all_glb' in config file (line " + std::to_string(lineNumber) + "): " + value);
-                }
-                config.mergeAllGlbSet = true;
-            } else if (key == "instance_limit") {
-                try {
-                    config.instanceLimit = std::stoi(value);
-                    if (config.instanceLimit < 1) { // Instance limit cannot be less than 1
-                        GltfInstancing::logWarning("Invalid value for 'instance_limit' (must be >= 1) in config file (line " + std::to_string(lineNumber) + "): " + value + ". Using default 2.");
-                        config.instanceLimit = 2;
-                    }
-                    config.instanceLimitSet = true;
-                } catch (const std::exception& e) {
-                    GltfInstancing::logWarning("Invalid value for 'instance_limit' in config file (line " + std::to_string(lineNumber) + "): " + value + ". Error: " + e.what());
-                }
-            } else if (key == "mesh_segmentation") {
-                std::transform(value.begin(), value.end(), value.begin(), ::tolower);
-                if (value == "true" || value == "1" || value == "yes") {
-                    config.meshSegmentation = true;
-                } else if (value == "false" || value == "0" || value == "no") {
-                    config.meshSegmentation = false;
-                } else {
-                    GltfInstancing::logWarning("Invalid boolean value for 'mesh_segmentation' in config file (line " + std::to_string(lineNumber) + "): " + value);
-                }
-                config.meshSegmentationSet = true;
-            } else if (key == "csv_directory") {
-                config.csvDirectory = value;
-                config.csvDirectorySet = true;
-            } else {
-                GltfInstancing::logWarning("Unknown configuration key in config file (line " + std::to_string(lineNumber) + "): " + key);
+            const std::string source = "config file (line " + std::to_string(lineNumber) + ")";
+            if (!applyConfigurationValue(config, key, value, source)) {
+                GltfInstancing::logWarning("Unknown configuration key in " + source + ": " + key);
             }
         } else {
             GltfInstancing::logWarning("Malformed line in config file (line " + std::to_string(lineNumber) + "): " + line);
@@ -194,66 +606,102 @@ void printUsage(const char* progName) {
     GltfInstancing::logInfo("  --merge-all-glb:                     Merge all GLB outputs into a single file per type. Default: false.");
     GltfInstancing::logInfo("  --instance-limit <value>:            Minimum number of instances to form a group. Default: 2.");
     GltfInstancing::logInfo("  --mesh-segmentation:                 Export each mesh as a separate GLB file. Default: false.");
+    GltfInstancing::logInfo("  --segmentation-archive:              Pack segmented GLBs into segmented_meshes.bin + .json manifest. Default: false.");
     GltfInstancing::logInfo("  --csv-dir <path>:                    Path to directory with CSV files for post-processing.");
+    GltfInstancing::logInfo("  --embed-element-ids:                 Write the CSV element IDs into the GLBs (EXT_instance_features per instance). Default: false.");
+    GltfInstancing::logInfo("  --threads <count>:                   Worker threads for loading/processing. 0 = all hardware threads. Default: 1.");
+    GltfInstancing::logInfo("  --decode-images:                     Decode texture images on load instead of keeping the encoded bytes only. Default: false.");
+    GltfInstancing::logInfo("  --out-of-core:                       Index models one at a time and re-open them for writing (inputs larger than RAM). Default: false.");
+    GltfInstancing::logInfo("  --model-cache-mb <MB>:               Resident model budget for --out-of-core. Default: 4096.");
+    GltfInstancing::logInfo("  --signature-cache:                   With --out-of-core, skip parsing files unchanged since the last run (signature_cache.bin). Default: false.");
+    GltfInstancing::logInfo("  --shard <index>/<count>:             Only index this node's share of the input into detection_shard_<index>_of_<count>.bin.");
+    GltfInstancing::logInfo("  --merge-shards <dir>:                Detect (out of core) from the shard indexes in <dir> and write the outputs.");
+    GltfInstancing::logInfo("  --verify-matches:                    Confirm exact-mode signature matches with a full attribute comparison. Default: false.");
+    GltfInstancing::logInfo("  --canonicalize-pose:                 Instance meshes whose vertices were baked into different poses (exact mode). Default: false.");
+    GltfInstancing::logInfo("  --canonical-quantization <value>:    Position quantization step for --canonicalize-pose. Default: 0.0001.");
+    GltfInstancing::logInfo("  --granularity <mesh|primitive>:      primitive: also instance parts shared by otherwise unmatched meshes (exact mode). Default: mesh.");
+    GltfInstancing::logInfo("  --compact-instances:                 Store instance translations relative to a per-group origin, rotations as SHORT. Default: false.");
+    GltfInstancing::logInfo("  --batch-non-instanced:               Merge non-instanced meshes sharing a material into batched primitives (EXT_mesh_features). Default: false.");
+    GltfInstancing::logInfo("  --batch-vertex-budget <count>:       Maximum vertices per batched primitive. Default: 262144.");
+    GltfInstancing::logInfo("  --optimize-meshes:                   Reorder written meshes for vertex cache, overdraw and vertex fetch; weld duplicates. Default: false.");
+    GltfInstancing::logInfo("  --meshopt-compression:               Encode vertex and index buffer views with EXT_meshopt_compression. Default: false.");
+    GltfInstancing::logInfo("  --quantize-position-bits <0-16>:     Quantize POSITION to this many bits (KHR_mesh_quantization). Default: 0 (float).");
+    GltfInstancing::logInfo("  --quantize-normal-bits <0|8|16>:     Store NORMAL as normalized BYTE (8) or SHORT (16). Default: 0 (float).");
+    GltfInstancing::logInfo("  --quantize-texcoord-bits <0|8|16>:   Store TEXCOORD_n in [0, 1] as normalized UNSIGNED_BYTE/SHORT. Default: 0 (float).");
+    GltfInstancing::logInfo("  --spatial-tiling:                    Also write tileset_tiled.json with spatially partitioned per-tile GLBs. Default: false.");
+    GltfInstancing::logInfo("  --tiling-scheme <octree|quadtree>:   Partitioning for --spatial-tiling. Default: octree.");
+    GltfInstancing::logInfo("  --tile-max-items <count>:            Maximum meshes + instances per leaf tile. Default: 4096.");
+    GltfInstancing::logInfo("  --tile-max-depth <levels>:           Maximum tile depth below the root. Default: 10.");
+    GltfInstancing::logInfo("  --lod:                               Give inner tiles of the spatial tileset simplified content (REPLACE refinement). Default: false.");
+    GltfInstancing::logInfo("  --lod-ratio <fraction>:              Fraction of triangles kept per tile level. Default: 0.25.");
+    GltfInstancing::logInfo("  --lod-error-budget <fraction>:       Simplification error one level above the leaves, relative to mesh size. Default: 0.01.");
+    GltfInstancing::logInfo("  --metrics-report:                    Write per-stage wall/CPU time, peak memory, I/O bytes and counters to metrics.json. Default: false.");
+    GltfInstancing::logInfo("  --trace-meshes <names>:              Comma-separated mesh names whose detection is traced (needs --log-level DEBUG).");
+    GltfInstancing::logInfo("");
+    GltfInstancing::logInfo("Service Mode:");
+    GltfInstancing::logInfo("  --serve:                             Read one JSON job per line from stdin ({\"id\": ..., \"options\": {<config keys>}}), stream events to stdout.");
+    GltfInstancing::logInfo("  --serve-workers <count>:             Jobs run at the same time in service mode. Default: 1.");
+    GltfInstancing::logInfo("  --serve-queue <count>:               Jobs waiting for a worker before new ones are rejected. Default: 16.");
+    GltfInstancing::logInfo("  --serve-cache-dir <path>:            Directory of the service mode signature caches. Default: <temp>/gltf_instancing_cache.");
 }
 
-struct CsvEntry {
-    std::string meshHash;
-    std::string elementId;
-};
-
 struct ResultEntry {
     std::string meshNameOrHash;
     std::string componentId;
     std::string status;
+    std::string instancedGroup; // Instanced node (representative mesh name) the element became an instance of
+    std::string instanceIndex; // Index of the instance in that node's EXT_mesh_gpu_instancing attributes
 };
 
-// Helper function to read a CSV file
-bool loadCsvEntries(const std::filesystem::path& csvPath, std::vector<CsvEntry>& entries) {
-    std::ifstream file(csvPath);
-    if (!file.is_open()) {
-        GltfInstancing::logError("Could not open CSV file: " + csvPath.string());
-        return false;
-    }
-
-    std::string line;
-    // Skip header
-    if (!std::getline(file, line)) {
-        GltfInstancing::logWarning("CSV file is empty or could not read header: " + csvPath.string());
-        return true; // Not a failure, just empty
-    }
-
-    int lineNumber = 1;
-    while (std::getline(file, line)) {
-        lineNumber++;
-        if (line.empty() || line.find_first_not_of(" \t\r\n") == std::string::npos) {
-            continue; // Skip empty lines
-        }
-
-        std::stringstream ss(line);
-        std::string meshHash, elementId;
-
-        if (std::getline(ss, meshHash, ',') && std::getline(ss, elementId)) {
-            // Trim whitespace
-            meshHash.erase(0, meshHash.find_first_not_of(" \t\r\n"));
-            meshHash.erase(meshHash.find_last_not_of(" \t\r\n") + 1);
-            elementId.erase(0, elementId.find_first_not_of(" \t\r\n"));
-            elementId.erase(elementId.find_last_not_of(" \t\r\n") + 1);
+// Where a source mesh was placed in instanced_meshes.glb.
+struct InstancePlacement {
+    std::string groupName; // Name of the instanced node
+    size_t instanceIndex = 0;
+    int32_t sourcePrimitiveIndex = -1; // See MeshInstanceInfo::sourcePrimitiveIndex
+};
 
-            if (!meshHash.empty()) {
-                entries.push_back({meshHash, elementId});
-            } else {
-                GltfInstancing::logWarning("Skipping row " + std::to_string(lineNumber) + " in " + csvPath.filename().string() + " due to empty mesh hash.");
+// Source mesh name -> its instance in the instanced GLB, for the CSV join. A mesh drawn more
+// than once keeps its first placement. A mesh split by primitive granularity is placed in one
+// group per shared primitive; it reports a whole-mesh placement if it has one, else the group
+// of its lowest-index shared primitive. Needs the source models in memory (empty out of core).
+std::unordered_map<std::string, InstancePlacement> collectInstancePlacements(
+    const std::vector<GltfInstancing::LoadedGltfModel>& loadedModels,
+    const GltfInstancing::InstancingDetectionResult& detectionResult) {
+    std::unordered_map<std::string, InstancePlacement> placements;
+    for (const auto& group : detectionResult.instancedGroups) {
+        for (size_t instanceIndex = 0; instanceIndex < group.instances.size(); ++instanceIndex) {
+            const GltfInstancing::MeshInstanceInfo& instance = group.instances[instanceIndex];
+            // Model IDs are the load order, see GlbReader::loadGltfModels.
+            if (instance.originalGltfIndex < 0 || static_cast<size_t>(instance.originalGltfIndex) >= loadedModels.size()) {
+                continue;
+            }
+            const CesiumGltf::Model& model = loadedModels[static_cast<size_t>(instance.originalGltfIndex)].model;
+            const CesiumGltf::Mesh* mesh = CesiumGltf::Model::getSafe(&model.meshes, instance.originalMeshIndex);
+            if (!mesh || mesh->name.empty()) {
+                continue;
+            }
+            InstancePlacement placement{ group.representativeMeshName, instanceIndex, instance.sourcePrimitiveIndex };
+            auto [existing, inserted] = placements.emplace(mesh->name, placement);
+            if (!inserted && existing->second.sourcePrimitiveIndex >= 0 &&
+                (placement.sourcePrimitiveIndex < 0 || placement.sourcePrimitiveIndex < existing->second.sourcePrimitiveIndex)) {
+                existing->second = placement;
             }
-        } else {
-            GltfInstancing::logWarning("Skipping malformed row " + std::to_string(lineNumber) + " in " + csvPath.filename().string());
         }
     }
-    return true;
+    return placements;
 }
 
 // Main function to process GLB against CSV files, similar to the Python script
-void processCsvAgainstGlb(const ToolConfiguration& config) {
+// csvFiles: the parsed *_IDExport.csv files of the CSV directory (see loadElementCsvFiles).
+// knownMeshNames: mesh names of non_instanced_meshes.glb as recorded when Stage 1 wrote it;
+// without them the GLB is read back to collect the names.
+// placements: instance of each instanced source mesh, reported next to its element.
+// Files are joined and written in parallel on config.threadCount workers.
+void processCsvAgainstGlb(
+    const ToolConfiguration& config,
+    const std::vector<GltfInstancing::ElementCsvFile>& csvFiles,
+    const std::optional<std::vector<std::string>>& knownMeshNames,
+    const std::unordered_map<std::string, InstancePlacement>& placements) {
     if (!config.csvDirectorySet || config.csvDirectory.empty()) {
         GltfInstancing::logInfo("Stage 3: CSV Processing is disabled (no --csv-dir specified). Skipping.");
         return;
@@ -261,10 +709,9 @@ void processCsvAgainstGlb(const ToolConfiguration& config) {
 
     GltfInstancing::logInfo("Stage 3: Starting CSV processing against generated GLB.");
 
-    // 1. Check for CSV directory
-    std::filesystem::path csvDirPath(config.csvDirectory);
-    if (!std::filesystem::is_directory(csvDirPath)) {
-        GltfInstancing::logError("CSV directory specified does not exist or is not a directory: " + config.csvDirectory);
+    // 1. The CSV files were parsed before Stage 1 wrote its GLBs
+    if (csvFiles.empty()) {
+        GltfInstancing::logInfo("No _IDExport.csv files were loaded from: " + config.csvDirectory);
         return;
     }
 
@@ -275,264 +722,330 @@ void processCsvAgainstGlb(const ToolConfiguration& config) {
         return;
     }
 
-    // 3. Extract mesh names from the GLB
-    GltfInstancing::logInfo("Reading mesh names from: " + nonInstancedGlbPath.string());
-    GltfInstancing::GlbReader reader;
-    std::set<std::filesystem::path> glbFileSet = {nonInstancedGlbPath};
-    std::vector<GltfInstancing::LoadedGltfModel> models = reader.loadGltfModels(glbFileSet);
-    
-    if (models.empty()) {
-        GltfInstancing::logError("Failed to load non_instanced_meshes.glb for CSV processing.");
-        return;
-    }
-
+    // 3. Extract mesh names from the GLB (sorted for the report, hashed for the join)
     std::set<std::string> meshNamesFromGlb;
-    for (const auto& modelData : models) {
-        for (const auto& mesh : modelData.model.meshes) {
-            if (!mesh.name.empty()) {
-                meshNamesFromGlb.insert(mesh.name);
+    if (knownMeshNames) {
+        for (const auto& meshName : *knownMeshNames) {
+            if (!meshName.empty()) {
+                meshNamesFromGlb.insert(meshName);
+            }
+        }
+    } else {
+        GltfInstancing::logInfo("Reading mesh names from: " + nonInstancedGlbPath.string());
+        GltfInstancing::GlbReader reader; // Geometry-only: only mesh names are needed
+        std::set<std::filesystem::path> glbFileSet = {nonInstancedGlbPath};
+        std::vector<GltfInstancing::LoadedGltfModel> models = reader.loadGltfModels(glbFileSet);
+
+        if (models.empty()) {
+            GltfInstancing::logError("Failed to load non_instanced_meshes.glb for CSV processing.");
+            return;
+        }
+
+        for (const auto& modelData : models) {
+            for (const auto& mesh : modelData.model.meshes) {
+                if (!mesh.name.empty()) {
+                    meshNamesFromGlb.insert(mesh.name);
+                }
+            }
+            // Batched meshes (--batch-non-instanced) keep their names in the element property table.
+            for (const auto& elementName : GltfInstancing::readBatchedElementNames(modelData.model)) {
+                if (!elementName.empty()) {
+                    meshNamesFromGlb.insert(elementName);
+                }
             }
         }
     }
+    const std::unordered_set<std::string> glbMeshNameSet(meshNamesFromGlb.begin(), meshNamesFromGlb.end());
     GltfInstancing::logInfo("Found " + std::to_string(meshNamesFromGlb.size()) + " unique mesh names in the GLB file.");
 
 
-    // 4. Find and process each CSV file
-    GltfInstancing::logInfo("Scanning for CSV files in: " + csvDirPath.string());
-    const std::string suffix = "_IDExport.csv";
-    for (const auto& entry : std::filesystem::directory_iterator(csvDirPath)) {
-        const auto& path = entry.path();
-        const std::string filename = path.filename().string();
-        
-        // Check if the file is a regular file and ends with the required suffix
-        if (entry.is_regular_file() && 
-            filename.length() >= suffix.length() && 
-            filename.compare(filename.length() - suffix.length(), suffix.length(), suffix) == 0) {
-            
-            GltfInstancing::logInfo("--- Processing CSV file: " + filename + " ---");
-
-            // Load CSV entries
-            std::vector<CsvEntry> csvEntries;
-            if (!loadCsvEntries(path, csvEntries)) {
-                GltfInstancing::logError("Failed to load CSV file, skipping: " + path.string());
-                continue;
-            }
-            GltfInstancing::logInfo("Loaded " + std::to_string(csvEntries.size()) + " entries from " + filename);
+    // 4. Join and write each CSV file
+    GltfInstancing::parallelFor(csvFiles.size(), config.threadCount, [&](size_t fileIndex, int /*workerIndex*/) {
+        const GltfInstancing::ElementCsvFile& csvFile = csvFiles[fileIndex];
+        const std::string filename = csvFile.path.filename().string();
+        GltfInstancing::logInfo("--- Processing CSV file: " + filename + " (" + std::to_string(csvFile.rows.size()) + " entries) ---");
 
-            // Perform comparison
-            std::vector<ResultEntry> nonInstancedMatches;
-            std::vector<ResultEntry> instancedFromCsv;
-            std::set<std::string> matchedGlbMeshNames;
+        // Perform comparison
+        std::vector<ResultEntry> nonInstancedMatches;
+        std::vector<ResultEntry> instancedFromCsv;
+        std::unordered_set<std::string> matchedGlbMeshNames;
 
-            for (const auto& csvEntry : csvEntries) {
-                if (meshNamesFromGlb.count(csvEntry.meshHash)) {
-                    // Non-Instanced: mesh hash from CSV is in GLB
-                    nonInstancedMatches.push_back({csvEntry.meshHash, csvEntry.elementId, "Non-Instanced"});
-                    matchedGlbMeshNames.insert(csvEntry.meshHash);
-                } else {
-                    // Instanced: mesh hash from CSV is NOT in GLB
-                    instancedFromCsv.push_back({csvEntry.meshHash, csvEntry.elementId, "Instanced"});
+        for (const auto& csvEntry : csvFile.rows) {
+            if (glbMeshNameSet.count(csvEntry.meshHash)) {
+                // Non-Instanced: mesh hash from CSV is in GLB
+                nonInstancedMatches.push_back({csvEntry.meshHash, csvEntry.elementId, "Non-Instanced", "", ""});
+                matchedGlbMeshNames.insert(csvEntry.meshHash);
+            } else {
+                // Instanced: mesh hash from CSV is NOT in GLB
+                ResultEntry result{csvEntry.meshHash, csvEntry.elementId, "Instanced", "", ""};
+                auto placement = placements.find(csvEntry.meshHash);
+                if (placement != placements.end()) {
+                    result.instancedGroup = placement->second.groupName;
+                    result.instanceIndex = std::to_string(placement->second.instanceIndex);
                 }
+                instancedFromCsv.push_back(std::move(result));
             }
+        }
 
-            // Find meshes from GLB that were not in any CSV entry
-            std::vector<ResultEntry> instancedFromGlb;
-            for (const auto& glbMeshName : meshNamesFromGlb) {
-                if (matchedGlbMeshNames.find(glbMeshName) == matchedGlbMeshNames.end()) {
-                    instancedFromGlb.push_back({glbMeshName, "", "Instanced"});
-                }
-            }
-            
-            GltfInstancing::logInfo("Comparison complete:");
-            GltfInstancing::logInfo("  Non-Instanced (in GLB and CSV): " + std::to_string(nonInstancedMatches.size()));
-            GltfInstancing::logInfo("  Instanced (in CSV only): " + std::to_string(instancedFromCsv.size()));
-            GltfInstancing::logInfo("  Instanced (in GLB only): " + std::to_string(instancedFromGlb.size()));
-
-            // Write results to a new CSV
-            std::string outputFileName = path.stem().string() + "_results.csv";
-            std::filesystem::path outputCsvPath = std::filesystem::path(config.outputDirectory) / outputFileName;
-
-            std::ofstream outFile(outputCsvPath);
-            if (!outFile.is_open()) {
-                GltfInstancing::logError("Failed to open output CSV file for writing: " + outputCsvPath.string());
-                continue;
+        // Find meshes from GLB that were not in any CSV entry
+        std::vector<ResultEntry> instancedFromGlb;
+        for (const auto& glbMeshName : meshNamesFromGlb) {
+            if (matchedGlbMeshNames.find(glbMeshName) == matchedGlbMeshNames.end()) {
+                instancedFromGlb.push_back({glbMeshName, "", "Instanced", "", ""});
             }
+        }
 
-            outFile << "Mesh Name/Hash,Component ID,Status\n";
-            for (const auto& result : nonInstancedMatches) {
-                outFile << "\"" << result.meshNameOrHash << "\",\"" << result.componentId << "\",\"" << result.status << "\"\n";
-            }
-            for (const auto& result : instancedFromCsv) {
-                outFile << "\"" << result.meshNameOrHash << "\",\"" << result.componentId << "\",\"" << result.status << "\"\n";
-            }
-            for (const auto& result : instancedFromGlb) {
-                outFile << "\"" << result.meshNameOrHash << "\",\"" << result.componentId << "\",\"" << result.status << "\"\n";
-            }
+        GltfInstancing::logInfo("Comparison complete for " + filename + ":");
+        GltfInstancing::logInfo("  Non-Instanced (in GLB and CSV): " + std::to_string(nonInstancedMatches.size()));
+        GltfInstancing::logInfo("  Instanced (in CSV only): " + std::to_string(instancedFromCsv.size()));
+        GltfInstancing::logInfo("  Instanced (in GLB only): " + std::to_string(instancedFromGlb.size()));
+
+        // Write results to a new CSV
+        std::string outputFileName = csvFile.path.stem().string() + "_results.csv";
+        std::filesystem::path outputCsvPath = std::filesystem::path(config.outputDirectory) / outputFileName;
 
-            outFile.close();
-            GltfInstancing::logInfo("Results written to: " + outputCsvPath.string());
+        std::ofstream outFile(outputCsvPath);
+        if (!outFile.is_open()) {
+            GltfInstancing::logError("Failed to open output CSV file for writing: " + outputCsvPath.string());
+            return;
         }
-    }
+
+        outFile << "Mesh Name/Hash,Component ID,Status,Instanced Group,Instance Index\n";
+        auto writeResults = [&](const std::vector<ResultEntry>& results) {
+            for (const auto& result : results) {
+                outFile << "\"" << result.meshNameOrHash << "\",\"" << result.componentId << "\",\"" << result.status << "\",\""
+                        << result.instancedGroup << "\",\"" << result.instanceIndex << "\"\n";
+            }
+        };
+        writeResults(nonInstancedMatches);
+        writeResults(instancedFromCsv);
+        writeResults(instancedFromGlb);
+
+        outFile.close();
+        GltfInstancing::logInfo("Results written to: " + outputCsvPath.string());
+    });
      GltfInstancing::logInfo("--- Finished processing all CSV files. ---");
 }
 
-int main(int argc, char* argv[]) {
-   /* #if _DEBUG
-        std::cout << "Waiting for debugger to attach. Press Enter to continue..." << std::endl;
-        std::cin.get();
-    #endif*/
+// Spatial tileset (tileset_tiled.json): the placements of detectionResult partitioned into a spatial tile
+// hierarchy, one GLB per leaf tile under <output>/tiles. With LOD generation, inner tiles get a
+// GLB of their simplified subtree as well. The monolithic Stage 1 GLBs are kept, since the
+// segmentation and CSV stages read them.
+// The tiling is planned before the Stage 1 output jobs run; each tile GLB is a job of its own
+// and fills contentUris[i] for tree.tiles[i].
+struct SpatialTilesetPlan {
+    GltfInstancing::SpatialTileTree tree;
+    std::vector<GltfInstancing::MeshLodSet> lods;
+    std::filesystem::path tilesDirectory;
+    std::vector<size_t> contentTiles; // Tiles that get a GLB
+    std::vector<std::string> contentUris;
+};
 
-    GltfInstancing::logInfo("GltfInstancingTool starting...");
+// Builds the tile tree (and the LODs) when spatial tiling is enabled; std::nullopt otherwise.
+std::optional<SpatialTilesetPlan> planSpatialTileset(
+    const ToolConfiguration& config,
+    const std::vector<GltfInstancing::LoadedGltfModel>& loadedModels,
+    const GltfInstancing::InstancingDetectionResult& detectionResult) {
+    if (!config.spatialTiling) {
+        return std::nullopt;
+    }
+    GltfInstancing::logInfo("Stage 1: Spatial tiling enabled (" + config.tilingScheme + "). Writing hierarchical tileset...");
+
+    SpatialTilesetPlan plan;
+    GltfInstancing::SpatialTilingOptions tilingOptions;
+    tilingOptions.quadtree = config.tilingScheme == "quadtree";
+    tilingOptions.maxItemsPerTile = static_cast<size_t>(config.tileMaxItems);
+    tilingOptions.maxDepth = config.tileMaxDepth;
+    plan.tree = GltfInstancing::buildSpatialTileTree(loadedModels, detectionResult, tilingOptions);
+    if (plan.tree.tiles.empty()) {
+        GltfInstancing::logInfo("Skipping spatial tiling: no meshes to tile.");
+        return std::nullopt;
+    }
 
-    ToolConfiguration config;
-    std::string customConfigFilePath;
-    bool useCustomConfigFile = false;
+    plan.tilesDirectory = std::filesystem::path(config.outputDirectory) / "tiles";
+    std::error_code ec;
+    std::filesystem::create_directories(plan.tilesDirectory, ec);
+    if (ec) {
+        GltfInstancing::logError("Failed to create tile directory: " + plan.tilesDirectory.string() + ". Error: " + ec.message());
+        return std::nullopt;
+    }
 
-    // Set default log level, can be overridden by CLI
-    GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_INFO);
+    if (config.lodGeneration) {
+        GltfInstancing::LodOptions lodOptions;
+        lodOptions.ratio = config.lodRatio;
+        lodOptions.errorBudget = static_cast<float>(config.lodErrorBudget);
+        plan.lods = GltfInstancing::generateTileLods(loadedModels, plan.tree, lodOptions);
+    }
 
-    // 1. First pass: Check for --config and --log-level arguments to set them up early
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--config") {
-            if (i + 1 < argc) {
-                customConfigFilePath = argv[++i];
-                useCustomConfigFile = true;
-            }
-        } else if (arg == "--log-level") {
-             if (i + 1 < argc) {
-                std::string levelStr = argv[++i];
-                std::transform(levelStr.begin(), levelStr.end(), levelStr.begin(), ::toupper);
-                if (levelStr == "NONE") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::NONE);
-                else if (levelStr == "ERROR") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_ERROR);
-                else if (levelStr == "WARNING") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_WARNING);
-                else if (levelStr == "INFO") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_INFO);
-                else if (levelStr == "DEBUG") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_DEBUG);
-                else if (levelStr == "VERBOSE") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_VERBOSE);
-            }
+    plan.contentUris.resize(plan.tree.tiles.size());
+    for (size_t i = 0; i < plan.tree.tiles.size(); ++i) {
+        if (plan.tree.tiles[i].isLeaf() || plan.tree.replaceRefinement) {
+            plan.contentTiles.push_back(i);
         }
     }
+    return plan;
+}
 
-    if(useCustomConfigFile) {
-        GltfInstancing::logInfo("Custom configuration file specified: " + customConfigFilePath);
-        if (!loadConfigurationFromFile(customConfigFilePath, config)) {
-            GltfInstancing::logError("Failed to load specified configuration file: " + customConfigFilePath + ". Exiting.");
-            return 1; 
+// Writes the GLB of plan.tree.tiles[tileIndex] and records its URI.
+void writeSpatialTile(
+    SpatialTilesetPlan& plan,
+    const std::vector<GltfInstancing::LoadedGltfModel>& loadedModels,
+    size_t tileIndex,
+    GltfInstancing::GlbWriter& glbWriter) {
+    const GltfInstancing::SpatialTile& tile = plan.tree.tiles[tileIndex];
+    const GltfInstancing::MeshLodSet* meshLods = tile.height > 0 ? &plan.lods[static_cast<size_t>(tile.height - 1)] : nullptr;
+    const std::string fileName = "tile_" + tile.address + ".glb";
+    if (glbWriter.writeInstancedGlb(loadedModels, tile.content, plan.tilesDirectory / fileName, meshLods)) {
+        plan.contentUris[tileIndex] = "tiles/" + fileName;
+    } else {
+        GltfInstancing::logError("Failed to write tile GLB: " + fileName);
+    }
+}
+
+// Writes tileset_tiled.json once every tile GLB has been written.
+void finishSpatialTileset(const ToolConfiguration& config, const SpatialTilesetPlan& plan) {
+    GltfInstancing::TilesetWriter tilesetWriter;
+    std::filesystem::path tiledTilesetPath = std::filesystem::path(config.outputDirectory) / "tileset_tiled.json";
+    if (tilesetWriter.writeTileTree(plan.tree, plan.contentUris, tiledTilesetPath)) {
+        GltfInstancing::logInfo("Successfully wrote hierarchical tileset to: " + tiledTilesetPath.string());
+    } else {
+        GltfInstancing::logError("Failed to write the hierarchical tileset file.");
+    }
+}
+
+// Writes a one-tile tileset for a Stage 1 GLB; skipped if the GLB was not produced or is empty.
+void writeSingleContentTileset(
+    const std::optional<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>>& writeResult,
+    const std::filesystem::path& tilesetPath,
+    const std::string& label) {
+    if (!writeResult || !writeResult->second.isValid()) {
+        GltfInstancing::logInfo("Skipping " + label + " tileset generation: no valid " + label + " GLB was produced.");
+        return;
+    }
+    std::vector<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>> contents = { *writeResult };
+
+    GltfInstancing::BoundingBox bbox = writeResult->second;
+    glm::dvec3 extents = bbox.max - bbox.min;
+    double diagonal = glm::length(extents);
+    double rootGeometricError = (diagonal > 0) ? (diagonal * 0.1) : 1.0;
+    if (rootGeometricError < 1.0) rootGeometricError = 1.0;
+
+    GltfInstancing::logDebug("Calculated root geometric error for " + label + " tileset: " + std::to_string(rootGeometricError));
+    GltfInstancing::TilesetWriter tilesetWriter;
+    if (tilesetWriter.writeTileset(contents, tilesetPath, rootGeometricError)) {
+        GltfInstancing::logInfo("Successfully wrote " + label + " tileset to: " + tilesetPath.string());
+    } else {
+        GltfInstancing::logError("Failed to write the " + label + " tileset file.");
+    }
+}
+
+// Service mode hooks of one pipeline run; a default context is a plain command-line run.
+struct PipelineContext {
+    std::function<void(const std::string& stageName)> onStage; // Called as each metrics stage begins
+    GltfInstancing::WarmModelStore* warmModels = nullptr; // Decoded models shared across jobs
+    GltfInstancing::SignatureCacheStore* signatureCaches = nullptr; // Replaces <output>/signature_cache.bin
+};
+
+GltfInstancing::InstancingDetector createInstancingDetector(const ToolConfiguration& config) {
+    return GltfInstancing::InstancingDetector(config.geometryTolerance, config.attributesToSkipDataHash, config.normalTolerance, config.instanceLimit, config.threadCount,
+        config.verifySignatureMatches, config.canonicalizePose, config.canonicalQuantization);
+}
+
+void writeMetricsReportIfRequested(const ToolConfiguration& config) {
+    if (config.metricsReport) {
+        std::filesystem::path metricsPath = std::filesystem::path(config.outputDirectory) / "metrics.json";
+        if (GltfInstancing::writeMetricsReport(metricsPath)) {
+            GltfInstancing::logInfo("Wrote metrics report to: " + metricsPath.string());
         }
     }
+}
 
-    // 2. Parse all command-line arguments (will override config file settings)
-    int argIndex = 1; 
-    while(argIndex < argc) {
-        std::string arg = argv[argIndex];
+// Shard mode: indexes this node's share of the discovered files (every shardCount-th one,
+// starting at shardIndex) into <output>/detection_shard_<index>_of_<count>.bin; no GLB is
+// written. The share follows the sorted discovery order, so all nodes need the same input listing.
+int writeShardIndex(
+    const ToolConfiguration& config,
+    const std::set<std::filesystem::path>& glbFilePaths,
+    const GltfInstancing::GlbReaderOptions& readerOptions) {
+    std::vector<std::filesystem::path> shardPaths;
+    size_t position = 0;
+    for (const auto& path : glbFilePaths) {
+        if (position++ % static_cast<size_t>(config.shardCount) == static_cast<size_t>(config.shardIndex)) {
+            shardPaths.push_back(path);
+        }
+    }
+    GltfInstancing::logInfo("Shard " + std::to_string(config.shardIndex) + " of " + std::to_string(config.shardCount) + ": indexing " +
+                            std::to_string(shardPaths.size()) + " of " + std::to_string(glbFilePaths.size()) + " GLB file(s).");
+
+    const std::filesystem::path shardIndexPath = std::filesystem::path(config.outputDirectory) / shardIndexFileName(config.shardIndex, config.shardCount);
+    GltfInstancing::InstancingDetector detector = createInstancingDetector(config);
+    GltfInstancing::SignatureCache shardIndex(shardIndexPath, detector.signatureSettingsKey());
+    const size_t cacheBytes = static_cast<size_t>(config.modelCacheMb) * 1024 * 1024;
+    GltfInstancing::ModelCache modelCache(std::move(shardPaths), readerOptions, cacheBytes);
+    const size_t indexedCount = detector.indexShard(modelCache, shardIndex);
+    if (!shardIndex.save()) {
+        return 1;
+    }
+    GltfInstancing::logInfo("Wrote shard index with " + std::to_string(indexedCount) + " file record(s) to: " + shardIndexPath.string());
+    GltfInstancing::logInfo("Collect the shard indexes of all nodes in one directory and pass it to --merge-shards to write the outputs.");
+    return 0;
+}
 
-        // Options processed in the first pass can be skipped
-        if (arg == "--config" || arg == "--log-level") {
-            argIndex += 2;
-            if (argIndex > argc) break;
+// Merge run: adds the records of every shard index (detection_shard_<index>_of_<count>.bin) in
+// directory to cache. The files of missing or unreadable shards are parsed by the merge run.
+void mergeShardIndexes(const std::filesystem::path& directory, GltfInstancing::SignatureCache& cache) {
+    std::error_code ec;
+    if (!std::filesystem::is_directory(directory, ec)) {
+        GltfInstancing::logError("Shard index directory does not exist or is not a directory: " + directory.string() + ". Every file is parsed by this run.");
+        return;
+    }
+    const std::string prefix = "detection_shard_";
+    const std::string suffix = ".bin";
+    std::map<int, std::set<int>> mergedShardsByCount;
+    for (const auto& dirEntry : std::filesystem::directory_iterator(directory, ec)) {
+        const std::string fileName = dirEntry.path().filename().string();
+        if (!dirEntry.is_regular_file() || fileName.size() <= prefix.size() + suffix.size() ||
+            fileName.compare(0, prefix.size(), prefix) != 0 || fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) != 0) {
             continue;
         }
-
-        if (arg == "--input_directory") {
-            if (argIndex + 1 < argc) {
-                config.inputDirectory = argv[++argIndex];
-                config.inputDirectorySet = true;
-            } else {
-                GltfInstancing::logError("--input_directory option (CLI) requires a path."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--output_directory") {
-            if (argIndex + 1 < argc) {
-                config.outputDirectory = argv[++argIndex];
-                config.outputDirectorySet = true;
-            } else {
-                GltfInstancing::logError("--output_directory option (CLI) requires a path."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--tolerance") {
-            if (argIndex + 1 < argc) {
-                try {
-                    config.geometryTolerance = std::stod(argv[++argIndex]);
-                    config.geometryToleranceSet = true;
-                    GltfInstancing::logDebug("Command-line override: Using geometry tolerance: " + std::to_string(config.geometryTolerance));
-                } catch (const std::exception& e) {
-                    GltfInstancing::logError("Invalid value for --tolerance (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
-                }
-            } else {
-                GltfInstancing::logError("--tolerance option (CLI) requires a value."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--skip-attribute-data-hash") {
-            if (argIndex + 1 < argc) {
-                config.attributesToSkipDataHash = splitAndTrim(argv[++argIndex], ',');
-                config.attributesToSkipDataHashSet = true;
-                if (!config.attributesToSkipDataHash.empty()) {
-                    std::string attrsLogged = "Command-line override: Tolerance mode will skip data hashing for attributes: ";
-                    for (const auto& attr : config.attributesToSkipDataHash) attrsLogged += attr + " ";
-                    GltfInstancing::logDebug(attrsLogged);
-                }
-            } else {
-                GltfInstancing::logError("--skip-attribute-data-hash option (CLI) requires a comma-separated list."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--normal-tolerance") {
-            if (argIndex + 1 < argc) {
-                try {
-                    config.normalTolerance = std::stod(argv[++argIndex]);
-                    if (config.normalTolerance < 0.0) {
-                        GltfInstancing::logWarning("WARNING (CLI): Normal tolerance cannot be negative. Using 0.0.");
-                        config.normalTolerance = 0.0;
-                    }
-                    config.normalToleranceSet = true;
-                    GltfInstancing::logDebug("Command-line override: Using normal tolerance: " + std::to_string(config.normalTolerance));
-                } catch (const std::exception& e) {
-                    GltfInstancing::logError("Invalid value for --normal-tolerance (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
-                }
-            } else {
-                GltfInstancing::logError("--normal-tolerance option (CLI) requires a value."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--merge-all-glb") {
-            config.mergeAllGlb = true;
-            config.mergeAllGlbSet = true;
-            GltfInstancing::logDebug("Command-line override: Merge all GLB outputs enabled.");
-        } else if (arg == "--instance-limit") {
-            if (argIndex + 1 < argc) {
-                try {
-                    config.instanceLimit = std::stoi(argv[++argIndex]);
-                     if (config.instanceLimit < 1) {
-                        GltfInstancing::logWarning("WARNING (CLI): Instance limit must be >= 1. Using default 2.");
-                        config.instanceLimit = 2;
-                    }
-                    config.instanceLimitSet = true;
-                    GltfInstancing::logDebug("Command-line override: Using instance limit: " + std::to_string(config.instanceLimit));
-                } catch (const std::exception& e) {
-                    GltfInstancing::logError("Invalid value for --instance-limit (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
-                }
-            } else {
-                GltfInstancing::logError("--instance-limit option (CLI) requires a value."); printUsage(argv[0]); return 1;
-            }
-        } else if (arg == "--mesh-segmentation") {
-            config.meshSegmentation = true;
-            config.meshSegmentationSet = true;
-            GltfInstancing::logDebug("Command-line override: Mesh segmentation enabled (each mesh to a separate GLB).");
-        } else if (arg == "--csv-dir") {
-            if (argIndex + 1 < argc) {
-                config.csvDirectory = argv[++argIndex];
-                config.csvDirectorySet = true;
-                GltfInstancing::logDebug("Command-line override: CSV processing directory set to: " + config.csvDirectory);
-            } else {
-                GltfInstancing::logError("--csv-dir option (CLI) requires a path."); printUsage(argv[0]); return 1;
-            }
-        } else { // An unknown option
-            GltfInstancing::logError("Unexpected command-line argument: " + arg);
-            printUsage(argv[0]);
-            return 1;
+        std::string specification = fileName.substr(prefix.size(), fileName.size() - prefix.size() - suffix.size());
+        const size_t ofPos = specification.find("_of_");
+        int shardIndex = 0;
+        int shardCount = 0;
+        if (ofPos == std::string::npos || !parseShardSpecification(specification.replace(ofPos, 4, "/"), shardIndex, shardCount)) {
+            continue;
+        }
+        if (cache.mergeFrom(dirEntry.path())) {
+            mergedShardsByCount[shardCount].insert(shardIndex);
         }
-        argIndex++;
     }
 
-    // 3. Finalize and validate configuration
-    if (config.inputDirectory.empty()) {
-        GltfInstancing::logError("--input_directory must be specified.");
-        printUsage(argv[0]);
-        return 1;
+    if (mergedShardsByCount.empty()) {
+        GltfInstancing::logWarning("No shard index found in " + directory.string() + "; every file is parsed by this run.");
+        return;
+    }
+    if (mergedShardsByCount.size() > 1) {
+        GltfInstancing::logWarning("Shard indexes of different shard counts in " + directory.string() + "; all of them are merged.");
     }
+    for (const auto& [shardCount, shardIndices] : mergedShardsByCount) {
+        if (shardIndices.size() < static_cast<size_t>(shardCount)) {
+            GltfInstancing::logWarning("Merged " + std::to_string(shardIndices.size()) + " of " + std::to_string(shardCount) +
+                                       " shard indexes; the files of the missing shards are parsed by this run.");
+        } else {
+            GltfInstancing::logInfo("Merged all " + std::to_string(shardCount) + " shard indexes.");
+        }
+    }
+}
+
+// Runs the whole tool (Stages 1 to 3) for a configuration whose input directory is set.
+// Returns the process exit code.
+int runPipeline(ToolConfiguration config, const PipelineContext& context) {
+    GltfInstancing::clearMetricsStages();
+    auto reportStage = [&](const std::string& stageName) {
+        if (context.onStage) {
+            context.onStage(stageName);
+        }
+    };
 
     if (config.outputDirectory.empty()) {
         std::filesystem::path inputPath(config.inputDirectory);
@@ -561,52 +1074,134 @@ int main(int argc, char* argv[]) {
         GltfInstancing::logError("Output path exists but is not a directory: " + config.outputDirectory);
         return 1;
     }
+    if (config.shardCount > 0 && !config.mergeShardsDirectory.empty()) {
+        GltfInstancing::logError("shard and merge_shards_directory cannot be combined: shard runs only index, the merge run groups and writes.");
+        return 1;
+    }
+    if ((config.shardCount > 0 || !config.mergeShardsDirectory.empty()) && config.verifySignatureMatches) {
+        // Verification compares the geometry itself, which the shard indexes do not hold.
+        GltfInstancing::logError("Sharded detection cannot be combined with verify_signature_matches.");
+        return 1;
+    }
+    if (!config.mergeShardsDirectory.empty() && !config.outOfCore) {
+        GltfInstancing::logInfo("Merging shard indexes uses the out-of-core pipeline.");
+        config.outOfCore = true;
+    }
 
     GltfInstancing::logInfo("Stage 1: Discovering, Reading, and Processing GLB files for Instancing...");
-    GltfInstancing::GlbReader reader;
+    reportStage("load");
+    GltfInstancing::MetricsStage loadStage("load");
+    GltfInstancing::GlbReaderOptions glbReaderOptions;
+    glbReaderOptions.decodeImages = config.decodeImages;
+    GltfInstancing::GlbReader reader(glbReaderOptions);
     std::set<std::filesystem::path> initialGlbFilePaths = reader.discoverGlbFiles(config.inputDirectory, true /* recursive */);
 
     if (initialGlbFilePaths.empty()) {
         GltfInstancing::logInfo("No GLB files found in input directory to process.");
         return 0;
     }
+    if (config.shardCount > 0) {
+        loadStage.finish();
+        reportStage("shard_index");
+        GltfInstancing::MetricsStage shardIndexStage("shard_index");
+        const int exitCode = writeShardIndex(config, initialGlbFilePaths, glbReaderOptions);
+        shardIndexStage.finish();
+        writeMetricsReportIfRequested(config);
+        return exitCode;
+    }
 
-    std::vector<GltfInstancing::LoadedGltfModel> loadedModels = reader.loadGltfModels(initialGlbFilePaths);
-    if (loadedModels.empty()) {
-        GltfInstancing::logError("Failed to load any GLB models from input directory.");
-        return 1;
+    // Out of core no model stays loaded: loadedModels stays empty and the cache re-opens files on demand.
+    std::vector<GltfInstancing::LoadedGltfModel> loadedModels;
+    std::unique_ptr<GltfInstancing::ModelCache> modelCache;
+    if (config.outOfCore) {
+        const size_t cacheBytes = static_cast<size_t>(config.modelCacheMb) * 1024 * 1024;
+        modelCache = std::make_unique<GltfInstancing::ModelCache>(
+            std::vector<std::filesystem::path>(initialGlbFilePaths.begin(), initialGlbFilePaths.end()), glbReaderOptions, cacheBytes);
+        GltfInstancing::logInfo("Out-of-core pipeline: " + std::to_string(modelCache->modelCount()) + " GLB file(s), model cache " +
+                                std::to_string(config.modelCacheMb) + " MB.");
+    } else {
+        loadedModels = context.warmModels
+            ? context.warmModels->loadGltfModels(initialGlbFilePaths, glbReaderOptions, config.threadCount)
+            : reader.loadGltfModels(initialGlbFilePaths, config.threadCount);
+        if (loadedModels.empty()) {
+            GltfInstancing::logError("Failed to load any GLB models from input directory.");
+            return 1;
+        }
+        GltfInstancing::logInfo("Successfully loaded " + std::to_string(loadedModels.size()) + " initial GLB model(s).");
     }
-    GltfInstancing::logInfo("Successfully loaded " + std::to_string(loadedModels.size()) + " initial GLB model(s).");
+    loadStage.finish();
 
     // --- Instancing Analysis: Before ---
+    size_t inputModelCount = 0;
     size_t totalNodesBefore = 0;
     size_t totalMeshesBefore = 0;
     size_t totalInstancesBefore = 0;
 
+    auto accumulateInputStatistics = [&](const GltfInstancing::ModelStatistics& statistics) {
+        ++inputModelCount;
+        totalNodesBefore += statistics.nodeCount;
+        totalMeshesBefore += statistics.meshCount;
+        totalInstancesBefore += statistics.gpuInstanceCount;
+    };
     for (const auto& loadedModel : loadedModels) {
-        totalNodesBefore += loadedModel.model.nodes.size();
-        totalMeshesBefore += loadedModel.model.meshes.size();
-        for (const auto& node : loadedModel.model.nodes) {
-            auto it = node.extensions.find("EXT_mesh_gpu_instancing");
-            if (it != node.extensions.end()) {
-                const CesiumGltf::ExtensionExtMeshGpuInstancing* pInstancing = std::any_cast<CesiumGltf::ExtensionExtMeshGpuInstancing>(&it->second);
-                if (pInstancing) {
-                    auto attr_it = pInstancing->attributes.find("TRANSLATION");
-                    if (attr_it != pInstancing->attributes.end()) {
-                        int32_t accessorIndex = attr_it->second;
-                        if (accessorIndex >= 0 && static_cast<size_t>(accessorIndex) < loadedModel.model.accessors.size()) {
-                            totalInstancesBefore += loadedModel.model.accessors[accessorIndex].count;
-                        }
-                    }
-                }
-            }
-        }
+        accumulateInputStatistics(GltfInstancing::computeModelStatistics(loadedModel.model));
     }
     // ---
 
     GltfInstancing::logInfo("Stage 1: Detecting instancing opportunities...");
-    GltfInstancing::InstancingDetector detector(config.geometryTolerance, config.attributesToSkipDataHash, config.normalTolerance, config.instanceLimit);
-    GltfInstancing::InstancingDetectionResult detectionResult = detector.detect(loadedModels);
+    reportStage("detect");
+    GltfInstancing::MetricsStage detectStage("detect");
+    GltfInstancing::InstancingDetector detector = createInstancingDetector(config);
+    std::unique_ptr<GltfInstancing::SignatureCache> signatureCache;
+    if (config.signatureCache && !config.outOfCore) {
+        // Only the two-pass pipeline can leave unchanged files unparsed.
+        GltfInstancing::logWarning("signature_cache requires out_of_core; the signature cache is not used.");
+    } else if (config.signatureCache && !context.signatureCaches) {
+        signatureCache = std::make_unique<GltfInstancing::SignatureCache>(
+            std::filesystem::path(config.outputDirectory) / "signature_cache.bin", detector.signatureSettingsKey());
+    }
+    const bool useSharedSignatureCache = config.outOfCore && config.signatureCache && context.signatureCaches;
+    // Merge run: the shard records join the signature cache, or make up one of their own.
+    std::unique_ptr<GltfInstancing::SignatureCache> shardIndexes;
+    if (!config.mergeShardsDirectory.empty()) {
+        if (signatureCache) {
+            mergeShardIndexes(config.mergeShardsDirectory, *signatureCache);
+        } else if (!useSharedSignatureCache) {
+            shardIndexes = std::make_unique<GltfInstancing::SignatureCache>(detector.signatureSettingsKey());
+            mergeShardIndexes(config.mergeShardsDirectory, *shardIndexes);
+        }
+    }
+    GltfInstancing::InstancingDetectionResult detectionResult;
+    if (useSharedSignatureCache) {
+        // Service mode: the cache of these detection settings stays in memory across jobs.
+        context.signatureCaches->withCache(detector.signatureSettingsKey(), [&](GltfInstancing::SignatureCache& sharedCache) {
+            if (!config.mergeShardsDirectory.empty()) {
+                mergeShardIndexes(config.mergeShardsDirectory, sharedCache);
+            }
+            detectionResult = detector.detectStreaming(*modelCache, accumulateInputStatistics, &sharedCache);
+        });
+    } else {
+        detectionResult = config.outOfCore
+            ? detector.detectStreaming(*modelCache, accumulateInputStatistics, signatureCache ? signatureCache.get() : shardIndexes.get())
+            : detector.detect(loadedModels);
+    }
+    if (config.instancingGranularity == "primitive") {
+        if (config.outOfCore) {
+            // Splitting meshes needs the models resident; pass 2 re-opens the unmodified files.
+            GltfInstancing::logWarning("instancing_granularity = primitive requires the in-core pipeline; using mesh granularity.");
+        } else {
+            detector.splitSharedPrimitives(loadedModels, detectionResult);
+        }
+    }
+    if (signatureCache) {
+        signatureCache->save();
+        signatureCache.reset();
+    }
+    detectStage.finish();
+    if (config.outOfCore && inputModelCount == 0) {
+        GltfInstancing::logError("Failed to load any GLB models from input directory.");
+        return 1;
+    }
 
     // --- Instancing Analysis: After ---
     size_t totalInstancesAfter = 0;
@@ -633,7 +1228,7 @@ int main(int argc, char* argv[]) {
 
     GltfInstancing::logInfo("--- Instancing Analysis ---");
     GltfInstancing::logInfo("Initial state:");
-    GltfInstancing::logInfo("  Total models loaded: " + std::to_string(loadedModels.size()));
+    GltfInstancing::logInfo("  Total models loaded: " + std::to_string(inputModelCount));
     GltfInstancing::logInfo("  Total nodes: " + std::to_string(totalNodesBefore));
     GltfInstancing::logInfo("  Total meshes: " + std::to_string(totalMeshesBefore));
     GltfInstancing::logInfo("  Total instances (from EXT_mesh_gpu_instancing): " + std::to_string(totalInstancesBefore));
@@ -688,7 +1283,7 @@ int main(int argc, char* argv[]) {
         std::stringstream stream;
         stream << std::fixed << std::setprecision(2) << reductionPercentage;
 
-        analysisCsvFile << loadedModels.size() << ","
+        analysisCsvFile << inputModelCount << ","
                         << totalNodesBefore << ","
                         << totalMeshesBefore << ","
                         << totalInstancesBefore << ","
@@ -715,109 +1310,156 @@ int main(int argc, char* argv[]) {
         // However, the user query implies segmentation AFTER instancing outputs. So if these are empty, there's nothing to segment later.
     }
 
+    // The CSV files are read before Stage 1 writes, so their element IDs can go into the GLBs.
+    reportStage("csv_parse");
+    GltfInstancing::MetricsStage csvParseStage("csv_parse");
+    std::vector<GltfInstancing::ElementCsvFile> elementCsvFiles;
+    if (config.csvDirectorySet && !config.csvDirectory.empty()) {
+        if (std::filesystem::is_directory(config.csvDirectory)) {
+            GltfInstancing::logInfo("Scanning for CSV files in: " + config.csvDirectory);
+            elementCsvFiles = GltfInstancing::loadElementCsvFiles(config.csvDirectory, config.threadCount);
+            GltfInstancing::logInfo("Loaded " + std::to_string(elementCsvFiles.size()) + " _IDExport.csv file(s).");
+        } else {
+            GltfInstancing::logError("CSV directory specified does not exist or is not a directory: " + config.csvDirectory);
+        }
+    }
+    std::unordered_map<std::string, std::string> elementIds;
+    if (config.embedElementIds) {
+        if (elementCsvFiles.empty()) {
+            GltfInstancing::logWarning("embed_element_ids is set but no _IDExport.csv files were loaded; no element IDs are embedded.");
+        } else {
+            elementIds = GltfInstancing::buildElementIdMap(elementCsvFiles);
+            if (config.outOfCore) {
+                // Instance features need every instance's source mesh name, which out of core is not resident.
+                GltfInstancing::logWarning("embed_element_ids with out_of_core: instances get no feature IDs; non-instanced meshes still carry theirs.");
+            }
+        }
+    }
+    csvParseStage.finish();
+
     GltfInstancing::logInfo("Stage 1: Writing instanced and non-instanced GLB files...");
-    GltfInstancing::GlbWriter glbWriter;
+    reportStage("write");
+    GltfInstancing::MetricsStage writeStage("write");
+    GltfInstancing::GlbWriterOptions glbWriterOptions;
+    glbWriterOptions.compactInstanceAttributes = config.compactInstanceAttributes;
+    glbWriterOptions.batchNonInstancedMeshes = config.batchNonInstancedMeshes;
+    glbWriterOptions.batchVertexBudget = static_cast<size_t>(config.batchVertexBudget);
+    glbWriterOptions.optimizeMeshes = config.optimizeMeshes;
+    glbWriterOptions.compression.meshoptCompression = config.meshoptCompression;
+    glbWriterOptions.compression.positionBits = config.quantizePositionBits;
+    glbWriterOptions.compression.normalBits = config.quantizeNormalBits;
+    glbWriterOptions.compression.texCoordBits = config.quantizeTexCoordBits;
+    // Segmentation takes the Stage 1 GLBs from memory; out of core they are re-read instead.
+    glbWriterOptions.retainOutputModels = config.meshSegmentation && !config.outOfCore;
+    if (!elementIds.empty()) {
+        glbWriterOptions.elementIds = &elementIds;
+    }
     std::filesystem::path instancedGlbFileNameBase = "instanced_meshes";
     std::filesystem::path nonInstancedGlbFileNameBase = "non_instanced_meshes";
-    std::vector<std::filesystem::path> stage1_outputGlbs; // Store paths of GLBs generated in stage 1
+    std::vector<GltfInstancing::GlbOutputArtifact> stage1_outputs; // GLBs generated in stage 1, in memory where retained
+    std::optional<GltfInstancing::GlbOutputArtifact> instancedArtifact;
+    std::optional<GltfInstancing::GlbOutputArtifact> nonInstancedArtifact;
 
     std::optional<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>> instancedWriteResult;
     std::optional<std::pair<std::filesystem::path, GltfInstancing::BoundingBox>> nonInstancedWriteResult;
 
-    if (config.mergeAllGlb) {
-        GltfInstancing::logDebug("MergeAllGlb is enabled. Writing merged instanced and non-instanced files.");
-        std::filesystem::path mergedInstancedGlbPath = std::filesystem::path(config.outputDirectory) / (instancedGlbFileNameBase.string() + ".glb");
-        instancedWriteResult = glbWriter.writeInstancedMeshesOnly(loadedModels, detectionResult, mergedInstancedGlbPath);
-        if (instancedWriteResult) {
-            GltfInstancing::logInfo("Merged Instanced GLB written to: " + instancedWriteResult->first.string());
-            stage1_outputGlbs.push_back(instancedWriteResult->first);
-        } else {
-            GltfInstancing::logError("Failed to write merged instanced GLB.");
-        }
+    // Current GlbWriter's writeInstancedMeshesOnly and writeNonInstancedMeshesOnly
+    // already combine all input models' results into single output files, with or without mergeAllGlb.
+    GltfInstancing::logDebug(config.mergeAllGlb ? "MergeAllGlb is enabled. Writing merged instanced and non-instanced files."
+                                                : "MergeAllGlb is disabled. Writing combined instanced and non-instanced files.");
+    const std::string mergedLabel = config.mergeAllGlb ? "Merged " : "";
 
-        std::filesystem::path mergedNonInstancedGlbPath = std::filesystem::path(config.outputDirectory) / (nonInstancedGlbFileNameBase.string() + ".glb");
-        nonInstancedWriteResult = glbWriter.writeNonInstancedMeshesOnly(loadedModels, detectionResult, mergedNonInstancedGlbPath);
-        if (nonInstancedWriteResult) {
-            GltfInstancing::logInfo("Merged Non-Instanced GLB written to: " + nonInstancedWriteResult->first.string());
-            stage1_outputGlbs.push_back(nonInstancedWriteResult->first);
-        } else {
-            GltfInstancing::logError("Failed to write merged non-instanced GLB.");
-        }
+    std::optional<SpatialTilesetPlan> spatialPlan;
+    if (config.outOfCore && config.spatialTiling) {
+        // The tiler and LOD generator read the source models as a whole.
+        GltfInstancing::logWarning("spatial_tiling is not supported with out_of_core; skipping the spatial tileset.");
     } else {
-        GltfInstancing::logDebug("MergeAllGlb is disabled. Processing files individually (if applicable - current writer writes combined files).");
-        // Current GlbWriter's writeInstancedMeshesOnly and writeNonInstancedMeshesOnly
-        // already combine all input models' results into single output files.
-        // If per-input-file output was desired, GlbWriter would need significant changes.
-        // For now, assume it behaves like mergeAllGlb=true in terms of output file count for these calls.
+        spatialPlan = planSpatialTileset(config, loadedModels, detectionResult);
+    }
+
+    // Every Stage 1 output is an independent job over the shared, read-only source models (or
+    // the model cache). Each worker owns a GlbWriter, which holds the build state of one GLB at a
+    // time, so the instanced GLB, the non-instanced GLB (each with its tileset) and the tile GLBs
+    // are written concurrently; results go into per-job slots.
+    std::vector<std::function<void(GltfInstancing::GlbWriter&)>> outputJobs;
+    outputJobs.push_back([&](GltfInstancing::GlbWriter& writer) {
         std::filesystem::path instancedGlbPath = std::filesystem::path(config.outputDirectory) / (instancedGlbFileNameBase.string() + ".glb");
-        instancedWriteResult = glbWriter.writeInstancedMeshesOnly(loadedModels, detectionResult, instancedGlbPath);
+        instancedWriteResult = writer.writeInstancedMeshesOnly(loadedModels, detectionResult, instancedGlbPath);
         if (instancedWriteResult) {
-            GltfInstancing::logInfo("Instanced GLB written to: " + instancedWriteResult->first.string());
-            stage1_outputGlbs.push_back(instancedWriteResult->first);
+            GltfInstancing::logInfo(mergedLabel + "Instanced GLB written to: " + instancedWriteResult->first.string());
+            instancedArtifact = writer.takeOutputArtifact();
         } else {
-            GltfInstancing::logError("Failed to write instanced GLB.");
+            GltfInstancing::logError("Failed to write " + mergedLabel + "instanced GLB.");
         }
-    
+        writeSingleContentTileset(instancedWriteResult, std::filesystem::path(config.outputDirectory) / "tileset_instanced.json", "instanced");
+    });
+    outputJobs.push_back([&](GltfInstancing::GlbWriter& writer) {
         std::filesystem::path nonInstancedGlbPath = std::filesystem::path(config.outputDirectory) / (nonInstancedGlbFileNameBase.string() + ".glb");
-        nonInstancedWriteResult = glbWriter.writeNonInstancedMeshesOnly(loadedModels, detectionResult, nonInstancedGlbPath);
+        nonInstancedWriteResult = writer.writeNonInstancedMeshesOnly(loadedModels, detectionResult, nonInstancedGlbPath);
         if (nonInstancedWriteResult) {
-            GltfInstancing::logInfo("Non-Instanced GLB written to: " + nonInstancedWriteResult->first.string());
-            stage1_outputGlbs.push_back(nonInstancedWriteResult->first);
+            GltfInstancing::logInfo(mergedLabel + "Non-Instanced GLB written to: " + nonInstancedWriteResult->first.string());
+            nonInstancedArtifact = writer.takeOutputArtifact();
         } else {
-            GltfInstancing::logError("Failed to write non-instanced GLB.");
+            GltfInstancing::logError("Failed to write " + mergedLabel + "non-instanced GLB.");
+        }
+        writeSingleContentTileset(nonInstancedWriteResult, std::filesystem::path(config.outputDirectory) / "tileset_non_instanced.json", "non-instanced");
+    });
+    if (spatialPlan) {
+        for (size_t tileIndex : spatialPlan->contentTiles) {
+            outputJobs.push_back([&, tileIndex](GltfInstancing::GlbWriter& writer) {
+                writeSpatialTile(*spatialPlan, loadedModels, tileIndex, writer);
+            });
         }
     }
 
-    // Stage 1 Tileset Generation
-    GltfInstancing::logInfo("Stage 1: Generating 3D Tilesets for Stage 1 outputs...");
-    GltfInstancing::TilesetWriter tilesetWriter;
-
-    // Generate tileset for instanced meshes
-    if (instancedWriteResult && instancedWriteResult->second.isValid()) {
-        std::filesystem::path instancedTilesetPath = std::filesystem::path(config.outputDirectory) / "tileset_instanced.json";
-        std::vector<std::filesystem::path> instancedUris = { instancedWriteResult->first };
-        
-        GltfInstancing::BoundingBox bbox = instancedWriteResult->second;
-        glm::dvec3 extents = bbox.max - bbox.min;
-        double diagonal = glm::length(extents);
-        double rootGeometricError = (diagonal > 0) ? (diagonal * 0.1) : 1.0;
-        if (rootGeometricError < 1.0) rootGeometricError = 1.0;
-
-        GltfInstancing::logDebug("Calculated root geometric error for instanced tileset: " + std::to_string(rootGeometricError));
-        if (tilesetWriter.writeTileset(instancedUris, instancedTilesetPath, rootGeometricError)) {
-            GltfInstancing::logInfo("Successfully wrote instanced tileset to: " + instancedTilesetPath.string());
-        } else {
-            GltfInstancing::logError("Failed to write the instanced tileset file.");
+    const int outputWorkerCount = static_cast<int>(std::min(
+        static_cast<size_t>(GltfInstancing::resolveThreadCount(config.threadCount)), outputJobs.size()));
+    if (outputWorkerCount > 1) {
+        GltfInstancing::logInfo("Writing " + std::to_string(outputJobs.size()) + " Stage 1 output(s) with " + std::to_string(outputWorkerCount) + " worker thread(s).");
+    }
+    std::vector<std::unique_ptr<GltfInstancing::GlbWriter>> outputWriters(static_cast<size_t>(std::max(outputWorkerCount, 1)));
+    GltfInstancing::parallelFor(outputJobs.size(), outputWorkerCount, [&](size_t jobIndex, int workerIndex) {
+        std::unique_ptr<GltfInstancing::GlbWriter>& writer = outputWriters[static_cast<size_t>(workerIndex)];
+        if (!writer) {
+            writer = std::make_unique<GltfInstancing::GlbWriter>(glbWriterOptions);
+            writer->setModelSource(modelCache.get()); // Pass 2 of the out-of-core pipeline
         }
-    } else {
-        GltfInstancing::logInfo("Skipping instanced tileset generation: no valid instanced GLB was produced.");
+        outputJobs[jobIndex](*writer);
+    });
+    outputWriters.clear();
+
+    // Mesh names of the non-instanced GLB for the CSV stage, so it does not parse the file again.
+    std::optional<std::vector<std::string>> nonInstancedMeshNames;
+    if (nonInstancedArtifact) {
+        nonInstancedMeshNames = nonInstancedArtifact->meshNames;
+    }
+    if (instancedArtifact) {
+        stage1_outputs.push_back(std::move(*instancedArtifact));
+    }
+    if (nonInstancedArtifact) {
+        stage1_outputs.push_back(std::move(*nonInstancedArtifact));
+    }
+    if (spatialPlan) {
+        finishSpatialTileset(config, *spatialPlan);
     }
 
-    // Generate tileset for non-instanced meshes
-    if (nonInstancedWriteResult && nonInstancedWriteResult->second.isValid()) {
-        std::filesystem::path nonInstancedTilesetPath = std::filesystem::path(config.outputDirectory) / "tileset_non_instanced.json";
-        std::vector<std::filesystem::path> nonInstancedUris = { nonInstancedWriteResult->first };
+    if (modelCache) {
+        GltfInstancing::logInfo("Out-of-core pipeline: " + std::to_string(modelCache->loadCount()) + " model load(s) for " +
+                                std::to_string(modelCache->modelCount()) + " file(s).");
+        modelCache.reset();
+    }
 
-        GltfInstancing::BoundingBox bbox = nonInstancedWriteResult->second;
-        glm::dvec3 extents = bbox.max - bbox.min;
-        double diagonal = glm::length(extents);
-        double rootGeometricError = (diagonal > 0) ? (diagonal * 0.1) : 1.0;
-        if (rootGeometricError < 1.0) rootGeometricError = 1.0;
+    // Stage 2 works on the loaded Stage 1 outputs.
+    GltfInstancing::GlbWriter glbWriter(glbWriterOptions);
 
-        GltfInstancing::logDebug("Calculated root geometric error for non-instanced tileset: " + std::to_string(rootGeometricError));
-        if (tilesetWriter.writeTileset(nonInstancedUris, nonInstancedTilesetPath, rootGeometricError)) {
-            GltfInstancing::logInfo("Successfully wrote non-instanced tileset to: " + nonInstancedTilesetPath.string());
-        } else {
-            GltfInstancing::logError("Failed to write the non-instanced tileset file.");
-        }
-    } else {
-        GltfInstancing::logInfo("Skipping non-instanced tileset generation: no valid non-instanced GLB was produced.");
-    }
+    writeStage.finish();
 
     // Stage 2: Mesh Segmentation (if enabled)
+    reportStage("segmentation");
+    GltfInstancing::MetricsStage segmentationStage("segmentation");
     if (config.meshSegmentation) {
         GltfInstancing::logInfo("Stage 2: Mesh Segmentation enabled. Processing GLBs generated in Stage 1.");
-        if (stage1_outputGlbs.empty()) {
+        if (stage1_outputs.empty()) {
             GltfInstancing::logInfo("No GLB files were generated in Stage 1. Skipping mesh segmentation.");
         } else {
             std::filesystem::path segmentationOutputDir = std::filesystem::path(config.outputDirectory) / "segmented_glb_output";
@@ -840,14 +1482,17 @@ int main(int argc, char* argv[]) {
 
             GltfInstancing::logInfo("Segmented GLBs will be saved to: " + segmentationOutputDir.string());
             
-            // GlbReader for Stage 2 (re-reading Stage 1 outputs)
-            GltfInstancing::GlbReader stage2Reader; 
-            // GlbWriter for Stage 2 (will use its own internal state, writeMeshesAsSeparateGlbs resets it per mesh)
-            // GlbWriter glbWriterForSegmentation; // Re-use glbWriter instance, its state is managed by writeMeshesAsSeparateGlbs
+            // GlbReader for Stage 2 (re-reading Stage 1 outputs that were not kept in memory)
+            GltfInstancing::GlbReader stage2Reader(glbReaderOptions);
 
             std::vector<GltfInstancing::LoadedGltfModel> modelsToSegment;
-            for (const auto& glbPath : stage1_outputGlbs) {
-                if (std::filesystem::exists(glbPath)) {
+            for (auto& stage1Output : stage1_outputs) {
+                const std::filesystem::path& glbPath = stage1Output.path;
+                if (stage1Output.model) {
+                    GltfInstancing::logInfo("Using in-memory Stage 1 GLB for segmentation: " + glbPath.string());
+                    modelsToSegment.push_back(std::move(*stage1Output.model));
+                    stage1Output.model.reset();
+                } else if (std::filesystem::exists(glbPath)) {
                     GltfInstancing::logInfo("Loading Stage 1 GLB for segmentation: " + glbPath.string());
                     std::set<std::filesystem::path> singleFileSet;
                     singleFileSet.insert(glbPath);
@@ -867,9 +1512,11 @@ int main(int argc, char* argv[]) {
                 GltfInstancing::logInfo("No valid Stage 1 GLB models could be loaded for segmentation.");
             } else {
                 GltfInstancing::logInfo("Proceeding to segment " + std::to_string(modelsToSegment.size()) + " model(s) (from Stage 1 outputs).");
-                // The glbWriter instance is already available.
-                // Its writeMeshesAsSeparateGlbs method resets its internal state for each mesh.
-                bool segmentationSuccess = glbWriter.writeMeshesAsSeparateGlbs(modelsToSegment, segmentationOutputDir);
+                // writeMeshesAsSeparateGlbs builds the meshes on per-worker writers with glbWriter's options.
+                GltfInstancing::SegmentationOptions segmentationOptions;
+                segmentationOptions.threadCount = config.threadCount;
+                segmentationOptions.packArchive = config.segmentationArchive;
+                bool segmentationSuccess = glbWriter.writeMeshesAsSeparateGlbs(modelsToSegment, segmentationOutputDir, segmentationOptions);
                 if (segmentationSuccess) {
                     GltfInstancing::logInfo("Stage 2: Mesh segmentation completed successfully.");
                 } else {
@@ -882,9 +1529,726 @@ int main(int argc, char* argv[]) {
         GltfInstancing::logInfo("Stage 2: Mesh Segmentation is disabled. Skipping.");
     }
 
+    segmentationStage.finish();
+
     // Stage 3: CSV Processing
-    processCsvAgainstGlb(config);
+    reportStage("csv");
+    GltfInstancing::MetricsStage csvStage("csv");
+    processCsvAgainstGlb(config, elementCsvFiles, nonInstancedMeshNames, collectInstancePlacements(loadedModels, detectionResult));
+    csvStage.finish();
+
+    writeMetricsReportIfRequested(config);
 
     GltfInstancing::logInfo("GltfInstancingTool finished successfully.");
     return 0;
+}
+
+// Settings of the service mode (--serve); command line only, they are not job options.
+struct ServiceOptions {
+    bool enabled = false;
+    int workerCount = 1; // Jobs run at the same time
+    size_t queueCapacity = 16; // Jobs waiting for a worker before new ones are rejected
+    std::string cacheDirectory; // Signature caches; defaults to <temp>/gltf_instancing_cache
+};
+
+// One queued service job: its id as sent by the client and the resolved configuration.
+struct ServiceJob {
+    nlohmann::json id;
+    ToolConfiguration config;
+};
+
+// Serializes the event lines on stdout (written from the reader and all worker threads).
+std::mutex g_serviceOutputMutex;
+
+void writeServiceEvent(const nlohmann::json& event) {
+    std::lock_guard<std::mutex> lock(g_serviceOutputMutex);
+    std::cout << event.dump() << std::endl;
+}
+
+// A job option as the config file would spell it: booleans as true/false, numbers as written,
+// arrays of strings comma-separated. Returns std::nullopt for other JSON types.
+std::optional<std::string> jobOptionToConfigurationValue(const nlohmann::json& value) {
+    if (value.is_string()) {
+        return value.get<std::string>();
+    }
+    if (value.is_boolean()) {
+        return std::string(value.get<bool>() ? "true" : "false");
+    }
+    if (value.is_number()) {
+        return value.dump();
+    }
+    if (value.is_array()) {
+        std::string joined;
+        for (const auto& element : value) {
+            if (!element.is_string()) {
+                return std::nullopt;
+            }
+            joined += (joined.empty() ? "" : ",") + element.get<std::string>();
+        }
+        return joined;
+    }
+    return std::nullopt;
+}
+
+// Builds the configuration of one job from the service's base configuration (config file and
+// command line) and the job's options, which take the config file keys. Returns an error
+// message for unusable jobs.
+std::optional<std::string> configureServiceJob(const nlohmann::json& options, const std::string& source, ToolConfiguration& config) {
+    if (!options.is_object()) {
+        return std::string("'options' must be an object of configuration keys");
+    }
+    for (const auto& [key, jsonValue] : options.items()) {
+        if (key == "trace_meshes") {
+            return std::string("'trace_meshes' applies to the whole service; pass --trace-meshes when starting it");
+        }
+        std::optional<std::string> value = jobOptionToConfigurationValue(jsonValue);
+        if (!value) {
+            return "Unsupported value type for '" + key + "'";
+        }
+        if (!applyConfigurationValue(config, key, *value, source)) {
+            return "Unknown configuration key: " + key;
+        }
+    }
+    if (config.inputDirectory.empty()) {
+        return std::string("'input_directory' must be specified");
+    }
+    return std::nullopt;
+}
+
+// Service mode: reads one JSON job per line from stdin and runs the jobs on a bounded queue
+// served by options.workerCount worker threads, keeping decoded models and signature caches
+// warm across jobs. Requests:
+//   {"id": <any>, "options": {<config file key>: <value>, ...}}
+//   {"command": "shutdown"} (or end of input): finish the queued jobs and exit
+// Events, one JSON object per line on stdout ("event" is ready, queued, rejected, started,
+// stage, finished or shutdown); finished carries the job's exitCode, seconds and outputDirectory.
+// Log lines go to stderr.
+int runService(const ToolConfiguration& baseConfig, const ServiceOptions& options) {
+    std::filesystem::path cacheDirectory = options.cacheDirectory.empty()
+        ? std::filesystem::temp_directory_path() / "gltf_instancing_cache"
+        : std::filesystem::path(options.cacheDirectory);
+    std::error_code ec;
+    std::filesystem::create_directories(cacheDirectory, ec);
+    if (!std::filesystem::is_directory(cacheDirectory)) {
+        GltfInstancing::logError("Failed to create service cache directory: " + cacheDirectory.string() + (ec ? ". Error: " + ec.message() : ""));
+        return 1;
+    }
+
+    GltfInstancing::WarmModelStore warmModels(static_cast<size_t>(baseConfig.modelCacheMb) * 1024 * 1024);
+    GltfInstancing::SignatureCacheStore signatureCaches(cacheDirectory);
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<ServiceJob> queue;
+    bool stopping = false;
+
+    auto workerLoop = [&]() {
+        while (true) {
+            ServiceJob job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return; // Stopping and drained
+                }
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            writeServiceEvent({ { "event", "started" }, { "id", job.id } });
+            PipelineContext context;
+            context.onStage = [&job](const std::string& stageName) {
+                writeServiceEvent({ { "event", "stage" }, { "id", job.id }, { "stage", stageName } });
+            };
+            context.warmModels = &warmModels;
+            context.signatureCaches = &signatureCaches;
+
+            const auto startTime = std::chrono::steady_clock::now();
+            int exitCode = 1;
+            try {
+                exitCode = runPipeline(job.config, context);
+            } catch (const std::exception& e) {
+                GltfInstancing::logError("Service job " + job.id.dump() + " failed: " + e.what());
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            std::string outputDirectory = job.config.outputDirectory.empty()
+                ? (std::filesystem::path(job.config.inputDirectory) / "processed_output").string()
+                : job.config.outputDirectory;
+            writeServiceEvent({ { "event", "finished" }, { "id", job.id }, { "exitCode", exitCode },
+                                { "seconds", seconds }, { "outputDirectory", outputDirectory } });
+        }
+    };
+
+    const int workerCount = std::max(options.workerCount, 1);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < workerCount; ++w) {
+        workers.emplace_back(workerLoop);
+    }
+    GltfInstancing::logInfo("Service mode: " + std::to_string(workerCount) + " worker(s), queue of " + std::to_string(options.queueCapacity) +
+                            ", signature caches in " + cacheDirectory.string());
+    writeServiceEvent({ { "event", "ready" }, { "workers", workerCount }, { "queueCapacity", options.queueCapacity },
+                        { "cacheDirectory", cacheDirectory.string() } });
+
+    std::string line;
+    size_t requestNumber = 0;
+    while (std::getline(std::cin, line)) {
+        ++requestNumber;
+        line = trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        nlohmann::json request = nlohmann::json::parse(line, nullptr, false);
+        if (request.is_discarded() || !request.is_object()) {
+            writeServiceEvent({ { "event", "rejected" }, { "id", nullptr }, { "reason", "Malformed JSON request (line " + std::to_string(requestNumber) + ")" } });
+            continue;
+        }
+        if (request.contains("command") && request["command"] == "shutdown") {
+            break;
+        }
+
+        ServiceJob job;
+        job.id = request.contains("id") ? request["id"] : nlohmann::json(requestNumber);
+        job.config = baseConfig;
+        std::optional<std::string> error = configureServiceJob(
+            request.contains("options") ? request["options"] : nlohmann::json::object(), "job " + job.id.dump(), job.config);
+        if (error) {
+            writeServiceEvent({ { "event", "rejected" }, { "id", job.id }, { "reason", *error } });
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (queue.size() >= options.queueCapacity) {
+            lock.unlock();
+            writeServiceEvent({ { "event", "rejected" }, { "id", job.id }, { "reason", "Job queue is full" } });
+            continue;
+        }
+        // Written under the queue lock, so no worker reports the job as started before this.
+        writeServiceEvent({ { "event", "queued" }, { "id", job.id }, { "position", queue.size() } });
+        queue.push_back(std::move(job));
+        lock.unlock();
+        queueChanged.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    writeServiceEvent({ { "event", "shutdown" } });
+    GltfInstancing::logInfo("Service mode: shut down.");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+   /* #if _DEBUG
+        std::cout << "Waiting for debugger to attach. Press Enter to continue..." << std::endl;
+        std::cin.get();
+    #endif*/
+
+    // In service mode stdout carries the event stream only, so logging is moved to stderr
+    // before the first line is written.
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--serve") {
+            GltfInstancing::setLogToStandardError(true);
+        }
+    }
+
+    GltfInstancing::logInfo("GltfInstancingTool starting...");
+
+    ToolConfiguration config;
+    ServiceOptions serviceOptions;
+    std::string customConfigFilePath;
+    bool useCustomConfigFile = false;
+
+    // Set default log level, can be overridden by CLI
+    GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_INFO);
+
+    // 1. First pass: Check for --config and --log-level arguments to set them up early
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config") {
+            if (i + 1 < argc) {
+                customConfigFilePath = argv[++i];
+                useCustomConfigFile = true;
+            }
+        } else if (arg == "--log-level") {
+             if (i + 1 < argc) {
+                std::string levelStr = argv[++i];
+                std::transform(levelStr.begin(), levelStr.end(), levelStr.begin(), ::toupper);
+                if (levelStr == "NONE") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::NONE);
+                else if (levelStr == "ERROR") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_ERROR);
+                else if (levelStr == "WARNING") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_WARNING);
+                else if (levelStr == "INFO") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_INFO);
+                else if (levelStr == "DEBUG") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_DEBUG);
+                else if (levelStr == "VERBOSE") GltfInstancing::setLogLevel(GltfInstancing::LogLevel::LEVEL_VERBOSE);
+            }
+        }
+    }
+
+    if(useCustomConfigFile) {
+        GltfInstancing::logInfo("Custom configuration file specified: " + customConfigFilePath);
+        if (!loadConfigurationFromFile(customConfigFilePath, config)) {
+            GltfInstancing::logError("Failed to load specified configuration file: " + customConfigFilePath + ". Exiting.");
+            return 1; 
+        }
+    }
+
+    // 2. Parse all command-line arguments (will override config file settings)
+    int argIndex = 1; 
+    while(argIndex < argc) {
+        std::string arg = argv[argIndex];
+
+        // Options processed in the first pass can be skipped
+        if (arg == "--config" || arg == "--log-level") {
+            argIndex += 2;
+            if (argIndex > argc) break;
+            continue;
+        }
+
+        if (arg == "--input_directory") {
+            if (argIndex + 1 < argc) {
+                config.inputDirectory = argv[++argIndex];
+                config.inputDirectorySet = true;
+            } else {
+                GltfInstancing::logError("--input_directory option (CLI) requires a path."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--output_directory") {
+            if (argIndex + 1 < argc) {
+                config.outputDirectory = argv[++argIndex];
+                config.outputDirectorySet = true;
+            } else {
+                GltfInstancing::logError("--output_directory option (CLI) requires a path."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--tolerance") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.geometryTolerance = std::stod(argv[++argIndex]);
+                    config.geometryToleranceSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using geometry tolerance: " + std::to_string(config.geometryTolerance));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --tolerance (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--tolerance option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--skip-attribute-data-hash") {
+            if (argIndex + 1 < argc) {
+                config.attributesToSkipDataHash = splitAndTrim(argv[++argIndex], ',');
+                config.attributesToSkipDataHashSet = true;
+                if (!config.attributesToSkipDataHash.empty()) {
+                    std::string attrsLogged = "Command-line override: Tolerance mode will skip data hashing for attributes: ";
+                    for (const auto& attr : config.attributesToSkipDataHash) attrsLogged += attr + " ";
+                    GltfInstancing::logDebug(attrsLogged);
+                }
+            } else {
+                GltfInstancing::logError("--skip-attribute-data-hash option (CLI) requires a comma-separated list."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--normal-tolerance") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.normalTolerance = std::stod(argv[++argIndex]);
+                    if (config.normalTolerance < 0.0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Normal tolerance cannot be negative. Using 0.0.");
+                        config.normalTolerance = 0.0;
+                    }
+                    config.normalToleranceSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using normal tolerance: " + std::to_string(config.normalTolerance));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --normal-tolerance (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--normal-tolerance option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--merge-all-glb") {
+            config.mergeAllGlb = true;
+            config.mergeAllGlbSet = true;
+            GltfInstancing::logDebug("Command-line override: Merge all GLB outputs enabled.");
+        } else if (arg == "--instance-limit") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.instanceLimit = std::stoi(argv[++argIndex]);
+                     if (config.instanceLimit < 1) {
+                        GltfInstancing::logWarning("WARNING (CLI): Instance limit must be >= 1. Using default 2.");
+                        config.instanceLimit = 2;
+                    }
+                    config.instanceLimitSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using instance limit: " + std::to_string(config.instanceLimit));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --instance-limit (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--instance-limit option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--mesh-segmentation") {
+            config.meshSegmentation = true;
+            config.meshSegmentationSet = true;
+            GltfInstancing::logDebug("Command-line override: Mesh segmentation enabled (each mesh to a separate GLB).");
+        } else if (arg == "--segmentation-archive") {
+            config.segmentationArchive = true;
+            config.segmentationArchiveSet = true;
+            GltfInstancing::logDebug("Command-line override: Segmented GLBs packed into one archive.");
+        } else if (arg == "--csv-dir") {
+            if (argIndex + 1 < argc) {
+                config.csvDirectory = argv[++argIndex];
+                config.csvDirectorySet = true;
+                GltfInstancing::logDebug("Command-line override: CSV processing directory set to: " + config.csvDirectory);
+            } else {
+                GltfInstancing::logError("--csv-dir option (CLI) requires a path."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--embed-element-ids") {
+            config.embedElementIds = true;
+            config.embedElementIdsSet = true;
+            GltfInstancing::logDebug("Command-line override: Embedding CSV element IDs in the Stage 1 GLBs.");
+        } else if (arg == "--threads") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.threadCount = std::stoi(argv[++argIndex]);
+                    if (config.threadCount < 0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Thread count cannot be negative. Using 0 (all hardware threads).");
+                        config.threadCount = 0;
+                    }
+                    config.threadCountSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using thread count: " + std::to_string(config.threadCount));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --threads (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--threads option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--decode-images") {
+            config.decodeImages = true;
+            config.decodeImagesSet = true;
+            GltfInstancing::logDebug("Command-line override: Image decoding enabled.");
+        } else if (arg == "--out-of-core") {
+            config.outOfCore = true;
+            config.outOfCoreSet = true;
+            GltfInstancing::logDebug("Command-line override: Out-of-core pipeline enabled.");
+        } else if (arg == "--model-cache-mb") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.modelCacheMb = std::stoi(argv[++argIndex]);
+                    if (config.modelCacheMb < 1) {
+                        GltfInstancing::logWarning("WARNING (CLI): Model cache must be at least 1 MB. Using 4096.");
+                        config.modelCacheMb = 4096;
+                    }
+                    config.modelCacheMbSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using model cache size (MB): " + std::to_string(config.modelCacheMb));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --model-cache-mb (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--model-cache-mb option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--signature-cache") {
+            config.signatureCache = true;
+            config.signatureCacheSet = true;
+            GltfInstancing::logDebug("Command-line override: Persistent signature cache enabled.");
+        } else if (arg == "--shard") {
+            if (argIndex + 1 < argc) {
+                const std::string shard = argv[++argIndex];
+                if (!parseShardSpecification(shard, config.shardIndex, config.shardCount)) {
+                    GltfInstancing::logError("Invalid value for --shard (CLI): " + shard + ". Expected <index>/<count>, e.g. 0/4."); printUsage(argv[0]); return 1;
+                }
+                config.shardSet = true;
+                GltfInstancing::logDebug("Command-line override: Indexing shard " + std::to_string(config.shardIndex) + " of " + std::to_string(config.shardCount));
+            } else {
+                GltfInstancing::logError("--shard option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--merge-shards") {
+            if (argIndex + 1 < argc) {
+                config.mergeShardsDirectory = argv[++argIndex];
+                config.mergeShardsDirectorySet = true;
+                GltfInstancing::logDebug("Command-line override: Merging shard indexes from: " + config.mergeShardsDirectory);
+            } else {
+                GltfInstancing::logError("--merge-shards option (CLI) requires a path."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--verify-matches") {
+            config.verifySignatureMatches = true;
+            config.verifySignatureMatchesSet = true;
+            GltfInstancing::logDebug("Command-line override: Signature match verification enabled.");
+        } else if (arg == "--canonicalize-pose") {
+            config.canonicalizePose = true;
+            config.canonicalizePoseSet = true;
+            GltfInstancing::logDebug("Command-line override: Pose canonicalization enabled.");
+        } else if (arg == "--canonical-quantization") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.canonicalQuantization = std::stod(argv[++argIndex]);
+                    if (config.canonicalQuantization <= 0.0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Canonical quantization must be positive. Using 0.0001.");
+                        config.canonicalQuantization = 1e-4;
+                    }
+                    config.canonicalQuantizationSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using canonical quantization: " + std::to_string(config.canonicalQuantization));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --canonical-quantization (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--canonical-quantization option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--granularity") {
+            if (argIndex + 1 < argc) {
+                std::string granularity = argv[++argIndex];
+                std::transform(granularity.begin(), granularity.end(), granularity.begin(), ::tolower);
+                if (granularity != "mesh" && granularity != "primitive") {
+                    GltfInstancing::logError("Invalid value for --granularity (CLI): " + granularity + ". Expected mesh or primitive."); printUsage(argv[0]); return 1;
+                }
+                config.instancingGranularity = granularity;
+                config.instancingGranularitySet = true;
+                GltfInstancing::logDebug("Command-line override: Using instancing granularity: " + config.instancingGranularity);
+            } else {
+                GltfInstancing::logError("--granularity option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--compact-instances") {
+            config.compactInstanceAttributes = true;
+            config.compactInstanceAttributesSet = true;
+            GltfInstancing::logDebug("Command-line override: Compact instance attributes enabled.");
+        } else if (arg == "--batch-non-instanced") {
+            config.batchNonInstancedMeshes = true;
+            config.batchNonInstancedMeshesSet = true;
+            GltfInstancing::logDebug("Command-line override: Batching of non-instanced meshes enabled.");
+        } else if (arg == "--batch-vertex-budget") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.batchVertexBudget = std::stoi(argv[++argIndex]);
+                    if (config.batchVertexBudget <= 0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Batch vertex budget must be positive. Using 262144.");
+                        config.batchVertexBudget = 262144;
+                    }
+                    config.batchVertexBudgetSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using batch vertex budget: " + std::to_string(config.batchVertexBudget));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --batch-vertex-budget (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--batch-vertex-budget option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--optimize-meshes") {
+            config.optimizeMeshes = true;
+            config.optimizeMeshesSet = true;
+            GltfInstancing::logDebug("Command-line override: Mesh optimization enabled.");
+        } else if (arg == "--meshopt-compression") {
+            config.meshoptCompression = true;
+            config.meshoptCompressionSet = true;
+            GltfInstancing::logDebug("Command-line override: Meshopt compression enabled.");
+        } else if (arg == "--quantize-position-bits") {
+            if (argIndex + 1 < argc) {
+                try {
+                    int bits = std::stoi(argv[++argIndex]);
+                    if (bits < 0 || bits > 16) {
+                        GltfInstancing::logWarning("WARNING (CLI): Position bits must be between 0 and 16. Using 0 (no quantization).");
+                        bits = 0;
+                    }
+                    config.quantizePositionBits = bits;
+                    config.quantizePositionBitsSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using position quantization bits: " + std::to_string(config.quantizePositionBits));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --quantize-position-bits (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--quantize-position-bits option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--quantize-normal-bits") {
+            if (argIndex + 1 < argc) {
+                try {
+                    int bits = std::stoi(argv[++argIndex]);
+                    if (bits != 0 && bits != 8 && bits != 16) {
+                        GltfInstancing::logWarning("WARNING (CLI): Normal bits must be 0, 8 or 16. Using 0 (no quantization).");
+                        bits = 0;
+                    }
+                    config.quantizeNormalBits = bits;
+                    config.quantizeNormalBitsSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using normal quantization bits: " + std::to_string(config.quantizeNormalBits));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --quantize-normal-bits (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--quantize-normal-bits option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--quantize-texcoord-bits") {
+            if (argIndex + 1 < argc) {
+                try {
+                    int bits = std::stoi(argv[++argIndex]);
+                    if (bits != 0 && bits != 8 && bits != 16) {
+                        GltfInstancing::logWarning("WARNING (CLI): Texture coordinate bits must be 0, 8 or 16. Using 0 (no quantization).");
+                        bits = 0;
+                    }
+                    config.quantizeTexCoordBits = bits;
+                    config.quantizeTexCoordBitsSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using texture coordinate quantization bits: " + std::to_string(config.quantizeTexCoordBits));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --quantize-texcoord-bits (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--quantize-texcoord-bits option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--spatial-tiling") {
+            config.spatialTiling = true;
+            config.spatialTilingSet = true;
+            GltfInstancing::logDebug("Command-line override: Spatial tiling enabled.");
+        } else if (arg == "--tiling-scheme") {
+            if (argIndex + 1 < argc) {
+                std::string scheme = argv[++argIndex];
+                std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+                if (scheme != "octree" && scheme != "quadtree") {
+                    GltfInstancing::logError("Invalid value for --tiling-scheme (CLI): " + scheme + ". Expected octree or quadtree."); printUsage(argv[0]); return 1;
+                }
+                config.tilingScheme = scheme;
+                config.tilingSchemeSet = true;
+                GltfInstancing::logDebug("Command-line override: Using tiling scheme: " + config.tilingScheme);
+            } else {
+                GltfInstancing::logError("--tiling-scheme option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--tile-max-items") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.tileMaxItems = std::stoi(argv[++argIndex]);
+                    if (config.tileMaxItems <= 0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Tile item limit must be positive. Using 4096.");
+                        config.tileMaxItems = 4096;
+                    }
+                    config.tileMaxItemsSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using tile item limit: " + std::to_string(config.tileMaxItems));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --tile-max-items (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--tile-max-items option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--tile-max-depth") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.tileMaxDepth = std::stoi(argv[++argIndex]);
+                    if (config.tileMaxDepth < 0) {
+                        GltfInstancing::logWarning("WARNING (CLI): Tile depth cannot be negative. Using 0.");
+                        config.tileMaxDepth = 0;
+                    }
+                    config.tileMaxDepthSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using tile max depth: " + std::to_string(config.tileMaxDepth));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --tile-max-depth (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--tile-max-depth option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--lod") {
+            config.lodGeneration = true;
+            config.lodGenerationSet = true;
+            GltfInstancing::logDebug("Command-line override: LOD generation enabled.");
+        } else if (arg == "--lod-ratio") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.lodRatio = std::stod(argv[++argIndex]);
+                    if (config.lodRatio <= 0.0 || config.lodRatio >= 1.0) {
+                        GltfInstancing::logWarning("WARNING (CLI): LOD ratio must lie in (0, 1). Using 0.25.");
+                        config.lodRatio = 0.25;
+                    }
+                    config.lodRatioSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using LOD ratio: " + std::to_string(config.lodRatio));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --lod-ratio (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--lod-ratio option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--lod-error-budget") {
+            if (argIndex + 1 < argc) {
+                try {
+                    config.lodErrorBudget = std::stod(argv[++argIndex]);
+                    if (config.lodErrorBudget <= 0.0) {
+                        GltfInstancing::logWarning("WARNING (CLI): LOD error budget must be positive. Using 0.01.");
+                        config.lodErrorBudget = 0.01;
+                    }
+                    config.lodErrorBudgetSet = true;
+                    GltfInstancing::logDebug("Command-line override: Using LOD error budget: " + std::to_string(config.lodErrorBudget));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --lod-error-budget (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--lod-error-budget option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--metrics-report") {
+            config.metricsReport = true;
+            config.metricsReportSet = true;
+            GltfInstancing::logDebug("Command-line override: Metrics report enabled.");
+        } else if (arg == "--trace-meshes") {
+            if (argIndex + 1 < argc) {
+                config.traceMeshNames = splitAndTrim(argv[++argIndex], ',');
+                config.traceMeshNamesSet = true;
+                GltfInstancing::logDebug("Command-line override: Tracing " + std::to_string(config.traceMeshNames.size()) + " mesh name(s).");
+            } else {
+                GltfInstancing::logError("--trace-meshes option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--serve") {
+            serviceOptions.enabled = true;
+            GltfInstancing::logDebug("Command-line override: Service mode enabled.");
+        } else if (arg == "--serve-workers") {
+            if (argIndex + 1 < argc) {
+                try {
+                    serviceOptions.workerCount = std::stoi(argv[++argIndex]);
+                    if (serviceOptions.workerCount < 1) {
+                        GltfInstancing::logWarning("WARNING (CLI): --serve-workers must be at least 1. Using 1.");
+                        serviceOptions.workerCount = 1;
+                    }
+                    GltfInstancing::logDebug("Command-line override: Service workers: " + std::to_string(serviceOptions.workerCount));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --serve-workers (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--serve-workers option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--serve-queue") {
+            if (argIndex + 1 < argc) {
+                try {
+                    const int queueCapacity = std::stoi(argv[++argIndex]);
+                    if (queueCapacity < 1) {
+                        GltfInstancing::logWarning("WARNING (CLI): --serve-queue must be at least 1. Using 16.");
+                        serviceOptions.queueCapacity = 16;
+                    } else {
+                        serviceOptions.queueCapacity = static_cast<size_t>(queueCapacity);
+                    }
+                    GltfInstancing::logDebug("Command-line override: Service queue capacity: " + std::to_string(serviceOptions.queueCapacity));
+                } catch (const std::exception& e) {
+                    GltfInstancing::logError("Invalid value for --serve-queue (CLI): " + std::string(argv[argIndex]) + ". Error: " + e.what()); printUsage(argv[0]); return 1;
+                }
+            } else {
+                GltfInstancing::logError("--serve-queue option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else if (arg == "--serve-cache-dir") {
+            if (argIndex + 1 < argc) {
+                serviceOptions.cacheDirectory = argv[++argIndex];
+                GltfInstancing::logDebug("Command-line override: Service cache directory: " + serviceOptions.cacheDirectory);
+            } else {
+                GltfInstancing::logError("--serve-cache-dir option (CLI) requires a value."); printUsage(argv[0]); return 1;
+            }
+        } else { // An unknown option
+            GltfInstancing::logError("Unexpected command-line argument: " + arg);
+            printUsage(argv[0]);
+            return 1;
+        }
+        argIndex++;
+    }
+
+    GltfInstancing::setTraceMeshNames(config.traceMeshNames);
+    if (!config.traceMeshNames.empty() && !GltfInstancing::isLogLevelEnabled(GltfInstancing::LogLevel::LEVEL_DEBUG)) {
+        GltfInstancing::logWarning("trace_meshes is set but the log level is below DEBUG; no mesh traces will be written.");
+    }
+
+    // Service mode: the configuration so far is the base every job's options are applied to.
+    if (serviceOptions.enabled) {
+        return runService(config, serviceOptions);
+    }
+
+    // 3. Finalize and validate configuration
+    if (config.inputDirectory.empty()) {
+        GltfInstancing::logError("--input_directory must be specified.");
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    PipelineContext context;
+    return runPipeline(config, context);
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+﻿#include "mapped_file.h"
+#include "utilities.h" // For logging
+
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GltfInstancing {
+
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            _data = std::exchange(other._data, nullptr);
+            _size = std::exchange(other._size, 0);
+#ifdef _WIN32
+            _fileHandle = std::exchange(other._fileHandle, nullptr);
+            _mappingHandle = std::exchange(other._mappingHandle, nullptr);
+#else
+            _fileDescriptor = std::exchange(other._fileDescriptor, -1);
+#endif
+        }
+        return *this;
+    }
+
+    void MappedFile::close() {
+#ifdef _WIN32
+        if (_data) {
+            UnmapViewOfFile(_data);
+        }
+        if (_mappingHandle) {
+            CloseHandle(static_cast<HANDLE>(_mappingHandle));
+        }
+        if (_fileHandle) {
+            CloseHandle(static_cast<HANDLE>(_fileHandle));
+        }
+        _fileHandle = nullptr;
+        _mappingHandle = nullptr;
+#else
+        if (_data && _size > 0) {
+            munmap(const_cast<std::byte*>(_data), _size);
+        }
+        if (_fileDescriptor >= 0) {
+            ::close(_fileDescriptor);
+        }
+        _fileDescriptor = -1;
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    std::optional<MappedFile> MappedFile::open(const std::filesystem::path& filePath) {
+        MappedFile mapped;
+#ifdef _WIN32
+        HANDLE file = CreateFileW(filePath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            logError("MappedFile: failed to open file: " + filePath.string() + " (error " + std::to_string(GetLastError()) + ")");
+            return std::nullopt;
+        }
+        mapped._fileHandle = file;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            logError("MappedFile: failed to query size of: " + filePath.string());
+            return std::nullopt;
+        }
+        if (fileSize.QuadPart == 0) {
+            return mapped; // Nothing to map
+        }
+
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            logError("MappedFile: CreateFileMapping failed for: " + filePath.string() + " (error " + std::to_string(GetLastError()) + ")");
+            return std::nullopt;
+        }
+        mapped._mappingHandle = mapping;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view) {
+            logError("MappedFile: MapViewOfFile failed for: " + filePath.string() + " (error " + std::to_string(GetLastError()) + ")");
+            return std::nullopt;
+        }
+        mapped._data = static_cast<const std::byte*>(view);
+        mapped._size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            logError("MappedFile: failed to open file: " + filePath.string());
+            return std::nullopt;
+        }
+        mapped._fileDescriptor = fd;
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            logError("MappedFile: failed to query size of: " + filePath.string());
+            return std::nullopt;
+        }
+        if (fileStat.st_size == 0) {
+            return mapped;
+        }
+
+        void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            logError("MappedFile: mmap failed for: " + filePath.string());
+            return std::nullopt;
+        }
+        madvise(view, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+        mapped._data = static_cast<const std::byte*>(view);
+        mapped._size = static_cast<size_t>(fileStat.st_size);
+#endif
+        return mapped;
+    }
+
+} // namespace GltfInstancing
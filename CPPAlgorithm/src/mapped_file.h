@@ -0,0 +1,47 @@
+﻿#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+
+#include <gsl/span>
+
+namespace GltfInstancing {
+
+    // Read-only memory mapping of a whole file. The mapping stays valid for the lifetime
+    // of the object, so spans obtained from bytes() must not outlive it.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        // Returns std::nullopt (and logs) if the file cannot be opened or mapped.
+        // Empty files are returned as a valid mapping with size() == 0.
+        static std::optional<MappedFile> open(const std::filesystem::path& filePath);
+
+        const std::byte* data() const { return _data; }
+        size_t size() const { return _size; }
+        gsl::span<const std::byte> bytes() const { return gsl::span<const std::byte>(_data, _size); }
+
+    private:
+        void close();
+
+        const std::byte* _data = nullptr;
+        size_t _size = 0;
+#ifdef _WIN32
+        void* _fileHandle = nullptr;
+        void* _mappingHandle = nullptr;
+#else
+        int _fileDescriptor = -1;
+#endif
+    };
+
+} // namespace GltfInstancing
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,308 @@
+﻿#include "mesh_batcher.h"
+#include "lod_generator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+#include <CesiumGltf/Accessor.h>
+#include <CesiumGltf/AccessorView.h>
+#include <CesiumGltf/Buffer.h>
+#include <CesiumGltf/BufferView.h>
+#include <CesiumGltf/MeshPrimitive.h>
+#include <CesiumGltf/ExtensionModelExtStructuralMetadata.h>
+
+#include <gsl/span>
+
+namespace GltfInstancing {
+
+    namespace {
+        // One source primitive decoded and transformed, before it is appended to a batch.
+        struct StagedPrimitive {
+            int32_t material = -1;
+            std::vector<glm::dvec3> positions; // World space
+            std::vector<float> normals;
+            std::vector<float> texCoords;
+            std::vector<uint32_t> indices;     // Local to this primitive
+        };
+
+        const CesiumGltf::Accessor* attributeAccessor(const CesiumGltf::Model& model, const CesiumGltf::MeshPrimitive& primitive, const std::string& name) {
+            auto it = primitive.attributes.find(name);
+            if (it == primitive.attributes.end()) {
+                return nullptr;
+            }
+            return CesiumGltf::Model::getSafe(&model.accessors, it->second);
+        }
+
+        // Read-only view of a tightly packed simplified attribute with the interface of
+        // CesiumGltf::AccessorView, so stageVertices reads both alike.
+        template <typename T>
+        class PackedView {
+        public:
+            explicit PackedView(const SimplifiedAttribute& attribute)
+                : _data(reinterpret_cast<const T*>(attribute.data.data())),
+                  _size(static_cast<int64_t>(attribute.data.size() / sizeof(T))),
+                  _valid(attribute.componentType == CesiumGltf::Accessor::ComponentType::FLOAT && attribute.data.size() % sizeof(T) == 0) {}
+
+            CesiumGltf::AccessorViewStatus status() const {
+                return _valid ? CesiumGltf::AccessorViewStatus::Valid : CesiumGltf::AccessorViewStatus::WrongSizeT;
+            }
+            int64_t size() const { return _size; }
+            const T& operator[](int64_t i) const { return _data[i]; }
+
+        private:
+            const T* _data;
+            int64_t _size;
+            bool _valid;
+        };
+
+        // Transforms positions (and normals, texCoords when present, which must have as many
+        // elements) into out. Returns false if a view is invalid.
+        template <typename Vec3View, typename Vec2View>
+        bool stageVertices(
+            const Vec3View& positions,
+            const std::optional<Vec3View>& normals,
+            const std::optional<Vec2View>& texCoords,
+            const glm::dmat4& worldMatrix,
+            const glm::dmat3& normalMatrix,
+            StagedPrimitive& out) {
+            if (positions.status() != CesiumGltf::AccessorViewStatus::Valid) {
+                return false;
+            }
+            const size_t vertexCount = static_cast<size_t>(positions.size());
+            out.positions.resize(vertexCount);
+            for (size_t i = 0; i < vertexCount; ++i) {
+                out.positions[i] = glm::dvec3(worldMatrix * glm::dvec4(glm::dvec3(positions[static_cast<int64_t>(i)]), 1.0));
+            }
+
+            if (normals) {
+                if (normals->status() != CesiumGltf::AccessorViewStatus::Valid || static_cast<size_t>(normals->size()) != vertexCount) {
+                    return false;
+                }
+                out.normals.resize(vertexCount * 3);
+                for (size_t i = 0; i < vertexCount; ++i) {
+                    glm::dvec3 n = normalMatrix * glm::dvec3((*normals)[static_cast<int64_t>(i)]);
+                    const double length = glm::length(n);
+                    if (length > 0.0) {
+                        n /= length;
+                    }
+                    out.normals[i * 3 + 0] = static_cast<float>(n.x);
+                    out.normals[i * 3 + 1] = static_cast<float>(n.y);
+                    out.normals[i * 3 + 2] = static_cast<float>(n.z);
+                }
+            }
+
+            if (texCoords) {
+                if (texCoords->status() != CesiumGltf::AccessorViewStatus::Valid || static_cast<size_t>(texCoords->size()) != vertexCount) {
+                    return false;
+                }
+                out.texCoords.resize(vertexCount * 2);
+                for (size_t i = 0; i < vertexCount; ++i) {
+                    const glm::vec2 uv = (*texCoords)[static_cast<int64_t>(i)];
+                    out.texCoords[i * 2 + 0] = uv.x;
+                    out.texCoords[i * 2 + 1] = uv.y;
+                }
+            }
+            return true;
+        }
+    }
+
+    MeshBatcher::MeshBatcher(size_t vertexBudget) : _vertexBudget(vertexBudget > 0 ? vertexBudget : 1) {}
+
+    bool MeshBatcher::canBatch(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh) {
+        if (mesh.primitives.empty()) {
+            return false;
+        }
+        for (const auto& primitive : mesh.primitives) {
+            if (primitive.mode != CesiumGltf::MeshPrimitive::Mode::TRIANGLES || !primitive.targets.empty()) {
+                return false;
+            }
+            if (primitive.attributes.find("POSITION") == primitive.attributes.end()) {
+                return false;
+            }
+            for (const auto& [name, accessorIndex] : primitive.attributes) {
+                std::string expectedType;
+                if (name == "POSITION" || name == "NORMAL") {
+                    expectedType = CesiumGltf::Accessor::Type::VEC3;
+                } else if (name == "TEXCOORD_0") {
+                    expectedType = CesiumGltf::Accessor::Type::VEC2;
+                } else {
+                    return false; // Colors, tangents, skins, extra UV sets: keep the mesh as is
+                }
+                const CesiumGltf::Accessor* accessor = CesiumGltf::Model::getSafe(&model.accessors, accessorIndex);
+                if (!accessor || accessor->sparse ||
+                    accessor->componentType != CesiumGltf::Accessor::ComponentType::FLOAT ||
+                    accessor->type != expectedType) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool MeshBatcher::addMesh(
+        const CesiumGltf::Model& model,
+        const CesiumGltf::Mesh& mesh,
+        const glm::dmat4& worldMatrix,
+        const std::vector<int32_t>& outputMaterials,
+        uint32_t featureId,
+        const SimplifiedMesh* simplified) {
+        if (featureId >= kMaxFeatureCount || outputMaterials.size() != mesh.primitives.size() || !canBatch(model, mesh)) {
+            return false;
+        }
+
+        const glm::dmat3 linear(worldMatrix);
+        const glm::dmat3 normalMatrix = glm::transpose(glm::inverse(linear));
+        const bool flipWinding = glm::determinant(linear) < 0.0;
+
+        // Decode everything first so a bad primitive leaves the batches untouched.
+        std::vector<StagedPrimitive> staged(simplified ? simplified->primitives.size() : mesh.primitives.size());
+        for (size_t p = 0; p < staged.size(); ++p) {
+            StagedPrimitive& out = staged[p];
+            if (simplified) {
+                const SimplifiedPrimitive& primitive = simplified->primitives[p];
+                if (primitive.sourcePrimitiveIndex >= outputMaterials.size()) {
+                    return false;
+                }
+                out.material = outputMaterials[primitive.sourcePrimitiveIndex];
+                const SimplifiedAttribute* positions = primitive.findAttribute("POSITION");
+                const SimplifiedAttribute* normals = primitive.findAttribute("NORMAL");
+                const SimplifiedAttribute* texCoords = primitive.findAttribute("TEXCOORD_0");
+                if (!positions ||
+                    !stageVertices(PackedView<glm::vec3>(*positions), normals ? std::optional(PackedView<glm::vec3>(*normals)) : std::nullopt,
+                                   texCoords ? std::optional(PackedView<glm::vec2>(*texCoords)) : std::nullopt, worldMatrix, normalMatrix, out)) {
+                    return false;
+                }
+                out.indices = primitive.indices;
+                if (std::any_of(out.indices.begin(), out.indices.end(), [&](uint32_t index) { return index >= out.positions.size(); })) {
+                    return false;
+                }
+            } else {
+                const CesiumGltf::MeshPrimitive& primitive = mesh.primitives[p];
+                out.material = outputMaterials[p];
+                const CesiumGltf::Accessor* normals = attributeAccessor(model, primitive, "NORMAL");
+                const CesiumGltf::Accessor* texCoords = attributeAccessor(model, primitive, "TEXCOORD_0");
+                if (!stageVertices(CesiumGltf::AccessorView<glm::vec3>(model, *attributeAccessor(model, primitive, "POSITION")),
+                                   normals ? std::optional(CesiumGltf::AccessorView<glm::vec3>(model, *normals)) : std::nullopt,
+                                   texCoords ? std::optional(CesiumGltf::AccessorView<glm::vec2>(model, *texCoords)) : std::nullopt,
+                                   worldMatrix, normalMatrix, out)) {
+                    return false;
+                }
+                if (!readTriangleIndices(model, primitive, out.positions.size(), out.indices)) {
+                    return false;
+                }
+            }
+            if (flipWinding) { // Mirroring transforms reverse the triangle orientation
+                for (size_t i = 0; i + 2 < out.indices.size(); i += 3) {
+                    std::swap(out.indices[i + 1], out.indices[i + 2]);
+                }
+            }
+        }
+
+        for (StagedPrimitive& primitive : staged) {
+            const bool hasNormals = !primitive.normals.empty();
+            const bool hasTexCoords = !primitive.texCoords.empty();
+            const auto key = std::make_tuple(primitive.material, hasNormals, hasTexCoords);
+            const size_t vertexCount = primitive.positions.size();
+
+            auto open = _openBatches.find(key);
+            if (open != _openBatches.end() && _batches[open->second].vertexCount() + vertexCount > _vertexBudget) {
+                _openBatches.erase(open); // Full: later geometry goes to a new batch
+                open = _openBatches.end();
+            }
+            if (open == _openBatches.end()) {
+                GeometryBatch& batch = _batches.emplace_back();
+                batch.material = primitive.material;
+                batch.hasNormals = hasNormals;
+                batch.hasTexCoords = hasTexCoords;
+                batch.origin = glm::dvec3(worldMatrix[3]);
+                open = _openBatches.emplace(key, _batches.size() - 1).first;
+            }
+
+            GeometryBatch& batch = _batches[open->second];
+            const uint32_t baseVertex = static_cast<uint32_t>(batch.vertexCount());
+            batch.positions.reserve(batch.positions.size() + vertexCount * 3);
+            for (const glm::dvec3& position : primitive.positions) {
+                batch.positions.push_back(static_cast<float>(position.x - batch.origin.x));
+                batch.positions.push_back(static_cast<float>(position.y - batch.origin.y));
+                batch.positions.push_back(static_cast<float>(position.z - batch.origin.z));
+                batch.bounds.min = glm::min(batch.bounds.min, position);
+                batch.bounds.max = glm::max(batch.bounds.max, position);
+            }
+            batch.normals.insert(batch.normals.end(), primitive.normals.begin(), primitive.normals.end());
+            batch.texCoords.insert(batch.texCoords.end(), primitive.texCoords.begin(), primitive.texCoords.end());
+            batch.featureIds.insert(batch.featureIds.end(), vertexCount, static_cast<float>(featureId));
+            batch.indices.reserve(batch.indices.size() + primitive.indices.size());
+            for (uint32_t index : primitive.indices) {
+                batch.indices.push_back(baseVertex + index);
+            }
+        }
+        return true;
+    }
+
+    std::vector<GeometryBatch> MeshBatcher::takeBatches() {
+        _openBatches.clear();
+        return std::exchange(_batches, {});
+    }
+
+    std::vector<std::string> readBatchedElementNames(const CesiumGltf::Model& model) {
+        std::vector<std::string> names;
+        const auto* metadata = model.getExtension<CesiumGltf::ExtensionModelExtStructuralMetadata>();
+        if (!metadata) {
+            return names;
+        }
+
+        // Returns the bytes of a bufferView, or an empty span if it is out of range.
+        auto viewBytes = [&](int32_t bufferViewIndex) -> gsl::span<const std::byte> {
+            const CesiumGltf::BufferView* bufferView = CesiumGltf::Model::getSafe(&model.bufferViews, bufferViewIndex);
+            if (!bufferView) {
+                return {};
+            }
+            const CesiumGltf::Buffer* buffer = CesiumGltf::Model::getSafe(&model.buffers, bufferView->buffer);
+            if (!buffer || bufferView->byteOffset < 0 || bufferView->byteLength < 0 ||
+                static_cast<size_t>(bufferView->byteOffset + bufferView->byteLength) > buffer->cesium.data.size()) {
+                return {};
+            }
+            return gsl::span<const std::byte>(buffer->cesium.data.data() + bufferView->byteOffset, static_cast<size_t>(bufferView->byteLength));
+        };
+
+        for (const auto& table : metadata->propertyTables) {
+            if (table.classProperty != kBatchElementClass) {
+                continue;
+            }
+            auto property = table.properties.find(kBatchElementNameProperty);
+            if (property == table.properties.end()) {
+                continue;
+            }
+            if (property->second.stringOffsetType != CesiumGltf::PropertyTableProperty::StringOffsetType::UINT32) {
+                logWarning("Unsupported string offset type in batched element names: " + property->second.stringOffsetType);
+                return names;
+            }
+            const gsl::span<const std::byte> values = viewBytes(property->second.values);
+            const gsl::span<const std::byte> offsets = viewBytes(property->second.stringOffsets);
+            const size_t count = table.count > 0 ? static_cast<size_t>(table.count) : 0;
+            if (offsets.size() < (count + 1) * sizeof(uint32_t)) {
+                logWarning("Batched element name table is truncated.");
+                return names;
+            }
+
+            names.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t begin = 0;
+                uint32_t end = 0;
+                std::memcpy(&begin, offsets.data() + i * sizeof(uint32_t), sizeof(uint32_t));
+                std::memcpy(&end, offsets.data() + (i + 1) * sizeof(uint32_t), sizeof(uint32_t));
+                if (begin > end || end > values.size()) {
+                    logWarning("Invalid string offset in batched element name table.");
+                    names.clear();
+                    return names;
+                }
+                names.emplace_back(reinterpret_cast<const char*>(values.data()) + begin, end - begin);
+            }
+            return names;
+        }
+        return names;
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,94 @@
+﻿#ifndef MESH_BATCHER_H
+#define MESH_BATCHER_H
+
+#include "utilities.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+#include <CesiumGltf/Mesh.h>
+
+#include <glm/glm.hpp>
+
+namespace GltfInstancing {
+
+    struct SimplifiedMesh; // lod_generator.h
+
+    // Structural metadata names used for batched output: feature i of a batched primitive is
+    // row i of the property table of class kBatchElementClass, whose kBatchElementNameProperty
+    // holds the source mesh name (the element ID the CSV export refers to).
+    constexpr const char* kBatchElementClass = "element";
+    constexpr const char* kBatchElementNameProperty = "name";
+    constexpr const char* kElementIdProperty = "elementId"; // Element (CSV component) ID, when known
+
+    // One merged TRIANGLES primitive: the geometry of many non-instanced meshes that share an
+    // output material and attribute layout, with their world transforms baked in.
+    // Positions are relative to origin, which goes on the batch node (float precision stays
+    // local at georeferenced coordinates).
+    struct GeometryBatch {
+        int32_t material = -1; // Material index in the output glTF
+        bool hasNormals = false;
+        bool hasTexCoords = false;
+        glm::dvec3 origin{ 0.0 };
+        std::vector<float> positions;  // xyz per vertex
+        std::vector<float> normals;    // xyz per vertex, when hasNormals
+        std::vector<float> texCoords;  // uv per vertex (TEXCOORD_0), when hasTexCoords
+        std::vector<float> featureIds; // _FEATURE_ID_0 per vertex
+        std::vector<uint32_t> indices;
+        BoundingBox bounds; // World space
+
+        size_t vertexCount() const { return positions.size() / 3; }
+    };
+
+    // Collects non-instanced meshes into GeometryBatch primitives grouped by
+    // (material, attribute layout). A batch is closed once the next mesh would push it past
+    // vertexBudget vertices; a single primitive larger than the budget gets a batch of its own.
+    class MeshBatcher {
+    public:
+        // Feature IDs are written as FLOAT, which is exact up to 2^24.
+        static constexpr uint32_t kMaxFeatureCount = 1u << 24;
+
+        explicit MeshBatcher(size_t vertexBudget);
+
+        // True if every primitive of mesh can be merged: TRIANGLES mode, no morph targets and only
+        // POSITION (FLOAT VEC3), NORMAL (FLOAT VEC3) and TEXCOORD_0 (FLOAT VEC2) attributes.
+        static bool canBatch(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh);
+
+        // Bakes worldMatrix into every primitive of mesh and appends it to the open batch for its
+        // output material (outputMaterials, one per primitive), tagging its vertices with featureId.
+        // Returns false, leaving all batches unchanged, if the mesh cannot be batched or its data
+        // is invalid; the caller then writes it as a regular node.
+        // With simplified (a simplification of mesh), its vertices and indices are merged instead
+        // of the source accessors; canBatch still applies to mesh.
+        bool addMesh(
+            const CesiumGltf::Model& model,
+            const CesiumGltf::Mesh& mesh,
+            const glm::dmat4& worldMatrix,
+            const std::vector<int32_t>& outputMaterials,
+            uint32_t featureId,
+            const SimplifiedMesh* simplified = nullptr);
+
+        bool empty() const { return _batches.empty(); }
+
+        // Returns all batches (closed and open) and resets the batcher.
+        std::vector<GeometryBatch> takeBatches();
+
+    private:
+        size_t _vertexBudget;
+        std::vector<GeometryBatch> _batches;
+        // (material, hasNormals, hasTexCoords) -> index of the batch still accepting geometry
+        std::map<std::tuple<int32_t, bool, bool>, size_t> _openBatches;
+    };
+
+    // Reads the element names written next to batched primitives (the kBatchElementClass property
+    // table of EXT_structural_metadata). Returns an empty vector if the model has none.
+    std::vector<std::string> readBatchedElementNames(const CesiumGltf::Model& model);
+
+} // namespace GltfInstancing
+
+#endif // MESH_BATCHER_H
@@ -0,0 +1,145 @@
+﻿#include "mesh_optimization.h"
+#include "utilities.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <CesiumGltf/Accessor.h>
+#include <CesiumGltf/MeshPrimitive.h>
+
+#include <meshoptimizer.h>
+
+namespace GltfInstancing {
+
+    std::optional<SimplifiedMesh> unpackTriangleMesh(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh) {
+        if (mesh.primitives.empty()) {
+            return std::nullopt;
+        }
+        SimplifiedMesh result;
+        for (size_t p = 0; p < mesh.primitives.size(); ++p) {
+            const CesiumGltf::MeshPrimitive& primitive = mesh.primitives[p];
+            if (primitive.mode != CesiumGltf::MeshPrimitive::Mode::TRIANGLES || !primitive.targets.empty()) {
+                return std::nullopt;
+            }
+            auto positionIt = primitive.attributes.find("POSITION");
+            const CesiumGltf::Accessor* positionAccessor = positionIt != primitive.attributes.end()
+                ? CesiumGltf::Model::getSafe(&model.accessors, positionIt->second)
+                : nullptr;
+            if (!positionAccessor || positionAccessor->count <= 0 ||
+                positionAccessor->componentType != CesiumGltf::Accessor::ComponentType::FLOAT ||
+                positionAccessor->type != CesiumGltf::Accessor::Type::VEC3) {
+                return std::nullopt;
+            }
+
+            SimplifiedPrimitive& out = result.primitives.emplace_back();
+            out.sourcePrimitiveIndex = p;
+            out.vertexCount = static_cast<size_t>(positionAccessor->count);
+            for (const auto& [name, accessorIndex] : primitive.attributes) {
+                const CesiumGltf::Accessor* accessor = CesiumGltf::Model::getSafe(&model.accessors, accessorIndex);
+                std::optional<AccessorByteLayout> layout = accessor ? getAccessorByteLayout(model, *accessor) : std::nullopt;
+                if (!layout || static_cast<size_t>(layout->count) != out.vertexCount) {
+                    return std::nullopt;
+                }
+                SimplifiedAttribute& attribute = out.attributes[name];
+                attribute.type = accessor->type;
+                attribute.componentType = accessor->componentType;
+                attribute.normalized = accessor->normalized;
+                const size_t elementSize = static_cast<size_t>(layout->elementSize);
+                attribute.data.resize(out.vertexCount * elementSize);
+                if (layout->isContiguous()) {
+                    std::memcpy(attribute.data.data(), layout->data, attribute.data.size());
+                } else {
+                    for (size_t i = 0; i < out.vertexCount; ++i) {
+                        std::memcpy(attribute.data.data() + i * elementSize, layout->data + i * static_cast<size_t>(layout->stride), elementSize);
+                    }
+                }
+            }
+            if (!readTriangleIndices(model, primitive, out.vertexCount, out.indices)) {
+                return std::nullopt;
+            }
+            result.sourceTriangleCount += out.indices.size() / 3;
+        }
+        result.triangleCount = result.sourceTriangleCount;
+        return result;
+    }
+
+    void remapPrimitiveVertices(SimplifiedPrimitive& primitive, const uint32_t* remap, size_t newVertexCount) {
+        meshopt_remapIndexBuffer(primitive.indices.data(), primitive.indices.data(), primitive.indices.size(), remap);
+        for (auto& [name, attribute] : primitive.attributes) {
+            const size_t elementSize = attribute.data.size() / primitive.vertexCount;
+            std::vector<std::byte> remapped(newVertexCount * elementSize);
+            meshopt_remapVertexBuffer(remapped.data(), attribute.data.data(), primitive.vertexCount, elementSize, remap);
+            attribute.data = std::move(remapped);
+        }
+        primitive.vertexCount = newVertexCount;
+    }
+
+    void optimizePrimitive(SimplifiedPrimitive& primitive) {
+        const SimplifiedAttribute* position = primitive.findAttribute("POSITION");
+        if (!position || primitive.vertexCount == 0 || primitive.indices.empty()) {
+            return;
+        }
+        const size_t indexCount = primitive.indices.size();
+        std::vector<uint32_t> remap(primitive.vertexCount);
+
+        // Weld exact duplicates (every attribute stream equal); unreferenced vertices go too.
+        std::vector<meshopt_Stream> streams;
+        for (const auto& [name, attribute] : primitive.attributes) {
+            const size_t elementSize = attribute.data.size() / primitive.vertexCount;
+            streams.push_back({ attribute.data.data(), elementSize, elementSize });
+        }
+        size_t uniqueVertexCount = meshopt_generateVertexRemapMulti(
+            remap.data(), primitive.indices.data(), indexCount, primitive.vertexCount, streams.data(), streams.size());
+        remapPrimitiveVertices(primitive, remap.data(), uniqueVertexCount);
+
+        const float* positions = reinterpret_cast<const float*>(position->data.data());
+        meshopt_optimizeVertexCache(primitive.indices.data(), primitive.indices.data(), indexCount, primitive.vertexCount);
+        meshopt_optimizeOverdraw(primitive.indices.data(), primitive.indices.data(), indexCount,
+            positions, primitive.vertexCount, sizeof(float) * 3, 1.05f);
+
+        remap.resize(primitive.vertexCount);
+        size_t fetchVertexCount = meshopt_optimizeVertexFetchRemap(remap.data(), primitive.indices.data(), indexCount, primitive.vertexCount);
+        remapPrimitiveVertices(primitive, remap.data(), fetchVertexCount);
+    }
+
+    void optimizeBatch(GeometryBatch& batch) {
+        size_t vertexCount = batch.vertexCount();
+        if (vertexCount == 0 || batch.indices.empty()) {
+            return;
+        }
+        // (stream, floats per vertex); absent streams are empty and skipped
+        const std::pair<std::vector<float>*, size_t> floatStreams[] = {
+            { &batch.positions, 3 }, { &batch.normals, 3 }, { &batch.texCoords, 2 }, { &batch.featureIds, 1 } };
+        auto remapBatch = [&](const std::vector<uint32_t>& remap, size_t newVertexCount) {
+            meshopt_remapIndexBuffer(batch.indices.data(), batch.indices.data(), batch.indices.size(), remap.data());
+            for (const auto& [stream, components] : floatStreams) {
+                if (stream->empty()) {
+                    continue;
+                }
+                std::vector<float> remapped(newVertexCount * components);
+                meshopt_remapVertexBuffer(remapped.data(), stream->data(), vertexCount, components * sizeof(float), remap.data());
+                *stream = std::move(remapped);
+            }
+            vertexCount = newVertexCount;
+        };
+
+        std::vector<meshopt_Stream> streams;
+        for (const auto& [stream, components] : floatStreams) {
+            if (!stream->empty()) {
+                streams.push_back({ stream->data(), components * sizeof(float), components * sizeof(float) });
+            }
+        }
+        std::vector<uint32_t> remap(vertexCount);
+        remapBatch(remap, meshopt_generateVertexRemapMulti(
+            remap.data(), batch.indices.data(), batch.indices.size(), vertexCount, streams.data(), streams.size()));
+
+        meshopt_optimizeVertexCache(batch.indices.data(), batch.indices.data(), batch.indices.size(), vertexCount);
+        meshopt_optimizeOverdraw(batch.indices.data(), batch.indices.data(), batch.indices.size(),
+            batch.positions.data(), vertexCount, sizeof(float) * 3, 1.05f);
+
+        remap.resize(vertexCount);
+        remapBatch(remap, meshopt_optimizeVertexFetchRemap(remap.data(), batch.indices.data(), batch.indices.size(), vertexCount));
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,38 @@
+﻿#ifndef MESH_OPTIMIZATION_H
+#define MESH_OPTIMIZATION_H
+
+#include "lod_generator.h" // For SimplifiedMesh / SimplifiedPrimitive
+#include "mesh_batcher.h"  // For GeometryBatch
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <CesiumGltf/Model.h>
+#include <CesiumGltf/Mesh.h>
+
+namespace GltfInstancing {
+
+    // Reads every primitive of mesh into the tightly packed form of SimplifiedMesh (UINT32
+    // indices, attributes in their source formats) without changing the geometry.
+    // Returns std::nullopt for meshes the writer must copy verbatim: non-TRIANGLES primitives,
+    // morph targets, non-float POSITION or unreadable (e.g. sparse) accessors.
+    std::optional<SimplifiedMesh> unpackTriangleMesh(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh);
+
+    // Renumbers the vertices of primitive with a meshoptimizer remap table (old index ->
+    // new index, ~0u for dropped vertices): indices and every attribute.
+    void remapPrimitiveVertices(SimplifiedPrimitive& primitive, const uint32_t* remap, size_t newVertexCount);
+
+    // GPU-side reordering of a primitive, geometry unchanged: welds vertices whose attributes
+    // are all byte-identical, orders triangles for the post-transform vertex cache and then for
+    // overdraw (allowing a 5% cache loss), and finally orders vertices by first use for fetch
+    // locality. Requires POSITION (FLOAT VEC3), as produced by unpackTriangleMesh.
+    void optimizePrimitive(SimplifiedPrimitive& primitive);
+
+    // The same reordering for a merged primitive of MeshBatcher, keeping every stream
+    // (including the feature IDs) in step.
+    void optimizeBatch(GeometryBatch& batch);
+
+} // namespace GltfInstancing
+
+#endif // MESH_OPTIMIZATION_H
@@ -0,0 +1,214 @@
+﻿#include "metrics.h"
+#include "utilities.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace GltfInstancing {
+
+    namespace {
+
+        constexpr size_t kCounterCount = static_cast<size_t>(MetricCounter::Count);
+
+        std::array<std::atomic<uint64_t>, kCounterCount> g_counters{};
+        std::atomic<uint64_t> g_bytesRead{ 0 };
+        std::atomic<uint64_t> g_bytesWritten{ 0 };
+
+        // JSON keys, indexed like MetricCounter.
+        const char* const kCounterNames[kCounterCount] = {
+            "signatureCacheHits",
+            "modelCacheHits",
+            "modelCacheLoads",
+            "warmModelHits",
+            "fallbackHashes",
+            "boundingBoxRejections"
+        };
+
+        struct StageRecord {
+            std::string name;
+            double wallSeconds = 0.0;
+            double cpuSeconds = 0.0;
+            size_t peakResidentBytes = 0;
+            uint64_t bytesRead = 0;
+            uint64_t bytesWritten = 0;
+            std::array<uint64_t, kCounterCount> counters{};
+        };
+
+        // Per thread, so concurrent service jobs (one per worker thread) keep separate reports.
+        thread_local std::vector<StageRecord> g_stages;
+
+        double wallSeconds() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        nlohmann::json countersToJson(const std::array<uint64_t, kCounterCount>& counters) {
+            nlohmann::json json = nlohmann::json::object();
+            for (size_t i = 0; i < kCounterCount; ++i) {
+                json[kCounterNames[i]] = counters[i];
+            }
+            return json;
+        }
+
+    } // namespace
+
+    void countMetric(MetricCounter counter, uint64_t amount) {
+        g_counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void addBytesRead(uint64_t byteCount) {
+        g_bytesRead.fetch_add(byteCount, std::memory_order_relaxed);
+    }
+
+    void addBytesWritten(uint64_t byteCount) {
+        g_bytesWritten.fetch_add(byteCount, std::memory_order_relaxed);
+    }
+
+    double processCpuSeconds() {
+#ifdef _WIN32
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+            return 0.0;
+        }
+        auto toSeconds = [](const FILETIME& time) {
+            const uint64_t ticks = (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+            return static_cast<double>(ticks) * 1e-7; // 100 ns units
+        };
+        return toSeconds(kernelTime) + toSeconds(userTime);
+#else
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0.0;
+        }
+        return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+               static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+    }
+
+    size_t peakResidentBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return static_cast<size_t>(counters.PeakWorkingSetSize);
+        }
+        return 0;
+#else
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss); // bytes
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+    }
+
+    MetricsStage::MetricsStage(std::string name)
+        : _name(std::move(name)),
+          _startWallSeconds(wallSeconds()),
+          _startCpuSeconds(processCpuSeconds()),
+          _startBytesRead(g_bytesRead.load(std::memory_order_relaxed)),
+          _startBytesWritten(g_bytesWritten.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < kCounterCount; ++i) {
+            _startCounters[i] = g_counters[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    MetricsStage::~MetricsStage() {
+        finish();
+    }
+
+    void MetricsStage::finish() {
+        if (_finished) {
+            return;
+        }
+        _finished = true;
+
+        StageRecord record;
+        record.name = _name;
+        record.wallSeconds = wallSeconds() - _startWallSeconds;
+        record.cpuSeconds = processCpuSeconds() - _startCpuSeconds;
+        record.peakResidentBytes = peakResidentBytes();
+        record.bytesRead = g_bytesRead.load(std::memory_order_relaxed) - _startBytesRead;
+        record.bytesWritten = g_bytesWritten.load(std::memory_order_relaxed) - _startBytesWritten;
+        for (size_t i = 0; i < kCounterCount; ++i) {
+            record.counters[i] = g_counters[i].load(std::memory_order_relaxed) - _startCounters[i];
+        }
+        logDebug("Stage '" + record.name + "': " + std::to_string(record.wallSeconds) + " s wall, " +
+                 std::to_string(record.cpuSeconds) + " s CPU.");
+
+        g_stages.push_back(std::move(record));
+    }
+
+    void clearMetricsStages() {
+        g_stages.clear();
+    }
+
+    bool writeMetricsReport(const std::filesystem::path& reportPath) {
+        nlohmann::json stages = nlohmann::json::array();
+        StageRecord totals;
+        for (const StageRecord& record : g_stages) {
+            stages.push_back({
+                { "name", record.name },
+                { "wallSeconds", record.wallSeconds },
+                { "cpuSeconds", record.cpuSeconds },
+                { "peakResidentBytes", record.peakResidentBytes },
+                { "bytesRead", record.bytesRead },
+                { "bytesWritten", record.bytesWritten },
+                { "counters", countersToJson(record.counters) }
+            });
+            totals.wallSeconds += record.wallSeconds;
+            totals.cpuSeconds += record.cpuSeconds;
+            totals.peakResidentBytes = std::max(totals.peakResidentBytes, record.peakResidentBytes);
+            totals.bytesRead += record.bytesRead;
+            totals.bytesWritten += record.bytesWritten;
+            for (size_t i = 0; i < kCounterCount; ++i) {
+                totals.counters[i] += record.counters[i];
+            }
+        }
+
+        nlohmann::json report;
+        report["stages"] = std::move(stages);
+        report["totals"] = {
+            { "wallSeconds", totals.wallSeconds },
+            { "cpuSeconds", totals.cpuSeconds },
+            { "peakResidentBytes", totals.peakResidentBytes },
+            { "bytesRead", totals.bytesRead },
+            { "bytesWritten", totals.bytesWritten },
+            { "counters", countersToJson(totals.counters) }
+        };
+
+        std::ofstream reportFile(reportPath, std::ios::trunc);
+        if (!reportFile) {
+            logError("Failed to open metrics report for writing: " + reportPath.string());
+            return false;
+        }
+        reportFile << report.dump(2) << std::endl;
+        if (!reportFile) {
+            logError("Failed to write metrics report: " + reportPath.string());
+            return false;
+        }
+        return true;
+    }
+
+} // namespace GltfInstancing
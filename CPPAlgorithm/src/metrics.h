@@ -0,0 +1,66 @@
+﻿#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace GltfInstancing {
+
+    // Process-wide event counters. Incremented from any thread; each stage reports the
+    // increments made while it ran.
+    enum class MetricCounter {
+        SignatureCacheHits,    // Files whose signatures were replayed from the signature cache
+        ModelCacheHits,        // ModelCache::acquire calls served from memory
+        ModelCacheLoads,       // ModelCache::acquire calls that had to parse the file
+        WarmModelHits,         // Models copied from a service mode WarmModelStore instead of parsed
+        FallbackHashes,        // Accessors hashed from their properties (data bytes not locatable)
+        BoundingBoxRejections, // Tolerance-mode candidates rejected by the bounding box comparison
+        Count
+    };
+
+    void countMetric(MetricCounter counter, uint64_t amount = 1);
+    void addBytesRead(uint64_t byteCount);
+    void addBytesWritten(uint64_t byteCount);
+
+    // User + kernel CPU time of the whole process so far, all threads.
+    double processCpuSeconds();
+    // Peak resident set (working set on Windows) of the process so far; 0 if unavailable.
+    size_t peakResidentBytes();
+
+    // Measures one pipeline stage from construction to finish() (or destruction, whichever
+    // comes first): wall time, process CPU time, peak RSS at the end, bytes read/written and
+    // counter increments. Finished stages are kept in order for writeMetricsReport.
+    // Stages are meant to run one after another on one thread, which owns the list of finished
+    // stages; work they hand to worker threads is included. Time, memory, I/O and counters are
+    // process-wide, so stages of concurrent service jobs include each other's work.
+    class MetricsStage {
+    public:
+        explicit MetricsStage(std::string name);
+        ~MetricsStage();
+        MetricsStage(const MetricsStage&) = delete;
+        MetricsStage& operator=(const MetricsStage&) = delete;
+
+        void finish();
+
+    private:
+        std::string _name;
+        bool _finished = false;
+        double _startWallSeconds = 0.0;
+        double _startCpuSeconds = 0.0;
+        uint64_t _startBytesRead = 0;
+        uint64_t _startBytesWritten = 0;
+        std::array<uint64_t, static_cast<size_t>(MetricCounter::Count)> _startCounters{};
+    };
+
+    // Forgets the finished stages of the calling thread, so one thread can report several runs.
+    void clearMetricsStages();
+
+    // Writes the finished stages of the calling thread and their totals as JSON. Returns false (logged) on I/O errors.
+    bool writeMetricsReport(const std::filesystem::path& reportPath);
+
+} // namespace GltfInstancing
+
+#endif // METRICS_H
@@ -0,0 +1,224 @@
+﻿#include "model_cache.h"
+#include "utilities.h" // For logging
+#include "metrics.h"
+
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace GltfInstancing {
+
+    size_t estimateModelBytes(const CesiumGltf::Model& model) {
+        size_t bytes = 0;
+        for (const auto& buffer : model.buffers) {
+            bytes += buffer.cesium.data.size();
+        }
+        for (const auto& image : model.images) {
+            bytes += image.cesium.pixelData.size();
+        }
+        return bytes;
+    }
+
+    ModelCache::ModelCache(std::vector<std::filesystem::path> paths, const GlbReaderOptions& readerOptions, size_t capacityBytes)
+        : _paths(std::move(paths)), _readerOptions(readerOptions), _capacityBytes(capacityBytes), _failed(_paths.size(), false) {}
+
+    std::shared_ptr<const LoadedGltfModel> ModelCache::acquire(int modelId) {
+        if (modelId < 0 || static_cast<size_t>(modelId) >= _paths.size()) {
+            logError("ModelCache: invalid model ID " + std::to_string(modelId));
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto found = _entries.find(modelId);
+        if (found != _entries.end()) {
+            _recentlyUsed.splice(_recentlyUsed.begin(), _recentlyUsed, found->second.recency);
+            countMetric(MetricCounter::ModelCacheHits);
+            return found->second.model;
+        }
+        if (_failed[static_cast<size_t>(modelId)]) {
+            return nullptr;
+        }
+        auto loading = _loading.find(modelId);
+        if (loading != _loading.end()) {
+            std::shared_future<std::shared_ptr<const LoadedGltfModel>> pending = loading->second;
+            lock.unlock();
+            return pending.get();
+        }
+
+        // Claim the load, then parse without holding the lock.
+        std::promise<std::shared_ptr<const LoadedGltfModel>> promise;
+        _loading.emplace(modelId, promise.get_future().share());
+        std::unique_ptr<GlbReader> reader;
+        if (!_idleReaders.empty()) {
+            reader = std::move(_idleReaders.back());
+            _idleReaders.pop_back();
+        }
+        ++_loadCount;
+        lock.unlock();
+
+        countMetric(MetricCounter::ModelCacheLoads);
+        std::shared_ptr<const LoadedGltfModel> model;
+        size_t bytes = 0;
+        try {
+            if (!reader) {
+                reader = std::make_unique<GlbReader>(_readerOptions);
+            }
+            std::optional<LoadedGltfModel> loaded = reader->readGlb(_paths[static_cast<size_t>(modelId)], modelId);
+            if (loaded) {
+                bytes = estimateModelBytes(loaded->model);
+                model = std::make_shared<const LoadedGltfModel>(std::move(*loaded));
+            }
+        } catch (const std::exception& e) {
+            // The claimed load must still be published, or its waiters and the reader are lost.
+            logError("ModelCache: failed to load " + _paths[static_cast<size_t>(modelId)].string() + ". Error: " + e.what());
+            model.reset();
+        }
+
+        // Publish the result and apply eviction.
+        lock.lock();
+        if (reader) {
+            _idleReaders.push_back(std::move(reader));
+        }
+        _loading.erase(modelId);
+        if (model) {
+            Entry entry;
+            entry.bytes = bytes;
+            entry.model = model;
+            _recentlyUsed.push_front(modelId);
+            entry.recency = _recentlyUsed.begin();
+            _residentBytes += entry.bytes;
+            _entries.emplace(modelId, std::move(entry));
+            evictBeyondCapacity();
+        } else {
+            _failed[static_cast<size_t>(modelId)] = true;
+        }
+        lock.unlock();
+        promise.set_value(model);
+        return model;
+    }
+
+    void ModelCache::release(int modelId) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto found = _entries.find(modelId);
+        if (found == _entries.end()) {
+            return;
+        }
+        _residentBytes -= found->second.bytes;
+        _recentlyUsed.erase(found->second.recency);
+        _entries.erase(found);
+    }
+
+    void ModelCache::evictBeyondCapacity() {
+        while (_residentBytes > _capacityBytes && _recentlyUsed.size() > 1) {
+            const int victim = _recentlyUsed.back();
+            _recentlyUsed.pop_back();
+            auto found = _entries.find(victim);
+            _residentBytes -= found->second.bytes;
+            _entries.erase(found);
+        }
+    }
+
+    WarmModelStore::WarmModelStore(size_t capacityBytes)
+        : _capacityBytes(capacityBytes) {}
+
+    std::vector<LoadedGltfModel> WarmModelStore::loadGltfModels(
+        const std::set<std::filesystem::path>& glbPaths,
+        const GlbReaderOptions& readerOptions,
+        int threadCount) {
+        const std::vector<std::filesystem::path> orderedPaths(glbPaths.begin(), glbPaths.end());
+        const std::string optionSuffix = readerOptions.decodeImages ? ":decoded" : ":encoded";
+
+        // Hits are copied in place; misses are left empty and parsed together below.
+        std::vector<std::optional<LoadedGltfModel>> slots(orderedPaths.size());
+        std::vector<std::string> keys(orderedPaths.size());
+        parallelFor(orderedPaths.size(), threadCount, [&](size_t i, int /*workerIndex*/) {
+            std::optional<std::string> fileHash = computeFileContentHash(orderedPaths[i]);
+            if (!fileHash) {
+                return; // Logged; the reader logs the file once more and skips it
+            }
+            keys[i] = *fileHash + optionSuffix;
+            std::shared_ptr<const CesiumGltf::Model> model = find(keys[i]);
+            if (model) {
+                LoadedGltfModel loaded;
+                loaded.model = *model;
+                loaded.originalPath = orderedPaths[i];
+                loaded.fileHash = *fileHash;
+                slots[i] = std::move(loaded);
+                countMetric(MetricCounter::WarmModelHits);
+            }
+        });
+
+        std::set<std::filesystem::path> missingPaths;
+        std::unordered_map<std::string, size_t> slotByPath;
+        for (size_t i = 0; i < orderedPaths.size(); ++i) {
+            if (!slots[i]) {
+                missingPaths.insert(orderedPaths[i]);
+                slotByPath.emplace(orderedPaths[i].string(), i);
+            }
+        }
+        if (!missingPaths.empty()) {
+            GlbReader reader(readerOptions);
+            for (LoadedGltfModel& loaded : reader.loadGltfModels(missingPaths, threadCount)) {
+                const size_t i = slotByPath.at(loaded.originalPath.string());
+                if (!keys[i].empty()) {
+                    store(keys[i], loaded.model);
+                }
+                slots[i] = std::move(loaded);
+            }
+        }
+        logInfo("Warm model store: " + std::to_string(orderedPaths.size() - missingPaths.size()) + " of " +
+                std::to_string(orderedPaths.size()) + " model(s) reused without parsing.");
+
+        std::vector<LoadedGltfModel> loadedModels;
+        loadedModels.reserve(orderedPaths.size());
+        int currentModelId = 0;
+        for (auto& slot : slots) {
+            if (slot) {
+                slot->uniqueId = currentModelId++;
+                loadedModels.push_back(std::move(*slot));
+            }
+        }
+        return loadedModels;
+    }
+
+    std::shared_ptr<const CesiumGltf::Model> WarmModelStore::find(const std::string& key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto found = _entries.find(key);
+        if (found == _entries.end()) {
+            return nullptr;
+        }
+        _recentlyUsed.splice(_recentlyUsed.begin(), _recentlyUsed, found->second.recency);
+        return found->second.model;
+    }
+
+    void WarmModelStore::store(const std::string& key, const CesiumGltf::Model& model) {
+        const size_t bytes = estimateModelBytes(model);
+        if (bytes > _capacityBytes) {
+            return;
+        }
+        // Copied outside the lock; the caller keeps its own model.
+        std::shared_ptr<const CesiumGltf::Model> copy = std::make_shared<const CesiumGltf::Model>(model);
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_entries.count(key) > 0) {
+            return; // Stored meanwhile by a concurrent job
+        }
+        Entry entry;
+        entry.model = std::move(copy);
+        entry.bytes = bytes;
+        _recentlyUsed.push_front(key);
+        entry.recency = _recentlyUsed.begin();
+        _residentBytes += bytes;
+        _entries.emplace(key, std::move(entry));
+        evictBeyondCapacity();
+    }
+
+    void WarmModelStore::evictBeyondCapacity() {
+        while (_residentBytes > _capacityBytes && !_recentlyUsed.empty()) {
+            auto found = _entries.find(_recentlyUsed.back());
+            _recentlyUsed.pop_back();
+            _residentBytes -= found->second.bytes;
+            _entries.erase(found);
+        }
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,107 @@
+﻿#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include "glb_reader.h" // For GlbReader, LoadedGltfModel
+
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+
+namespace GltfInstancing {
+
+    // Approximate resident size of a loaded model: buffer data plus decoded image pixels.
+    size_t estimateModelBytes(const CesiumGltf::Model& model);
+
+    // On-demand access to a fixed list of GLB files for the out-of-core pipeline. paths[i] is
+    // model ID i. Models are loaded when first acquired and the least recently used ones are
+    // released once the resident models exceed capacityBytes (the most recent one always stays,
+    // however large). Safe to use from several threads: files are parsed outside the lock, so
+    // different models load concurrently and hits are never blocked by a load; a thread that
+    // acquires a model another thread is loading waits for that load.
+    class ModelCache {
+    public:
+        ModelCache(std::vector<std::filesystem::path> paths, const GlbReaderOptions& readerOptions, size_t capacityBytes);
+
+        size_t modelCount() const { return _paths.size(); }
+        const std::filesystem::path& path(int modelId) const { return _paths[static_cast<size_t>(modelId)]; }
+
+        // The model with this ID, loaded on a miss. Evicted models stay alive for as long as a
+        // returned pointer is held. Returns nullptr (logged once) if the file cannot be read.
+        std::shared_ptr<const LoadedGltfModel> acquire(int modelId);
+
+        // Drops the cache's reference to the model (e.g. after its only use).
+        void release(int modelId);
+
+        size_t loadCount() const { return _loadCount; }
+        size_t residentBytes() const { return _residentBytes; }
+
+    private:
+        struct Entry {
+            std::shared_ptr<const LoadedGltfModel> model;
+            size_t bytes = 0;
+            std::list<int>::iterator recency; // Position in _recentlyUsed
+        };
+
+        void evictBeyondCapacity();
+
+        std::vector<std::filesystem::path> _paths;
+        GlbReaderOptions _readerOptions;
+        size_t _capacityBytes;
+        std::mutex _mutex;
+        std::unordered_map<int, Entry> _entries;
+        // Loads in progress; their result is nullptr if the file could not be read.
+        std::unordered_map<int, std::shared_future<std::shared_ptr<const LoadedGltfModel>>> _loading;
+        // GltfReader is not safe to share between threads, so each concurrent load takes its own.
+        std::vector<std::unique_ptr<GlbReader>> _idleReaders;
+        std::list<int> _recentlyUsed; // Most recent first
+        std::vector<bool> _failed; // Files that could not be read, not retried
+        size_t _residentBytes = 0;
+        size_t _loadCount = 0;
+    };
+
+    // Decoded models kept across service mode jobs, keyed by file content hash and the image
+    // decoding option, so a job over files an earlier job already parsed copies the models
+    // instead of parsing them again. The least recently used models are dropped once the stored
+    // models exceed capacityBytes; a model larger than that is not stored. Safe to use from
+    // several threads.
+    class WarmModelStore {
+    public:
+        explicit WarmModelStore(size_t capacityBytes);
+
+        // Same result as GlbReader(readerOptions).loadGltfModels(glbPaths, threadCount): the
+        // models in path order with IDs 0..n-1. Every file is still read once to hash it.
+        std::vector<LoadedGltfModel> loadGltfModels(
+            const std::set<std::filesystem::path>& glbPaths,
+            const GlbReaderOptions& readerOptions,
+            int threadCount);
+
+    private:
+        struct Entry {
+            std::shared_ptr<const CesiumGltf::Model> model;
+            size_t bytes = 0;
+            std::list<std::string>::iterator recency; // Position in _recentlyUsed
+        };
+
+        std::shared_ptr<const CesiumGltf::Model> find(const std::string& key);
+        void store(const std::string& key, const CesiumGltf::Model& model);
+        void evictBeyondCapacity();
+
+        size_t _capacityBytes;
+        std::mutex _mutex;
+        std::unordered_map<std::string, Entry> _entries;
+        std::list<std::string> _recentlyUsed; // Most recent first
+        size_t _residentBytes = 0;
+    };
+
+} // namespace GltfInstancing
+
+#endif // MODEL_CACHE_H
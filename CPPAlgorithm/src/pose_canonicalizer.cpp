@@ -0,0 +1,309 @@
+﻿#include "pose_canonicalizer.h"
+#include "utilities.h" // For logging and hashAccessorContent128
+
+#include <CesiumGltf/Accessor.h>
+#include <CesiumGltf/AccessorView.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace GltfInstancing {
+
+    namespace {
+        // Relative eigenvalue gap below which two principal axes are treated as interchangeable.
+        constexpr double kEigenvalueGap = 1e-3;
+        // Relative skewness below which an axis direction cannot be decided from the third moment.
+        constexpr double kSkewnessEpsilon = 1e-4;
+        // Minimum offset from the centroid (relative to the principal spread) for a vertex to break a tie.
+        constexpr double kTieBreakEpsilon = 1e-3;
+        // NORMAL / TANGENT quantization in the canonical frame (unit vectors).
+        constexpr double kDirectionStep = 1e-4;
+
+        bool readPositions(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh, std::vector<glm::dvec3>& positions) {
+            for (const auto& primitive : mesh.primitives) {
+                if (!primitive.targets.empty()) {
+                    return false; // Morph target deltas would also need re-orienting
+                }
+                auto posIt = primitive.attributes.find("POSITION");
+                if (posIt == primitive.attributes.end()) {
+                    return false;
+                }
+                CesiumGltf::AccessorView<glm::vec3> view(model, posIt->second);
+                if (view.status() != CesiumGltf::AccessorViewStatus::Valid) {
+                    return false; // Not FLOAT VEC3 (e.g. KHR_mesh_quantization) or invalid
+                }
+                positions.reserve(positions.size() + static_cast<size_t>(view.size()));
+                for (int64_t i = 0; i < view.size(); ++i) {
+                    positions.push_back(glm::dvec3(view[i]));
+                }
+            }
+            return !positions.empty();
+        }
+
+        // Cyclic Jacobi rotations on a symmetric 3x3 matrix. On return `values` holds the
+        // eigenvalues and the columns of `vectors` the matching unit eigenvectors.
+        void jacobiEigen(const glm::dmat3& symmetric, glm::dvec3& values, glm::dmat3& vectors) {
+            double a[3][3];
+            double v[3][3] = { {1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0} };
+            for (int c = 0; c < 3; ++c) {
+                for (int r = 0; r < 3; ++r) {
+                    a[r][c] = symmetric[c][r];
+                }
+            }
+
+            for (int sweep = 0; sweep < 50; ++sweep) {
+                double offDiagonal = std::abs(a[0][1]) + std::abs(a[0][2]) + std::abs(a[1][2]);
+                if (offDiagonal < 1e-300) {
+                    break;
+                }
+                for (int p = 0; p < 2; ++p) {
+                    for (int q = p + 1; q < 3; ++q) {
+                        if (std::abs(a[p][q]) < 1e-300) {
+                            continue;
+                        }
+                        double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                        double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                        double c = 1.0 / std::sqrt(t * t + 1.0);
+                        double s = t * c;
+                        for (int k = 0; k < 3; ++k) {
+                            double akp = a[k][p];
+                            double akq = a[k][q];
+                            a[k][p] = c * akp - s * akq;
+                            a[k][q] = s * akp + c * akq;
+                        }
+                        for (int k = 0; k < 3; ++k) {
+                            double apk = a[p][k];
+                            double aqk = a[q][k];
+                            a[p][k] = c * apk - s * aqk;
+                            a[q][k] = s * apk + c * aqk;
+                        }
+                        for (int k = 0; k < 3; ++k) {
+                            double vkp = v[k][p];
+                            double vkq = v[k][q];
+                            v[k][p] = c * vkp - s * vkq;
+                            v[k][q] = s * vkp + c * vkq;
+                        }
+                    }
+                }
+            }
+
+            for (int i = 0; i < 3; ++i) {
+                values[i] = a[i][i];
+                vectors[i] = glm::dvec3(v[0][i], v[1][i], v[2][i]);
+            }
+        }
+
+        // Orients axis using the sign of the third moment, falling back to the first vertex
+        // with a clear projection. Returns false if neither decides.
+        bool orientAxis(glm::dvec3& axis, const std::vector<glm::dvec3>& centered, double spread) {
+            double thirdMoment = 0.0;
+            for (const auto& p : centered) {
+                double d = glm::dot(p, axis);
+                thirdMoment += d * d * d;
+            }
+            thirdMoment /= static_cast<double>(centered.size());
+            if (std::abs(thirdMoment) > kSkewnessEpsilon * spread * spread * spread) {
+                if (thirdMoment < 0.0) axis = -axis;
+                return true;
+            }
+            for (const auto& p : centered) {
+                double d = glm::dot(p, axis);
+                if (std::abs(d) > kTieBreakEpsilon * spread) {
+                    if (d < 0.0) axis = -axis;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Direction of the first vertex (in order) with a clear component perpendicular to
+        // `excluded` (pass a zero vector to exclude nothing).
+        std::optional<glm::dvec3> firstVertexDirection(const std::vector<glm::dvec3>& centered, const glm::dvec3& excluded, double spread) {
+            for (const auto& p : centered) {
+                glm::dvec3 d = p - glm::dot(p, excluded) * excluded;
+                double length = glm::length(d);
+                if (length > kTieBreakEpsilon * spread) {
+                    return d / length;
+                }
+            }
+            return std::nullopt;
+        }
+
+        void updateQuantized(ContentHasher128& hasher, const glm::dvec3& value, double step) {
+            int64_t q[3] = {
+                static_cast<int64_t>(std::llround(value.x / step)),
+                static_cast<int64_t>(std::llround(value.y / step)),
+                static_cast<int64_t>(std::llround(value.z / step))
+            };
+            hasher.update(q, sizeof(q));
+        }
+    }
+
+    std::optional<CanonicalPose> computeCanonicalPose(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh) {
+        std::vector<glm::dvec3> positions;
+        if (!readPositions(model, mesh, positions)) {
+            return std::nullopt;
+        }
+
+        glm::dvec3 centroid(0.0);
+        for (const auto& p : positions) {
+            centroid += p;
+        }
+        centroid /= static_cast<double>(positions.size());
+
+        glm::dmat3 covariance(0.0);
+        for (auto& p : positions) {
+            p -= centroid; // positions are centered from here on
+            covariance += glm::outerProduct(p, p);
+        }
+        covariance /= static_cast<double>(positions.size());
+
+        glm::dvec3 eigenValues;
+        glm::dmat3 eigenVectors;
+        jacobiEigen(covariance, eigenValues, eigenVectors);
+
+        // Sort by descending variance.
+        std::array<int, 3> order = { 0, 1, 2 };
+        std::sort(order.begin(), order.end(), [&](int lhs, int rhs) { return eigenValues[lhs] > eigenValues[rhs]; });
+        const double lambda0 = eigenValues[order[0]];
+        const double lambda1 = eigenValues[order[1]];
+        const double lambda2 = eigenValues[order[2]];
+        if (!(lambda0 > 0.0)) {
+            return std::nullopt; // All vertices coincide
+        }
+        const double spread = std::sqrt(lambda0);
+        const bool distinct01 = (lambda0 - lambda1) > kEigenvalueGap * lambda0;
+        const bool distinct12 = (lambda1 - lambda2) > kEigenvalueGap * lambda0;
+
+        glm::dvec3 axis0, axis1, axis2;
+        if (distinct01 && distinct12) {
+            axis0 = glm::normalize(eigenVectors[order[0]]);
+            axis1 = glm::normalize(eigenVectors[order[1]]);
+            if (!orientAxis(axis0, positions, spread) || !orientAxis(axis1, positions, spread)) {
+                return std::nullopt;
+            }
+            axis2 = glm::cross(axis0, axis1);
+        } else if (distinct01) {
+            // Rotationally symmetric around the principal axis: vertex order fixes the second axis.
+            axis0 = glm::normalize(eigenVectors[order[0]]);
+            if (!orientAxis(axis0, positions, spread)) {
+                return std::nullopt;
+            }
+            auto second = firstVertexDirection(positions, axis0, spread);
+            if (!second) {
+                return std::nullopt;
+            }
+            axis1 = *second;
+            axis2 = glm::cross(axis0, axis1);
+        } else if (distinct12) {
+            // Symmetric in the principal plane: the least-variance axis is unique.
+            axis2 = glm::normalize(eigenVectors[order[2]]);
+            if (!orientAxis(axis2, positions, spread)) {
+                return std::nullopt;
+            }
+            auto first = firstVertexDirection(positions, axis2, spread);
+            if (!first) {
+                return std::nullopt;
+            }
+            axis0 = *first;
+            axis1 = glm::cross(axis2, axis0);
+        } else {
+            // Isotropic: both axes come from the vertex order.
+            auto first = firstVertexDirection(positions, glm::dvec3(0.0), spread);
+            if (!first) {
+                return std::nullopt;
+            }
+            axis0 = *first;
+            auto second = firstVertexDirection(positions, axis0, spread);
+            if (!second) {
+                return std::nullopt;
+            }
+            axis1 = *second;
+            axis2 = glm::cross(axis0, axis1);
+        }
+
+        CanonicalPose pose;
+        pose.canonicalToLocal = glm::dmat4(
+            glm::dvec4(axis0, 0.0),
+            glm::dvec4(axis1, 0.0),
+            glm::dvec4(axis2, 0.0),
+            glm::dvec4(centroid, 1.0));
+        glm::dmat3 inverseRotation = glm::transpose(glm::dmat3(axis0, axis1, axis2));
+        pose.localToCanonical = glm::dmat4(inverseRotation);
+        pose.localToCanonical[3] = glm::dvec4(-(inverseRotation * centroid), 1.0);
+        return pose;
+    }
+
+    std::optional<ContentHash128> hashCanonicalMesh(
+        const CesiumGltf::Model& model,
+        const CesiumGltf::Mesh& mesh,
+        const CanonicalPose& pose,
+        double positionStep,
+        const std::vector<uint64_t>& primitiveMaterialKeys) {
+        const glm::dmat3 toCanonicalRotation(pose.localToCanonical);
+
+        ContentHasher128 hasher;
+        hasher.updateValue(static_cast<uint64_t>(mesh.primitives.size()));
+        for (size_t primitiveIndex = 0; primitiveIndex < mesh.primitives.size(); ++primitiveIndex) {
+            const auto& primitive = mesh.primitives[primitiveIndex];
+            hasher.updateValue(primitive.mode);
+            hasher.updateValue(primitiveIndex < primitiveMaterialKeys.size() ? primitiveMaterialKeys[primitiveIndex] : static_cast<uint64_t>(primitive.material));
+
+            if (primitive.indices >= 0 && static_cast<size_t>(primitive.indices) < model.accessors.size()) {
+                auto indicesHash = hashAccessorContent128(model, model.accessors[static_cast<size_t>(primitive.indices)]);
+                if (!indicesHash) {
+                    return std::nullopt;
+                }
+                hasher.updateValue(indicesHash->low);
+                hasher.updateValue(indicesHash->high);
+            } else {
+                hasher.updateValue(static_cast<int64_t>(-1));
+            }
+
+            // std::map iteration keeps the attribute order stable.
+            for (const auto& [attrName, accessorIndex] : primitive.attributes) {
+                hasher.updateString(attrName);
+                if (attrName == "POSITION" || attrName == "NORMAL") {
+                    CesiumGltf::AccessorView<glm::vec3> view(model, accessorIndex);
+                    if (view.status() != CesiumGltf::AccessorViewStatus::Valid) {
+                        return std::nullopt;
+                    }
+                    hasher.updateValue(view.size());
+                    for (int64_t i = 0; i < view.size(); ++i) {
+                        if (attrName == "POSITION") {
+                            updateQuantized(hasher, glm::dvec3(pose.localToCanonical * glm::dvec4(glm::dvec3(view[i]), 1.0)), positionStep);
+                        } else {
+                            updateQuantized(hasher, toCanonicalRotation * glm::dvec3(view[i]), kDirectionStep);
+                        }
+                    }
+                } else if (attrName == "TANGENT") {
+                    CesiumGltf::AccessorView<glm::vec4> view(model, accessorIndex);
+                    if (view.status() != CesiumGltf::AccessorViewStatus::Valid) {
+                        return std::nullopt;
+                    }
+                    hasher.updateValue(view.size());
+                    for (int64_t i = 0; i < view.size(); ++i) {
+                        glm::dvec4 tangent(view[i]);
+                        updateQuantized(hasher, toCanonicalRotation * glm::dvec3(tangent), kDirectionStep);
+                        hasher.updateValue(tangent.w < 0.0 ? -1 : 1); // Handedness is pose-invariant
+                    }
+                } else {
+                    if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+                        return std::nullopt;
+                    }
+                    auto attributeHash = hashAccessorContent128(model, model.accessors[static_cast<size_t>(accessorIndex)]);
+                    if (!attributeHash) {
+                        return std::nullopt;
+                    }
+                    hasher.updateValue(attributeHash->low);
+                    hasher.updateValue(attributeHash->high);
+                }
+            }
+        }
+        return hasher.finalize();
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,48 @@
+﻿#ifndef POSE_CANONICALIZER_H
+#define POSE_CANONICALIZER_H
+
+#include "content_hash.h"
+
+#include <optional>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+#include <CesiumGltf/Mesh.h>
+
+#include <glm/glm.hpp>
+
+namespace GltfInstancing {
+
+    // Rigid frame that maps a mesh's local geometry to a pose-independent canonical form:
+    // origin at the vertex centroid, axes along the principal axes of the vertex distribution.
+    // Two copies of the same geometry that were baked into different world poses end up with
+    // the same canonical coordinates, and instanceLocal = canonicalToLocal(instance) *
+    // localToCanonical(representative) maps the representative's vertices onto the instance.
+    struct CanonicalPose {
+        glm::dmat4 canonicalToLocal{ 1.0 }; // Rotation (right-handed, no reflection) + translation
+        glm::dmat4 localToCanonical{ 1.0 };
+    };
+
+    // Computes the canonical frame of all POSITION data of the mesh (every primitive, in order).
+    // Axis order follows descending variance and signs are fixed by the third moment (skewness).
+    // Where the distribution is symmetric (equal eigenvalues or zero skewness) the vertex order
+    // breaks the tie, so copies that keep their vertex order still canonicalize identically.
+    // Returns std::nullopt when no reliable frame exists (non-float positions, morph targets,
+    // point-like geometry); such meshes are matched by the regular signature instead.
+    std::optional<CanonicalPose> computeCanonicalPose(const CesiumGltf::Model& model, const CesiumGltf::Mesh& mesh);
+
+    // Hashes the mesh as seen in the canonical frame: POSITION quantized to positionStep,
+    // NORMAL and TANGENT.xyz rotated into the frame and quantized, every other attribute and the
+    // indices hashed exactly. Primitive mode and primitiveMaterialKeys (one material identity per
+    // primitive, e.g. a material content hash) are included.
+    // Returns std::nullopt if an attribute cannot be read.
+    std::optional<ContentHash128> hashCanonicalMesh(
+        const CesiumGltf::Model& model,
+        const CesiumGltf::Mesh& mesh,
+        const CanonicalPose& pose,
+        double positionStep,
+        const std::vector<uint64_t>& primitiveMaterialKeys);
+
+} // namespace GltfInstancing
+
+#endif // POSE_CANONICALIZER_H
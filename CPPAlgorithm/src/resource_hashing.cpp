@@ -0,0 +1,273 @@
+﻿#include "resource_hashing.h"
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <variant>
+
+#include <CesiumGltf/Buffer.h>
+#include <CesiumGltf/BufferView.h>
+#include <CesiumGltf/Image.h>
+#include <CesiumGltf/Material.h>
+#include <CesiumGltf/Sampler.h>
+#include <CesiumGltf/Texture.h>
+#include <CesiumGltf/ExtensionKhrMaterialsUnlit.h>
+#include <CesiumGltf/ExtensionKhrTextureTransform.h>
+#include <CesiumUtility/JsonValue.h>
+
+namespace GltfInstancing {
+
+    namespace {
+        // Distinct seeds per resource kind, so e.g. an image and a bufferView with the same bytes differ.
+        constexpr uint64_t IMAGE_SEED = 0x696d616765ULL;
+        constexpr uint64_t SAMPLER_SEED = 0x73616d706c6572ULL;
+        constexpr uint64_t TEXTURE_SEED = 0x74657874757265ULL;
+        constexpr uint64_t MATERIAL_SEED = 0x6d6174657269616cULL;
+        constexpr uint64_t BUFFER_VIEW_SEED = 0x6276ULL;
+
+        void hashJsonValue(const CesiumUtility::JsonValue& value, ContentHasher128& hasher);
+
+        void hashJsonObject(const CesiumUtility::JsonValue::Object& object, ContentHasher128& hasher) {
+            hasher.updateValue(static_cast<uint64_t>(object.size()));
+            for (const auto& [key, member] : object) { // std::map: ordered by key
+                hasher.updateString(key);
+                hashJsonValue(member, hasher);
+            }
+        }
+
+        void hashJsonValue(const CesiumUtility::JsonValue& value, ContentHasher128& hasher) {
+            hasher.updateValue(static_cast<uint64_t>(value.value.index()));
+            std::visit([&hasher](const auto& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, CesiumUtility::JsonValue::String>) {
+                    hasher.updateString(v);
+                } else if constexpr (std::is_same_v<T, CesiumUtility::JsonValue::Object>) {
+                    hashJsonObject(v, hasher);
+                } else if constexpr (std::is_same_v<T, CesiumUtility::JsonValue::Array>) {
+                    hasher.updateValue(static_cast<uint64_t>(v.size()));
+                    for (const auto& element : v) {
+                        hashJsonValue(element, hasher);
+                    }
+                } else if constexpr (!std::is_same_v<T, CesiumUtility::JsonValue::Null>) {
+                    hasher.updateValue(v); // double, uint64, int64, bool
+                }
+            }, value.value);
+        }
+
+        void hashDoubles(const std::vector<double>& values, ContentHasher128& hasher) {
+            hasher.updateValue(static_cast<uint64_t>(values.size()));
+            if (!values.empty()) {
+                hasher.update(values.data(), values.size() * sizeof(double));
+            }
+        }
+
+        // Extras plus every extension, in name order. Returns false for an extension whose
+        // payload type is not known here: its content cannot be compared.
+        bool hashExtensible(const CesiumUtility::ExtensibleObject& object, ContentHasher128& hasher) {
+            hashJsonObject(object.extras, hasher);
+
+            std::vector<const std::string*> names;
+            names.reserve(object.extensions.size());
+            for (const auto& extension : object.extensions) {
+                names.push_back(&extension.first);
+            }
+            std::sort(names.begin(), names.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+            hasher.updateValue(static_cast<uint64_t>(names.size()));
+            for (const std::string* name : names) {
+                hasher.updateString(*name);
+                const std::any& payload = object.extensions.at(*name);
+                if (const auto* json = std::any_cast<CesiumUtility::JsonValue>(&payload)) {
+                    hashJsonValue(*json, hasher);
+                } else if (std::any_cast<CesiumGltf::ExtensionKhrMaterialsUnlit>(&payload)) {
+                    // Marker extension without properties
+                } else if (const auto* transform = std::any_cast<CesiumGltf::ExtensionKhrTextureTransform>(&payload)) {
+                    hashDoubles(transform->offset, hasher);
+                    hasher.updateValue(transform->rotation);
+                    hashDoubles(transform->scale, hasher);
+                    hasher.updateValue(transform->texCoord.value_or(-1));
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    ResourceContentHasher::ResourceContentHasher(const CesiumGltf::Model& model) : _model(&model) {}
+
+    std::optional<ContentHash128> ResourceContentHasher::bufferView(int32_t bufferViewIndex) {
+        auto cached = _bufferViews.find(bufferViewIndex);
+        if (cached != _bufferViews.end()) {
+            return cached->second;
+        }
+        std::optional<ContentHash128> result;
+        const CesiumGltf::BufferView* view = CesiumGltf::Model::getSafe(&_model->bufferViews, bufferViewIndex);
+        const CesiumGltf::Buffer* buffer = view ? CesiumGltf::Model::getSafe(&_model->buffers, view->buffer) : nullptr;
+        if (buffer && view->byteOffset >= 0 && view->byteLength >= 0 &&
+            view->byteOffset + view->byteLength <= static_cast<int64_t>(buffer->cesium.data.size())) {
+            ContentHasher128 hasher(BUFFER_VIEW_SEED);
+            hasher.updateValue(view->byteStride.value_or(0));
+            hasher.updateValue(view->target.value_or(-1));
+            hasher.updateValue(view->byteLength);
+            hasher.update(buffer->cesium.data.data() + view->byteOffset, static_cast<size_t>(view->byteLength));
+            result = hasher.finalize();
+        }
+        _bufferViews.emplace(bufferViewIndex, result);
+        return result;
+    }
+
+    std::optional<ContentHash128> ResourceContentHasher::image(int32_t imageIndex) {
+        auto cached = _images.find(imageIndex);
+        if (cached != _images.end()) {
+            return cached->second;
+        }
+        std::optional<ContentHash128> result;
+        if (const CesiumGltf::Image* image = CesiumGltf::Model::getSafe(&_model->images, imageIndex)) {
+            ContentHasher128 hasher(IMAGE_SEED);
+            hasher.updateString(image->mimeType.value_or(""));
+            bool identified = false;
+            if (image->bufferView >= 0) {
+                const CesiumGltf::BufferView* view = CesiumGltf::Model::getSafe(&_model->bufferViews, image->bufferView);
+                const CesiumGltf::Buffer* buffer = view ? CesiumGltf::Model::getSafe(&_model->buffers, view->buffer) : nullptr;
+                if (buffer && view->byteOffset >= 0 &&
+                    view->byteOffset + view->byteLength <= static_cast<int64_t>(buffer->cesium.data.size())) {
+                    hasher.updateValue(uint8_t(0));
+                    hasher.update(buffer->cesium.data.data() + view->byteOffset, static_cast<size_t>(view->byteLength));
+                    identified = true;
+                }
+            } else if (image->uri && !image->uri->empty()) {
+                hasher.updateValue(uint8_t(1));
+                hasher.updateString(*image->uri);
+                identified = true;
+            } else if (!image->cesium.pixelData.empty()) {
+                hasher.updateValue(uint8_t(2));
+                hasher.updateValue(image->cesium.width);
+                hasher.updateValue(image->cesium.height);
+                hasher.updateValue(image->cesium.channels);
+                hasher.updateValue(image->cesium.bytesPerChannel);
+                hasher.update(image->cesium.pixelData.data(), image->cesium.pixelData.size());
+                identified = true;
+            }
+            if (identified && hashExtensible(*image, hasher)) {
+                result = hasher.finalize();
+            }
+        }
+        _images.emplace(imageIndex, result);
+        return result;
+    }
+
+    std::optional<ContentHash128> ResourceContentHasher::sampler(int32_t samplerIndex) {
+        auto cached = _samplers.find(samplerIndex);
+        if (cached != _samplers.end()) {
+            return cached->second;
+        }
+        std::optional<ContentHash128> result;
+        if (const CesiumGltf::Sampler* sampler = CesiumGltf::Model::getSafe(&_model->samplers, samplerIndex)) {
+            ContentHasher128 hasher(SAMPLER_SEED);
+            hasher.updateValue(sampler->magFilter.value_or(-1));
+            hasher.updateValue(sampler->minFilter.value_or(-1));
+            hasher.updateValue(sampler->wrapS);
+            hasher.updateValue(sampler->wrapT);
+            if (hashExtensible(*sampler, hasher)) {
+                result = hasher.finalize();
+            }
+        }
+        _samplers.emplace(samplerIndex, result);
+        return result;
+    }
+
+    std::optional<ContentHash128> ResourceContentHasher::texture(int32_t textureIndex) {
+        auto cached = _textures.find(textureIndex);
+        if (cached != _textures.end()) {
+            return cached->second;
+        }
+        std::optional<ContentHash128> result;
+        if (const CesiumGltf::Texture* texture = CesiumGltf::Model::getSafe(&_model->textures, textureIndex)) {
+            ContentHasher128 hasher(TEXTURE_SEED);
+            bool identified = true;
+            if (texture->sampler >= 0) {
+                auto samplerHash = sampler(texture->sampler);
+                identified = samplerHash.has_value();
+                if (samplerHash) hasher.updateValue(*samplerHash);
+            } else {
+                hasher.updateValue(ContentHash128{}); // Default sampler
+            }
+            if (identified && texture->source >= 0) {
+                auto imageHash = image(texture->source);
+                identified = imageHash.has_value();
+                if (imageHash) hasher.updateValue(*imageHash);
+            } else {
+                hasher.updateValue(ContentHash128{});
+            }
+            if (identified && hashExtensible(*texture, hasher)) {
+                result = hasher.finalize();
+            }
+        }
+        _textures.emplace(textureIndex, result);
+        return result;
+    }
+
+    std::optional<ContentHash128> ResourceContentHasher::material(int32_t materialIndex) {
+        auto cached = _materials.find(materialIndex);
+        if (cached != _materials.end()) {
+            return cached->second;
+        }
+        std::optional<ContentHash128> result;
+        if (const CesiumGltf::Material* material = CesiumGltf::Model::getSafe(&_model->materials, materialIndex)) {
+            ContentHasher128 hasher(MATERIAL_SEED);
+            bool identified = true;
+
+            // Presence flag, texture content, texCoord and extensions of one texture slot.
+            auto hashTextureInfo = [&](const CesiumGltf::TextureInfo* info) {
+                hasher.updateValue(static_cast<uint8_t>(info ? 1 : 0));
+                if (!info || !identified) {
+                    return;
+                }
+                auto textureHash = info->index >= 0 ? texture(info->index) : std::optional<ContentHash128>(ContentHash128{});
+                if (!textureHash || !hashExtensible(*info, hasher)) {
+                    identified = false;
+                    return;
+                }
+                hasher.updateValue(*textureHash);
+                hasher.updateValue(info->texCoord);
+            };
+
+            const auto& pbr = material->pbrMetallicRoughness;
+            hasher.updateValue(static_cast<uint8_t>(pbr ? 1 : 0));
+            if (pbr) {
+                hashDoubles(pbr->baseColorFactor, hasher);
+                hasher.updateValue(pbr->metallicFactor);
+                hasher.updateValue(pbr->roughnessFactor);
+                hashTextureInfo(pbr->baseColorTexture ? &*pbr->baseColorTexture : nullptr);
+                hashTextureInfo(pbr->metallicRoughnessTexture ? &*pbr->metallicRoughnessTexture : nullptr);
+                identified = identified && hashExtensible(*pbr, hasher);
+            }
+            hashTextureInfo(material->normalTexture ? &*material->normalTexture : nullptr);
+            if (material->normalTexture) hasher.updateValue(material->normalTexture->scale);
+            hashTextureInfo(material->occlusionTexture ? &*material->occlusionTexture : nullptr);
+            if (material->occlusionTexture) hasher.updateValue(material->occlusionTexture->strength);
+            hashTextureInfo(material->emissiveTexture ? &*material->emissiveTexture : nullptr);
+            hashDoubles(material->emissiveFactor, hasher);
+            hasher.updateString(material->alphaMode);
+            hasher.updateValue(material->alphaCutoff);
+            hasher.updateValue(material->doubleSided);
+
+            if (identified && hashExtensible(*material, hasher)) {
+                result = hasher.finalize();
+            }
+        }
+        _materials.emplace(materialIndex, result);
+        return result;
+    }
+
+    std::vector<std::optional<ContentHash128>> computeMaterialContentHashes(const CesiumGltf::Model& model) {
+        ResourceContentHasher hasher(model);
+        std::vector<std::optional<ContentHash128>> hashes(model.materials.size());
+        for (size_t i = 0; i < model.materials.size(); ++i) {
+            hashes[i] = hasher.material(static_cast<int32_t>(i));
+        }
+        return hashes;
+    }
+
+} // namespace GltfInstancing
@@ -0,0 +1,52 @@
+﻿#ifndef RESOURCE_HASHING_H
+#define RESOURCE_HASHING_H
+
+#include "content_hash.h"
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+
+namespace GltfInstancing {
+
+    // Content hashes of glTF resources that do not depend on resource indices or on the model a
+    // resource lives in: two files that embed the same JPEG, sampler or material produce equal
+    // hashes, which lets the writer store the resource once and the detector compare materials
+    // across files. Names are ignored; extras and known extensions are included.
+    // std::nullopt means the resource cannot be identified by content (invalid index, missing
+    // data, or an extension whose payload is not understood) and must not be deduplicated.
+    // Results are memoized per index, so one hasher per source model should be reused.
+    class ResourceContentHasher {
+    public:
+        explicit ResourceContentHasher(const CesiumGltf::Model& model);
+
+        // Points the hasher at a reloaded copy of the same file (ModelCache); memoized hashes stay valid.
+        void rebind(const CesiumGltf::Model& model) { _model = &model; }
+
+        // Encoded bytes of a bufferView image, otherwise URI + mimeType, otherwise decoded pixels.
+        std::optional<ContentHash128> image(int32_t imageIndex);
+        std::optional<ContentHash128> sampler(int32_t samplerIndex);
+        // Sampler and image content (an absent sampler hashes as the glTF default).
+        std::optional<ContentHash128> texture(int32_t textureIndex);
+        // Every material property; texture references are replaced by texture content hashes.
+        std::optional<ContentHash128> material(int32_t materialIndex);
+        // Raw bytes of the view plus byteStride and target.
+        std::optional<ContentHash128> bufferView(int32_t bufferViewIndex);
+
+    private:
+        const CesiumGltf::Model* _model;
+        std::unordered_map<int32_t, std::optional<ContentHash128>> _images;
+        std::unordered_map<int32_t, std::optional<ContentHash128>> _samplers;
+        std::unordered_map<int32_t, std::optional<ContentHash128>> _textures;
+        std::unordered_map<int32_t, std::optional<ContentHash128>> _materials;
+        std::unordered_map<int32_t, std::optional<ContentHash128>> _bufferViews;
+    };
+
+    // Material content hash of every material of the model, indexed like model.materials.
+    std::vector<std::optional<ContentHash128>> computeMaterialContentHashes(const CesiumGltf::Model& model);
+
+} // namespace GltfInstancing
+
+#endif // RESOURCE_HASHING_H
@@ -0,0 +1,374 @@
+﻿#include "signature_cache.h"
+#include "mapped_file.h"
+#include "utilities.h" // For logging
+#include "metrics.h"
+
+#include <CesiumGltf/ExtensionExtMeshGpuInstancing.h>
+
+#include <any>
+#include <cstring> // For std::memcpy
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace GltfInstancing {
+
+    // File layout: "GISC", u32 format version, u64 settings key, u64 record count, then per record
+    //   string fileHash, u64 nodeCount, u64 meshCount, u64 gpuInstanceCount,
+    //   u64 mesh count, per mesh: string name, u64 signature, u8 poseCanonicalized,
+    //     16 f64 canonicalToLocal, 16 f64 localToCanonical, u64 box count, 6 f64 (min, max) per box,
+    //   u64 placement count, per placement: i32 nodeIndex, i32 meshIndex, 16 f64 worldMatrix.
+    // Strings are a u64 length followed by the bytes; matrices are column-major.
+    namespace {
+        constexpr char kMagic[4] = { 'G', 'I', 'S', 'C' };
+        constexpr uint32_t kFormatVersion = 1;
+
+        class RecordWriter {
+        public:
+            explicit RecordWriter(std::ofstream& out) : _out(out) {}
+
+            template <typename T>
+            void value(const T& v) {
+                static_assert(std::is_trivially_copyable<T>::value, "RecordWriter::value requires a trivially copyable type");
+                _out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+            }
+            void string(const std::string& s) {
+                value(static_cast<uint64_t>(s.size()));
+                _out.write(s.data(), static_cast<std::streamsize>(s.size()));
+            }
+            void matrix(const glm::dmat4& m) {
+                for (int column = 0; column < 4; ++column) {
+                    for (int row = 0; row < 4; ++row) {
+                        value(m[column][row]);
+                    }
+                }
+            }
+            void vector(const glm::dvec3& v) {
+                value(v.x);
+                value(v.y);
+                value(v.z);
+            }
+
+        private:
+            std::ofstream& _out;
+        };
+
+        // Bounds-checked reads over the mapped file; any overrun marks the reader as failed.
+        class RecordReader {
+        public:
+            RecordReader(const std::byte* data, size_t size) : _data(data), _size(size) {}
+
+            bool ok() const { return _ok; }
+            bool atEnd() const { return _offset == _size; }
+
+            template <typename T>
+            T value() {
+                static_assert(std::is_trivially_copyable<T>::value, "RecordReader::value requires a trivially copyable type");
+                T v{};
+                if (!take(sizeof(T))) {
+                    return v;
+                }
+                std::memcpy(&v, _data + _offset - sizeof(T), sizeof(T));
+                return v;
+            }
+            std::string string() {
+                const uint64_t length = value<uint64_t>();
+                if (!take(length)) {
+                    return std::string();
+                }
+                return std::string(reinterpret_cast<const char*>(_data + _offset - length), static_cast<size_t>(length));
+            }
+            glm::dmat4 matrix() {
+                glm::dmat4 m(1.0);
+                for (int column = 0; column < 4; ++column) {
+                    for (int row = 0; row < 4; ++row) {
+                        m[column][row] = value<double>();
+                    }
+                }
+                return m;
+            }
+            glm::dvec3 vector() {
+                glm::dvec3 v;
+                v.x = value<double>();
+                v.y = value<double>();
+                v.z = value<double>();
+                return v;
+            }
+            // Element count that cannot exceed the remaining bytes (elementSize bytes at least each).
+            uint64_t count(size_t elementSize) {
+                const uint64_t n = value<uint64_t>();
+                if (_ok && n > (_size - _offset) / elementSize) {
+                    _ok = false;
+                    return 0;
+                }
+                return n;
+            }
+
+        private:
+            bool take(uint64_t byteCount) {
+                if (!_ok || byteCount > _size - _offset) {
+                    _ok = false;
+                    return false;
+                }
+                _offset += static_cast<size_t>(byteCount);
+                return true;
+            }
+
+            const std::byte* _data;
+            size_t _size;
+            size_t _offset = 0;
+            bool _ok = true;
+        };
+    } // namespace
+
+    ModelStatistics computeModelStatistics(const CesiumGltf::Model& model) {
+        ModelStatistics statistics;
+        statistics.nodeCount = model.nodes.size();
+        statistics.meshCount = model.meshes.size();
+        for (const auto& node : model.nodes) {
+            auto it = node.extensions.find("EXT_mesh_gpu_instancing");
+            if (it == node.extensions.end()) {
+                continue;
+            }
+            const CesiumGltf::ExtensionExtMeshGpuInstancing* pInstancing = std::any_cast<CesiumGltf::ExtensionExtMeshGpuInstancing>(&it->second);
+            if (!pInstancing) {
+                continue;
+            }
+            auto attributeIt = pInstancing->attributes.find("TRANSLATION");
+            if (attributeIt != pInstancing->attributes.end()) {
+                const int32_t accessorIndex = attributeIt->second;
+                if (accessorIndex >= 0 && static_cast<size_t>(accessorIndex) < model.accessors.size()) {
+                    statistics.gpuInstanceCount += static_cast<size_t>(model.accessors[static_cast<size_t>(accessorIndex)].count);
+                }
+            }
+        }
+        return statistics;
+    }
+
+    SignatureCache::SignatureCache(std::filesystem::path path, uint64_t settingsKey)
+        : _path(std::move(path)), _settingsKey(settingsKey) {
+        std::error_code ec;
+        if (!std::filesystem::exists(_path, ec)) {
+            logMessage("No signature cache at " + _path.string() + "; every file will be indexed.");
+            return;
+        }
+        if (!load()) {
+            _entries.clear();
+            _loadedRecordCount = 0;
+        }
+    }
+
+    SignatureCache::SignatureCache(uint64_t settingsKey)
+        : _settingsKey(settingsKey) {}
+
+    bool SignatureCache::load() {
+        bool settingsMismatch = false;
+        if (!readFile(_path, _entries, settingsMismatch)) {
+            if (settingsMismatch) {
+                logMessage("Signature cache was written with other detection settings; every file will be indexed again.");
+            }
+            return false;
+        }
+        _loadedRecordCount = _entries.size();
+        logMessage("Loaded signature cache with " + std::to_string(_loadedRecordCount) + " file record(s): " + _path.string());
+        return true;
+    }
+
+    bool SignatureCache::mergeFrom(const std::filesystem::path& path) {
+        std::unordered_map<std::string, Entry> entries;
+        bool settingsMismatch = false;
+        if (!readFile(path, entries, settingsMismatch)) {
+            if (settingsMismatch) {
+                logWarning("Signature records were written with other detection settings, ignoring them: " + path.string());
+            }
+            return false;
+        }
+        size_t addedCount = 0;
+        for (auto& [fileHash, entry] : entries) {
+            addedCount += _entries.emplace(fileHash, std::move(entry)).second ? 1 : 0;
+        }
+        _loadedRecordCount += addedCount;
+        logMessage("Merged " + std::to_string(addedCount) + " of " + std::to_string(entries.size()) + " file record(s) from: " + path.string());
+        return true;
+    }
+
+    bool SignatureCache::readFile(const std::filesystem::path& path, std::unordered_map<std::string, Entry>& entries, bool& settingsMismatch) const {
+        settingsMismatch = false;
+        std::optional<MappedFile> mappedFile = MappedFile::open(path);
+        if (!mappedFile) {
+            logWarning("Cannot open signature cache, ignoring it: " + path.string());
+            return false;
+        }
+        RecordReader reader(mappedFile->data(), mappedFile->size());
+        char magic[4] = {};
+        for (char& c : magic) {
+            c = reader.value<char>();
+        }
+        const uint32_t version = reader.value<uint32_t>();
+        const uint64_t settingsKey = reader.value<uint64_t>();
+        if (!reader.ok() || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kFormatVersion) {
+            logWarning("Signature cache has an unknown format, ignoring it: " + path.string());
+            return false;
+        }
+        if (settingsKey != _settingsKey) {
+            settingsMismatch = true;
+            return false;
+        }
+
+        const uint64_t recordCount = reader.count(8);
+        for (uint64_t r = 0; r < recordCount && reader.ok(); ++r) {
+            const std::string fileHash = reader.string();
+            SignatureCacheRecord record;
+            record.statistics.nodeCount = static_cast<size_t>(reader.value<uint64_t>());
+            record.statistics.meshCount = static_cast<size_t>(reader.value<uint64_t>());
+            record.statistics.gpuInstanceCount = static_cast<size_t>(reader.value<uint64_t>());
+
+            record.meshes.resize(static_cast<size_t>(reader.count(8 + 8 + 1 + 256 + 8)));
+            for (CachedMeshSignature& mesh : record.meshes) {
+                mesh.meshName = reader.string();
+                mesh.signature = reader.value<uint64_t>();
+                mesh.poseCanonicalized = reader.value<uint8_t>() != 0;
+                mesh.canonicalToLocal = reader.matrix();
+                mesh.localToCanonical = reader.matrix();
+                mesh.primitiveBoundingBoxes.resize(static_cast<size_t>(reader.count(48)));
+                for (BoundingBox& box : mesh.primitiveBoundingBoxes) {
+                    box.min = reader.vector();
+                    box.max = reader.vector();
+                }
+            }
+
+            record.placements.resize(static_cast<size_t>(reader.count(4 + 4 + 128)));
+            for (CachedMeshPlacement& placement : record.placements) {
+                placement.nodeIndex = reader.value<int32_t>();
+                placement.meshIndex = reader.value<int32_t>();
+                placement.worldMatrix = reader.matrix();
+            }
+            entries[fileHash].record = std::move(record);
+        }
+        if (!reader.ok() || !reader.atEnd()) {
+            logWarning("Signature cache is truncated or corrupt, ignoring it: " + path.string());
+            return false;
+        }
+        return true;
+    }
+
+    const SignatureCacheRecord* SignatureCache::find(const std::string& fileHash) {
+        auto it = _entries.find(fileHash);
+        if (it == _entries.end()) {
+            return nullptr;
+        }
+        it->second.used = true;
+        ++_hitCount;
+        countMetric(MetricCounter::SignatureCacheHits);
+        return &it->second.record;
+    }
+
+    const SignatureCacheRecord& SignatureCache::store(const std::string& fileHash, SignatureCacheRecord record) {
+        Entry& entry = _entries[fileHash];
+        entry.record = std::move(record);
+        entry.used = true;
+        return entry.record;
+    }
+
+    bool SignatureCache::save(bool keepUnusedRecords) const {
+        if (_path.empty()) {
+            logError("Signature cache has no file to be saved to.");
+            return false;
+        }
+        // Written next to the final path and renamed over it, so an interrupted run leaves the
+        // previous cache intact.
+        std::filesystem::path temporaryPath = _path;
+        temporaryPath += ".tmp";
+        {
+            std::ofstream out(temporaryPath, std::ios::binary);
+            if (!out) {
+                logError("Failed to open signature cache for writing: " + temporaryPath.string());
+                return false;
+            }
+            RecordWriter writer(out);
+            out.write(kMagic, sizeof(kMagic));
+            writer.value(kFormatVersion);
+            writer.value(_settingsKey);
+            uint64_t recordCount = 0;
+            for (const auto& [fileHash, entry] : _entries) {
+                recordCount += (entry.used || keepUnusedRecords) ? 1 : 0;
+            }
+            writer.value(recordCount);
+
+            for (const auto& [fileHash, entry] : _entries) {
+                if (!entry.used && !keepUnusedRecords) {
+                    continue;
+                }
+                const SignatureCacheRecord& record = entry.record;
+                writer.string(fileHash);
+                writer.value(static_cast<uint64_t>(record.statistics.nodeCount));
+                writer.value(static_cast<uint64_t>(record.statistics.meshCount));
+                writer.value(static_cast<uint64_t>(record.statistics.gpuInstanceCount));
+
+                writer.value(static_cast<uint64_t>(record.meshes.size()));
+                for (const CachedMeshSignature& mesh : record.meshes) {
+                    writer.string(mesh.meshName);
+                    writer.value(mesh.signature);
+                    writer.value(static_cast<uint8_t>(mesh.poseCanonicalized ? 1 : 0));
+                    writer.matrix(mesh.canonicalToLocal);
+                    writer.matrix(mesh.localToCanonical);
+                    writer.value(static_cast<uint64_t>(mesh.primitiveBoundingBoxes.size()));
+                    for (const BoundingBox& box : mesh.primitiveBoundingBoxes) {
+                        writer.vector(box.min);
+                        writer.vector(box.max);
+                    }
+                }
+
+                writer.value(static_cast<uint64_t>(record.placements.size()));
+                for (const CachedMeshPlacement& placement : record.placements) {
+                    writer.value(placement.nodeIndex);
+                    writer.value(placement.meshIndex);
+                    writer.matrix(placement.worldMatrix);
+                }
+            }
+            out.close();
+            if (!out) {
+                logError("Failed to write signature cache: " + temporaryPath.string());
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temporaryPath, _path, ec);
+        if (ec) {
+            logError("Failed to replace signature cache " + _path.string() + ". Error: " + ec.message());
+            return false;
+        }
+        return true;
+    }
+
+    SignatureCacheStore::SignatureCacheStore(std::filesystem::path directory)
+        : _directory(std::move(directory)) {}
+
+    void SignatureCacheStore::withCache(uint64_t settingsKey, const std::function<void(SignatureCache&)>& fn) {
+        Slot* slot = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::unique_ptr<Slot>& entry = _slots[settingsKey];
+            if (!entry) {
+                entry = std::make_unique<Slot>();
+            }
+            slot = entry.get(); // Slots are never removed
+        }
+
+        std::lock_guard<std::mutex> slotLock(slot->mutex);
+        if (!slot->cache) {
+            std::ostringstream fileName;
+            fileName << "signature_cache_" << std::hex << std::setw(16) << std::setfill('0') << settingsKey << ".bin";
+            slot->cache = std::make_unique<SignatureCache>(_directory / fileName.str(), settingsKey);
+        }
+        slot->cache->resetHitCount();
+        fn(*slot->cache);
+        slot->cache->save(true /* keepUnusedRecords */);
+    }
+
+} // namespace GltfInstancing
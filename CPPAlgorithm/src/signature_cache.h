@@ -0,0 +1,132 @@
+﻿#ifndef SIGNATURE_CACHE_H
+#define SIGNATURE_CACHE_H
+
+#include "utilities.h" // For BoundingBox
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <CesiumGltf/Model.h>
+
+#include <glm/glm.hpp>
+
+namespace GltfInstancing {
+
+    // Input statistics of one file, kept with its cache record so cached files need not be loaded.
+    struct ModelStatistics {
+        size_t nodeCount = 0;
+        size_t meshCount = 0;
+        size_t gpuInstanceCount = 0; // EXT_mesh_gpu_instancing instances (TRANSLATION counts)
+    };
+
+    ModelStatistics computeModelStatistics(const CesiumGltf::Model& model);
+
+    // Detection index of one mesh, as computed by InstancingDetector's signature phase.
+    struct CachedMeshSignature {
+        std::string meshName;
+        uint64_t signature = 0; // 0 for meshes no node references
+        bool poseCanonicalized = false;
+        glm::dmat4 canonicalToLocal{ 1.0 };
+        glm::dmat4 localToCanonical{ 1.0 };
+        std::vector<BoundingBox> primitiveBoundingBoxes; // Tolerance mode only
+    };
+
+    // One drawn copy of a mesh: a mesh node of the default scene, or one EXT_mesh_gpu_instancing
+    // instance of it, in scene traversal order.
+    struct CachedMeshPlacement {
+        int32_t nodeIndex = -1;
+        int32_t meshIndex = -1;
+        glm::dmat4 worldMatrix{ 1.0 };
+    };
+
+    // Everything out-of-core detection takes from a file: with it, the file is not parsed.
+    struct SignatureCacheRecord {
+        ModelStatistics statistics;
+        std::vector<CachedMeshSignature> meshes; // Indexed like model.meshes
+        std::vector<CachedMeshPlacement> placements;
+    };
+
+    // On-disk map from file content hash (LoadedGltfModel::fileHash) to SignatureCacheRecord,
+    // so re-runs over mostly unchanged inputs only parse the files that changed.
+    // The file is a little-endian binary (see signature_cache.cpp) read through a memory mapping.
+    // settingsKey identifies the detection settings the signatures depend on; a cache written
+    // with other settings or another format version is ignored as a whole.
+    class SignatureCache {
+    public:
+        SignatureCache(std::filesystem::path path, uint64_t settingsKey);
+
+        // An empty cache without a backing file, filled by store() and mergeFrom() (e.g. the
+        // merged shard indexes of a sharded run); save() is not available.
+        explicit SignatureCache(uint64_t settingsKey);
+
+        // The record of the file with this content hash, or nullptr. Records are never moved, so
+        // the pointer stays valid for the lifetime of the cache.
+        const SignatureCacheRecord* find(const std::string& fileHash);
+
+        const SignatureCacheRecord& store(const std::string& fileHash, SignatureCacheRecord record);
+
+        // Rewrites the cache file with the records found or stored during this run; records of
+        // files that no longer exist are dropped unless keepUnusedRecords is set (a cache shared
+        // by service mode jobs over different inputs). Returns false (logged) on I/O errors.
+        bool save(bool keepUnusedRecords = false) const;
+
+        // Adds the records of another cache file written with the same settings, such as the
+        // shard index of one build agent; records already present are kept. Returns false
+        // (logged) if the file is unreadable, corrupt or was written with other settings.
+        bool mergeFrom(const std::filesystem::path& path);
+
+        size_t loadedRecordCount() const { return _loadedRecordCount; }
+        size_t hitCount() const { return _hitCount; }
+        void resetHitCount() { _hitCount = 0; }
+
+    private:
+        struct Entry {
+            SignatureCacheRecord record;
+            bool used = false;
+        };
+
+        bool load();
+
+        // Reads the records of a cache file into entries. Returns false (logged) for unreadable
+        // or corrupt files, and with settingsMismatch set for files written with other settings.
+        bool readFile(const std::filesystem::path& path, std::unordered_map<std::string, Entry>& entries, bool& settingsMismatch) const;
+
+        std::filesystem::path _path;
+        uint64_t _settingsKey;
+        std::unordered_map<std::string, Entry> _entries;
+        size_t _loadedRecordCount = 0;
+        size_t _hitCount = 0;
+    };
+
+    // Signature caches kept in memory across service mode jobs, one per detection settings key,
+    // each backed by signature_cache_<key>.bin in a shared directory. Jobs whose settings match
+    // reuse each other's records even though they write to different output directories.
+    class SignatureCacheStore {
+    public:
+        explicit SignatureCacheStore(std::filesystem::path directory);
+
+        // Runs fn with exclusive use of the cache for settingsKey (loaded on first use; jobs
+        // with the same settings take turns), then saves it with the records of all jobs.
+        void withCache(uint64_t settingsKey, const std::function<void(SignatureCache&)>& fn);
+
+    private:
+        struct Slot {
+            std::mutex mutex;
+            std::unique_ptr<SignatureCache> cache;
+        };
+
+        std::filesystem::path _directory;
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<Slot>> _slots;
+    };
+
+} // namespace GltfInstancing
+
+#endif // SIGNATURE_CACHE_H
@@ -0,0 +1,214 @@
+﻿#include "spatial_tiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <utility>
+
+namespace GltfInstancing {
+
+    namespace {
+        constexpr uint32_t kNonInstanced = std::numeric_limits<uint32_t>::max();
+        constexpr int kMortonBitsPerAxis = 21;
+
+        // A non-instanced mesh (group == kNonInstanced, index into nonInstancedMeshes) or one
+        // instance (index into instancedGroups[group].instances).
+        struct Placement {
+            uint64_t code = 0;
+            uint32_t group = kNonInstanced;
+            uint32_t index = 0;
+            BoundingBox bounds;
+        };
+
+        // Spreads the low 21 bits of v so that two zero bits follow each bit.
+        uint64_t spreadBitsBy3(uint64_t v) {
+            v &= 0x1fffff;
+            v = (v | v << 32) & 0x1f00000000ffffULL;
+            v = (v | v << 16) & 0x1f0000ff0000ffULL;
+            v = (v | v << 8) & 0x100f00f00f00f00fULL;
+            v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+            v = (v | v << 2) & 0x1249249249249249ULL;
+            return v;
+        }
+
+        // Spreads the low 21 bits of v so that one zero bit follows each bit.
+        uint64_t spreadBitsBy2(uint64_t v) {
+            v &= 0x1fffff;
+            v = (v | v << 16) & 0x0000ffff0000ffffULL;
+            v = (v | v << 8) & 0x00ff00ff00ff00ffULL;
+            v = (v | v << 4) & 0x0f0f0f0f0f0f0f0fULL;
+            v = (v | v << 2) & 0x3333333333333333ULL;
+            v = (v | v << 1) & 0x5555555555555555ULL;
+            return v;
+        }
+
+        uint64_t quantizeAxis(double value, double minimum, double extent) {
+            const double maxCell = static_cast<double>((1u << kMortonBitsPerAxis) - 1);
+            if (!(extent > 0.0)) {
+                return 0;
+            }
+            const double t = std::min(1.0, std::max(0.0, (value - minimum) / extent));
+            return static_cast<uint64_t>(t * maxCell);
+        }
+
+        struct TreeBuildContext {
+            const InstancingDetectionResult& detectionResult;
+            const SpatialTilingOptions& options;
+            const std::vector<Placement>& placements;
+            SpatialTileTree& tree;
+            int bitsPerLevel;
+        };
+
+        void fillLeafContent(const TreeBuildContext& context, size_t begin, size_t end, SpatialTile& tile) {
+            std::map<uint32_t, size_t> groupSlots; // source group -> index in tile.content.instancedGroups
+            for (size_t i = begin; i < end; ++i) {
+                const Placement& placement = context.placements[i];
+                tile.bounds.merge(placement.bounds);
+                if (placement.group == kNonInstanced) {
+                    tile.content.nonInstancedMeshes.push_back(context.detectionResult.nonInstancedMeshes[placement.index]);
+                    continue;
+                }
+                const InstancedMeshGroup& source = context.detectionResult.instancedGroups[placement.group];
+                auto [slot, inserted] = groupSlots.try_emplace(placement.group, tile.content.instancedGroups.size());
+                if (inserted) {
+                    InstancedMeshGroup& group = tile.content.instancedGroups.emplace_back();
+                    group.representativeGltfModelIndex = source.representativeGltfModelIndex;
+                    group.representativeMeshIndexInModel = source.representativeMeshIndexInModel;
+                    group.representativeMeshName = source.representativeMeshName;
+                    group.meshSignature = source.meshSignature;
+                    group.representativePrimitiveBoundingBoxes = source.representativePrimitiveBoundingBoxes;
+                    group.representativeLocalToCanonical = source.representativeLocalToCanonical;
+                }
+                tile.content.instancedGroups[slot->second].instances.push_back(source.instances[placement.index]);
+            }
+        }
+
+        // Builds the tile for placements [begin, end), whose codes agree on the first codeLevel
+        // digits. Returns its index in context.tree.tiles.
+        size_t buildTile(const TreeBuildContext& context, size_t begin, size_t end, int codeLevel, int level, const std::string& address) {
+            const size_t tileIndex = context.tree.tiles.size();
+            context.tree.tiles.emplace_back();
+            context.tree.tiles[tileIndex].level = level;
+            context.tree.tiles[tileIndex].address = address;
+
+            const uint64_t digitMask = (uint64_t(1) << context.bitsPerLevel) - 1;
+            std::vector<std::pair<size_t, size_t>> childRanges;
+            if (end - begin > context.options.maxItemsPerTile && level < context.options.maxDepth) {
+                // Descend until the placements differ in a digit (no single-child levels).
+                for (int nextLevel = codeLevel + 1; nextLevel <= kMortonBitsPerAxis && childRanges.size() < 2; ++nextLevel) {
+                    const int shift = context.bitsPerLevel * (kMortonBitsPerAxis - nextLevel);
+                    childRanges.clear();
+                    size_t rangeBegin = begin;
+                    for (size_t i = begin + 1; i <= end; ++i) {
+                        if (i == end || ((context.placements[i].code >> shift) & digitMask) != ((context.placements[rangeBegin].code >> shift) & digitMask)) {
+                            childRanges.emplace_back(rangeBegin, i);
+                            rangeBegin = i;
+                        }
+                    }
+                    codeLevel = nextLevel;
+                }
+            }
+
+            if (childRanges.size() < 2) {
+                fillLeafContent(context, begin, end, context.tree.tiles[tileIndex]);
+                return tileIndex;
+            }
+
+            for (size_t child = 0; child < childRanges.size(); ++child) {
+                // tiles may reallocate while the children are built, so index instead of holding a reference
+                size_t childIndex = buildTile(context, childRanges[child].first, childRanges[child].second,
+                    codeLevel, level + 1, address + "_" + std::to_string(child));
+                context.tree.tiles[tileIndex].children.push_back(childIndex);
+                context.tree.tiles[tileIndex].bounds.merge(context.tree.tiles[childIndex].bounds);
+                context.tree.tiles[tileIndex].height = std::max(context.tree.tiles[tileIndex].height, context.tree.tiles[childIndex].height + 1);
+            }
+            return tileIndex;
+        }
+    }
+
+    SpatialTileTree buildSpatialTileTree(
+        const std::vector<LoadedGltfModel>& originalModels,
+        const InstancingDetectionResult& detectionResult,
+        const SpatialTilingOptions& options) {
+        SpatialTileTree tree;
+
+        std::map<int, const CesiumGltf::Model*> modelsById;
+        for (const auto& loadedModel : originalModels) {
+            modelsById[loadedModel.uniqueId] = &loadedModel.model;
+        }
+        std::map<std::pair<int, int>, BoundingBox> meshBoxes; // (modelId, meshIndex) -> local bounds
+        auto meshBox = [&](int modelId, int meshIndex) -> const BoundingBox& {
+            auto [it, inserted] = meshBoxes.try_emplace(std::make_pair(modelId, meshIndex));
+            if (inserted) {
+                auto model = modelsById.find(modelId);
+                if (model != modelsById.end() && meshIndex >= 0 && static_cast<size_t>(meshIndex) < model->second->meshes.size()) {
+                    it->second = getMeshBoundingBox(*model->second, model->second->meshes[meshIndex]);
+                }
+            }
+            return it->second;
+        };
+        // Placements without readable bounds still need a tile: they become a point at their origin.
+        auto placementBounds = [](const BoundingBox& localBox, const glm::dmat4& worldMatrix) {
+            BoundingBox box = localBox;
+            if (box.isValid()) {
+                box.transform(worldMatrix);
+            } else {
+                box.min = box.max = glm::dvec3(worldMatrix[3]);
+            }
+            return box;
+        };
+
+        std::vector<Placement> placements;
+        for (size_t i = 0; i < detectionResult.nonInstancedMeshes.size(); ++i) {
+            const NonInstancedMeshInfo& mesh = detectionResult.nonInstancedMeshes[i];
+            Placement& placement = placements.emplace_back();
+            placement.index = static_cast<uint32_t>(i);
+            placement.bounds = placementBounds(meshBox(mesh.originalGltfModelIndex, mesh.originalMeshIndexInModel), mesh.transform.toMat4());
+        }
+        for (size_t g = 0; g < detectionResult.instancedGroups.size(); ++g) {
+            const InstancedMeshGroup& group = detectionResult.instancedGroups[g];
+            const BoundingBox& localBox = meshBox(group.representativeGltfModelIndex, group.representativeMeshIndexInModel);
+            for (size_t i = 0; i < group.instances.size(); ++i) {
+                Placement& placement = placements.emplace_back();
+                placement.group = static_cast<uint32_t>(g);
+                placement.index = static_cast<uint32_t>(i);
+                placement.bounds = placementBounds(localBox, group.instances[i].worldMatrix);
+            }
+        }
+        if (placements.empty()) {
+            return tree;
+        }
+
+        BoundingBox sceneBox;
+        for (const Placement& placement : placements) {
+            sceneBox.merge(placement.bounds);
+        }
+        const glm::dvec3 extent = sceneBox.max - sceneBox.min;
+        for (Placement& placement : placements) {
+            const glm::dvec3 center = (placement.bounds.min + placement.bounds.max) * 0.5;
+            const uint64_t x = quantizeAxis(center.x, sceneBox.min.x, extent.x);
+            const uint64_t y = quantizeAxis(center.y, sceneBox.min.y, extent.y);
+            const uint64_t z = quantizeAxis(center.z, sceneBox.min.z, extent.z);
+            placement.code = options.quadtree
+                ? (spreadBitsBy2(x) << 1) | spreadBitsBy2(z)
+                : (spreadBitsBy3(x) << 2) | (spreadBitsBy3(y) << 1) | spreadBitsBy3(z);
+        }
+        std::stable_sort(placements.begin(), placements.end(),
+            [](const Placement& a, const Placement& b) { return a.code < b.code; });
+
+        TreeBuildContext context{ detectionResult, options, placements, tree, options.quadtree ? 2 : 3 };
+        buildTile(context, 0, placements.size(), 0, 0, "0");
+
+        size_t leafCount = 0;
+        int maxLevel = 0;
+        for (const SpatialTile& tile : tree.tiles) {
+            leafCount += tile.isLeaf() ? 1 : 0;
+            maxLevel = std::max(maxLevel, tile.level);
+        }
+        logInfo("Spatial tiling: " + std::to_string(placements.size()) + " placements in " + std::to_string(leafCount) +
+                " leaf tiles (" + std::to_string(tree.tiles.size()) + " tiles, depth " + std::to_string(maxLevel) + ").");
+        return tree;
+    }
+
+} // namespace GltfInstancing
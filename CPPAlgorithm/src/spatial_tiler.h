@@ -0,0 +1,63 @@
+﻿#ifndef SPATIAL_TILER_H
+#define SPATIAL_TILER_H
+
+#include "utilities.h"
+#include "instancing_detector.h" // For InstancingDetectionResult
+#include "glb_reader.h"         // For LoadedGltfModel
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace GltfInstancing {
+
+    struct SpatialTilingOptions {
+        // Quadtree: split only the horizontal glTF axes (X and Z; Y is up), which suits flat
+        // city-scale scenes. Octree otherwise.
+        bool quadtree = false;
+        // A tile is split while it holds more mesh placements (non-instanced meshes plus
+        // instances) than this.
+        size_t maxItemsPerTile = 4096;
+        // Maximum tile level below the root (level 0).
+        int maxDepth = 10;
+    };
+
+    // One tile of the hierarchy. Only leaves have content; inner tiles group their children
+    // until generateTileLods gives them simplified content.
+    struct SpatialTile {
+        BoundingBox bounds;          // Tight: world bounds of every placement below this tile
+        int level = 0;
+        int height = 0;              // Levels below this tile: 0 for leaves
+        std::string address;         // Child digits from the root, e.g. "0_3_5" (root: "0")
+        std::vector<size_t> children; // Indices into SpatialTileTree::tiles
+        // Leaves: the placements of this tile in Morton order, split per instanced group (each
+        // group keeps its representative, with only this tile's instances).
+        InstancingDetectionResult content;
+        // World-space error of rendering this tile instead of its children. Set by
+        // generateTileLods; unset, the tileset writer derives one from the tile size.
+        std::optional<double> geometricError;
+
+        bool isLeaf() const { return children.empty(); }
+    };
+
+    struct SpatialTileTree {
+        std::vector<SpatialTile> tiles; // tiles[0] is the root; empty if there was nothing to tile
+        // Inner tiles hold a simplified copy of their subtree (REPLACE refinement) instead of
+        // no content (ADD refinement).
+        bool replaceRefinement = false;
+    };
+
+    // Partitions every placement of detectionResult (non-instanced meshes and the individual
+    // instances of each group) by the Morton code of its world bounds centre. Placements are
+    // sorted by code once; each tile is then a contiguous range, split by the next 3 (octree) or
+    // 2 (quadtree) code bits. Splits that would leave a single child are skipped so the
+    // hierarchy has no empty levels.
+    SpatialTileTree buildSpatialTileTree(
+        const std::vector<LoadedGltfModel>& originalModels,
+        const InstancingDetectionResult& detectionResult,
+        const SpatialTilingOptions& options);
+
+} // namespace GltfInstancing
+
+#endif // SPATIAL_TILER_H
@@ -11,6 +11,8 @@
 #include <Cesium3DTiles/Content.h>
 #include <CesiumJsonWriter/JsonWriter.h> // For creating the JSON output
 #include <CesiumGltf/ExtensionExtMeshGpuInstancing.h>
+#include <CesiumGltf/AccessorView.h>
+#include <glm/gtc/type_precision.hpp> // For the normalized i16vec4 / i8vec4 rotations
 #include <fstream> // For writing the file
 
 namespace GltfInstancing {
@@ -56,6 +58,7 @@ namespace GltfInstancing {
             gltf = readGLBResult.model.value();
             return true;
         }
+        return false;
     }
 
     unsigned short byteSize_fromComponentType(unsigned short componentType)
@@ -106,6 +109,7 @@ namespace GltfInstancing {
         }
         outFile << jsonString;
         outFile.close();
+        return true;
     }
 
     void changeGLBToCesiumAxis(std::vector<double>& boundingBox) {
@@ -135,48 +139,76 @@ namespace GltfInstancing {
             return false;
         }
         //将extension中的instance部分转换成其特有的结构
-        ExtensionExtMeshGpuInstancing extInfo = std::any_cast<ExtensionExtMeshGpuInstancing>(it->second);
-        //获取每个矩阵对应的accessor索引
-        extInfo.attributes["TRANSLATION"];
-        extInfo.attributes["ROTATION"];
-        extInfo.attributes["SCALE"];
-        const Accessor& tran_acc = gltf.accessors[extInfo.attributes["TRANSLATION"]];
-        const BufferView& tran_bfv = gltf.bufferViews[tran_acc.bufferView];
-        const Buffer& tran_bff = gltf.buffers[tran_bfv.buffer];
-        const Accessor& rot_acc = gltf.accessors[extInfo.attributes["ROTATION"]];
-        const BufferView& rot_bfv = gltf.bufferViews[rot_acc.bufferView];
-        const Buffer& rot_bff = gltf.buffers[rot_bfv.buffer];
-        const Accessor& sca_acc = gltf.accessors[extInfo.attributes["SCALE"]];
-        const BufferView& sca_bfv = gltf.bufferViews[sca_acc.bufferView];
-        const Buffer& sca_bff = gltf.buffers[sca_bfv.buffer];
+        const ExtensionExtMeshGpuInstancing& extInfo = std::any_cast<const ExtensionExtMeshGpuInstancing&>(it->second);
+        //获取每个矩阵对应的accessor索引（SCALE 可省略，缺省为1；用find避免向attributes中插入空项）
+        auto accessorIndexOf = [&extInfo](const std::string& name) -> int32_t {
+            auto attribute = extInfo.attributes.find(name);
+            return attribute == extInfo.attributes.end() ? -1 : attribute->second;
+        };
+        const int32_t tranIndex = accessorIndexOf("TRANSLATION");
+        const int32_t rotIndex = accessorIndexOf("ROTATION");
+        const int32_t scaIndex = accessorIndexOf("SCALE");
+
+        AccessorView<glm::vec3> tranView(gltf, tranIndex);
+        AccessorView<glm::vec3> scaView(gltf, scaIndex);
+        const bool hasTranslation = tranView.status() == AccessorViewStatus::Valid;
+        const bool hasScale = scaView.status() == AccessorViewStatus::Valid;
+
+        //ROTATION 可为 FLOAT，或 KHR_mesh_quantization 的归一化 SHORT / BYTE
+        AccessorView<glm::vec4> rotFloatView;
+        AccessorView<glm::i16vec4> rotShortView;
+        AccessorView<glm::i8vec4> rotByteView;
+        int rotComponentType = -1;
+        if (rotIndex >= 0 && rotIndex < static_cast<int32_t>(gltf.accessors.size())) {
+            rotComponentType = gltf.accessors[rotIndex].componentType;
+            if (rotComponentType == Accessor::ComponentType::FLOAT) {
+                rotFloatView = AccessorView<glm::vec4>(gltf, rotIndex);
+            }
+            else if (rotComponentType == Accessor::ComponentType::SHORT) {
+                rotShortView = AccessorView<glm::i16vec4>(gltf, rotIndex);
+            }
+            else if (rotComponentType == Accessor::ComponentType::BYTE) {
+                rotByteView = AccessorView<glm::i8vec4>(gltf, rotIndex);
+            }
+        }
+        const bool hasRotation =
+            rotFloatView.status() == AccessorViewStatus::Valid ||
+            rotShortView.status() == AccessorViewStatus::Valid ||
+            rotByteView.status() == AccessorViewStatus::Valid;
+
+        int64_t instanceCount = -1;
+        for (int32_t index : { tranIndex, rotIndex, scaIndex }) {
+            if (index >= 0 && index < static_cast<int32_t>(gltf.accessors.size())) {
+                instanceCount = std::max(instanceCount, gltf.accessors[index].count);
+            }
+        }
+        if (instanceCount < 0 ||
+            (tranIndex >= 0 && (!hasTranslation || tranView.size() < instanceCount)) ||
+            (rotIndex >= 0 && !hasRotation) ||
+            (scaIndex >= 0 && (!hasScale || scaView.size() < instanceCount))) {
+            logError("Unreadable EXT_mesh_gpu_instancing attributes on node " + std::to_string(nodeIndex));
+            return false;
+        }
+
+        //归一化整数分量转换为 [-1, 1] 的浮点数
+        auto readRotation = [&](int64_t i) -> glm::vec4 {
+            if (rotFloatView.status() == AccessorViewStatus::Valid && i < rotFloatView.size()) {
+                return rotFloatView[i];
+            }
+            if (rotShortView.status() == AccessorViewStatus::Valid && i < rotShortView.size()) {
+                return glm::max(glm::vec4(rotShortView[i]) / 32767.0f, glm::vec4(-1.0f));
+            }
+            if (rotByteView.status() == AccessorViewStatus::Valid && i < rotByteView.size()) {
+                return glm::max(glm::vec4(rotByteView[i]) / 127.0f, glm::vec4(-1.0f));
+            }
+            return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        };
+
         //遍历该node的所有转移矩阵（循环数量代表实例的数量）
-        for (int i = 0; i < tran_acc.count; i++) {
-            glm::vec3 tran_Value, sca_Value;
-            glm::vec4 rot_Value;
-            int tran_distance = tran_acc.byteOffset + tran_bfv.byteOffset;
-            int rot_distance = rot_acc.byteOffset + rot_bfv.byteOffset;
-            int sca_distance = sca_acc.byteOffset + sca_bfv.byteOffset;
-            int tranByteSize = byteSize_fromComponentType(tran_acc.componentType);
-            int rotByteSize = byteSize_fromComponentType(rot_acc.componentType);
-            int scaByteSize = byteSize_fromComponentType(sca_acc.componentType);
-
-            //把byte数据转换成对应的类型
-            std::memcpy(&(tran_Value.x), tran_bff.cesium.data.data() + tran_distance, tranByteSize);
-            std::memcpy(&(tran_Value.y), tran_bff.cesium.data.data() + tran_distance + tranByteSize, tranByteSize);
-            std::memcpy(&(tran_Value.z), tran_bff.cesium.data.data() + tran_distance + tranByteSize * 2, tranByteSize);
-
-            std::memcpy(&(rot_Value.x), rot_bff.cesium.data.data() + rot_distance, rotByteSize);
-            std::memcpy(&(rot_Value.y), rot_bff.cesium.data.data() + rot_distance + rotByteSize, rotByteSize);
-            std::memcpy(&(rot_Value.z), rot_bff.cesium.data.data() + rot_distance + rotByteSize * 2, rotByteSize);
-            std::memcpy(&(rot_Value.w), rot_bff.cesium.data.data() + rot_distance + rotByteSize * 3, rotByteSize);
-
-            std::memcpy(&(sca_Value.x), sca_bff.cesium.data.data() + sca_distance, scaByteSize);
-            std::memcpy(&(sca_Value.y), sca_bff.cesium.data.data() + sca_distance + scaByteSize, scaByteSize);
-            std::memcpy(&(sca_Value.z), sca_bff.cesium.data.data() + sca_distance + scaByteSize * 2, scaByteSize);
-
-            tran_distance += byteSize_fromComponentType(tran_acc.componentType) * 3;
-            rot_distance += byteSize_fromComponentType(rot_acc.componentType) * 4;
-            sca_distance += byteSize_fromComponentType(sca_acc.componentType) * 3;
+        for (int64_t i = 0; i < instanceCount; i++) {
+            glm::vec3 tran_Value = hasTranslation ? tranView[i] : glm::vec3(0.0f);
+            glm::vec4 rot_Value = readRotation(i);
+            glm::vec3 sca_Value = hasScale ? scaView[i] : glm::vec3(1.0f);
 
             glm::mat4 T = glm::translate(glm::mat4(1.0), tran_Value);
             glm::mat4 R = glm::mat4_cast(glm::normalize(glm::make_quat(&rot_Value[0]))); // 四元数转矩阵
@@ -187,11 +219,54 @@ namespace GltfInstancing {
         return true;
     }
 
-    bool TilesetWriter::writeTileset(
-        const std::vector<std::filesystem::path>& uris,
-        const std::filesystem::path& tilesetOutputPath,
-        double geometricError) {
-        Tileset tileset;
+    //包围盒转为 tileset 的 box（中心 + 三个半轴），并从gltf的y向上坐标系转为cesium的z向上坐标系
+    std::vector<double> toCesiumBoundingVolumeBox(const BoundingBox& box) {
+        const std::array<double, 12> volume = box.toTilesetBoundingVolumeBox();
+        std::vector<double> boundingBox(volume.begin(), volume.end());
+        changeGLBToCesiumAxis(boundingBox);
+        return boundingBox;
+    }
+
+    //计算glb的世界包围盒：每个mesh的局部AABB只算一次，实例只变换AABB的8个角点，
+    //代价为 O(顶点数 + 实例数)，而不是 O(顶点数 × 实例数)
+    BoundingBox computeGltfBoundingBox(const Model& gltf) {
+        BoundingBox glbBox;
+        std::vector<BoundingBox> meshBoxes(gltf.meshes.size());
+        std::vector<bool> meshBoxComputed(gltf.meshes.size(), false);
+
+        //展平场景图：每个节点的世界矩阵一次性算好（含父节点变换）
+        const FlattenedSceneGraph flattened = flattenSceneGraph(gltf);
+        for (size_t entry = 0; entry < flattened.size(); entry++) {
+            const int i = flattened.nodeIndices[entry];
+            const auto& node = gltf.nodes[i];
+            if (node.mesh < 0 || static_cast<size_t>(node.mesh) >= gltf.meshes.size()) continue;
+            if (!meshBoxComputed[node.mesh]) {
+                meshBoxes[node.mesh] = getMeshBoundingBox(gltf, gltf.meshes[node.mesh]);
+                meshBoxComputed[node.mesh] = true;
+            }
+            const BoundingBox& meshBox = meshBoxes[node.mesh];
+            if (!meshBox.isValid()) continue;
+
+            const glm::dmat4& transform = flattened.worldMatrices[entry];
+            std::vector<glm::mat4> transforms;
+            if (GetInstanceTransform(gltf, i, transforms)) {//如果是实例，则逐个实例变换角点
+                for (const auto& InsTransform : transforms) {
+                    BoundingBox instanceBox = meshBox;
+                    instanceBox.transform(transform * glm::dmat4(InsTransform));
+                    glbBox.merge(instanceBox);
+                }
+            }
+            else {
+                BoundingBox nodeBox = meshBox;
+                nodeBox.transform(transform);
+                glbBox.merge(nodeBox);
+            }
+        }
+        return glbBox;
+    }
+
+    //tileset 的公共部分：版本与根节点的地理定位变换
+    void initializeTileset(Tileset& tileset) {
         tileset.asset.version = "1.1";
         tileset.geometricError = 10000;
         tileset.root.geometricError = 10000;
@@ -199,147 +274,100 @@ namespace GltfInstancing {
         { -0.9023136427, 0.4310860309, 0.0, 0.0, -0.2117562093, -0.4431713488,
           0.8716388481, 0.0, 0.3731804153, 0.7899661139, 0.4899996041, 0.0,
           -2418525.0442296155, 5400267.3619212005, 2429440.0912170662, 1.0 };
-        //最外层包围盒
-        double bminX, bminY, bminZ;
-        bminX = bminY = bminZ = std::numeric_limits<double>::max();
-        double bmaxX, bmaxY, bmaxZ;
-        bmaxX = bmaxY = bmaxZ = std::numeric_limits<double>::min();
+    }
+
+    //由瓦片大小得到几何误差：叶子为0，内部瓦片取包围盒对角线的一部分
+    double tileGeometricError(const SpatialTile& tile) {
+        if (tile.isLeaf()) {
+            return 0.0;
+        }
+        const double diagonal = glm::length(tile.bounds.max - tile.bounds.min);
+        return std::max(1.0, diagonal * 0.1);
+    }
+
+    //递归生成瓦片：默认按 ADD 方式细化，内容只在叶子上；有LOD时内部瓦片带简化内容，按 REPLACE 方式细化
+    void buildTilesetTile(const SpatialTileTree& tree, size_t tileIndex, const std::vector<std::string>& contentUris, Tile& tile) {
+        const SpatialTile& spatialTile = tree.tiles[tileIndex];
+        tile.boundingVolume.box = toCesiumBoundingVolumeBox(spatialTile.bounds);
+        tile.geometricError = spatialTile.geometricError.value_or(tileGeometricError(spatialTile));
+        tile.refine = tree.replaceRefinement ? "REPLACE" : "ADD";
+        if (tileIndex < contentUris.size() && !contentUris[tileIndex].empty()) {
+            Content content;
+            content.uri = contentUris[tileIndex];
+            tile.content = content;
+        }
+        for (size_t childIndex : spatialTile.children) {
+            buildTilesetTile(tree, childIndex, contentUris, tile.children.emplace_back());
+        }
+    }
+
+    bool TilesetWriter::writeTileset(
+        const std::vector<std::filesystem::path>& uris,
+        const std::filesystem::path& tilesetOutputPath,
+        double geometricError) {
+        std::vector<std::pair<std::filesystem::path, BoundingBox>> contents;
         for (const auto& uri : uris) {
             Model gltf;
-            Tile tile;
-
             if (!ReadGltfFromGlbFile(uri, gltf)) {
-                std::cout << "Error: read false: " << uri << std::endl;
+                logError("Failed to read GLB for tileset generation: " + uri.string());
+                return false;
+            }
+            contents.emplace_back(uri, computeGltfBoundingBox(gltf));
+        }
+        return writeTileset(contents, tilesetOutputPath, geometricError);
+    }
+
+    bool TilesetWriter::writeTileset(
+        const std::vector<std::pair<std::filesystem::path, BoundingBox>>& contents,
+        const std::filesystem::path& tilesetOutputPath,
+        double geometricError) {
+        Tileset tileset;
+        initializeTileset(tileset);
+        //最外层包围盒
+        BoundingBox rootBox;
+        for (const auto& [uri, contentBox] : contents) {
+            if (!contentBox.isValid()) {
+                logError("Invalid bounding box for tileset content: " + uri.string());
                 return false;
             }
+            Tile tile;
             //设置uri
             Content content;
             content.uri = uri.filename().string();
             tile.content = content;//存储uri
-            //计算包围盒
-            //遍历glb所有顶点
-            double minX, minY, minZ;
-            minX = minY = minZ = std::numeric_limits<double>::max();
-            double maxX, maxY, maxZ;
-            maxX = maxY = maxZ = std::numeric_limits<double>::min();
-
-            for (int i = 0; i < gltf.nodes.size(); i++) {
-                const auto& node = gltf.nodes[i];
-                glm::dmat4 transform;
-                std::vector<glm::mat4> transforms;
-                bool isInstance = GetInstanceTransform(gltf, i, transforms);
-                //计算转移矩阵
-                //判断是实例还是非实例
-                if (!isInstance) {
-                    if (!node.matrix.empty() && !glm::isIdentity(glm::make_mat4(node.matrix.data()), glm::epsilon<double>())) {//如果matrix不为空且单位矩阵的话
-                        transform = glm::make_mat4(node.matrix.data());
-                    }
-                    //if (!node.matrix.empty()) {//如果存在matrix的话
-                    //    transform = glm::make_mat4(node.matrix.data());
-                    //}
-                    else {//如果不存在matrix的话，使用TRS
-                        glm::dvec3 b = glm::make_vec3(node.translation.data());
-                        glm::dmat4 T = glm::translate(glm::dmat4(1.0), b);
-                        glm::dmat4 R = glm::mat4_cast(glm::normalize((glm::make_quat(node.rotation.data())))); // 四元数转矩阵
-                        glm::dmat4 S = glm::scale(glm::dmat4(1.0), glm::make_vec3(node.scale.data()));
-                        transform = T * R * S;
-                    }
-                }
-
-
-                if (node.mesh < 0) continue;
-                //遍历mesh
-                for (auto& meshPrimitive : gltf.meshes[node.mesh].primitives) {
-                    //2.存储每个顶点或三角面的信息（与对应的tile关联）//不进行draco解压缩的话不要执行下面的代码
-                    //要存储的数据类型
-                    typeInformation verticeInfo;
-                    //获取类型名称和accessor索引
-                    //顶点
-                    verticeInfo = { "POSITION", meshPrimitive.attributes.find("POSITION")->second };
-                    //继续完善各个信息
-                    verticeInfo.bufferViewIndice = gltf.accessors[verticeInfo.accessorIndice].bufferView;
-                    verticeInfo.acc_byteOffset = gltf.accessors[verticeInfo.accessorIndice].byteOffset;
-                    verticeInfo.componentType = gltf.accessors[verticeInfo.accessorIndice].componentType;
-                    verticeInfo.count = gltf.accessors[verticeInfo.accessorIndice].count;
-                    verticeInfo.type = gltf.accessors[verticeInfo.accessorIndice].type;
-                    //在bufferview中获取
-                    verticeInfo.bufferIndice = gltf.bufferViews[verticeInfo.bufferViewIndice].buffer;
-                    verticeInfo.buf_byteOffset = gltf.bufferViews[verticeInfo.bufferViewIndice].byteOffset;
-                    verticeInfo.byteLength = gltf.bufferViews[verticeInfo.bufferViewIndice].byteLength;
-                    //获取对应的buffer数据
-                    const std::vector<std::byte>& positionbufferdata = gltf.buffers[verticeInfo.bufferIndice].cesium.data;
-
-                    //xyz中每个值占用的字节大小
-                    unsigned short byteSize = byteSize_fromComponentType(verticeInfo.componentType);
-                    for (unsigned int num = 0; num < verticeInfo.count; num++) {
-                        //位置
-                        unsigned int positionlocation = verticeInfo.acc_byteOffset + verticeInfo.buf_byteOffset +
-                            num * 3 * byteSize;
-                        glm::vec4 positionvalue;
-                        positionvalue.w = 1.0;
-                        //把byte数据转换成对应的类型
-                        std::memcpy(&(positionvalue.x), positionbufferdata.data() + positionlocation, byteSize);
-                        std::memcpy(&(positionvalue.y), positionbufferdata.data() + positionlocation + byteSize, byteSize);
-                        std::memcpy(&(positionvalue.z), positionbufferdata.data() + positionlocation + byteSize * 2, byteSize);
-                        //计算应用转移矩阵之后的坐标
-                        glm::dvec4 dpositionvalue(positionvalue.x, positionvalue.y, positionvalue.z, positionvalue.w);
-                        if (isInstance) {//如果是实例，则遍历实例转移矩阵，计算每个实例的坐标，并比较最值
-                            for (const auto& InsTransform : transforms) {
-                                glm::dvec4 temppositionvalue = InsTransform * dpositionvalue;
-                                //比较大小
-                                if (temppositionvalue.x < minX) minX = temppositionvalue.x;
-                                if (temppositionvalue.y < minY) minY = temppositionvalue.y;
-                                if (temppositionvalue.z < minZ) minZ = temppositionvalue.z;
-                                if (temppositionvalue.x > maxX) maxX = temppositionvalue.x;
-                                if (temppositionvalue.y > maxY) maxY = temppositionvalue.y;
-                                if (temppositionvalue.z > maxZ) maxZ = temppositionvalue.z;
-                            }
-                        }
-                        else {//如果是非实例，则直接用计算的单个转移矩阵乘顶点坐标
-                            dpositionvalue = transform * dpositionvalue;
-                            //比较大小
-                            if (dpositionvalue.x < minX) minX = dpositionvalue.x;
-                            if (dpositionvalue.y < minY) minY = dpositionvalue.y;
-                            if (dpositionvalue.z < minZ) minZ = dpositionvalue.z;
-                            if (dpositionvalue.x > maxX) maxX = dpositionvalue.x;
-                            if (dpositionvalue.y > maxY) maxY = dpositionvalue.y;
-                            if (dpositionvalue.z > maxZ) maxZ = dpositionvalue.z;
-                        }
-
-                    }
-
-                }
-
-            }
-            //对每个glb比较其最大值最小值，为最大包围盒做准备
-            if (minX < bminX) bminX = minX;
-            if (minY < bminY) bminY = minY;
-            if (minZ < bminZ) bminZ = minZ;
-            if (maxX > bmaxX) bmaxX = maxX;
-            if (maxY > bmaxY) bmaxY = maxY;
-            if (maxZ > bmaxZ) bmaxZ = maxZ;
-
-            double centerX = (maxX + minX) / 2, centerY = (maxY + minY) / 2, centerZ = (maxZ + minZ) / 2;
-            double distanceX = maxX - centerX, distanceY = maxY - centerY, distanceZ = maxZ - centerZ;
-            std::vector<double> boundingBox = { centerX,centerY,centerZ,distanceX,0,0,0,distanceY,0,0,0,distanceZ };
-            //将包围盒从gltf的y向上坐标系转为cesium的z向上坐标系
-            changeGLBToCesiumAxis(boundingBox);
             //将包围盒输入到tile中
-            tile.boundingVolume.box = boundingBox;
+            tile.boundingVolume.box = toCesiumBoundingVolumeBox(contentBox);
             //设置refine
             tile.refine = "REPLACE";
             //设置geometricerror
             tile.geometricError = geometricError;
             //将tile加入到tileset中
             tileset.root.children.emplace_back(tile);
+            rootBox.merge(contentBox);
         }
         //制作根节点最大包围盒
-        double bcenterX = (bmaxX + bminX) / 2, bcenterY = (bmaxY + bminY) / 2, bcenterZ = (bmaxZ + bminZ) / 2;
-        double bdistanceX = bmaxX - bcenterX, bdistanceY = bmaxY - bcenterY, bdistanceZ = bmaxZ - bcenterZ;
-        std::vector<double> BboundingBox = { bcenterX,bcenterY,bcenterZ,bdistanceX,0,0,0,bdistanceY,0,0,0,bdistanceZ };
-        //将包围盒从gltf的y向上坐标系转为cesium的z向上坐标系
-        changeGLBToCesiumAxis(BboundingBox);
-        tileset.root.boundingVolume.box = BboundingBox;
+        tileset.root.boundingVolume.box = toCesiumBoundingVolumeBox(rootBox);
+        //输出json
+        if (!exportTilesetToJson(tileset, tilesetOutputPath)) {
+            return false;
+        }
+        return true;
+    }
+
+    bool TilesetWriter::writeTileTree(
+        const SpatialTileTree& tree,
+        const std::vector<std::string>& contentUris,
+        const std::filesystem::path& tilesetOutputPath) {
+        if (tree.tiles.empty() || !tree.tiles[0].bounds.isValid()) {
+            logError("Cannot write a tileset for an empty tile tree: " + tilesetOutputPath.string());
+            return false;
+        }
+        Tileset tileset;
+        initializeTileset(tileset);
+        buildTilesetTile(tree, 0, contentUris, tileset.root);
+        tileset.geometricError = std::max(1.0, glm::length(tree.tiles[0].bounds.max - tree.tiles[0].bounds.min) * 0.1);
+        //根瓦片本身的误差之上再留余量，保证根瓦片能被加载
+        tileset.geometricError = std::max(tileset.geometricError, tileset.root.geometricError * 2.0);
         //输出json
         if (!exportTilesetToJson(tileset, tilesetOutputPath)) {
             return false;
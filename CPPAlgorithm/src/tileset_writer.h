@@ -2,10 +2,13 @@
 #define TILESET_WRITER_H
 
 #include "utilities.h" // For BoundingBox and logging
+#include "spatial_tiler.h" // For SpatialTileTree
 #include <filesystem>
 #include <string>
 #include <optional>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 // Cesium Native 3D Tiles classes
 #include <Cesium3DTiles/Tileset.h>
@@ -50,12 +53,31 @@ namespace GltfInstancing {
         // tilesetOutputPath: The full path where the tileset.json should be saved.
         // rootBoundingVolume: The bounding volume for the root tile.
         // geometricError: The geometric error for the root tile.
+        // Reads every GLB back to compute its bounds (the 8 corners of each mesh AABB per node/instance).
         bool writeTileset(
             const std::vector<std::filesystem::path>& uris,
             const std::filesystem::path& tilesetOutputPath,
             double geometricError = 500.0 // Default geometric error
         );
 
+        // Same, with the world bounds of each GLB already known (e.g. returned by GlbWriter),
+        // so no GLB is read again. Bounds are in glTF (y-up) coordinates.
+        bool writeTileset(
+            const std::vector<std::pair<std::filesystem::path, BoundingBox>>& contents,
+            const std::filesystem::path& tilesetOutputPath,
+            double geometricError = 500.0
+        );
+
+        // Writes a hierarchical tileset mirroring tree: one tile per SpatialTile with its tight
+        // bounds, refine ADD, geometricError 0 for leaves and 10% of the tile diagonal above.
+        // After generateTileLods: refine REPLACE and the geometric errors computed for the tiles.
+        // contentUris[i] (relative to the tileset) is the content of tree.tiles[i]; empty for none.
+        bool writeTileTree(
+            const SpatialTileTree& tree,
+            const std::vector<std::string>& contentUris,
+            const std::filesystem::path& tilesetOutputPath
+        );
+
     private:
         //Cesium3DTilesWriter::TilesetWriter _writer;
     };
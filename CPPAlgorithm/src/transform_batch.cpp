@@ -0,0 +1,224 @@
+﻿#include "transform_batch.h"
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace GltfInstancing {
+
+    namespace {
+        inline const glm::dmat4& matrixAt(const glm::dmat4* matrices, size_t strideBytes, size_t index) {
+            return *reinterpret_cast<const glm::dmat4*>(reinterpret_cast<const unsigned char*>(matrices) + index * strideBytes);
+        }
+
+        // Reference kernel: column lengths for scale, Shepperd's method for the rotation.
+        void decomposeOne(const glm::dmat4& m, const glm::dvec3& origin, float* translation, float* rotation, float* scale) {
+            double c[3][3];
+            for (int col = 0; col < 3; ++col) {
+                for (int row = 0; row < 3; ++row) {
+                    c[col][row] = m[col][row];
+                }
+            }
+
+            double s[3];
+            for (int col = 0; col < 3; ++col) {
+                s[col] = std::sqrt(c[col][0] * c[col][0] + c[col][1] * c[col][1] + c[col][2] * c[col][2]);
+            }
+            const double det =
+                c[0][0] * (c[1][1] * c[2][2] - c[1][2] * c[2][1]) -
+                c[0][1] * (c[1][0] * c[2][2] - c[1][2] * c[2][0]) +
+                c[0][2] * (c[1][0] * c[2][1] - c[1][1] * c[2][0]);
+            if (det < 0.0) {
+                s[0] = -s[0]; s[1] = -s[1]; s[2] = -s[2];
+            }
+
+            // r<row><col> of the pure rotation
+            double r[3][3];
+            for (int col = 0; col < 3; ++col) {
+                const double inv = s[col] != 0.0 ? 1.0 / s[col] : 0.0;
+                for (int row = 0; row < 3; ++row) {
+                    r[row][col] = c[col][row] * inv;
+                }
+            }
+
+            double qx, qy, qz, qw;
+            const double trace = r[0][0] + r[1][1] + r[2][2];
+            if (trace > 0.0) {
+                const double k = 0.5 / std::sqrt(trace + 1.0);
+                qw = 0.25 / k;
+                qx = (r[2][1] - r[1][2]) * k;
+                qy = (r[0][2] - r[2][0]) * k;
+                qz = (r[1][0] - r[0][1]) * k;
+            } else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+                const double k = 2.0 * std::sqrt(1.0 + r[0][0] - r[1][1] - r[2][2]);
+                qw = (r[2][1] - r[1][2]) / k;
+                qx = 0.25 * k;
+                qy = (r[0][1] + r[1][0]) / k;
+                qz = (r[0][2] + r[2][0]) / k;
+            } else if (r[1][1] > r[2][2]) {
+                const double k = 2.0 * std::sqrt(1.0 + r[1][1] - r[0][0] - r[2][2]);
+                qw = (r[0][2] - r[2][0]) / k;
+                qx = (r[0][1] + r[1][0]) / k;
+                qy = 0.25 * k;
+                qz = (r[1][2] + r[2][1]) / k;
+            } else {
+                const double k = 2.0 * std::sqrt(1.0 + r[2][2] - r[0][0] - r[1][1]);
+                qw = (r[1][0] - r[0][1]) / k;
+                qx = (r[0][2] + r[2][0]) / k;
+                qy = (r[1][2] + r[2][1]) / k;
+                qz = 0.25 * k;
+            }
+            const double length = std::sqrt(qx * qx + qy * qy + qz * qz + qw * qw);
+            if (!(length > 0.0) || !std::isfinite(length)) {
+                qx = 0.0; qy = 0.0; qz = 0.0; qw = 1.0; // Degenerate (zero scale) matrix
+            } else {
+                qx /= length; qy /= length; qz /= length; qw /= length;
+            }
+
+            translation[0] = static_cast<float>(m[3][0] - origin.x);
+            translation[1] = static_cast<float>(m[3][1] - origin.y);
+            translation[2] = static_cast<float>(m[3][2] - origin.z);
+            rotation[0] = static_cast<float>(qx);
+            rotation[1] = static_cast<float>(qy);
+            rotation[2] = static_cast<float>(qz);
+            rotation[3] = static_cast<float>(qw);
+            scale[0] = static_cast<float>(s[0]);
+            scale[1] = static_cast<float>(s[1]);
+            scale[2] = static_cast<float>(s[2]);
+        }
+
+#if defined(__AVX2__)
+        inline __m256d loadLanes(const glm::dmat4* const* m, int col, int row) {
+            return _mm256_set_pd((*m[3])[col][row], (*m[2])[col][row], (*m[1])[col][row], (*m[0])[col][row]);
+        }
+
+        // Four matrices per step. Lanes whose rotation has w close to zero (near 180 degrees),
+        // where the trace formula loses precision, or a zero scale are redone by decomposeOne.
+        size_t decomposeAvx2(const glm::dmat4* matrices, size_t strideBytes, size_t count,
+                             float* translations, float* rotations, float* scales, const glm::dvec3& origin) {
+            const __m256d zero = _mm256_setzero_pd();
+            const __m256d one = _mm256_set1_pd(1.0);
+            const __m256d half = _mm256_set1_pd(0.5);
+            const __m256d signBit = _mm256_set1_pd(-0.0);
+            const __m256d traceLimit = _mm256_set1_pd(-0.9); // w >= ~0.16
+            const __m256d originX = _mm256_set1_pd(origin.x);
+            const __m256d originY = _mm256_set1_pd(origin.y);
+            const __m256d originZ = _mm256_set1_pd(origin.z);
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const glm::dmat4* m[4] = {
+                    &matrixAt(matrices, strideBytes, i), &matrixAt(matrices, strideBytes, i + 1),
+                    &matrixAt(matrices, strideBytes, i + 2), &matrixAt(matrices, strideBytes, i + 3)
+                };
+
+                __m256d c[3][3];
+                for (int col = 0; col < 3; ++col) {
+                    for (int row = 0; row < 3; ++row) {
+                        c[col][row] = loadLanes(m, col, row);
+                    }
+                }
+
+                __m256d s[3];
+                for (int col = 0; col < 3; ++col) {
+                    s[col] = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(
+                        _mm256_mul_pd(c[col][0], c[col][0]), _mm256_mul_pd(c[col][1], c[col][1])),
+                        _mm256_mul_pd(c[col][2], c[col][2])));
+                }
+                const __m256d det = _mm256_add_pd(_mm256_sub_pd(
+                    _mm256_mul_pd(c[0][0], _mm256_sub_pd(_mm256_mul_pd(c[1][1], c[2][2]), _mm256_mul_pd(c[1][2], c[2][1]))),
+                    _mm256_mul_pd(c[0][1], _mm256_sub_pd(_mm256_mul_pd(c[1][0], c[2][2]), _mm256_mul_pd(c[1][2], c[2][0])))),
+                    _mm256_mul_pd(c[0][2], _mm256_sub_pd(_mm256_mul_pd(c[1][0], c[2][1]), _mm256_mul_pd(c[1][1], c[2][0]))));
+                const __m256d flip = _mm256_and_pd(_mm256_cmp_pd(det, zero, _CMP_LT_OQ), signBit);
+                __m256d zeroScale = zero;
+                for (int col = 0; col < 3; ++col) {
+                    zeroScale = _mm256_or_pd(zeroScale, _mm256_cmp_pd(s[col], zero, _CMP_EQ_OQ));
+                    s[col] = _mm256_xor_pd(s[col], flip);
+                }
+
+                // r<row><col>
+                __m256d r[3][3];
+                for (int col = 0; col < 3; ++col) {
+                    const __m256d inv = _mm256_div_pd(one, s[col]);
+                    for (int row = 0; row < 3; ++row) {
+                        r[row][col] = _mm256_mul_pd(c[col][row], inv);
+                    }
+                }
+
+                const __m256d trace = _mm256_add_pd(_mm256_add_pd(r[0][0], r[1][1]), r[2][2]);
+                const __m256d k = _mm256_div_pd(half, _mm256_sqrt_pd(_mm256_max_pd(_mm256_add_pd(trace, one), _mm256_set1_pd(1e-300))));
+                __m256d qw = _mm256_div_pd(_mm256_set1_pd(0.25), k);
+                __m256d qx = _mm256_mul_pd(_mm256_sub_pd(r[2][1], r[1][2]), k);
+                __m256d qy = _mm256_mul_pd(_mm256_sub_pd(r[0][2], r[2][0]), k);
+                __m256d qz = _mm256_mul_pd(_mm256_sub_pd(r[1][0], r[0][1]), k);
+                const __m256d invLength = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(
+                    _mm256_add_pd(_mm256_mul_pd(qx, qx), _mm256_mul_pd(qy, qy)),
+                    _mm256_add_pd(_mm256_mul_pd(qz, qz), _mm256_mul_pd(qw, qw)))));
+                qx = _mm256_mul_pd(qx, invLength);
+                qy = _mm256_mul_pd(qy, invLength);
+                qz = _mm256_mul_pd(qz, invLength);
+                qw = _mm256_mul_pd(qw, invLength);
+
+                const int fallbackMask = _mm256_movemask_pd(_mm256_or_pd(
+                    _mm256_cmp_pd(trace, traceLimit, _CMP_NGT_UQ), zeroScale));
+
+                alignas(16) float lanes[10][4];
+                _mm_store_ps(lanes[0], _mm256_cvtpd_ps(_mm256_sub_pd(loadLanes(m, 3, 0), originX)));
+                _mm_store_ps(lanes[1], _mm256_cvtpd_ps(_mm256_sub_pd(loadLanes(m, 3, 1), originY)));
+                _mm_store_ps(lanes[2], _mm256_cvtpd_ps(_mm256_sub_pd(loadLanes(m, 3, 2), originZ)));
+                _mm_store_ps(lanes[3], _mm256_cvtpd_ps(qx));
+                _mm_store_ps(lanes[4], _mm256_cvtpd_ps(qy));
+                _mm_store_ps(lanes[5], _mm256_cvtpd_ps(qz));
+                _mm_store_ps(lanes[6], _mm256_cvtpd_ps(qw));
+                _mm_store_ps(lanes[7], _mm256_cvtpd_ps(s[0]));
+                _mm_store_ps(lanes[8], _mm256_cvtpd_ps(s[1]));
+                _mm_store_ps(lanes[9], _mm256_cvtpd_ps(s[2]));
+
+                for (int lane = 0; lane < 4; ++lane) {
+                    const size_t index = i + static_cast<size_t>(lane);
+                    float* t = translations + index * 3;
+                    float* q = rotations + index * 4;
+                    float* sc = scales + index * 3;
+                    if (fallbackMask & (1 << lane)) {
+                        decomposeOne(*m[lane], origin, t, q, sc);
+                        continue;
+                    }
+                    t[0] = lanes[0][lane]; t[1] = lanes[1][lane]; t[2] = lanes[2][lane];
+                    q[0] = lanes[3][lane]; q[1] = lanes[4][lane]; q[2] = lanes[5][lane]; q[3] = lanes[6][lane];
+                    sc[0] = lanes[7][lane]; sc[1] = lanes[8][lane]; sc[2] = lanes[9][lane];
+                }
+            }
+            return i;
+        }
+#endif
+    }
+
+    void decomposeTransformsBatch(
+        const glm::dmat4* matrices,
+        size_t strideBytes,
+        size_t count,
+        float* translations,
+        float* rotations,
+        float* scales,
+        const glm::dvec3& translationOrigin) {
+        size_t done = 0;
+#if defined(__AVX2__)
+        done = decomposeAvx2(matrices, strideBytes, count, translations, rotations, scales, translationOrigin);
+#endif
+        for (size_t i = done; i < count; ++i) {
+            decomposeOne(matrixAt(matrices, strideBytes, i), translationOrigin, translations + i * 3, rotations + i * 4, scales + i * 3);
+        }
+    }
+
+    bool transformBatchUsesAvx2() {
+#if defined(__AVX2__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+} // namespace GltfInstancing
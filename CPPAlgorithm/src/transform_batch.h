@@ -0,0 +1,35 @@
+﻿#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+namespace GltfInstancing {
+
+    // Decomposes `count` affine matrices into glTF TRS floats, written tightly packed:
+    // translations as 3 floats, rotations as 4 floats (x, y, z, w) and scales as 3 floats per
+    // matrix. The destinations may point straight into an output buffer region.
+    // Matrix i is read from reinterpret_cast<const std::byte*>(matrices) + i * strideBytes, so
+    // the worldMatrix member of a MeshInstanceInfo array can be read in place.
+    // Shear and perspective are ignored; a negative determinant is folded into the scale
+    // (all three axes negated), matching glm::decompose.
+    // translationOrigin is subtracted in double precision before narrowing to float, so
+    // translations relative to a nearby origin keep full precision at georeferenced coordinates.
+    // Uses an AVX2 kernel (4 matrices per step) when built with GLTF_INSTANCER_ENABLE_AVX2,
+    // a scalar kernel otherwise. Both produce the same values up to rounding.
+    void decomposeTransformsBatch(
+        const glm::dmat4* matrices,
+        size_t strideBytes,
+        size_t count,
+        float* translations,
+        float* rotations,
+        float* scales,
+        const glm::dvec3& translationOrigin = glm::dvec3(0.0));
+
+    // True when decomposeTransformsBatch was compiled with the AVX2 kernel.
+    bool transformBatchUsesAvx2();
+
+} // namespace GltfInstancing
+
+#endif // TRANSFORM_BATCH_H
@@ -9,6 +9,11 @@
 #include <sstream>
 #include <iomanip> // For std::setw, std::setfill with hashes
 #include <functional> // For std::hash
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm> // For std::min
+#include <cstring>   // For std::memcmp
 #include <gsl/span>
 
 // For SHA256, you might need a library or implement it.
@@ -52,6 +57,15 @@ namespace GltfInstancing {
         }
     }
 
+    // Serializes output so that lines from worker threads do not interleave.
+    static std::mutex g_logMutex;
+    static bool g_logToStandardError = false;
+
+    void setLogToStandardError(bool toStandardError) {
+        std::lock_guard<std::mutex> lock(g_logMutex);
+        g_logToStandardError = toStandardError;
+    }
+
     void log(LogLevel level, const std::string& message) {
         if (level == LogLevel::NONE) {
             return; // Do not log anything if level is NONE
@@ -59,7 +73,8 @@ namespace GltfInstancing {
         // For ERROR, always print. For other levels, print if they are <= g_currentLogLevel.
         if (level <= g_currentLogLevel) {
             std::string prefix = "[" + logLevelToString(level) + "] ";
-            if (level == LogLevel::LEVEL_ERROR) { // Renamed from ERROR
+            std::lock_guard<std::mutex> lock(g_logMutex);
+            if (level == LogLevel::LEVEL_ERROR || g_logToStandardError) { // Renamed from ERROR
                 std::cerr << prefix << message << std::endl;
             } else {
                 std::cout << prefix << message << std::endl;
@@ -95,6 +110,57 @@ namespace GltfInstancing {
         log(LogLevel::LEVEL_VERBOSE, verboseMessage); // Renamed from VERBOSE
     }
 
+    // --- Diagnostic Tracing ---
+    static std::set<std::string> g_traceMeshNames;
+
+    void setTraceMeshNames(const std::set<std::string>& meshNames) {
+        g_traceMeshNames = meshNames;
+    }
+
+    bool isMeshTraced(const std::string& meshName) {
+        return !g_traceMeshNames.empty() && isLogLevelEnabled(LogLevel::LEVEL_DEBUG) && g_traceMeshNames.count(meshName) > 0;
+    }
+
+    // --- Threading Utilities ---
+    int resolveThreadCount(int requestedThreads) {
+        if (requestedThreads > 0) {
+            return requestedThreads;
+        }
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        return hardwareThreads > 0 ? static_cast<int>(hardwareThreads) : 1;
+    }
+
+    void parallelFor(size_t taskCount, int threadCount, const std::function<void(size_t taskIndex, int workerIndex)>& task) {
+        if (taskCount == 0) {
+            return;
+        }
+        size_t workerCount = std::min(static_cast<size_t>(resolveThreadCount(threadCount)), taskCount);
+        if (workerCount <= 1) {
+            // Serial path keeps the original single-threaded behaviour (and call order).
+            for (size_t i = 0; i < taskCount; ++i) {
+                task(i, 0);
+            }
+            return;
+        }
+
+        std::atomic<size_t> nextTask{ 0 };
+        auto workerLoop = [&](int workerIndex) {
+            for (size_t i = nextTask.fetch_add(1); i < taskCount; i = nextTask.fetch_add(1)) {
+                task(i, workerIndex);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(workerCount - 1);
+        for (size_t w = 1; w < workerCount; ++w) {
+            workers.emplace_back(workerLoop, static_cast<int>(w));
+        }
+        workerLoop(0); // The calling thread acts as worker 0
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
     // --- File and Path Utilities ---
     std::optional<std::vector<char>> readFileBytes(const std::filesystem::path& filePath) {
         std::ifstream file(filePath, std::ios::binary | std::ios::ate);
@@ -352,6 +418,77 @@ namespace GltfInstancing {
         return glm::dmat4(1.0);
     }
 
+    FlattenedSceneGraph flattenSceneGraph(const CesiumGltf::Model& model) {
+        FlattenedSceneGraph flattened;
+        const size_t nodeCount = model.nodes.size();
+
+        std::vector<int32_t> roots;
+        if (!model.scenes.empty()) {
+            int32_t sceneIndex = model.scene >= 0 ? model.scene : 0;
+            if (static_cast<size_t>(sceneIndex) >= model.scenes.size()) {
+                logError("flattenSceneGraph: invalid default scene index " + std::to_string(sceneIndex));
+                return flattened;
+            }
+            roots = model.scenes[static_cast<size_t>(sceneIndex)].nodes;
+        } else {
+            std::vector<bool> isChild(nodeCount, false);
+            for (const auto& node : model.nodes) {
+                for (int32_t child : node.children) {
+                    if (child >= 0 && static_cast<size_t>(child) < nodeCount) {
+                        isChild[static_cast<size_t>(child)] = true;
+                    }
+                }
+            }
+            for (size_t i = 0; i < nodeCount; ++i) {
+                if (!isChild[i]) {
+                    roots.push_back(static_cast<int32_t>(i));
+                }
+            }
+        }
+
+        flattened.nodeIndices.reserve(nodeCount);
+        flattened.meshIndices.reserve(nodeCount);
+        flattened.worldMatrices.reserve(nodeCount);
+
+        // Explicit stack of (node, position of the parent entry). Children are pushed in reverse
+        // so the output keeps the same pre-order as a recursive traversal.
+        constexpr size_t noParent = std::numeric_limits<size_t>::max();
+        std::vector<std::pair<int32_t, size_t>> stack;
+        std::vector<bool> visited(nodeCount, false);
+        for (auto rootIt = roots.rbegin(); rootIt != roots.rend(); ++rootIt) {
+            stack.emplace_back(*rootIt, noParent);
+        }
+
+        while (!stack.empty()) {
+            const auto [nodeIndex, parentEntry] = stack.back();
+            stack.pop_back();
+
+            if (nodeIndex < 0 || static_cast<size_t>(nodeIndex) >= nodeCount) {
+                logError("flattenSceneGraph: invalid node index " + std::to_string(nodeIndex));
+                continue;
+            }
+            if (visited[static_cast<size_t>(nodeIndex)]) {
+                logError("flattenSceneGraph: node " + std::to_string(nodeIndex) + " is reachable more than once (cycle or shared child). Skipping.");
+                continue;
+            }
+            visited[static_cast<size_t>(nodeIndex)] = true;
+
+            const CesiumGltf::Node& node = model.nodes[static_cast<size_t>(nodeIndex)];
+            const glm::dmat4 localTransform = getLocalTransformMatrix(node);
+            const size_t entry = flattened.nodeIndices.size();
+            flattened.nodeIndices.push_back(nodeIndex);
+            flattened.meshIndices.push_back(node.mesh);
+            flattened.worldMatrices.push_back(parentEntry == noParent
+                ? localTransform
+                : flattened.worldMatrices[parentEntry] * localTransform);
+
+            for (auto childIt = node.children.rbegin(); childIt != node.children.rend(); ++childIt) {
+                stack.emplace_back(*childIt, entry);
+            }
+        }
+        return flattened;
+    }
+
     // Helper to compare raw buffer data
     bool compareBufferData(gsl::span<const std::byte> data1, gsl::span<const std::byte> data2) {
         if (data1.size() != data2.size()) {
@@ -361,6 +498,59 @@ namespace GltfInstancing {
     }
 
 
+    std::optional<AccessorByteLayout> getAccessorByteLayout(const CesiumGltf::Model& model, const CesiumGltf::Accessor& accessor) {
+        if (accessor.sparse || accessor.bufferView < 0 || static_cast<size_t>(accessor.bufferView) >= model.bufferViews.size()) {
+            return std::nullopt;
+        }
+        const CesiumGltf::BufferView& bufferView = model.bufferViews[static_cast<size_t>(accessor.bufferView)];
+        if (bufferView.buffer < 0 || static_cast<size_t>(bufferView.buffer) >= model.buffers.size()) {
+            return std::nullopt;
+        }
+        const std::vector<std::byte>& bufferData = model.buffers[static_cast<size_t>(bufferView.buffer)].cesium.data;
+
+        AccessorByteLayout layout;
+        layout.count = accessor.count;
+        layout.elementSize = CesiumGltf::Accessor::computeNumberOfComponents(accessor.type) *
+                             CesiumGltf::Accessor::computeByteSizeOfComponent(accessor.componentType);
+        layout.stride = (bufferView.byteStride && *bufferView.byteStride > 0) ? *bufferView.byteStride : layout.elementSize;
+        if (layout.elementSize <= 0 || layout.count < 0) {
+            return std::nullopt;
+        }
+
+        const int64_t start = bufferView.byteOffset + accessor.byteOffset;
+        const int64_t span = layout.count > 0 ? (layout.count - 1) * layout.stride + layout.elementSize : 0;
+        if (start < 0 ||
+            accessor.byteOffset + span > bufferView.byteLength ||
+            start + span > static_cast<int64_t>(bufferData.size())) {
+            return std::nullopt;
+        }
+        layout.data = bufferData.data() + start;
+        return layout;
+    }
+
+    std::optional<ContentHash128> hashAccessorContent128(const CesiumGltf::Model& model, const CesiumGltf::Accessor& accessor, uint64_t seed) {
+        std::optional<AccessorByteLayout> layout = getAccessorByteLayout(model, accessor);
+        if (!layout) {
+            return std::nullopt;
+        }
+
+        ContentHasher128 hasher(seed);
+        hasher.updateString(accessor.type);
+        hasher.updateValue(accessor.componentType);
+        hasher.updateValue(accessor.count);
+        hasher.updateValue(static_cast<uint8_t>(accessor.normalized ? 1 : 0));
+        if (layout->isContiguous()) {
+            hasher.update(layout->data, static_cast<size_t>(layout->count * layout->elementSize));
+        }
+        else {
+            // Interleaved / padded: feed each element straight from the buffer, skipping the gaps.
+            for (int64_t i = 0; i < layout->count; ++i) {
+                hasher.update(layout->data + i * layout->stride, static_cast<size_t>(layout->elementSize));
+            }
+        }
+        return hasher.finalize();
+    }
+
     bool compareAccessorData(
         const CesiumGltf::Model& model1, const CesiumGltf::Accessor& accessor1,
         const CesiumGltf::Model& model2, const CesiumGltf::Accessor& accessor2
@@ -372,49 +562,57 @@ namespace GltfInstancing {
             return false;
         }
 
-        CesiumGltf::AccessorView<std::byte> view1(model1, accessor1);
-        CesiumGltf::AccessorView<std::byte> view2(model2, accessor2);
-
-        if (view1.status() != CesiumGltf::AccessorViewStatus::Valid ||
-            view2.status() != CesiumGltf::AccessorViewStatus::Valid) {
-            return view1.status() == view2.status();
+        // Compare the element bytes in place; strides may differ (e.g. one interleaved, one not).
+        std::optional<AccessorByteLayout> layout1 = getAccessorByteLayout(model1, accessor1);
+        std::optional<AccessorByteLayout> layout2 = getAccessorByteLayout(model2, accessor2);
+        if (!layout1 || !layout2) {
+            return false; // Cannot prove equality (no bufferView / sparse / invalid) - treat as different
         }
 
-        // For AccessorView<std::byte>, size() returns the number of bytes.
-        int64_t byteCount1 = view1.size();
-        int64_t byteCount2 = view2.size();
-
-        if (byteCount1 != byteCount2) {
-            return false;
+        if (layout1->isContiguous() && layout2->isContiguous()) {
+            return layout1->count == 0 ||
+                   std::memcmp(layout1->data, layout2->data, static_cast<size_t>(layout1->count * layout1->elementSize)) == 0;
         }
-
-        // If both are empty (size 0), they are considered equal.
-        if (byteCount1 == 0) {
-            return true;
+        for (int64_t i = 0; i < layout1->count; ++i) {
+            if (std::memcmp(layout1->data + i * layout1->stride, layout2->data + i * layout2->stride, static_cast<size_t>(layout1->elementSize)) != 0) {
+                return false;
+            }
         }
+        return true;
+    }
 
-        // data() returns const std::byte* pointing to the start of the view's data.
-        const std::byte* pData1 = view1.data();
-        const std::byte* pData2 = view2.data();
-
-        return std::memcmp(pData1, pData2, static_cast<size_t>(byteCount1)) == 0;
+    // Bounds-checked accessor lookup for the comparison helpers below.
+    static const CesiumGltf::Accessor* findAccessor(const CesiumGltf::Model& model, int32_t accessorIndex) {
+        if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+            return nullptr;
+        }
+        return &model.accessors[static_cast<size_t>(accessorIndex)];
     }
 
+    static bool compareAccessorDataByIndex(
+        const CesiumGltf::Model& model1, int32_t accessorIndex1,
+        const CesiumGltf::Model& model2, int32_t accessorIndex2
+    ) {
+        const CesiumGltf::Accessor* accessor1 = findAccessor(model1, accessorIndex1);
+        const CesiumGltf::Accessor* accessor2 = findAccessor(model2, accessorIndex2);
+        return accessor1 && accessor2 && compareAccessorData(model1, *accessor1, model2, *accessor2);
+    }
 
     bool comparePrimitiveAttributes(
         const CesiumGltf::Model& model1, const CesiumGltf::MeshPrimitive& primitive1,
-        const CesiumGltf::Model& model2, const CesiumGltf::MeshPrimitive& primitive2
+        const CesiumGltf::Model& model2, const CesiumGltf::MeshPrimitive& primitive2,
+        bool compareMaterialIndex
     ) {
         if (primitive1.mode != primitive2.mode) {
             return false;
         }
-        if (primitive1.material != primitive2.material) {
+        if (compareMaterialIndex && primitive1.material != primitive2.material) {
             return false; // Material ID must match
         }
 
         // Compare indices
         if (primitive1.indices >= 0 && primitive2.indices >= 0) {
-            if (!compareAccessorData(model1, model1.accessors[primitive1.indices], model2, model2.accessors[primitive2.indices])) {
+            if (!compareAccessorDataByIndex(model1, primitive1.indices, model2, primitive2.indices)) {
                 return false;
             }
         }
@@ -437,7 +635,7 @@ namespace GltfInstancing {
             }
             int32_t accessorIndex2 = it2->second;
 
-            if (!compareAccessorData(model1, model1.accessors[accessorIndex1], model2, model2.accessors[accessorIndex2])) {
+            if (!compareAccessorDataByIndex(model1, accessorIndex1, model2, accessorIndex2)) {
                 return false;
             }
         }
@@ -456,7 +654,7 @@ namespace GltfInstancing {
                 for (const auto& t_pair1 : target1) {
                     auto t_it2 = target2.find(t_pair1.first);
                     if (t_it2 == target2.end()) return false;
-                    if (!compareAccessorData(model1, model1.accessors[t_pair1.second], model2, model2.accessors[t_it2->second])) {
+                    if (!compareAccessorDataByIndex(model1, t_pair1.second, model2, t_it2->second)) {
                         return false;
                     }
                 }
@@ -629,4 +827,48 @@ namespace GltfInstancing {
         return true;
     }
 
+    namespace {
+        template <typename T>
+        bool appendIndices(const CesiumGltf::AccessorView<T>& view, size_t vertexCount, std::vector<uint32_t>& indices) {
+            if (view.status() != CesiumGltf::AccessorViewStatus::Valid) {
+                return false;
+            }
+            const int64_t triangleIndexCount = view.size() - view.size() % 3;
+            indices.reserve(static_cast<size_t>(triangleIndexCount));
+            for (int64_t i = 0; i < triangleIndexCount; ++i) {
+                const uint32_t index = static_cast<uint32_t>(view[i]);
+                if (index >= vertexCount) {
+                    return false;
+                }
+                indices.push_back(index);
+            }
+            return true;
+        }
+    }
+
+    bool readTriangleIndices(const CesiumGltf::Model& model, const CesiumGltf::MeshPrimitive& primitive, size_t vertexCount, std::vector<uint32_t>& indices) {
+        if (primitive.indices < 0) {
+            const size_t triangleIndexCount = vertexCount - vertexCount % 3;
+            indices.resize(triangleIndexCount);
+            for (size_t i = 0; i < triangleIndexCount; ++i) {
+                indices[i] = static_cast<uint32_t>(i);
+            }
+            return true;
+        }
+        const CesiumGltf::Accessor* accessor = CesiumGltf::Model::getSafe(&model.accessors, primitive.indices);
+        if (!accessor || accessor->sparse) {
+            return false;
+        }
+        switch (accessor->componentType) {
+        case CesiumGltf::Accessor::ComponentType::UNSIGNED_BYTE:
+            return appendIndices(CesiumGltf::AccessorView<uint8_t>(model, *accessor), vertexCount, indices);
+        case CesiumGltf::Accessor::ComponentType::UNSIGNED_SHORT:
+            return appendIndices(CesiumGltf::AccessorView<uint16_t>(model, *accessor), vertexCount, indices);
+        case CesiumGltf::Accessor::ComponentType::UNSIGNED_INT:
+            return appendIndices(CesiumGltf::AccessorView<uint32_t>(model, *accessor), vertexCount, indices);
+        default:
+            return false;
+        }
+    }
+
 } // namespace GltfInstancing
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <limits>     // For std::numeric_limits
 #include <array>      // For std::array
 #include <cmath>      // For std::abs
+#include <functional> // For std::function
+#include <set>        // For the trace mesh filter
 
 // Cesium Native includes
 // Assuming CesiumGltf is in the include path correctly
@@ -18,6 +20,8 @@
 #include "CesiumGltf/AccessorView.h"
 #include "CesiumGltf/Accessor.h"
 
+#include "content_hash.h"
+
 // GLM for math
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -41,6 +45,10 @@ namespace GltfInstancing {
     void setLogLevel(LogLevel level);
     LogLevel getLogLevel();
 
+    // Sends every log line to stderr instead of stdout (ERROR always goes to stderr), so that
+    // stdout carries nothing but the event stream of the service mode.
+    void setLogToStandardError(bool toStandardError);
+
     // Core logging function
     void log(LogLevel level, const std::string& message);
 
@@ -55,6 +63,37 @@ namespace GltfInstancing {
     void logMessage(const std::string& message); // TODO: Phase out or adapt to new system
     void logError(const std::string& errorMessage);
 
+    // --- Diagnostic Tracing ---
+    // True if messages of this level are printed at the current log level.
+    inline bool isLogLevelEnabled(LogLevel level) { return level != LogLevel::NONE && level <= g_currentLogLevel; }
+
+    // Meshes (by name) whose signature computation and grouping are traced at DEBUG level
+    // (the trace_meshes setting). Set once before processing starts.
+    void setTraceMeshNames(const std::set<std::string>& meshNames);
+    // True if meshName is traced: DEBUG is enabled and the name is in the trace filter.
+    // Cheap when tracing is off, so it can be asked for every node and primitive.
+    bool isMeshTraced(const std::string& meshName);
+
+// Level-gated logging for hot paths: the message expression is only evaluated (and no string is
+// formatted) when the message would actually be printed.
+#define GLTF_LOG_DEBUG(message) \
+    do { if (::GltfInstancing::isLogLevelEnabled(::GltfInstancing::LogLevel::LEVEL_DEBUG)) ::GltfInstancing::logDebug(message); } while (0)
+#define GLTF_LOG_VERBOSE(message) \
+    do { if (::GltfInstancing::isLogLevelEnabled(::GltfInstancing::LogLevel::LEVEL_VERBOSE)) ::GltfInstancing::logVerbose(message); } while (0)
+// Logs message at DEBUG level if meshName passes the trace filter (see isMeshTraced).
+#define GLTF_TRACE_MESH(meshName, message) \
+    do { if (::GltfInstancing::isMeshTraced(meshName)) ::GltfInstancing::logDebug(message); } while (0)
+
+    // --- Threading Utilities ---
+    // Resolves a user supplied worker count: values <= 0 mean "use all hardware threads".
+    int resolveThreadCount(int requestedThreads);
+
+    // Runs task(taskIndex, workerIndex) for every taskIndex in [0, taskCount) on up to
+    // threadCount workers. Tasks are handed out dynamically, so the execution order is not
+    // deterministic; callers must write results into per-task slots. workerIndex is stable
+    // for the lifetime of a worker and can be used to index per-worker state.
+    void parallelFor(size_t taskCount, int threadCount, const std::function<void(size_t taskIndex, int workerIndex)>& task);
+
     // --- File and Path Utilities ---
     std::optional<std::vector<char>> readFileBytes(const std::filesystem::path& filePath);
     std::string calculateFileSHA256(const std::filesystem::path& filePath);
@@ -82,11 +121,36 @@ namespace GltfInstancing {
 
     glm::dmat4 getLocalTransformMatrix(const CesiumGltf::Node& node);
 
+    // --- Scene Graph Flattening ---
+    // Structure-of-arrays view of a scene graph: entry i is a node in depth-first pre-order,
+    // with its world matrix already accumulated. Built in one linear pass (one matrix product
+    // per node) so consumers can iterate, or split work, without recursing.
+    struct FlattenedSceneGraph {
+        std::vector<int32_t> nodeIndices;
+        std::vector<int32_t> meshIndices; // node.mesh, -1 for nodes without a mesh
+        std::vector<glm::dmat4> worldMatrices;
+
+        size_t size() const { return nodeIndices.size(); }
+    };
+
+    // Flattens the model's default scene (model.scene, or scene 0). Models without scenes are
+    // flattened from their root nodes (nodes that are nobody's child). Invalid child indices and
+    // nodes reached twice (cycles / shared subtrees, both invalid glTF) are logged and skipped.
+    FlattenedSceneGraph flattenSceneGraph(const CesiumGltf::Model& model);
+
     struct MeshInstanceInfo {
         int32_t originalGltfIndex;
         int32_t originalNodeIndex;
         int32_t originalMeshIndex;
-        TransformComponents transform;
+        // Places the group's representative mesh at this instance. Kept as a matrix; GlbWriter
+        // decomposes all instances of a group in one batch (see transform_batch.h).
+        glm::dmat4 worldMatrix{ 1.0 };
+        // World transform of the instance's own mesh. Equal to worldMatrix unless pose
+        // canonicalization re-targeted the instance; used when it falls back to non-instanced.
+        glm::dmat4 sourceWorldMatrix{ 1.0 };
+        // Primitive granularity: the primitive of the source mesh this instance draws;
+        // -1 when the instance draws the whole mesh.
+        int32_t sourcePrimitiveIndex = -1;
     };
     
     struct BoundingBox {
@@ -114,6 +178,7 @@ namespace GltfInstancing {
         size_t meshSignature;
         std::vector<MeshInstanceInfo> instances;
         std::vector<BoundingBox> representativePrimitiveBoundingBoxes;
+        glm::dmat4 representativeLocalToCanonical{ 1.0 }; // Pose canonicalization only
     };
 
     struct NonInstancedMeshInfo {
@@ -123,14 +188,39 @@ namespace GltfInstancing {
         TransformComponents transform;
     };
 
+    // Location of an accessor's elements inside its buffer: element i starts at
+    // data + i * stride and is elementSize bytes long. Describes the data in place (no copy).
+    struct AccessorByteLayout {
+        const std::byte* data = nullptr;
+        int64_t count = 0;
+        int64_t elementSize = 0;
+        int64_t stride = 0;
+
+        bool isContiguous() const { return stride == elementSize; }
+    };
+
+    // Resolves accessor -> bufferView -> buffer with bounds checks. Returns std::nullopt for
+    // accessors without a bufferView, sparse accessors, or out-of-range views.
+    std::optional<AccessorByteLayout> getAccessorByteLayout(const CesiumGltf::Model& model, const CesiumGltf::Accessor& accessor);
+
+    // Streams the accessor's element bytes (honouring byteStride, without copying) together with
+    // its type/componentType/count/normalized into a 128-bit hash. Layout-independent: the same
+    // values stored interleaved or tightly packed hash identically. std::nullopt if the data
+    // cannot be located (see getAccessorByteLayout).
+    std::optional<ContentHash128> hashAccessorContent128(const CesiumGltf::Model& model, const CesiumGltf::Accessor& accessor, uint64_t seed = 0);
+
     bool compareAccessorData(
         const CesiumGltf::Model& model1, const CesiumGltf::Accessor& accessor1,
         const CesiumGltf::Model& model2, const CesiumGltf::Accessor& accessor2
     );
 
+    // Full byte-level comparison of two primitives (mode, material index, indices, attributes, targets).
+    // Used to confirm signature matches. Pass compareMaterialIndex = false when the primitives come
+    // from different files and materials are compared by content separately.
     bool comparePrimitiveAttributes(
         const CesiumGltf::Model& model1, const CesiumGltf::MeshPrimitive& primitive1,
-        const CesiumGltf::Model& model2, const CesiumGltf::MeshPrimitive& primitive2
+        const CesiumGltf::Model& model2, const CesiumGltf::MeshPrimitive& primitive2,
+        bool compareMaterialIndex = true
     );
 
     BoundingBox getPrimitiveBoundingBox(const CesiumGltf::Model& model, const CesiumGltf::MeshPrimitive& primitive);
@@ -138,6 +228,11 @@ namespace GltfInstancing {
 
     bool areBoundingBoxesSimilar(const BoundingBox& bb1, const BoundingBox& bb2, double tolerance);
 
+    // Reads the primitive's indices as UINT32, trimmed to whole triangles; a non-indexed primitive
+    // yields 0..vertexCount-1. Returns false for sparse or non-integer index accessors and for
+    // indices >= vertexCount.
+    bool readTriangleIndices(const CesiumGltf::Model& model, const CesiumGltf::MeshPrimitive& primitive, size_t vertexCount, std::vector<uint32_t>& indices);
+
 } // namespace GltfInstancing
 
 #endif // UTILITIES_H
\ No newline at end of file